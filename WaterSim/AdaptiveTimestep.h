@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// CFL limited time steps. A particle must not cross more than a fraction of the smoothing radius per step,
+// either through its speed (dt <= courant * h / vMax) or through its acceleration (dt <= forceFactor * sqrt(h / aMax)).
+
+// Largest speed and acceleration over every particle of one step, gravity included
+struct MotionBounds
+{
+	float maxSpeed = 0.0f;
+	float maxAcceleration = 0.0f;
+};
+
+struct AdaptiveTimestepSettings
+{
+	bool enabled = false;
+	float courant = 0.4f;
+	float forceFactor = 0.25f;
+	float minStep = 1.0f / 2000.0f;
+	float maxStep = 1.0f / 30.0f;
+	unsigned int maxSubsteps = 32; // Frame time beyond this many substeps is dropped rather than taken unstably
+};
+
+// What the last SPHBackend::Advance did
+struct AdaptiveTimestepStats
+{
+	unsigned int substeps = 0;
+	float smallestStep = 0.0f;
+	float largestStep = 0.0f;
+	float droppedTime = 0.0f; // Seconds that didn't fit in maxSubsteps
+	MotionBounds bounds; // Used for the last substep
+};
+
+inline float ComputeCFLTimestep(const MotionBounds& bounds, float smoothingRadius, const AdaptiveTimestepSettings& settings)
+{
+	float step = settings.maxStep;
+
+	if (bounds.maxSpeed > 0.0f)
+		step = std::min(step, settings.courant * smoothingRadius / bounds.maxSpeed);
+
+	if (bounds.maxAcceleration > 0.0f)
+		step = std::min(step, settings.forceFactor * std::sqrt(smoothingRadius / bounds.maxAcceleration));
+
+	return std::max(step, settings.minStep);
+}
@@ -1,6 +1,8 @@
 #include "Application.h"
 
 #include <Effects.h>
+#include <algorithm>
+#include <cstring>
 
 extern LRESULT ImGui_ImplWin32_WndProcHandler(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
@@ -172,6 +174,12 @@ HRESULT Application::Initialise(HINSTANCE hInstance, int nCmdShow)
 	sph = std::make_unique<SPH>(_pImmediateContext, _pd3dDevice);
     voxCount = sph->GetVoxelCount();
 
+	// Profiler
+	Profiler::SetThreadName("Main");
+	gpuProfiler = std::make_unique<GpuProfiler>(_pd3dDevice, _pImmediateContext);
+	sph->SetGpuProfiler(gpuProfiler.get());
+	gpuProfiler->BeginFrame();
+
 
 	CreateDDSTextureFromFile(_pd3dDevice, L"Resources\\stone.dds", nullptr, &_pTextureRV);
 	CreateDDSTextureFromFile(_pd3dDevice, L"Resources\\floor.dds", nullptr, &_pGroundTextureRV);
@@ -501,6 +509,7 @@ HRESULT Application::InitDevice()
 
 void Application::Cleanup()
 {
+	ReleaseRewindReadback();
 	if (_pImmediateContext) _pImmediateContext->ClearState();
 	if (_pSamplerLinear) _pSamplerLinear->Release();
 
@@ -520,6 +529,15 @@ void Application::Cleanup()
 	if (_pRenderTargetView) _pRenderTargetView->Release();
 	if (_pSwapChain) _pSwapChain->Release();
 	if (_pImmediateContext) _pImmediateContext->Release();
+	gpuProfiler.reset();
+	simulationThread.reset();
+	replayPlayer.reset();
+	rewindBuffer.reset();
+	for (int i = 0; i < 2; i++)
+	{
+		if (simulationPositionSRVs[i]) simulationPositionSRVs[i]->Release();
+		if (simulationPositionBuffers[i]) simulationPositionBuffers[i]->Release();
+	}
 	if (_pd3dDevice) _pd3dDevice->Release();
 	if (_depthStencilView) _depthStencilView->Release();
 	if (_depthStencilBuffer) _depthStencilBuffer->Release();
@@ -541,9 +559,47 @@ void Application::Cleanup()
 
 void Application::UpdatePhysics(float deltaTime)
 {
+	PROFILE_SCOPE("UpdatePhysics");
+
+	if (replayPlayer)
+	{
+		if (!SimulationControl)
+			replayFrameIndex = (std::min)(replayFrameIndex + 1, replayPlayer->GetFrameCount() - 1);
+		return;
+	}
+
+	// The simulation thread steps on its own
+	if (simulationThread)
+		return;
+
 	if (SimulationControl == false)
 	{
-		sph->Update(deltaTime, minX, minZ);
+		// Carrying on from a rewound state starts a new timeline
+		if (rewindBuffer && rewindFrame >= 0)
+		{
+			rewindBuffer->Truncate(static_cast<size_t>(rewindFrame) + 1);
+			rewindFrame = -1;
+		}
+
+		sph->Advance(deltaTime, minX, minZ);
+		physicsStepIndex++;
+		physicsTime += deltaTime;
+
+		// Every step is kept: the encoder quantises straight from the mapped copy, so this thread only maps and unmaps
+		if (rewindBuffer)
+		{
+			if (!rewindBuffer->IsBorrowing())
+				sph->UnmapParticles();
+
+			const ParticleState* capturedParticles = nullptr;
+			uint64_t capturedStep = 0;
+			if (sph->MapParticlesAsync(physicsStepIndex, capturedParticles, capturedStep))
+			{
+				double capturedTime = physicsTime - (physicsStepIndex - capturedStep) * static_cast<double>(deltaTime);
+				if (!rewindBuffer->CaptureBorrowed(capturedParticles, sph->GetParticleCount(), capturedStep, capturedTime))
+					sph->UnmapParticles();
+			}
+		}
 	}
 }
 
@@ -587,12 +643,169 @@ void Application::ImGui()
 	}
 	if (ImGui::CollapsingHeader("SPH"))
 	{
-		int particleSize = sph->particleList.size();
+		ImGui::Text("Number of Particles: %u", sph->GetParticleCount());
+		ImGui::InputInt("New Particle Count", &requestedParticleCount);
+		if (ImGui::Button("Rebuild Simulation"))
+		{
+			// The GPU bitonic sort needs a power of two, and one dispatch covers at most 65535 groups
+			UINT maxParticleCount = 1;
+			while (maxParticleCount * 2 <= D3D11_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION * THREADS_PER_GROUPs)
+				maxParticleCount <<= 1;
+			requestedParticleCount = std::clamp(requestedParticleCount, 1, static_cast<int>(maxParticleCount));
+
+			UINT particleCount = 1;
+			while (static_cast<int>(particleCount) < requestedParticleCount)
+				particleCount <<= 1;
+
+			requestedParticleCount = static_cast<int>(particleCount);
+			AdaptiveTimestepSettings adaptiveSettings = sph->GetAdaptiveTimestep();
+			ReleaseRewindReadback();
+			sph = std::make_unique<SPH>(_pImmediateContext, _pd3dDevice, particleCount);
+			sph->SetGpuProfiler(gpuProfiler.get());
+			sph->SetAdaptiveTimestep(adaptiveSettings);
+
+			if (rewindBuffer)
+				rewindBuffer->Clear();
+			rewindFrame = -1;
+		}
+		bool wallsChanged = ImGui::DragFloat("Min X", &minX, 0.5f, -100.0f, -1.0f);
+		wallsChanged |= ImGui::DragFloat("Min Z", &minZ, 0.5f, -50.0f, -1.0f);
+		bool pauseChanged = ImGui::Checkbox("Pause", &SimulationControl);
+
+		bool threaded = simulationThread != nullptr;
+		if (ImGui::Checkbox("CPU Simulation Thread", &threaded))
+			SetSimulationThreadEnabled(threaded);
 
-		ImGui::DragInt("Number of Particles", &particleSize);
-		ImGui::DragFloat("Min X", &minX, 0.5f, -100.0f, -1.0f);
-		ImGui::DragFloat("Min Z", &minZ, 0.5f, -50.0f, -1.0f);
-		ImGui::Checkbox("Pause", &SimulationControl);
+		if (simulationThread)
+		{
+			if (wallsChanged)
+				simulationThread->SetWalls(minX, minZ);
+			if (pauseChanged)
+				simulationThread->SetPaused(SimulationControl);
+
+			if (ImGui::Checkbox("Deterministic", &deterministicSimulation))
+			{
+				bool deterministic = deterministicSimulation;
+				simulationThread->Enqueue([deterministic](SPHCPU& sim) { sim.SetDeterministic(deterministic); });
+			}
+
+			if (ImGui::Checkbox("Dense Grid", &denseSimulationGrid))
+			{
+				GridMode gridMode = denseSimulationGrid ? GridMode::Dense : GridMode::Hashed;
+				simulationThread->Enqueue([gridMode](SPHCPU& sim) { sim.SetGridMode(gridMode); });
+			}
+
+			if (ImGui::Button("Save Checkpoint"))
+				simulationThread->SaveCheckpoint("WaterSim.checkpoint");
+			ImGui::SameLine();
+			if (ImGui::Button("Load Checkpoint"))
+				simulationThread->LoadCheckpoint("WaterSim.checkpoint");
+			ImGui::SameLine();
+			ImGui::Text("%s", simulationThread->GetCheckpointStatus());
+
+			if (ImGui::Checkbox("Record", &recordSimulation))
+			{
+				if (recordSimulation)
+					simulationThread->StartRecording("WaterSim.recording");
+				else
+					simulationThread->StopRecording();
+			}
+			FrameRecorderStats recordingStats = simulationThread->GetRecordingStats();
+			if (recordingStats.writeError != 0)
+				ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Recording stopped, write failed: %s", std::strerror(recordingStats.writeError));
+			if (recordSimulation)
+			{
+				double ratio = recordingStats.bytesWritten > 0 ? static_cast<double>(recordingStats.rawBytes) / recordingStats.bytesWritten : 0.0;
+				ImGui::Text("Recorded %llu frames (%llu dropped), %.1f MB, %.1fx smaller", static_cast<unsigned long long>(recordingStats.recordedFrames),
+					static_cast<unsigned long long>(recordingStats.droppedFrames), recordingStats.bytesWritten / (1024.0 * 1024.0), ratio);
+			}
+
+			const SimulationFrame& frame = simulationThread->GetFrame();
+			ImGui::Text("Step %llu, %.2f s simulated, %u particles", static_cast<unsigned long long>(frame.stepIndex), frame.simulatedTime, frame.particleCount);
+			ImGui::Text("Steps: %llu executed, %llu dropped", static_cast<unsigned long long>(frame.timestepStats.totalExecutedSteps),
+				static_cast<unsigned long long>(frame.timestepStats.totalDroppedSteps));
+		}
+
+		// Only the GPU simulation keeps a rewind history
+		if (!simulationThread && !replayPlayer)
+		{
+			bool rewindEnabled = rewindBuffer != nullptr;
+			if (ImGui::Checkbox("Rewind History", &rewindEnabled))
+			{
+				ReleaseRewindReadback();
+				rewindBuffer = rewindEnabled ? std::make_unique<RewindBuffer>() : nullptr;
+				rewindFrame = -1;
+			}
+
+			if (rewindBuffer)
+			{
+				size_t frameCount = rewindBuffer->GetFrameCount();
+				ImGui::Text("History: %zu frames, %.1f of %.0f MB", frameCount, rewindBuffer->GetBytesUsed() / (1024.0 * 1024.0),
+					rewindBuffer->GetCapacity() / (1024.0 * 1024.0));
+
+				if (ImGui::Button("Rewind") && frameCount > 0)
+				{
+					// Whatever is still being encoded belongs at the end of the history
+					if (rewindFrame < 0)
+					{
+						rewindBuffer->Flush();
+						frameCount = rewindBuffer->GetFrameCount();
+					}
+
+					size_t frame = rewindFrame < 0 ? frameCount - 1 : static_cast<size_t>((std::max)(rewindFrame - 1, 0));
+					if (frameCount > 0)
+						RestoreRewindFrame(frame);
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Step Forward") && rewindFrame >= 0 && static_cast<size_t>(rewindFrame) + 1 < frameCount)
+					RestoreRewindFrame(static_cast<size_t>(rewindFrame) + 1);
+
+				if (rewindFrame >= 0)
+					ImGui::Text("Showing step %llu (%.2f s), unpause to carry on from here", static_cast<unsigned long long>(physicsStepIndex), physicsTime);
+			}
+		}
+
+		bool replaying = replayPlayer != nullptr;
+		if (ImGui::Checkbox("Play Recording", &replaying))
+			SetReplayEnabled(replaying);
+
+		if (replayPlayer)
+		{
+			int frameIndex = static_cast<int>(replayFrameIndex);
+			if (ImGui::SliderInt("Frame", &frameIndex, 0, static_cast<int>(replayPlayer->GetFrameCount() - 1)))
+				replayFrameIndex = static_cast<uint64_t>(frameIndex);
+
+			if (replayFrame)
+				ImGui::Text("Step %llu, %.2f s simulated, %u particles", static_cast<unsigned long long>(replayFrame->stepIndex), replayFrame->simulatedTime, replayFrame->particleCount);
+			ImGui::Text("Frames decoded: %llu", static_cast<unsigned long long>(replayPlayer->GetDecodedFrameCount()));
+		}
+		else if (replayStatus[0] != '\0')
+		{
+			ImGui::Text("%s", replayStatus);
+		}
+
+		AdaptiveTimestepSettings adaptiveSettings = sph->GetAdaptiveTimestep();
+		bool adaptiveChanged = ImGui::Checkbox("Adaptive Timestep", &adaptiveSettings.enabled);
+		if (adaptiveSettings.enabled)
+		{
+			adaptiveChanged |= ImGui::DragFloat("Courant Number", &adaptiveSettings.courant, 0.01f, 0.05f, 1.0f);
+			adaptiveChanged |= ImGui::DragFloat("Force Factor", &adaptiveSettings.forceFactor, 0.01f, 0.05f, 1.0f);
+
+			int maxSubsteps = static_cast<int>(adaptiveSettings.maxSubsteps);
+			if (ImGui::SliderInt("Max Substeps", &maxSubsteps, 1, 128))
+			{
+				adaptiveSettings.maxSubsteps = static_cast<unsigned int>(maxSubsteps);
+				adaptiveChanged = true;
+			}
+
+			const AdaptiveTimestepStats& adaptiveStats = sph->GetAdaptiveTimestepStats();
+			ImGui::Text("Substeps: %u (%.2f - %.2f ms)", adaptiveStats.substeps, adaptiveStats.smallestStep * 1000.0f, adaptiveStats.largestStep * 1000.0f);
+			ImGui::Text("Max Speed: %.2f  Max Acceleration: %.2f", adaptiveStats.bounds.maxSpeed, adaptiveStats.bounds.maxAcceleration);
+			if (adaptiveStats.droppedTime > 0.0f)
+				ImGui::Text("Dropped: %.2f ms", adaptiveStats.droppedTime * 1000.0f);
+		}
+		if (adaptiveChanged)
+			sph->SetAdaptiveTimestep(adaptiveSettings);
 
 		ImGui::Text("Initial Values");
 
@@ -624,6 +837,33 @@ void Application::ImGui()
 			}
 		}*/
 	}
+	if (timestep && ImGui::CollapsingHeader("Timestep"))
+	{
+		float frameBudgetMs = timestep->GetFrameBudget() * 1000.0f;
+		if (ImGui::SliderFloat("Physics Budget (ms)", &frameBudgetMs, 1.0f, 50.0f))
+			timestep->SetFrameBudget(frameBudgetMs / 1000.0f);
+
+		int maxSteps = static_cast<int>(timestep->GetMaxStepsPerFrame());
+		if (ImGui::SliderInt("Max Steps Per Frame", &maxSteps, 1, 32))
+			timestep->SetMaxStepsPerFrame(static_cast<unsigned int>(maxSteps));
+
+		if (ImGui::SliderFloat("Physics Rate (Hz)", &physicsRate, 10.0f, 240.0f))
+		{
+			timestep->SetTargetFPS(physicsRate);
+			if (simulationThread)
+				simulationThread->SetStepRate(physicsRate);
+		}
+		ImGui::Checkbox("Interpolate Rendering", &interpolateRendering);
+
+		const TimestepStats& stats = timestep->GetStats();
+		ImGui::Text("This Frame: %u owed, %u executed, %u dropped (%.2f ms)", stats.owedSteps, stats.executedSteps, stats.droppedSteps, stats.physicsMs);
+		ImGui::Text("Total: %llu owed, %llu executed, %llu dropped", static_cast<unsigned long long>(stats.totalOwedSteps),
+			static_cast<unsigned long long>(stats.totalExecutedSteps), static_cast<unsigned long long>(stats.totalDroppedSteps));
+	}
+	if (ImGui::CollapsingHeader("Profiler"))
+	{
+		DrawProfilerView(profilerHistory, &traceExporter);
+	}
 
 	ImGui::End();
 
@@ -642,6 +882,9 @@ void Application::ImGui()
 
 void Application::Draw()
 {
+	PROFILE_SCOPE("Draw");
+	GpuProfileScope gpuScope(gpuProfiler.get(), "Draw");
+
 	float ClearColor[4] = { 0.5f, 0.5f, 0.5f, 1.0f }; // red,green,blue,alpha
 	_pImmediateContext->ClearRenderTargetView(_pRenderTargetView, ClearColor);
 	_pImmediateContext->ClearDepthStencilView(_depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
@@ -661,8 +904,25 @@ void Application::Draw()
 	_pImmediateContext->VSSetShader(_pVertexShader, nullptr, 0);
 	_pImmediateContext->VSSetConstantBuffers(0, 1, &_pConstantBuffer);
 
-	ID3D11ShaderResourceView* particlePosSRV = sph->GetParticlePositionSRV();
-	_pImmediateContext->VSSetShaderResources(1, 1, &particlePosSRV);
+	ID3D11ShaderResourceView* particlePosSRV[2] = { sph->GetParticlePositionSRV(), sph->GetPreviousParticlePositionSRV() };
+	UINT instanceCount = sph->GetParticleCount();
+
+	// Nothing new to blend towards while paused
+	bool interpolate = interpolateRendering && timestep && !SimulationControl;
+	float interpolationAlpha = interpolate ? timestep->GetInterpolationAlpha() : 1.0f;
+
+	if (replayPlayer)
+	{
+		UpdateReplayBuffers(particlePosSRV, instanceCount);
+	}
+	else if (simulationThread)
+	{
+		UpdateSimulationThreadBuffers(particlePosSRV, instanceCount, interpolationAlpha);
+		if (!interpolate)
+			interpolationAlpha = 1.0f;
+	}
+
+	_pImmediateContext->VSSetShaderResources(1, 2, particlePosSRV);
 
 	_pImmediateContext->PSSetShader(_pPixelShader, nullptr, 0);
 	_pImmediateContext->PSSetConstantBuffers(0, 1, &_pConstantBuffer);
@@ -693,6 +953,9 @@ void Application::Draw()
 
 	cb.World = XMMatrixIdentity();
 
+	cb.InterpolationAlpha = interpolationAlpha;
+	cb.Padding = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
 	//_pImmediateContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &cb, 0, 0);
 
 	D3D11_MAPPED_SUBRESOURCE mapped;
@@ -700,9 +963,174 @@ void Application::Draw()
 	memcpy(mapped.pData, &cb, sizeof(cb));
 	_pImmediateContext->Unmap(_pConstantBuffer, 0);
 
-	_pImmediateContext->DrawIndexedInstanced(sphereIndices.size(), (UINT)NUM_OF_PARTICLES, 0, 0, 0);
+	_pImmediateContext->DrawIndexedInstanced(sphereIndices.size(), instanceCount, 0, 0, 0);
 
 	ImGui();
 
 	_pSwapChain->Present(1, 0);
+}
+
+void Application::SetSimulationThreadEnabled(bool enabled)
+{
+	if (!enabled)
+	{
+		// Also finishes any recording
+		simulationThread.reset();
+		recordSimulation = false;
+		return;
+	}
+
+	simulationThread = std::make_unique<SimulationThread>(sph->GetParticleCount(), 0, physicsRate);
+	simulationThread->SetWalls(minX, minZ);
+	simulationThread->SetPaused(SimulationControl);
+	bool deterministic = deterministicSimulation;
+	simulationThread->Enqueue([deterministic](SPHCPU& sim) { sim.SetDeterministic(deterministic); });
+	GridMode gridMode = denseSimulationGrid ? GridMode::Dense : GridMode::Hashed;
+	simulationThread->Enqueue([gridMode](SPHCPU& sim) { sim.SetGridMode(gridMode); });
+	simulationCurrentBuffer = 0;
+}
+
+void Application::UpdateSimulationThreadBuffers(ID3D11ShaderResourceView* outSRVs[2], UINT& outInstanceCount, float& outAlpha)
+{
+	bool newFrame = simulationThread->AcquireFrame();
+	const SimulationFrame& frame = simulationThread->GetFrame();
+	if (newFrame)
+		UploadParticlePositions(frame.positions, true);
+
+	outSRVs[0] = simulationPositionSRVs[simulationCurrentBuffer];
+	outSRVs[1] = simulationPositionSRVs[simulationCurrentBuffer ^ 1];
+	outInstanceCount = simulationInstanceCount;
+
+	// States arrive one step apart, blend by how far wall time is into the next one
+	float sincePublish = std::chrono::duration<float>(Timestep::Clock::now() - frame.publishTime).count();
+	outAlpha = frame.stepTime > 0.0f ? (std::min)(sincePublish / frame.stepTime, 1.0f) : 1.0f;
+}
+
+void Application::SetReplayEnabled(bool enabled)
+{
+	replayFrame.reset();
+	replayPlayer.reset();
+	replayFrameIndex = 0;
+	replayStatus = "";
+
+	if (!enabled)
+	{
+		// Playback was drawn from the same buffers, a paused simulation thread won't publish anything to replace it
+		if (simulationThread)
+		{
+			simulationThread->AcquireFrame();
+			UploadParticlePositions(simulationThread->GetFrame().positions, false);
+		}
+		return;
+	}
+
+	replayPlayer = std::make_unique<RecordingPlayer>();
+	if (!replayPlayer->Open("WaterSim.recording"))
+	{
+		replayPlayer.reset();
+		replayStatus = "No finished recording in WaterSim.recording";
+	}
+}
+
+void Application::UpdateReplayBuffers(ID3D11ShaderResourceView* outSRVs[2], UINT& outInstanceCount)
+{
+	// A corrupt frame leaves the last good one on screen
+	std::shared_ptr<const ReplayFrame> frame = replayPlayer->GetFrame(replayFrameIndex);
+	if (frame && (!replayFrame || frame->frameIndex != replayFrame->frameIndex))
+	{
+		bool continuous = replayFrame && frame->frameIndex == replayFrame->frameIndex + 1;
+		UploadParticlePositions(frame->positions, continuous);
+		replayFrame = frame;
+	}
+
+	outSRVs[0] = simulationPositionSRVs[simulationCurrentBuffer];
+	outSRVs[1] = simulationPositionSRVs[simulationCurrentBuffer ^ 1];
+	outInstanceCount = replayFrame ? simulationInstanceCount : 0;
+}
+
+void Application::RestoreRewindFrame(size_t frame)
+{
+	if (!rewindBuffer->Restore(frame, rewindParticles))
+		return;
+
+	ReleaseRewindReadback();
+	sph->WriteParticles(rewindParticles);
+	SimulationControl = true;
+	rewindFrame = static_cast<int>(frame);
+	physicsStepIndex = rewindBuffer->GetFrameStep(frame);
+	physicsTime = rewindBuffer->GetFrameTime(frame);
+}
+
+void Application::ReleaseRewindReadback()
+{
+	if (rewindBuffer)
+		rewindBuffer->WaitForBorrowed();
+	if (sph)
+		sph->UnmapParticles();
+}
+
+void Application::UploadParticlePositions(const std::vector<Float4>& positions, bool continuous)
+{
+	UINT idCount = static_cast<UINT>(positions.size());
+
+	// Both buffers are recreated on growth, so the new state goes into both and there is nothing to blend from
+	if (idCount > simulationBufferCapacity)
+	{
+		UINT capacity = (std::max)(simulationBufferCapacity * 2, idCount);
+		for (int i = 0; i < 2; i++)
+		{
+			if (simulationPositionSRVs[i]) simulationPositionSRVs[i]->Release();
+			if (simulationPositionBuffers[i]) simulationPositionBuffers[i]->Release();
+
+			D3D11_BUFFER_DESC desc = {};
+			desc.ByteWidth = sizeof(Float4) * capacity;
+			desc.Usage = D3D11_USAGE_DYNAMIC;
+			desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+			desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+			desc.StructureByteStride = sizeof(Float4);
+			_pd3dDevice->CreateBuffer(&desc, nullptr, &simulationPositionBuffers[i]);
+			_pd3dDevice->CreateShaderResourceView(simulationPositionBuffers[i], nullptr, &simulationPositionSRVs[i]);
+		}
+
+		simulationBufferCapacity = capacity;
+	}
+
+	// The previous buffer only holds the old count, particles added since would blend from whatever was left there
+	if (idCount != simulationInstanceCount)
+		continuous = false;
+
+	auto upload = [&](UINT index)
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		if (FAILED(_pImmediateContext->Map(simulationPositionBuffers[index], 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+			return;
+
+		memcpy(mapped.pData, positions.data(), sizeof(Float4) * idCount);
+		_pImmediateContext->Unmap(simulationPositionBuffers[index], 0);
+	};
+
+	if (continuous)
+	{
+		// The buffer holding the last state becomes the previous one
+		simulationCurrentBuffer ^= 1;
+		upload(simulationCurrentBuffer);
+	}
+	else
+	{
+		upload(0);
+		upload(1);
+	}
+
+	simulationInstanceCount = idCount;
+}
+
+void Application::EndFrame()
+{
+	// Closes this frame's GPU queries and starts the next profiler frame
+	gpuProfiler->EndFrame();
+	profilerHistory.Update();
+	traceExporter.Submit(profilerHistory.GetCollected());
+	Profiler::BeginFrame();
+	gpuProfiler->BeginFrame();
 }
\ No newline at end of file
@@ -2,6 +2,12 @@
 
 #include "Includes.h"
 #include "SPH.h"
+#include "Timestep.h"
+#include "SimulationThread.h"
+#include "RecordingPlayer.h"
+#include "RewindBuffer.h"
+#include "GpuProfiler.h"
+#include "ProfilerView.h"
 
 using namespace DirectX;
 
@@ -38,6 +44,9 @@ struct ConstantBuffer
 
 	XMFLOAT3 EyePosW;
 	float HasTexture;
+
+	float InterpolationAlpha;
+	XMFLOAT3 Padding;
 };
 
 class Application
@@ -53,7 +62,14 @@ public:
 
 	void Update();
 	void UpdatePhysics(float deltaTime);
+
+	// Scheduler driving UpdatePhysics, shown and tuned in the debug window
+	void SetTimestep(Timestep* scheduler) { timestep = scheduler; }
+
+	// Adaptive stepping does its own substeps, so it is fed whole frames instead of fixed steps
+	bool IsAdaptiveTimestep() const { return sph->GetAdaptiveTimestep().enabled; }
 	void Draw();
+	void EndFrame();
 
 public:
 	// Public Variables
@@ -71,6 +87,27 @@ private:
 
 	void ImGui();
 
+	// Starts or stops the CPU simulation thread, which replaces the GPU simulation while it runs
+	void SetSimulationThreadEnabled(bool enabled);
+
+	// Uploads the newest published CPU state, returns the SRVs to draw (current, previous) and the blend alpha
+	void UpdateSimulationThreadBuffers(ID3D11ShaderResourceView* outSRVs[2], UINT& outInstanceCount, float& outAlpha);
+
+	// Opens WaterSim.recording for playback, which replaces both simulations while it is open
+	void SetReplayEnabled(bool enabled);
+
+	// Uploads the frame at the playhead, returns the SRVs to draw (current, previous)
+	void UpdateReplayBuffers(ID3D11ShaderResourceView* outSRVs[2], UINT& outInstanceCount);
+
+	// Puts the GPU simulation back to a frame of the rewind history and pauses there
+	void RestoreRewindFrame(size_t frame);
+	// Waits for the rewind encoder to finish with the mapped particle read back and unmaps it
+	void ReleaseRewindReadback();
+
+	// Writes positions into the next of the two CPU position buffers. Without continuous (a jump in time) it goes
+	// into both, so there is nothing to blend from.
+	void UploadParticlePositions(const std::vector<Float4>& positions, bool continuous);
+
 private:
 	// Private Variables
 
@@ -143,5 +180,41 @@ private:
 	ID3DUserDefinedAnnotation* _pAnnotation = nullptr;
 
 	float voxCount = 0.0f;
+	int requestedParticleCount = NUM_OF_PARTICLES;
+
+	Timestep* timestep = nullptr;
+
+	// Blends the last two physics steps so physics can tick slower than the display
+	bool interpolateRendering = true;
+	float physicsRate = 60.0f;
+
+	// CPU simulation on its own thread, states are uploaded into two dynamic buffers used in turn (also used by playback)
+	std::unique_ptr<SimulationThread> simulationThread;
+	ID3D11Buffer* simulationPositionBuffers[2] = {};
+	ID3D11ShaderResourceView* simulationPositionSRVs[2] = {};
+	UINT simulationBufferCapacity = 0;
+	UINT simulationCurrentBuffer = 0;
+	UINT simulationInstanceCount = 0;
+	bool deterministicSimulation = false; // Bit reproducible CPU steps, slower
+	bool denseSimulationGrid = false; // CPU neighbour grid of bounded cells instead of the GPU's hashed one
+	bool recordSimulation = false;
+
+	// Playback of a recording, advanced one frame per physics step
+	std::unique_ptr<RecordingPlayer> replayPlayer;
+	std::shared_ptr<const ReplayFrame> replayFrame; // Last uploaded
+	uint64_t replayFrameIndex = 0;
+	const char* replayStatus = "";
+
+	// Recent GPU simulation states for stepping back, filled by async readbacks after every step
+	std::unique_ptr<RewindBuffer> rewindBuffer;
+	std::vector<ParticleState> rewindParticles;
+	int rewindFrame = -1; // History frame on show, -1 while the simulation is live
+	uint64_t physicsStepIndex = 0;
+	double physicsTime = 0.0;
+
+	// Profiler
+	std::unique_ptr<GpuProfiler> gpuProfiler;
+	ProfilerHistory profilerHistory;
+	ChromeTraceExporter traceExporter;
 };
 
@@ -0,0 +1,1274 @@
+// Headless benchmark of the CPU simulation backend, built by CMakeLists.txt (not part of WaterSim.vcxproj).
+//
+//   WaterSimBenchmark --scenario dam_break --particles 131072 --steps 200 --threads 8 --output result.json
+//
+// Every stage of SPHCPU::Update is timed per step and summarised as min / median / p99 in JSON.
+// --trace FILE additionally records the timed steps as a Chrome / Perfetto trace.
+// The final state checksum only matches across thread counts with --deterministic.
+// --load-checkpoint starts from a saved state instead of the scenario's, --save-checkpoint saves the final one.
+// --record FILE captures every timed step into a recording, the capture is included in the step time.
+// --replay FILE plays a recording back instead of simulating: every frame in order, then --steps random seeks.
+// --sparse-voxels SIZE splats the marching cubes voxels into a BrickVolume of that voxel size instead of the dense grid.
+// --scalar-field times building the MarchingCubes scalar field from the particles after warmup with the reference
+// loop once, then ScalarFieldBuilder's splat and gather for --steps each. The reference visits every particle from every
+// voxel, keep --particles small.
+// --mesh ISO times marching cubes over the voxels after warmup for --steps, separate and welded vertices, serially and
+// split into slabs over --threads. Add --sparse-voxels for a finer grid, extracted from the bricks as well.
+// --slabs N runs the scenario on SPHSlabs, --threads split between N slabs, and reports the per slab balance.
+// --simd scalar|avx2|avx512 caps the density and pressure kernels' instruction set, the JSON's simd is the level
+// that actually ran once the machine's support is taken into account.
+// --grid hashed|dense picks the neighbour grid, the dense grid counting sorts its cells and ignores --sort.
+// --sort radix|bitonic picks the hashed grid's sort, compare the SortGrid stage between the two.
+// --skin R caches Verlet neighbour lists with that skin and reports their rebuilds, entries and memory.
+// --reorder CURVE permutes the particles into Morton or Hilbert order every --reorder-interval steps. Where the
+// machine has a usable PMU, the cache misses and references of the timed steps are reported as well.
+// --ranks N runs a weak scaling scene on SPHDistributed in N processes over localhost sockets, each rank getting
+// --particles of its own, and rank 0 reports the per rank step and transport times. Compare runs with different N.
+
+#include "SPHCPU.h"
+#include "CacheCounters.h"
+#include "SPHSlabs.h"
+#include "SPHDistributed.h"
+#include "SocketTransport.h"
+#include "ChromeTraceExporter.h"
+#include "FrameRecorder.h"
+#include "IsoSurface.h"
+#include "RecordingPlayer.h"
+#include "ScalarField.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct BenchmarkOptions
+	{
+		std::string scenario = "cube";
+		unsigned int particles = NUM_OF_PARTICLES;
+		unsigned int steps = 100;
+		unsigned int warmupSteps = 10;
+		unsigned int threads = 0;
+		float deltaTime = 1.0f / 60.0f;
+		bool adaptive = false; // deltaTime is then the frame length, split into CFL substeps
+		bool deterministic = false;
+		std::string outputPath; // stdout when empty
+		std::string tracePath; // No trace when empty
+		std::string loadCheckpointPath;
+		std::string saveCheckpointPath;
+		std::string recordPath; // No recording when empty
+		std::string replayPath; // Benchmarks playback of this recording instead of the simulation
+		float sparseVoxelSize = 0.0f; // Dense voxels when 0
+		SIMDLevel simdLevel = SIMDLevel::AVX512; // Falls back to the best the machine supports
+		GridMode gridMode = GridMode::Hashed;
+		SortMode sortMode = SortMode::Radix;
+		float neighbourSkin = 0.0f; // No neighbour lists when 0
+		ParticleOrder reorder = ParticleOrder::None;
+		unsigned int reorderInterval = 16;
+		bool scalarField = false; // Times the scalar field builders instead of the simulation
+		float meshIsoLevel = 0.0f; // Times mesh extraction at this iso level instead of the simulation when above 0
+		unsigned int slabs = 0; // SPHCPU when 0
+		unsigned int ranks = 0; // Not distributed when 0
+		int rank = -1; // Rank of this process, -1 forks the other ranks off this one as rank 0
+		unsigned int port = 47000; // Rank r listens on port + r
+	};
+
+	// Named values of an option, the names are also what the JSON reports
+	template <typename T>
+	struct Choice
+	{
+		const char* name;
+		T value;
+	};
+
+	const Choice<SIMDLevel> simdLevels[] =
+	{
+		{ "scalar", SIMDLevel::Scalar },
+		{ "avx2", SIMDLevel::AVX2 },
+		{ "avx512", SIMDLevel::AVX512 },
+	};
+
+	const Choice<GridMode> gridModes[] =
+	{
+		{ "hashed", GridMode::Hashed },
+		{ "dense", GridMode::Dense },
+	};
+
+	const Choice<SortMode> sortModes[] =
+	{
+		{ "radix", SortMode::Radix },
+		{ "bitonic", SortMode::Bitonic },
+	};
+
+	const Choice<ParticleOrder> particleOrders[] =
+	{
+		{ "none", ParticleOrder::None },
+		{ "morton", ParticleOrder::Morton },
+		{ "hilbert", ParticleOrder::Hilbert },
+	};
+
+	template <typename T, size_t N>
+	bool ParseChoice(const char* argument, const char* value, const Choice<T> (&choices)[N], T& outValue)
+	{
+		for (const Choice<T>& choice : choices)
+		{
+			if (std::strcmp(value, choice.name) == 0)
+			{
+				outValue = choice.value;
+				return true;
+			}
+		}
+
+		std::fprintf(stderr, "Unknown value %s for %s\n", value, argument);
+		return false;
+	}
+
+	template <typename T, size_t N>
+	const char* GetChoiceName(const Choice<T> (&choices)[N], T value)
+	{
+		for (const Choice<T>& choice : choices)
+		{
+			if (choice.value == value)
+				return choice.name;
+		}
+		return "unknown";
+	}
+
+	// Same walls as the Application defaults
+	constexpr float wallMinX = -50.0f;
+	constexpr float wallMinZ = -50.0f;
+
+	struct Scenario
+	{
+		const char* name;
+		const char* description;
+		void (*setup)(SPHCPU& sim, unsigned int particles, const BenchmarkOptions& options);
+	};
+
+	// Lattice of count particles filling [min, max], spacing chosen from the box volume
+	void FillBox(SPHCPU& sim, const Float3& min, const Float3& max, unsigned int count)
+	{
+		if (count == 0)
+			return;
+
+		Float3 size = max - min;
+		float spacing = std::cbrt(size.x * size.y * size.z / count);
+
+		int countX = std::max(1, static_cast<int>(std::ceil(size.x / spacing)));
+		int countY = std::max(1, static_cast<int>(std::ceil(size.y / spacing)));
+		int countZ = std::max(1, static_cast<int>(std::ceil(size.z / spacing)));
+
+		unsigned int emitted = 0;
+		for (int y = 0; y < countY && emitted < count; y++)
+			for (int z = 0; z < countZ && emitted < count; z++)
+				for (int x = 0; x < countX && emitted < count; x++, emitted++)
+					sim.EmitParticle({ min.x + (x + 0.5f) * spacing, min.y + (y + 0.5f) * spacing, min.z + (z + 0.5f) * spacing }, { 0.0f, 0.0f, 0.0f });
+	}
+
+	void SetupCube(SPHCPU&, unsigned int, const BenchmarkOptions&)
+	{
+		// SPHCPU::InitParticles already placed the starting cube
+	}
+
+	void SetupDamBreak(SPHCPU& sim, unsigned int particles, const BenchmarkOptions&)
+	{
+		FillBox(sim, { wallMinX, -30.0f, wallMinZ }, { 0.0f, 30.0f, -wallMinZ }, particles);
+	}
+
+	void SetupDrop(SPHCPU& sim, unsigned int particles, const BenchmarkOptions&)
+	{
+		// Shallow pool with a block falling into it
+		unsigned int blockCount = particles / 5;
+		FillBox(sim, { wallMinX, -30.0f, wallMinZ }, { -wallMinX, -15.0f, -wallMinZ }, particles - blockCount);
+		FillBox(sim, { -10.0f, 20.0f, -10.0f }, { 10.0f, 40.0f, 10.0f }, blockCount);
+	}
+
+	void SetupFill(SPHCPU& sim, unsigned int particles, const BenchmarkOptions& options)
+	{
+		// Starts empty and reaches the particle count on the last timed step
+		ParticleEmitter emitter;
+		emitter.min = { -10.0f, 30.0f, -10.0f };
+		emitter.max = { 10.0f, 45.0f, 10.0f };
+		emitter.velocity = { 0.0f, -5.0f, 0.0f };
+		emitter.rate = particles / ((options.warmupSteps + options.steps) * options.deltaTime);
+		sim.GetEmitters().push_back(emitter);
+	}
+
+	const Scenario scenarios[] =
+	{
+		{ "cube", "Default starting cube of SPH::InitParticles", SetupCube },
+		{ "dam_break", "Column of water released from one half of the tank", SetupDamBreak },
+		{ "drop", "Block dropped into a shallow pool", SetupDrop },
+		{ "fill", "Empty tank filled by an emitter", SetupFill },
+	};
+
+	const Scenario* FindScenario(const std::string& name)
+	{
+		for (const Scenario& scenario : scenarios)
+		{
+			if (name == scenario.name)
+				return &scenario;
+		}
+		return nullptr;
+	}
+
+	void PrintUsage()
+	{
+		std::fprintf(stderr,
+			"Usage: WaterSimBenchmark [options]\n"
+			"  --scenario NAME    Scene to simulate (default cube)\n"
+			"  --particles N      Particle count (default %u)\n"
+			"  --steps N          Timed steps (default 100)\n"
+			"  --warmup N         Untimed steps run first (default 10)\n"
+			"  --threads N        Worker threads, 0 for one per core (default 0)\n"
+			"  --dt SECONDS       Time step (default 1/60)\n"
+			"  --adaptive         Cover each --dt with CFL limited substeps\n"
+			"  --deterministic    Bit identical results for any --threads\n"
+			"  --output FILE      Write the JSON here instead of stdout\n"
+			"  --trace FILE       Write a Chrome trace of the timed steps\n"
+			"  --load-checkpoint FILE  Start from a checkpoint, its walls replace the defaults\n"
+			"  --save-checkpoint FILE  Save the state after the timed steps\n"
+			"  --record FILE           Record the timed steps\n"
+			"  --replay FILE           Time playing back a recording, --threads decode workers\n"
+			"  --sparse-voxels SIZE    Sparse bricked voxels of this size instead of the dense grid\n"
+			"  --simd LEVEL            Highest kernel level: scalar, avx2 or avx512 (default avx512)\n"
+			"  --grid MODE             Neighbour grid: hashed or dense (default hashed)\n"
+			"  --sort MODE             Hashed grid sort: radix or bitonic (default radix)\n"
+			"  --skin R                Verlet neighbour lists with this skin, 0 for none (default 0)\n"
+			"  --reorder CURVE         Particle storage order: none, morton or hilbert (default none)\n"
+			"  --reorder-interval N    Steps between reorders (default 16)\n"
+			"  --scalar-field          Time the scalar field builders on the particles after warmup\n"
+			"  --mesh ISO              Time serial and parallel marching cubes over the voxels after warmup\n"
+			"  --slabs N               Split the tank into N slabs with their own threads\n"
+			"  --ranks N               Weak scaling run in N processes, --particles per rank\n"
+			"  --rank R                Run only rank R of --ranks, each rank started by hand\n"
+			"  --port P                First localhost port of the ranks (default 47000)\n"
+			"Scenarios:\n", NUM_OF_PARTICLES);
+
+		for (const Scenario& scenario : scenarios)
+			std::fprintf(stderr, "  %-12s %s\n", scenario.name, scenario.description);
+	}
+
+	bool ParseOptions(int argc, char** argv, BenchmarkOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string argument = argv[i];
+			if (argument == "--help" || argument == "-h")
+				return false;
+
+			if (argument == "--adaptive")
+			{
+				options.adaptive = true;
+				continue;
+			}
+
+			if (argument == "--deterministic")
+			{
+				options.deterministic = true;
+				continue;
+			}
+
+			if (argument == "--scalar-field")
+			{
+				options.scalarField = true;
+				continue;
+			}
+
+			if (i + 1 >= argc)
+			{
+				std::fprintf(stderr, "Missing value for %s\n", argument.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (argument == "--scenario")
+				options.scenario = value;
+			else if (argument == "--particles")
+				options.particles = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			else if (argument == "--steps")
+				options.steps = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			else if (argument == "--warmup")
+				options.warmupSteps = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			else if (argument == "--threads")
+				options.threads = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			else if (argument == "--dt")
+				options.deltaTime = std::strtof(value, nullptr);
+			else if (argument == "--output")
+				options.outputPath = value;
+			else if (argument == "--trace")
+				options.tracePath = value;
+			else if (argument == "--load-checkpoint")
+				options.loadCheckpointPath = value;
+			else if (argument == "--save-checkpoint")
+				options.saveCheckpointPath = value;
+			else if (argument == "--record")
+				options.recordPath = value;
+			else if (argument == "--replay")
+				options.replayPath = value;
+			else if (argument == "--sparse-voxels")
+				options.sparseVoxelSize = std::strtof(value, nullptr);
+			else if (argument == "--simd")
+			{
+				if (!ParseChoice(argument.c_str(), value, simdLevels, options.simdLevel))
+					return false;
+			}
+			else if (argument == "--grid")
+			{
+				if (!ParseChoice(argument.c_str(), value, gridModes, options.gridMode))
+					return false;
+			}
+			else if (argument == "--sort")
+			{
+				if (!ParseChoice(argument.c_str(), value, sortModes, options.sortMode))
+					return false;
+			}
+			else if (argument == "--skin")
+				options.neighbourSkin = std::strtof(value, nullptr);
+			else if (argument == "--reorder")
+			{
+				if (!ParseChoice(argument.c_str(), value, particleOrders, options.reorder))
+					return false;
+			}
+			else if (argument == "--reorder-interval")
+				options.reorderInterval = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			else if (argument == "--mesh")
+				options.meshIsoLevel = std::strtof(value, nullptr);
+			else if (argument == "--slabs")
+				options.slabs = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			else if (argument == "--ranks")
+				options.ranks = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			else if (argument == "--rank")
+				options.rank = static_cast<int>(std::strtol(value, nullptr, 10));
+			else if (argument == "--port")
+				options.port = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			else
+			{
+				std::fprintf(stderr, "Unknown option %s\n", argument.c_str());
+				return false;
+			}
+		}
+
+		if (options.steps == 0 || options.deltaTime <= 0.0f)
+		{
+			std::fprintf(stderr, "--steps and --dt must be positive\n");
+			return false;
+		}
+
+		if (options.rank >= 0 && options.rank >= static_cast<int>(options.ranks))
+		{
+			std::fprintf(stderr, "--rank must be below --ranks\n");
+			return false;
+		}
+		return true;
+	}
+
+	struct Summary
+	{
+		double min = 0.0;
+		double median = 0.0;
+		double p99 = 0.0;
+		double mean = 0.0;
+	};
+
+	// Nearest rank percentiles
+	Summary Summarise(std::vector<double> samples)
+	{
+		Summary summary;
+		if (samples.empty())
+			return summary;
+
+		std::sort(samples.begin(), samples.end());
+
+		auto percentile = [&](double fraction)
+		{
+			size_t rank = static_cast<size_t>(std::ceil(fraction * samples.size()));
+			return samples[std::min(std::max<size_t>(rank, 1), samples.size()) - 1];
+		};
+
+		summary.min = samples.front();
+		summary.median = percentile(0.5);
+		summary.p99 = percentile(0.99);
+
+		for (double sample : samples)
+			summary.mean += sample;
+		summary.mean /= samples.size();
+		return summary;
+	}
+
+	void WriteSummary(FILE* file, const char* name, const Summary& summary, bool last)
+	{
+		std::fprintf(file, "    \"%s\": { \"min_ms\": %.4f, \"median_ms\": %.4f, \"p99_ms\": %.4f, \"mean_ms\": %.4f }%s\n",
+			name, summary.min, summary.median, summary.p99, summary.mean, last ? "" : ",");
+	}
+
+	// stdout when there is no --output
+	FILE* OpenOutput(const BenchmarkOptions& options)
+	{
+		if (options.outputPath.empty())
+			return stdout;
+
+		FILE* file = std::fopen(options.outputPath.c_str(), "w");
+		if (!file)
+			std::fprintf(stderr, "Can't open %s\n", options.outputPath.c_str());
+		return file;
+	}
+
+	// Playback decodes and builds the meshing voxels of each frame, like the app would
+	int RunReplay(const BenchmarkOptions& options)
+	{
+		RecordingPlayer player(options.threads);
+		if (!player.Open(options.replayPath, true))
+		{
+			std::fprintf(stderr, "Can't open recording %s\n", options.replayPath.c_str());
+			return 1;
+		}
+
+		uint64_t frameCount = player.GetFrameCount();
+		unsigned int particles = 0;
+
+		std::vector<double> playSamples;
+		playSamples.reserve(frameCount);
+		auto playStart = std::chrono::steady_clock::now();
+		for (uint64_t f = 0; f < frameCount; f++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			std::shared_ptr<const ReplayFrame> frame = player.GetFrame(f);
+			playSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+			if (!frame)
+			{
+				std::fprintf(stderr, "Frame %llu of %s is corrupt\n", static_cast<unsigned long long>(f), options.replayPath.c_str());
+				return 1;
+			}
+			particles = std::max(particles, frame->particleCount);
+		}
+		double playSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - playStart).count();
+		uint64_t playDecoded = player.GetDecodedFrameCount();
+
+		// Fixed seed so runs seek to the same frames
+		std::mt19937_64 random(1);
+		std::vector<double> seekSamples;
+		seekSamples.reserve(options.steps);
+		for (unsigned int seek = 0; seek < options.steps; seek++)
+		{
+			uint64_t target = random() % frameCount;
+			auto start = std::chrono::steady_clock::now();
+			player.GetFrame(target);
+			seekSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		FILE* file = OpenOutput(options);
+		if (!file)
+			return 1;
+
+		std::fprintf(file, "{\n");
+		std::fprintf(file, "  \"replay\": \"%s\",\n", options.replayPath.c_str());
+		std::fprintf(file, "  \"frames\": %" PRIu64 ",\n", frameCount);
+		std::fprintf(file, "  \"keyframe_interval\": %u,\n", player.GetHeader().keyframeInterval);
+		std::fprintf(file, "  \"max_particles\": %u,\n", particles);
+		std::fprintf(file, "  \"seeks\": %u,\n", options.steps);
+		std::fprintf(file, "  \"play_frames_per_second\": %.3f,\n", playSeconds > 0.0 ? frameCount / playSeconds : 0.0);
+		std::fprintf(file, "  \"play_decoded_frames\": %" PRIu64 ",\n", playDecoded);
+		std::fprintf(file, "  \"stages\": {\n");
+		WriteSummary(file, "Play", Summarise(playSamples), false);
+		WriteSummary(file, "Seek", Summarise(seekSamples), true);
+		std::fprintf(file, "  }\n");
+		std::fprintf(file, "}\n");
+
+		if (file != stdout)
+			std::fclose(file);
+
+		return 0;
+	}
+
+	// Largest difference from the reference, 0 when bit identical
+	float MaxDifference(const std::vector<float>& field, const std::vector<float>& reference)
+	{
+		float difference = 0.0f;
+		for (size_t i = 0; i < field.size(); i++)
+			difference = std::max(difference, std::abs(field[i] - reference[i]));
+		return difference;
+	}
+
+	// Field over the meshing voxel box of the tank, as the app would build it for MarchingCubes
+	int RunScalarField(const BenchmarkOptions& options, const char* scenarioName, SPHCPU& sim)
+	{
+		std::vector<ParticleState> states;
+		sim.ReadParticles(states);
+
+		std::vector<Float3> positions;
+		std::vector<float> densities;
+		for (uint32_t id = 0; id < states.size(); id++)
+		{
+			if (sim.IsParticleActive(id))
+			{
+				positions.push_back(states[id].position);
+				densities.push_back(states[id].density);
+			}
+		}
+
+		ScalarFieldGrid grid;
+		grid.sizeX = VOXEL_GRID_SIZE_X;
+		grid.sizeY = VOXEL_GRID_SIZE_Y;
+		grid.sizeZ = VOXEL_GRID_SIZE_Z;
+		grid.cellSize = VOXEL_SIZE;
+		grid.origin = { wallMinX, SPHSettings().minY, wallMinZ };
+		grid.smoothingRadius = sim.GetSmoothingRadius();
+
+		std::vector<float> reference;
+		auto referenceStart = std::chrono::steady_clock::now();
+		BuildScalarFieldReference(positions, densities, grid, reference);
+		double referenceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - referenceStart).count();
+
+		JobSystem jobSystem(options.threads);
+		ScalarFieldBuilder builder(jobSystem);
+
+		std::vector<float> splatField;
+		std::vector<float> gatherField;
+		std::vector<double> splatSamples;
+		std::vector<double> gatherSamples;
+		splatSamples.reserve(options.steps);
+		gatherSamples.reserve(options.steps);
+		for (unsigned int step = 0; step < options.steps; step++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			builder.Splat(positions, densities, grid, splatField);
+			splatSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+			start = std::chrono::steady_clock::now();
+			builder.Gather(positions, densities, grid, gatherField);
+			gatherSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		FILE* file = OpenOutput(options);
+		if (!file)
+			return 1;
+
+		std::fprintf(file, "{\n");
+		std::fprintf(file, "  \"scenario\": \"%s\",\n", scenarioName);
+		std::fprintf(file, "  \"particles\": %zu,\n", positions.size());
+		std::fprintf(file, "  \"voxels\": %zu,\n", reference.size());
+		std::fprintf(file, "  \"steps\": %u,\n", options.steps);
+		std::fprintf(file, "  \"warmup_steps\": %u,\n", options.warmupSteps);
+		std::fprintf(file, "  \"threads\": %u,\n", jobSystem.GetThreadCount());
+		std::fprintf(file, "  \"splat_max_difference\": %g,\n", MaxDifference(splatField, reference));
+		std::fprintf(file, "  \"gather_max_difference\": %g,\n", MaxDifference(gatherField, reference));
+		std::fprintf(file, "  \"stages\": {\n");
+		WriteSummary(file, "Reference", Summarise({ referenceMs }), false);
+		WriteSummary(file, "Splat", Summarise(splatSamples), false);
+		WriteSummary(file, "Gather", Summarise(gatherSamples), true);
+		std::fprintf(file, "  }\n");
+		std::fprintf(file, "}\n");
+
+		if (file != stdout)
+			std::fclose(file);
+
+		return 0;
+	}
+
+	// Extracts the surface of the simulation's voxels serially and with IsoSurfaceExtractor. --sparse-voxels makes a
+	// finer grid, copied out of the bricks into a dense field first, and also extracts straight from the bricks.
+	int RunMesh(const BenchmarkOptions& options, const char* scenarioName, SPHCPU& sim)
+	{
+		std::vector<float> brickField;
+		int sizeX = VOXEL_GRID_SIZE_X;
+		int sizeY = VOXEL_GRID_SIZE_Y;
+		int sizeZ = VOXEL_GRID_SIZE_Z;
+		float cellSize = VOXEL_SIZE;
+		if (sim.HasSparseVoxels())
+		{
+			const BrickVolume& volume = sim.GetBrickVoxels();
+			volume.CopyToDense(brickField);
+			sizeX = volume.GetSizeX();
+			sizeY = volume.GetSizeY();
+			sizeZ = volume.GetSizeZ();
+			cellSize = volume.GetVoxelSize();
+		}
+		const std::vector<float>& field = sim.HasSparseVoxels() ? brickField : sim.GetVoxels();
+
+		JobSystem jobSystem(options.threads);
+		IsoSurfaceExtractor extractor(jobSystem);
+
+		// Serial separate, serial welded, parallel separate, parallel welded, then the same from the bricks
+		constexpr int maxRunCount = 8;
+		const char* runNames[maxRunCount] = { "Separate", "Welded", "ParallelSeparate", "ParallelWelded",
+			"BrickSeparate", "BrickWelded", "ParallelBrickSeparate", "ParallelBrickWelded" };
+		int runCount = sim.HasSparseVoxels() ? 8 : 4;
+		std::vector<IsoSurfaceVertex> vertices[maxRunCount];
+		std::vector<uint32_t> indices[maxRunCount];
+		std::vector<double> samples[maxRunCount];
+
+		for (unsigned int step = 0; step < options.steps; step++)
+		{
+			for (int run = 0; run < runCount; run++)
+			{
+				IsoSurfaceVertices vertexMode = run % 2 == 0 ? IsoSurfaceVertices::Separate : IsoSurfaceVertices::Welded;
+				bool parallel = run % 4 >= 2;
+				vertices[run].clear();
+				indices[run].clear();
+
+				auto start = std::chrono::steady_clock::now();
+				if (run >= 4 && parallel)
+					extractor.Extract(sim.GetBrickVoxels(), options.meshIsoLevel, vertices[run], indices[run], vertexMode);
+				else if (run >= 4)
+					ExtractIsoSurface(sim.GetBrickVoxels(), options.meshIsoLevel, vertices[run], indices[run], vertexMode);
+				else if (parallel)
+					extractor.Extract(field, sizeX, sizeY, sizeZ, cellSize, options.meshIsoLevel, vertices[run], indices[run], vertexMode);
+				else
+					ExtractIsoSurface(field, sizeX, sizeY, sizeZ, cellSize, options.meshIsoLevel, vertices[run], indices[run], vertexMode);
+				samples[run].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+			}
+		}
+
+		// The parallel welded vertices are numbered differently, so the triangles are compared corner by corner
+		bool parallelMatches = true;
+		for (int run = 0; run < runCount; run++)
+		{
+			if (run % 4 < 2)
+				continue;
+
+			const std::vector<IsoSurfaceVertex>& serialVertices = vertices[run - 2];
+			const std::vector<uint32_t>& serialIndices = indices[run - 2];
+			if (serialIndices.size() != indices[run].size() || serialVertices.size() != vertices[run].size())
+			{
+				parallelMatches = false;
+				continue;
+			}
+
+			for (size_t i = 0; i < serialIndices.size(); i++)
+			{
+				if (std::memcmp(&serialVertices[serialIndices[i]], &vertices[run][indices[run][i]], sizeof(IsoSurfaceVertex)) != 0)
+					parallelMatches = false;
+			}
+		}
+
+		FILE* file = OpenOutput(options);
+		if (!file)
+			return 1;
+
+		// Bytes a frame uploads, vertices plus 32 bit indices
+		auto meshBytes = [&](int run)
+		{
+			return vertices[run].size() * sizeof(IsoSurfaceVertex) + indices[run].size() * sizeof(uint32_t);
+		};
+
+		std::fprintf(file, "{\n");
+		std::fprintf(file, "  \"scenario\": \"%s\",\n", scenarioName);
+		std::fprintf(file, "  \"particles\": %u,\n", sim.GetParticleCount());
+		std::fprintf(file, "  \"steps\": %u,\n", options.steps);
+		std::fprintf(file, "  \"warmup_steps\": %u,\n", options.warmupSteps);
+		std::fprintf(file, "  \"threads\": %u,\n", jobSystem.GetThreadCount());
+		std::fprintf(file, "  \"grid\": [%d, %d, %d],\n", sizeX, sizeY, sizeZ);
+		std::fprintf(file, "  \"voxel_size\": %.4f,\n", cellSize);
+		std::fprintf(file, "  \"iso_level\": %.4f,\n", options.meshIsoLevel);
+		std::fprintf(file, "  \"triangles\": %zu,\n", indices[1].size() / 3);
+		std::fprintf(file, "  \"separate_vertices\": %zu,\n", vertices[0].size());
+		std::fprintf(file, "  \"separate_bytes\": %zu,\n", meshBytes(0));
+		std::fprintf(file, "  \"welded_vertices\": %zu,\n", vertices[1].size());
+		std::fprintf(file, "  \"welded_bytes\": %zu,\n", meshBytes(1));
+		std::fprintf(file, "  \"parallel_matches\": %s,\n", parallelMatches ? "true" : "false");
+		std::fprintf(file, "  \"stages\": {\n");
+		for (int run = 0; run < runCount; run++)
+			WriteSummary(file, runNames[run], Summarise(samples[run]), run == runCount - 1);
+		std::fprintf(file, "  }\n");
+		std::fprintf(file, "}\n");
+
+		if (file != stdout)
+			std::fclose(file);
+
+		return 0;
+	}
+
+	// The scenario is set up on SPHCPU and its particles handed over, so both backends start from the same state
+	int RunSlabs(const BenchmarkOptions& options, const char* scenarioName, SPHCPU& source, float minX, float minZ)
+	{
+		if (!source.GetEmitters().empty() || !source.GetSinks().empty())
+		{
+			std::fprintf(stderr, "--slabs doesn't support emitters or sinks, pick another scenario\n");
+			return 1;
+		}
+
+		if (options.deterministic || !options.tracePath.empty() || !options.recordPath.empty() || !options.saveCheckpointPath.empty() ||
+			options.sparseVoxelSize > 0.0f)
+		{
+			std::fprintf(stderr, "--slabs can't be combined with --deterministic, --trace, --record, --save-checkpoint or --sparse-voxels\n");
+			return 1;
+		}
+
+		std::vector<ParticleState> states;
+		source.ReadParticles(states);
+
+		std::vector<ParticleState> particles;
+		for (uint32_t id = 0; id < states.size(); id++)
+		{
+			if (source.IsParticleActive(id))
+				particles.push_back(states[id]);
+		}
+
+		SPHSlabs sim(particles, options.slabs, options.threads);
+
+		AdaptiveTimestepSettings adaptiveSettings;
+		adaptiveSettings.enabled = options.adaptive;
+		sim.SetAdaptiveTimestep(adaptiveSettings);
+
+		for (unsigned int step = 0; step < options.warmupSteps; step++)
+			sim.Advance(options.deltaTime, minX, minZ);
+
+		std::vector<std::vector<double>> stageSamples(DOMAIN_STAGE_COUNT);
+		std::vector<double> stepSamples;
+		stepSamples.reserve(options.steps);
+
+		unsigned int slabCount = sim.GetSlabCount();
+		std::vector<double> slabParticles(slabCount, 0.0);
+		std::vector<double> slabHalo(slabCount, 0.0);
+		std::vector<double> slabBusy(slabCount, 0.0);
+
+		for (unsigned int step = 0; step < options.steps; step++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			sim.Advance(options.deltaTime, minX, minZ);
+			stepSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+			const std::array<double, DOMAIN_STAGE_COUNT>& stageTimes = sim.GetStageTimes();
+			for (unsigned int stage = 0; stage < DOMAIN_STAGE_COUNT; stage++)
+				stageSamples[stage].push_back(stageTimes[stage]);
+
+			std::vector<SlabStats> stats = sim.GetSlabStats();
+			for (unsigned int s = 0; s < slabCount; s++)
+			{
+				slabParticles[s] += stats[s].particles;
+				slabHalo[s] += stats[s].haloParticles;
+				slabBusy[s] += stats[s].busyMs;
+			}
+		}
+
+		FILE* file = OpenOutput(options);
+		if (!file)
+			return 1;
+
+		// Busiest slab against the average, 1 when the work is split perfectly
+		double totalBusy = 0.0;
+		double mostBusy = 0.0;
+		for (double busy : slabBusy)
+		{
+			totalBusy += busy;
+			mostBusy = std::max(mostBusy, busy);
+		}
+
+		Summary step = Summarise(stepSamples);
+
+		std::fprintf(file, "{\n");
+		std::fprintf(file, "  \"scenario\": \"%s\",\n", scenarioName);
+		std::fprintf(file, "  \"particles\": %u,\n", sim.GetParticleCount());
+		std::fprintf(file, "  \"steps\": %u,\n", options.steps);
+		std::fprintf(file, "  \"warmup_steps\": %u,\n", options.warmupSteps);
+		std::fprintf(file, "  \"slabs\": %u,\n", slabCount);
+		std::fprintf(file, "  \"threads\": %u,\n", sim.GetThreadCount());
+		std::fprintf(file, "  \"threads_per_slab\": %u,\n", sim.GetThreadsPerSlab());
+		std::fprintf(file, "  \"pinned\": %s,\n", sim.ArePinned() ? "true" : "false");
+		std::fprintf(file, "  \"delta_time\": %.6f,\n", options.deltaTime);
+		std::fprintf(file, "  \"adaptive\": %s,\n", options.adaptive ? "true" : "false");
+		std::fprintf(file, "  \"imbalance\": %.3f,\n", totalBusy > 0.0 ? mostBusy * slabCount / totalBusy : 1.0);
+		std::fprintf(file, "  \"steps_per_second\": %.3f,\n", step.mean > 0.0 ? 1000.0 / step.mean : 0.0);
+
+		// Means over the timed steps
+		std::fprintf(file, "  \"slab_particles\": [");
+		for (unsigned int s = 0; s < slabCount; s++)
+			std::fprintf(file, "%s%.1f", s > 0 ? ", " : "", slabParticles[s] / options.steps);
+		std::fprintf(file, "],\n");
+		std::fprintf(file, "  \"slab_halo_particles\": [");
+		for (unsigned int s = 0; s < slabCount; s++)
+			std::fprintf(file, "%s%.1f", s > 0 ? ", " : "", slabHalo[s] / options.steps);
+		std::fprintf(file, "],\n");
+
+		std::fprintf(file, "  \"stages\": {\n");
+		for (unsigned int stage = 0; stage < DOMAIN_STAGE_COUNT; stage++)
+			WriteSummary(file, GetDomainStageName(static_cast<DomainStage>(stage)), Summarise(stageSamples[stage]), false);
+		WriteSummary(file, "Step", step, true);
+		std::fprintf(file, "  }\n");
+		std::fprintf(file, "}\n");
+
+		if (file != stdout)
+			std::fclose(file);
+
+		return 0;
+	}
+	// What every rank sends rank 0 at the end, means over the timed steps
+	struct RankResult
+	{
+		double particles = 0.0;
+		double haloParticles = 0.0;
+		double stepMs = 0.0;
+		double transportMs = 0.0;
+		double bytesSent = 0.0;
+	};
+
+	// Weak scaling scene: every rank starts with a block of --particles filling its own slab of the tank from edge to
+	// edge, which widens with the rank count so each rank has the same space and work. The columns next to a slab
+	// boundary are half a radius from it, so halos are exchanged from the first step.
+	void AddRankBlock(SPHDistributed& sim, unsigned int particles, float minX)
+	{
+		constexpr int blockX = 32;
+		constexpr int blockZ = 16;
+		float spacing = SMOOTHING_RADIUS;
+		float slabWidth = -2.0f * minX / sim.GetRankCount();
+		float blockMinX = minX + slabWidth * sim.GetRank() + (slabWidth - blockX * spacing) * 0.5f;
+		float blockMinZ = -0.5f * blockZ * spacing;
+
+		SPHSettings settings;
+		std::vector<ParticleState> states(particles);
+		std::vector<uint32_t> ids(particles);
+		for (unsigned int i = 0; i < particles; i++)
+		{
+			int x = i % blockX;
+			int z = (i / blockX) % blockZ;
+			int y = i / (blockX * blockZ);
+
+			states[i] = {};
+			states[i].position = { blockMinX + (x + 0.5f) * spacing, settings.minY + (y + 0.5f) * spacing, blockMinZ + (z + 0.5f) * spacing };
+			ids[i] = sim.GetRank() * particles + i;
+		}
+		sim.AddParticles(states, ids);
+	}
+
+	int RunRank(const BenchmarkOptions& options, unsigned int rank)
+	{
+		SocketTransport transport;
+		if (!transport.Connect(rank, options.ranks, static_cast<uint16_t>(options.port)))
+		{
+			std::fprintf(stderr, "Rank %u can't connect to the other ranks on ports %u to %u\n", rank, options.port, options.port + options.ranks - 1);
+			return 1;
+		}
+
+		// The ranks share the machine unless told otherwise
+		unsigned int threads = options.threads;
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency() / options.ranks);
+
+		SPHDistributed sim(transport, threads);
+		float minX = -0.5f * options.ranks * 32.0f * SMOOTHING_RADIUS;
+		float minZ = wallMinZ;
+		AddRankBlock(sim, options.particles, minX);
+
+		AdaptiveTimestepSettings adaptiveSettings;
+		adaptiveSettings.enabled = options.adaptive;
+		sim.SetAdaptiveTimestep(adaptiveSettings);
+
+		for (unsigned int step = 0; step < options.warmupSteps; step++)
+			sim.Advance(options.deltaTime, minX, minZ);
+
+		std::vector<std::vector<double>> stageSamples(DOMAIN_STAGE_COUNT);
+		std::vector<double> transportSamples;
+		std::vector<double> stepSamples;
+		stepSamples.reserve(options.steps);
+
+		RankResult result;
+		uint64_t bytesBefore = transport.GetBytesSent();
+		for (unsigned int step = 0; step < options.steps && sim.IsConnected(); step++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			sim.Advance(options.deltaTime, minX, minZ);
+			stepSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+			const std::array<double, DOMAIN_STAGE_COUNT>& stageTimes = sim.GetStageTimes();
+			for (unsigned int stage = 0; stage < DOMAIN_STAGE_COUNT; stage++)
+				stageSamples[stage].push_back(stageTimes[stage]);
+			transportSamples.push_back(sim.GetTransportMs());
+
+			result.particles += sim.GetParticleCount();
+			result.haloParticles += sim.GetHaloCount();
+			result.transportMs += sim.GetTransportMs();
+		}
+
+		if (!sim.IsConnected())
+		{
+			std::fprintf(stderr, "Rank %u lost its connection to the other ranks\n", rank);
+			return 1;
+		}
+
+		Summary step = Summarise(stepSamples);
+		result.particles /= options.steps;
+		result.haloParticles /= options.steps;
+		result.transportMs /= options.steps;
+		result.stepMs = step.mean;
+		result.bytesSent = static_cast<double>(transport.GetBytesSent() - bytesBefore) / options.steps;
+
+		// Rank 0 collects everyone's results and reports them
+		std::vector<unsigned int> peers;
+		std::vector<std::vector<uint8_t>> send;
+		std::vector<std::vector<uint8_t>> receive;
+		if (rank > 0)
+		{
+			peers.push_back(0);
+			send.emplace_back(sizeof(RankResult));
+			std::memcpy(send[0].data(), &result, sizeof(RankResult));
+			return transport.Exchange(peers, send, receive) ? 0 : 1;
+		}
+
+		for (unsigned int peer = 1; peer < options.ranks; peer++)
+			peers.push_back(peer);
+		send.resize(peers.size());
+		if (!transport.Exchange(peers, send, receive))
+		{
+			std::fprintf(stderr, "Rank 0 lost its connection to the other ranks\n");
+			return 1;
+		}
+
+		std::vector<RankResult> results(1, result);
+		for (const std::vector<uint8_t>& message : receive)
+		{
+			RankResult peerResult;
+			if (message.size() == sizeof(RankResult))
+				std::memcpy(&peerResult, message.data(), sizeof(RankResult));
+			results.push_back(peerResult);
+		}
+
+		FILE* file = OpenOutput(options);
+		if (!file)
+			return 1;
+
+		double totalParticles = 0.0;
+		double slowestStep = 0.0;
+		for (const RankResult& rankResult : results)
+		{
+			totalParticles += rankResult.particles;
+			slowestStep = std::max(slowestStep, rankResult.stepMs);
+		}
+
+		auto writeRankArray = [&](const char* name, double RankResult::* field, const char* format, bool last)
+		{
+			std::fprintf(file, "  \"%s\": [", name);
+			for (size_t r = 0; r < results.size(); r++)
+			{
+				std::fprintf(file, r > 0 ? ", " : "");
+				std::fprintf(file, format, results[r].*field);
+			}
+			std::fprintf(file, "]%s\n", last ? "" : ",");
+		};
+
+		std::fprintf(file, "{\n");
+		std::fprintf(file, "  \"scenario\": \"weak_scaling\",\n");
+		std::fprintf(file, "  \"ranks\": %u,\n", options.ranks);
+		std::fprintf(file, "  \"particles_per_rank\": %u,\n", options.particles);
+		std::fprintf(file, "  \"particles\": %.0f,\n", totalParticles);
+		std::fprintf(file, "  \"steps\": %u,\n", options.steps);
+		std::fprintf(file, "  \"warmup_steps\": %u,\n", options.warmupSteps);
+		std::fprintf(file, "  \"threads_per_rank\": %u,\n", sim.GetThreadCount());
+		std::fprintf(file, "  \"delta_time\": %.6f,\n", options.deltaTime);
+		std::fprintf(file, "  \"adaptive\": %s,\n", options.adaptive ? "true" : "false");
+		// Ranks run in lockstep, so the slowest one sets the pace
+		std::fprintf(file, "  \"steps_per_second\": %.3f,\n", slowestStep > 0.0 ? 1000.0 / slowestStep : 0.0);
+		std::fprintf(file, "  \"particle_steps_per_second\": %.0f,\n", slowestStep > 0.0 ? totalParticles * 1000.0 / slowestStep : 0.0);
+		writeRankArray("rank_particles", &RankResult::particles, "%.1f", false);
+		writeRankArray("rank_halo_particles", &RankResult::haloParticles, "%.1f", false);
+		writeRankArray("rank_step_ms", &RankResult::stepMs, "%.4f", false);
+		writeRankArray("rank_transport_ms", &RankResult::transportMs, "%.4f", false);
+		writeRankArray("rank_bytes_sent", &RankResult::bytesSent, "%.0f", false);
+
+		// Rank 0's own
+		std::fprintf(file, "  \"stages\": {\n");
+		for (unsigned int stage = 0; stage < DOMAIN_STAGE_COUNT; stage++)
+			WriteSummary(file, GetDomainStageName(static_cast<DomainStage>(stage)), Summarise(stageSamples[stage]), false);
+		WriteSummary(file, "Transport", Summarise(transportSamples), false);
+		WriteSummary(file, "Step", step, true);
+		std::fprintf(file, "  }\n");
+		std::fprintf(file, "}\n");
+
+		if (file != stdout)
+			std::fclose(file);
+
+		return 0;
+	}
+
+	// Without --rank the other ranks are forked off this process, which becomes rank 0
+	int RunDistributed(const BenchmarkOptions& options)
+	{
+		if (options.slabs > 0 || options.deterministic || !options.tracePath.empty() || !options.recordPath.empty() ||
+			!options.loadCheckpointPath.empty() || !options.saveCheckpointPath.empty())
+		{
+			std::fprintf(stderr, "--ranks can't be combined with --slabs, --deterministic, --trace, --record or checkpoints\n");
+			return 1;
+		}
+
+		if (options.rank >= 0)
+			return RunRank(options, static_cast<unsigned int>(options.rank));
+
+#if defined(_WIN32)
+		std::fprintf(stderr, "Start every rank with --rank on Windows\n");
+		return 1;
+#else
+		std::vector<pid_t> children;
+		for (unsigned int rank = 1; rank < options.ranks; rank++)
+		{
+			pid_t child = fork();
+			if (child == 0)
+				std::exit(RunRank(options, rank));
+
+			if (child < 0)
+			{
+				std::fprintf(stderr, "Can't start rank %u\n", rank);
+				for (pid_t started : children)
+					kill(started, SIGTERM);
+				return 1;
+			}
+			children.push_back(child);
+		}
+
+		int result = RunRank(options, 0);
+		for (pid_t child : children)
+		{
+			int status = 0;
+			if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				result = 1;
+		}
+		return result;
+#endif
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (!options.replayPath.empty())
+		return RunReplay(options);
+
+	// Before anything starts a thread, the ranks may be forked
+	if (options.ranks > 0)
+		return RunDistributed(options);
+
+	const Scenario* scenario = FindScenario(options.scenario);
+	if (!scenario)
+	{
+		std::fprintf(stderr, "Unknown scenario %s\n", options.scenario.c_str());
+		PrintUsage();
+		return 1;
+	}
+
+	// Only the cube scenario uses the constructor's starting particles, the others emit their own.
+	// A checkpoint replaces the scenario altogether.
+	bool loadCheckpoint = !options.loadCheckpointPath.empty();
+	bool startingCube = scenario->setup == SetupCube && !loadCheckpoint;
+
+	// Before the simulation starts its workers, so they inherit the counters
+	CacheCounters cacheCounters;
+	SPHCPU sim(startingCube ? options.particles : 0, options.threads);
+	sim.SetDeterministic(options.deterministic);
+	if (options.sparseVoxelSize > 0.0f)
+		sim.SetSparseVoxels(true, options.sparseVoxelSize);
+	sim.SetParticleReorder(options.reorder, options.reorderInterval);
+	sim.SetSIMDLevel(options.simdLevel);
+	sim.SetGridMode(options.gridMode);
+	sim.SetSortMode(options.sortMode);
+	sim.SetNeighbourListSkin(options.neighbourSkin);
+
+	float minX = wallMinX;
+	float minZ = wallMinZ;
+	double checkpointLoadMs = 0.0;
+	if (loadCheckpoint)
+	{
+		auto start = std::chrono::steady_clock::now();
+		if (!sim.LoadCheckpoint(options.loadCheckpointPath, &minX, &minZ))
+		{
+			std::fprintf(stderr, "Can't load checkpoint %s\n", options.loadCheckpointPath.c_str());
+			return 1;
+		}
+		checkpointLoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	else
+	{
+		scenario->setup(sim, options.particles, options);
+	}
+
+	if (options.slabs > 0)
+		return RunSlabs(options, scenario->name, sim, minX, minZ);
+
+	AdaptiveTimestepSettings adaptiveSettings;
+	adaptiveSettings.enabled = options.adaptive;
+	sim.SetAdaptiveTimestep(adaptiveSettings);
+
+	for (unsigned int step = 0; step < options.warmupSteps; step++)
+		sim.Advance(options.deltaTime, minX, minZ);
+
+	if (options.scalarField)
+		return RunScalarField(options, scenario->name, sim);
+
+	if (options.meshIsoLevel > 0.0f)
+		return RunMesh(options, scenario->name, sim);
+
+	ChromeTraceExporter traceExporter;
+	std::vector<ProfileEvent> traceEvents;
+	if (!options.tracePath.empty())
+	{
+		if (!traceExporter.Start(options.tracePath))
+		{
+			std::fprintf(stderr, "Can't open %s\n", options.tracePath.c_str());
+			return 1;
+		}
+
+		Profiler::SetThreadName("Main");
+		Profiler::SetEnabled(true);
+	}
+
+	FrameRecorder recorder;
+	if (!options.recordPath.empty() && !recorder.Start(options.recordPath, sim.GetSmoothingRadius()))
+	{
+		std::fprintf(stderr, "Can't open %s\n", options.recordPath.c_str());
+		return 1;
+	}
+
+	std::vector<std::vector<double>> stageSamples(SPH_STAGE_COUNT);
+	std::vector<double> captureSamples;
+	std::vector<double> stepSamples;
+	stepSamples.reserve(options.steps);
+
+	unsigned int totalSubsteps = 0;
+	unsigned int mostSubsteps = 0;
+	double droppedTime = 0.0;
+
+	// Rebuilds of the timed steps only
+	unsigned int warmupRebuilds = sim.GetNeighbourListStats().rebuildCount;
+
+	cacheCounters.Start();
+	for (unsigned int step = 0; step < options.steps; step++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		sim.Advance(options.deltaTime, minX, minZ);
+		if (recorder.IsRecording())
+		{
+			auto captureStart = std::chrono::steady_clock::now();
+			recorder.Capture(sim, sim.GetStepIndex(), sim.GetSimulatedTime());
+			captureSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - captureStart).count());
+		}
+		stepSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+		const AdaptiveTimestepStats& adaptiveStats = sim.GetAdaptiveTimestepStats();
+		totalSubsteps += adaptiveStats.substeps;
+		mostSubsteps = std::max(mostSubsteps, adaptiveStats.substeps);
+		droppedTime += adaptiveStats.droppedTime;
+
+		const std::array<double, SPH_STAGE_COUNT>& stageTimes = sim.GetStageTimes();
+		for (unsigned int stage = 0; stage < SPH_STAGE_COUNT; stage++)
+			stageSamples[stage].push_back(stageTimes[stage]);
+
+		if (traceExporter.IsCapturing())
+		{
+			traceEvents.clear();
+			Profiler::Collect(traceEvents);
+			traceExporter.Submit(traceEvents);
+			Profiler::BeginFrame();
+		}
+	}
+
+	cacheCounters.Stop();
+
+	traceExporter.Stop();
+	bool recordingWritten = recorder.Stop();
+	FrameRecorderStats recordingStats = recorder.GetStats();
+	if (!recordingWritten)
+	{
+		std::fprintf(stderr, "Can't write recording %s: %s\n", options.recordPath.c_str(), std::strerror(recordingStats.writeError));
+		return 1;
+	}
+
+	double checkpointSaveMs = 0.0;
+	if (!options.saveCheckpointPath.empty())
+	{
+		auto start = std::chrono::steady_clock::now();
+		if (!sim.SaveCheckpoint(options.saveCheckpointPath, minX, minZ))
+		{
+			std::fprintf(stderr, "Can't save checkpoint %s\n", options.saveCheckpointPath.c_str());
+			return 1;
+		}
+		checkpointSaveMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	FILE* file = OpenOutput(options);
+	if (!file)
+		return 1;
+
+	Summary step = Summarise(stepSamples);
+	NeighbourListStats neighbourStats = sim.GetNeighbourListStats();
+
+	std::fprintf(file, "{\n");
+	std::fprintf(file, "  \"scenario\": \"%s\",\n", scenario->name);
+	std::fprintf(file, "  \"particles\": %u,\n", options.particles);
+	std::fprintf(file, "  \"final_particles\": %u,\n", sim.GetParticleCount());
+	std::fprintf(file, "  \"steps\": %u,\n", options.steps);
+	std::fprintf(file, "  \"warmup_steps\": %u,\n", options.warmupSteps);
+	std::fprintf(file, "  \"threads\": %u,\n", sim.GetThreadCount());
+	std::fprintf(file, "  \"simd_requested\": \"%s\",\n", GetChoiceName(simdLevels, options.simdLevel));
+	std::fprintf(file, "  \"simd\": \"%s\",\n", GetSIMDLevelName(sim.GetSIMDLevel()));
+	std::fprintf(file, "  \"delta_time\": %.6f,\n", options.deltaTime);
+	std::fprintf(file, "  \"adaptive\": %s,\n", options.adaptive ? "true" : "false");
+	std::fprintf(file, "  \"mean_substeps\": %.3f,\n", static_cast<double>(totalSubsteps) / options.steps);
+	std::fprintf(file, "  \"max_substeps\": %u,\n", mostSubsteps);
+	std::fprintf(file, "  \"dropped_time\": %.6f,\n", droppedTime);
+	std::fprintf(file, "  \"deterministic\": %s,\n", options.deterministic ? "true" : "false");
+	std::fprintf(file, "  \"grid\": \"%s\",\n", GetChoiceName(gridModes, sim.GetGridMode()));
+	std::fprintf(file, "  \"sort\": \"%s\",\n", GetChoiceName(sortModes, sim.GetSortMode()));
+	std::fprintf(file, "  \"neighbour_skin\": %.4f,\n", sim.GetNeighbourListSkin());
+	std::fprintf(file, "  \"neighbour_list_rebuilds\": %u,\n", neighbourStats.rebuildCount - warmupRebuilds);
+	std::fprintf(file, "  \"neighbour_list_entries\": %zu,\n", neighbourStats.entryCount);
+	std::fprintf(file, "  \"neighbour_list_bytes\": %zu,\n", neighbourStats.memoryBytes);
+	std::fprintf(file, "  \"reorder\": \"%s\",\n", GetChoiceName(particleOrders, sim.GetParticleOrder()));
+	std::fprintf(file, "  \"reorder_interval\": %u,\n", options.reorderInterval);
+	if (cacheCounters.IsAvailable())
+	{
+		std::fprintf(file, "  \"cache_misses\": %" PRIu64 ",\n", cacheCounters.GetCacheMisses());
+		std::fprintf(file, "  \"cache_references\": %" PRIu64 ",\n", cacheCounters.GetCacheReferences());
+	}
+	else
+	{
+		std::fprintf(file, "  \"cache_misses\": null,\n");
+		std::fprintf(file, "  \"cache_references\": null,\n");
+	}
+	std::fprintf(file, "  \"checksum\": \"%016" PRIx64 "\",\n", sim.ComputeStateChecksum());
+	std::fprintf(file, "  \"sparse_voxels\": %s,\n", sim.HasSparseVoxels() ? "true" : "false");
+	std::fprintf(file, "  \"voxel_size\": %.4f,\n", sim.HasSparseVoxels() ? sim.GetBrickVoxels().GetVoxelSize() : VOXEL_SIZE);
+	std::fprintf(file, "  \"voxel_bricks\": %u,\n", sim.GetBrickVoxels().GetBrickCount());
+	std::fprintf(file, "  \"voxel_memory_bytes\": %zu,\n", sim.GetVoxelMemoryBytes());
+	std::fprintf(file, "  \"checkpoint_load_ms\": %.3f,\n", checkpointLoadMs);
+	std::fprintf(file, "  \"checkpoint_save_ms\": %.3f,\n", checkpointSaveMs);
+	std::fprintf(file, "  \"recorded_frames\": %" PRIu64 ",\n", recordingStats.recordedFrames);
+	std::fprintf(file, "  \"dropped_frames\": %" PRIu64 ",\n", recordingStats.droppedFrames);
+	std::fprintf(file, "  \"recording_bytes\": %" PRIu64 ",\n", recordingStats.bytesWritten);
+	std::fprintf(file, "  \"recording_ratio\": %.3f,\n", recordingStats.bytesWritten > 0 ? static_cast<double>(recordingStats.rawBytes) / recordingStats.bytesWritten : 0.0);
+	std::fprintf(file, "  \"steps_per_second\": %.3f,\n", step.mean > 0.0 ? 1000.0 / step.mean : 0.0);
+	std::fprintf(file, "  \"stages\": {\n");
+
+	for (unsigned int stage = 0; stage < SPH_STAGE_COUNT; stage++)
+		WriteSummary(file, GetSPHStageName(static_cast<SPHStage>(stage)), Summarise(stageSamples[stage]), false);
+	if (!captureSamples.empty())
+		WriteSummary(file, "Capture", Summarise(captureSamples), false);
+	WriteSummary(file, "Step", step, true);
+
+	std::fprintf(file, "  }\n");
+	std::fprintf(file, "}\n");
+
+	if (file != stdout)
+		std::fclose(file);
+
+	return 0;
+}
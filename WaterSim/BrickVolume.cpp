@@ -0,0 +1,150 @@
+#include "BrickVolume.h"
+
+#include <algorithm>
+#include <cmath>
+
+BrickVolume::BrickVolume(int sizeX, int sizeY, int sizeZ, float voxelSize, const Float3& origin)
+{
+	Reset(sizeX, sizeY, sizeZ, voxelSize, origin);
+}
+
+void BrickVolume::Reset(int newSizeX, int newSizeY, int newSizeZ, float newVoxelSize, const Float3& newOrigin)
+{
+	sizeX = std::max(newSizeX, 0);
+	sizeY = std::max(newSizeY, 0);
+	sizeZ = std::max(newSizeZ, 0);
+	voxelSize = newVoxelSize;
+	origin = newOrigin;
+
+	bricksX = (sizeX + BRICK_SIZE - 1) / BRICK_SIZE;
+	bricksY = (sizeY + BRICK_SIZE - 1) / BRICK_SIZE;
+	bricksZ = (sizeZ + BRICK_SIZE - 1) / BRICK_SIZE;
+
+	brickTable.assign(size_t(bricksX) * bricksY * bricksZ, invalidBrick);
+	brickCount = 0;
+}
+
+void BrickVolume::Clear()
+{
+	for (unsigned int brick = 0; brick < brickCount; brick++)
+	{
+		const Int3& coord = brickCoords[brick];
+		brickTable[coord.x + bricksX * (coord.y + bricksY * coord.z)] = invalidBrick;
+	}
+	brickCount = 0;
+}
+
+uint32_t BrickVolume::FindBrick(int brickX, int brickY, int brickZ) const
+{
+	if (brickX < 0 || brickY < 0 || brickZ < 0 || brickX >= bricksX || brickY >= bricksY || brickZ >= bricksZ)
+		return invalidBrick;
+
+	return brickTable[brickX + bricksX * (brickY + bricksY * brickZ)];
+}
+
+uint32_t BrickVolume::AddBrick(int brickX, int brickY, int brickZ)
+{
+	uint32_t& entry = brickTable[brickX + bricksX * (brickY + bricksY * brickZ)];
+	if (entry != invalidBrick)
+		return entry;
+
+	// Bricks freed by Clear are reused before the storage grows
+	entry = brickCount++;
+	if (entry < brickCoords.size())
+	{
+		brickCoords[entry] = { brickX, brickY, brickZ };
+		std::fill_n(GetBrickData(entry), BRICK_VOXELS, 0.0f);
+	}
+	else
+	{
+		brickCoords.push_back({ brickX, brickY, brickZ });
+		brickData.resize(brickData.size() + BRICK_VOXELS, 0.0f);
+	}
+	return entry;
+}
+
+float BrickVolume::GetVoxel(int x, int y, int z) const
+{
+	if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ)
+		return 0.0f;
+
+	uint32_t brick = brickTable[x / BRICK_SIZE + bricksX * (y / BRICK_SIZE + bricksY * (z / BRICK_SIZE))];
+	if (brick == invalidBrick)
+		return 0.0f;
+
+	return GetBrickData(brick)[x % BRICK_SIZE + BRICK_SIZE * (y % BRICK_SIZE + BRICK_SIZE * (z % BRICK_SIZE))];
+}
+
+void BrickVolume::Splat(const Float3& position, float smoothingRadius)
+{
+	// Same arithmetic as SplatDensityVoxels, so at VOXEL_SIZE the voxels come out bit identical to the dense grid
+	int baseX = static_cast<int>(std::floor((position.x - origin.x) / voxelSize));
+	int baseY = static_cast<int>(std::floor((position.y - origin.y) / voxelSize));
+	int baseZ = static_cast<int>(std::floor((position.z - origin.z) / voxelSize));
+
+	// Voxel centres up to half a voxel past the radius can still be inside it. Only the shader's own voxel size keeps
+	// its 3x3x3 footprint, which is what the dense grid matches.
+	int reach = voxelSize == VOXEL_SIZE ? 1 : static_cast<int>(std::ceil(smoothingRadius / voxelSize));
+
+	for (int z = -reach; z <= reach; z++)
+		for (int y = -reach; y <= reach; y++)
+			for (int x = -reach; x <= reach; x++)
+			{
+				int cellX = baseX + x;
+				int cellY = baseY + y;
+				int cellZ = baseZ + z;
+
+				if (cellX < 0 || cellY < 0 || cellZ < 0 || cellX >= sizeX || cellY >= sizeY || cellZ >= sizeZ)
+					continue;
+
+				Float3 voxelPos = { origin.x + (cellX + 0.5f) * voxelSize, origin.y + (cellY + 0.5f) * voxelSize, origin.z + (cellZ + 0.5f) * voxelSize };
+				float dx = voxelPos.x - position.x;
+				float dy = voxelPos.y - position.y;
+				float dz = voxelPos.z - position.z;
+				float dist = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+				if (dist < smoothingRadius)
+				{
+					uint32_t brick = AddBrick(cellX / BRICK_SIZE, cellY / BRICK_SIZE, cellZ / BRICK_SIZE);
+					int index = cellX % BRICK_SIZE + BRICK_SIZE * (cellY % BRICK_SIZE + BRICK_SIZE * (cellZ % BRICK_SIZE));
+					GetBrickData(brick)[index] += 1.0f - (dist / smoothingRadius);
+				}
+			}
+}
+
+void BrickVolume::AddBricksOf(const BrickVolume& other)
+{
+	for (unsigned int brick = 0; brick < other.brickCount; brick++)
+	{
+		const Int3& coord = other.brickCoords[brick];
+		AddBrick(coord.x, coord.y, coord.z);
+	}
+}
+
+void BrickVolume::CopyToDense(std::vector<float>& outVoxels) const
+{
+	outVoxels.assign(size_t(sizeX) * sizeY * sizeZ, 0.0f);
+
+	for (unsigned int brick = 0; brick < brickCount; brick++)
+	{
+		const Int3& coord = brickCoords[brick];
+		const float* data = GetBrickData(brick);
+
+		// Edge bricks stick out of the volume
+		int countX = std::min(BRICK_SIZE, sizeX - coord.x * BRICK_SIZE);
+		int countY = std::min(BRICK_SIZE, sizeY - coord.y * BRICK_SIZE);
+		int countZ = std::min(BRICK_SIZE, sizeZ - coord.z * BRICK_SIZE);
+
+		for (int z = 0; z < countZ; z++)
+			for (int y = 0; y < countY; y++)
+			{
+				size_t dense = (coord.x * BRICK_SIZE) + size_t(sizeX) * ((coord.y * BRICK_SIZE + y) + size_t(sizeY) * (coord.z * BRICK_SIZE + z));
+				std::copy_n(data + BRICK_SIZE * (y + BRICK_SIZE * z), countX, outVoxels.data() + dense);
+			}
+	}
+}
+
+size_t BrickVolume::GetMemoryBytes() const
+{
+	return brickTable.capacity() * sizeof(uint32_t) + brickCoords.capacity() * sizeof(Int3) + brickData.capacity() * sizeof(float);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "SPHCommon.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sparse voxel volume made of BRICK_SIZE^3 bricks, a brick only takes memory once something is written into it.
+// Memory follows the fluid instead of the box, so voxel sizes well below VOXEL_SIZE stay affordable.
+// Voxels are x-fastest within a brick. Voxel (x, y, z) is sampled at origin + (x, y, z) * voxelSize plus half a voxel
+// like BuildDensityGrid, and voxels of missing bricks read 0.
+class BrickVolume
+{
+public:
+	static constexpr int BRICK_SIZE = 8;
+	static constexpr int BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+	static constexpr uint32_t invalidBrick = 0xFFFFFFFF;
+
+	BrickVolume() = default;
+	BrickVolume(int sizeX, int sizeY, int sizeZ, float voxelSize, const Float3& origin = { 0.0f, 0.0f, 0.0f });
+
+	// Changes the shape, which empties the volume
+	void Reset(int sizeX, int sizeY, int sizeZ, float voxelSize, const Float3& origin = { 0.0f, 0.0f, 0.0f });
+
+	// Empties the volume, the bricks' memory is kept for the next fill
+	void Clear();
+
+	int GetSizeX() const { return sizeX; }
+	int GetSizeY() const { return sizeY; }
+	int GetSizeZ() const { return sizeZ; }
+	float GetVoxelSize() const { return voxelSize; }
+	const Float3& GetOrigin() const { return origin; }
+
+	int GetBrickCountX() const { return bricksX; }
+	int GetBrickCountY() const { return bricksY; }
+	int GetBrickCountZ() const { return bricksZ; }
+
+	// Allocated bricks are numbered 0 to GetBrickCount() - 1 in allocation order
+	unsigned int GetBrickCount() const { return brickCount; }
+	const Int3& GetBrickCoord(uint32_t brick) const { return brickCoords[brick]; }
+
+	// Brick at brick coordinates, invalidBrick when it isn't allocated or is outside the volume
+	uint32_t FindBrick(int brickX, int brickY, int brickZ) const;
+
+	// Allocates a zeroed brick unless there is one already. Moves the brick data, pointers from GetBrickData go stale.
+	uint32_t AddBrick(int brickX, int brickY, int brickZ);
+
+	float* GetBrickData(uint32_t brick) { return brickData.data() + size_t(brick) * BRICK_VOXELS; }
+	const float* GetBrickData(uint32_t brick) const { return brickData.data() + size_t(brick) * BRICK_VOXELS; }
+
+	float GetVoxel(int x, int y, int z) const;
+
+	// Adds the BuildDensityGrid contribution of a particle, SplatDensityVoxels at any voxel size.
+	// The footprint reaches ceil(smoothingRadius / voxelSize) voxels either side, except the shader's 3x3x3 at VOXEL_SIZE.
+	void Splat(const Float3& position, float smoothingRadius);
+
+	// Allocates every brick other has, so another pass can add other's bricks to these without allocating
+	void AddBricksOf(const BrickVolume& other);
+
+	// sizeX * sizeY * sizeZ voxels, x fastest, laid out like SPHCPU::GetVoxels
+	void CopyToDense(std::vector<float>& outVoxels) const;
+
+	// Capacity of the brick table and the bricks
+	size_t GetMemoryBytes() const;
+
+private:
+	int sizeX = 0;
+	int sizeY = 0;
+	int sizeZ = 0;
+	float voxelSize = VOXEL_SIZE;
+	Float3 origin = { 0.0f, 0.0f, 0.0f };
+
+	int bricksX = 0;
+	int bricksY = 0;
+	int bricksZ = 0;
+
+	std::vector<uint32_t> brickTable; // Brick of every brick coordinate, x fastest
+	std::vector<Int3> brickCoords;
+	std::vector<float> brickData;
+	unsigned int brickCount = 0; // Entries past it in brickCoords and brickData are kept for reuse
+};
@@ -0,0 +1,94 @@
+#include "CacheCounters.h"
+
+#if defined(__linux__)
+#include <cstring>
+#include <initializer_list>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+	int OpenHardwareCounter(uint64_t config)
+	{
+		perf_event_attr attributes;
+		std::memset(&attributes, 0, sizeof(attributes));
+		attributes.size = sizeof(attributes);
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.config = config;
+		attributes.disabled = 1;
+		attributes.inherit = 1;
+		// perf_event_paranoid 2 (the usual default) only allows user space counting
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+
+		return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+	}
+
+	uint64_t ReadCounter(int fd)
+	{
+		uint64_t value = 0;
+		if (read(fd, &value, sizeof(value)) != sizeof(value))
+			return 0;
+		return value;
+	}
+}
+
+CacheCounters::CacheCounters()
+{
+	missesFd = OpenHardwareCounter(PERF_COUNT_HW_CACHE_MISSES);
+	referencesFd = OpenHardwareCounter(PERF_COUNT_HW_CACHE_REFERENCES);
+}
+
+CacheCounters::~CacheCounters()
+{
+	if (missesFd >= 0)
+		close(missesFd);
+	if (referencesFd >= 0)
+		close(referencesFd);
+}
+
+void CacheCounters::Start()
+{
+	if (!IsAvailable())
+		return;
+
+	for (int fd : { missesFd, referencesFd })
+	{
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void CacheCounters::Stop()
+{
+	if (!IsAvailable())
+		return;
+
+	for (int fd : { missesFd, referencesFd })
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+	misses = ReadCounter(missesFd);
+	references = ReadCounter(referencesFd);
+}
+
+#else
+
+CacheCounters::CacheCounters()
+{
+}
+
+CacheCounters::~CacheCounters()
+{
+}
+
+void CacheCounters::Start()
+{
+}
+
+void CacheCounters::Stop()
+{
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+// Hardware cache miss / reference counts around a block of code, backed by perf_event_open on Linux.
+// Create it before the simulation so the JobSystem workers inherit the counters.
+// On other platforms, or machines without a usable PMU, IsAvailable() is false and the counts stay 0.
+class CacheCounters
+{
+public:
+	CacheCounters();
+	~CacheCounters();
+
+	CacheCounters(const CacheCounters&) = delete;
+	CacheCounters& operator=(const CacheCounters&) = delete;
+
+	bool IsAvailable() const { return missesFd >= 0 && referencesFd >= 0; }
+
+	// Start resets both counters, Stop latches them
+	void Start();
+	void Stop();
+
+	uint64_t GetCacheMisses() const { return misses; }
+	uint64_t GetCacheReferences() const { return references; }
+
+private:
+	int missesFd = -1;
+	int referencesFd = -1;
+
+	uint64_t misses = 0;
+	uint64_t references = 0;
+};
@@ -0,0 +1,101 @@
+#include "Checkpoint.h"
+#include "ParticleSoA.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace
+{
+	uint64_t AlignOffset(uint64_t offset)
+	{
+		return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+	}
+
+	bool WritePadding(FILE* file, uint64_t from, uint64_t to)
+	{
+		static const char zeros[CHECKPOINT_ALIGNMENT] = {};
+		return std::fwrite(zeros, 1, static_cast<size_t>(to - from), file) == to - from;
+	}
+}
+
+bool WriteCheckpoint(const std::string& path, CheckpointHeader& header, const void* const sections[CHECKPOINT_SECTION_COUNT])
+{
+	std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.headerSize = sizeof(CheckpointHeader);
+
+	uint64_t offset = AlignOffset(sizeof(CheckpointHeader));
+	for (CheckpointSectionEntry& section : header.sections)
+	{
+		section.offset = offset;
+		offset = AlignOffset(offset + section.size);
+	}
+
+	std::string temporaryPath = path + ".tmp";
+	FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	// Sections are large and written once, stdio's buffer would only add a copy
+	std::setvbuf(file, nullptr, _IONBF, 0);
+
+	bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	uint64_t position = sizeof(header);
+
+	for (unsigned int i = 0; i < CHECKPOINT_SECTION_COUNT && written; i++)
+	{
+		const CheckpointSectionEntry& section = header.sections[i];
+		written = WritePadding(file, position, section.offset);
+
+		if (written && section.size > 0)
+			written = std::fwrite(sections[i], 1, static_cast<size_t>(section.size), file) == section.size;
+
+		position = section.offset + section.size;
+	}
+
+	written = WritePadding(file, position, AlignOffset(position)) && written;
+	written = std::fclose(file) == 0 && written;
+
+	std::error_code error;
+	if (written)
+		std::filesystem::rename(temporaryPath, path, error);
+
+	if (!written || error)
+	{
+		std::filesystem::remove(temporaryPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+bool CheckpointFile::Open(const std::string& path)
+{
+	if (!file.Open(path))
+		return false;
+
+	const CheckpointHeader& header = GetHeader();
+	bool valid = file.Size() >= sizeof(CheckpointHeader) &&
+		std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 &&
+		header.version == CHECKPOINT_VERSION &&
+		header.headerSize == sizeof(CheckpointHeader) &&
+		header.particleCount <= header.particleCapacity &&
+		header.particleCapacity % ParticleSoA::SIMD_WIDTH == 0 &&
+		header.particleCount <= header.idCount &&
+		header.freeIdCount <= header.idCount - header.particleCount;
+
+	for (unsigned int i = 0; i < CHECKPOINT_SECTION_COUNT && valid; i++)
+	{
+		const CheckpointSectionEntry& section = header.sections[i];
+		valid = section.offset % CHECKPOINT_ALIGNMENT == 0 && section.offset <= file.Size() && section.size <= file.Size() - section.offset;
+	}
+
+	if (!valid)
+	{
+		file.Close();
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "SPHCommon.h"
+#include "MappedFile.h"
+
+#include <string>
+
+// Binary snapshot of the CPU simulation, written by SPHCPU::SaveCheckpoint and read back by SPHCPU::LoadCheckpoint.
+// A CheckpointHeader is followed by one section per CheckpointSection at the offsets the header lists. Sections
+// start on CHECKPOINT_ALIGNMENT boundaries and the particle attributes are padded to the particle store's capacity,
+// so a mapped file can back ParticleSoA's arrays directly. Files use the writer's byte order (little-endian on
+// every platform the project builds for), and readers reject any version other than their own.
+
+constexpr char CHECKPOINT_MAGIC[8] = { 'W', 'S', 'I', 'M', 'C', 'K', 'P', 'T' };
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr uint64_t CHECKPOINT_ALIGNMENT = 64;
+
+enum class CheckpointSection : uint32_t
+{
+	// particleCapacity floats each, in slot order
+	PositionX,
+	PositionY,
+	PositionZ,
+	VelocityX,
+	VelocityY,
+	VelocityZ,
+	Density,
+	NearDensity,
+
+	SlotToId, // particleCount uint32
+	FreeIds, // freeIdCount uint32, in the order they are reused
+	Emitters, // emitterCount ParticleEmitter
+	Sinks, // sinkCount ParticleSink
+
+	Count
+};
+
+constexpr unsigned int CHECKPOINT_SECTION_COUNT = static_cast<unsigned int>(CheckpointSection::Count);
+constexpr unsigned int CHECKPOINT_ATTRIBUTE_COUNT = static_cast<unsigned int>(CheckpointSection::NearDensity) + 1;
+
+struct CheckpointSectionEntry
+{
+	uint64_t offset; // From the start of the file
+	uint64_t size; // Bytes
+};
+
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+
+	uint64_t stepIndex; // Updates run so far, substeps included
+	double simulatedTime;
+
+	uint32_t particleCount;
+	uint32_t particleCapacity; // A multiple of ParticleSoA::SIMD_WIDTH
+	uint32_t idCount;
+	uint32_t freeIdCount;
+	uint32_t emitterCount;
+	uint32_t sinkCount;
+	uint32_t emitterRandomState;
+
+	// Collision walls passed to Update, the box is mirrored so the max walls are -wallMinX and -wallMinZ
+	float wallMinX;
+	float wallMinZ;
+
+	SPHSettings settings;
+
+	CheckpointSectionEntry sections[CHECKPOINT_SECTION_COUNT];
+};
+
+// Writes header and sections to path. The sections' offsets are filled in here, only their sizes have to be set.
+// The file is written next to path and renamed over it at the end, so a failed save leaves the old checkpoint intact.
+bool WriteCheckpoint(const std::string& path, CheckpointHeader& header, const void* const sections[CHECKPOINT_SECTION_COUNT]);
+
+// Mapped checkpoint with a validated header, every section is known to lie inside the file
+class CheckpointFile
+{
+public:
+	// False when the file can't be mapped, isn't a checkpoint, has another version or is truncated
+	bool Open(const std::string& path);
+
+	const CheckpointHeader& GetHeader() const { return *reinterpret_cast<const CheckpointHeader*>(file.Data()); }
+
+	// Points into the copy-on-write mapping, writes never reach the file
+	template <typename T>
+	T* GetSection(CheckpointSection section) const
+	{
+		return reinterpret_cast<T*>(file.Data() + GetHeader().sections[static_cast<uint32_t>(section)].offset);
+	}
+
+private:
+	MappedFile file;
+};
@@ -0,0 +1,169 @@
+#include "ChromeTraceExporter.h"
+
+namespace
+{
+	void AppendEscaped(std::string& out, const char* text)
+	{
+		for (const char* c = text; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				out += '\\';
+				out += *c;
+			}
+			else if (static_cast<unsigned char>(*c) < 0x20)
+			{
+				out += ' ';
+			}
+			else
+			{
+				out += *c;
+			}
+		}
+	}
+}
+
+ChromeTraceExporter::~ChromeTraceExporter()
+{
+	Stop();
+}
+
+bool ChromeTraceExporter::Start(const std::string& newPath)
+{
+	Stop();
+
+	file = std::fopen(newPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	path = newPath;
+	startNs = Profiler::Now();
+	eventCount = 0;
+	stopping = false;
+	queued.clear();
+	namedTracks.clear();
+	firstEvent = true;
+
+	std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+	writer = std::thread(&ChromeTraceExporter::WriterLoop, this);
+	return true;
+}
+
+void ChromeTraceExporter::Stop()
+{
+	if (!file)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_one();
+	writer.join();
+
+	std::fputs("\n]}\n", file);
+	std::fclose(file);
+	file = nullptr;
+}
+
+void ChromeTraceExporter::Submit(const std::vector<ProfileEvent>& events)
+{
+	if (!file || events.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const ProfileEvent& event : events)
+		{
+			// GPU frames resolve late and may have started before the capture
+			if (event.startNs >= startNs)
+				queued.push_back(event);
+		}
+	}
+	wakeCondition.notify_one();
+}
+
+void ChromeTraceExporter::WriterLoop()
+{
+	std::vector<ProfileEvent> batch;
+
+	while (true)
+	{
+		bool finished;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [this] { return stopping || !queued.empty(); });
+
+			batch.swap(queued);
+			finished = stopping;
+		}
+
+		WriteEvents(batch);
+		batch.clear();
+
+		if (finished)
+			return;
+	}
+}
+
+void ChromeTraceExporter::WriteEvents(const std::vector<ProfileEvent>& events)
+{
+	char number[128];
+
+	for (const ProfileEvent& event : events)
+	{
+		WriteTrackName(event.track);
+
+		line.clear();
+		line += firstEvent ? "" : ",\n";
+		firstEvent = false;
+
+		line += "{\"name\":\"";
+		AppendEscaped(line, event.name);
+
+		// Complete events in microseconds since the capture started, one Chrome thread per profiler track
+		std::snprintf(number, sizeof(number), "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu",
+			event.track, (event.startNs - startNs) * 1e-3, (event.endNs - event.startNs) * 1e-3,
+			static_cast<unsigned long long>(event.frame));
+		line += number;
+
+		if (event.argName)
+		{
+			line += ",\"";
+			AppendEscaped(line, event.argName);
+			std::snprintf(number, sizeof(number), "\":%lld", static_cast<long long>(event.argValue));
+			line += number;
+		}
+
+		line += "}}";
+		std::fwrite(line.data(), 1, line.size(), file);
+	}
+
+	eventCount.fetch_add(events.size(), std::memory_order_relaxed);
+}
+
+void ChromeTraceExporter::WriteTrackName(uint32_t track)
+{
+	if (track < namedTracks.size() && namedTracks[track])
+		return;
+
+	if (track >= namedTracks.size())
+		namedTracks.resize(track + 1, false);
+	namedTracks[track] = true;
+
+	line.clear();
+	line += firstEvent ? "" : ",\n";
+	firstEvent = false;
+
+	char number[96];
+	std::snprintf(number, sizeof(number), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", track);
+	line += number;
+	AppendEscaped(line, Profiler::GetTrackName(track).c_str());
+	line += "\"}}";
+
+	// Keeps tracks in creation order in the viewer rather than sorted by name
+	std::snprintf(number, sizeof(number), ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}", track, track);
+	line += number;
+
+	std::fwrite(line.data(), 1, line.size(), file);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Profiler.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams profiler events to a Chrome / Perfetto trace-event JSON file (chrome://tracing, ui.perfetto.dev).
+// Submit only appends to an in-memory batch, a background thread formats and writes it, so capturing
+// thousands of frames doesn't add file IO to the frames being measured.
+class ChromeTraceExporter
+{
+public:
+	ChromeTraceExporter() = default;
+	~ChromeTraceExporter();
+
+	ChromeTraceExporter(const ChromeTraceExporter&) = delete;
+	ChromeTraceExporter& operator=(const ChromeTraceExporter&) = delete;
+
+	// Opens path and starts the writer thread, events recorded before this are ignored
+	bool Start(const std::string& path);
+
+	// Writes whatever is still queued and closes the file
+	void Stop();
+
+	bool IsCapturing() const { return file != nullptr; }
+	const std::string& GetPath() const { return path; }
+
+	// Queues a batch of events, usually ProfilerHistory::GetCollected() once per frame
+	void Submit(const std::vector<ProfileEvent>& events);
+
+	// Events written so far
+	uint64_t GetEventCount() const { return eventCount.load(std::memory_order_relaxed); }
+
+private:
+	void WriterLoop();
+	void WriteEvents(const std::vector<ProfileEvent>& events);
+	void WriteTrackName(uint32_t track);
+
+	FILE* file = nullptr;
+	std::string path;
+	uint64_t startNs = 0;
+	std::atomic<uint64_t> eventCount{ 0 };
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::vector<ProfileEvent> queued;
+	bool stopping = false;
+
+	// Writer thread only
+	std::vector<bool> namedTracks;
+	std::string line;
+	bool firstEvent = true;
+};
@@ -0,0 +1,207 @@
+#include "FrameRecorder.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+
+namespace
+{
+	// Recordings pass 2 GB, further than a long reaches on Windows
+	bool SeekTo(FILE* file, uint64_t offset)
+	{
+#if defined(_WIN32)
+		return _fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0;
+#else
+		return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+	}
+}
+
+FrameRecorder::~FrameRecorder()
+{
+	Stop();
+}
+
+bool FrameRecorder::Start(const std::string& newPath, float smoothingRadius, uint32_t keyframeInterval)
+{
+	Stop();
+
+	file = std::fopen(newPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	path = newPath;
+	header = MakeRecordingHeader(smoothingRadius, keyframeInterval);
+	stopping = false;
+
+	freeFrames.clear();
+	queuedFrames.clear();
+	for (unsigned int i = 0; i < QUEUE_LENGTH; i++)
+		freeFrames.push_back(std::make_unique<PendingFrame>());
+
+	recordedFrames = 0;
+	droppedFrames = 0;
+	keyframes = 0;
+	bytesWritten = sizeof(RecordingHeader);
+	rawBytes = 0;
+	writeError = 0;
+	frameOffsets.clear();
+
+	// Rewritten with the frame count and index offset by Stop
+	if (std::fwrite(&header, sizeof(header), 1, file) != 1)
+	{
+		FailWrite();
+		std::fclose(file);
+		file = nullptr;
+		return false;
+	}
+
+	writer = std::thread(&FrameRecorder::WriterLoop, this);
+	return true;
+}
+
+bool FrameRecorder::Stop()
+{
+	if (!file)
+		return true;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_one();
+	writer.join();
+
+	// A failed frame may have left part of itself behind, the index goes over it right after the last whole frame
+	bool framesWritten = writeError == 0;
+	header.frameCount = frameOffsets.size();
+	header.indexOffset = bytesWritten;
+	bool indexWritten = SeekTo(file, header.indexOffset) &&
+		std::fwrite(frameOffsets.data(), sizeof(uint64_t), frameOffsets.size(), file) == frameOffsets.size() &&
+		SeekTo(file, 0) &&
+		std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+	// Buffered writes only reach the disk here
+	bool closed = std::fclose(file) == 0;
+	file = nullptr;
+
+	if (!indexWritten || !closed)
+		return FailWrite();
+	return framesWritten;
+}
+
+bool FrameRecorder::FailWrite()
+{
+	int expected = 0;
+	writeError.compare_exchange_strong(expected, errno != 0 ? errno : EIO);
+	return false;
+}
+
+bool FrameRecorder::Capture(SPHBackend& backend, uint64_t stepIndex, double simulatedTime)
+{
+	if (!file || writeError != 0)
+		return false;
+
+	PROFILE_SCOPE("Capture Frame");
+
+	std::unique_ptr<PendingFrame> frame;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!freeFrames.empty())
+		{
+			frame = std::move(freeFrames.back());
+			freeFrames.pop_back();
+		}
+	}
+
+	if (!frame)
+	{
+		droppedFrames.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	backend.ReadParticles(frame->particles);
+
+	uint32_t idCount = static_cast<uint32_t>(frame->particles.size());
+	frame->active.resize(idCount);
+	for (uint32_t id = 0; id < idCount; id++)
+		frame->active[id] = backend.IsParticleActive(id);
+
+	frame->stepIndex = stepIndex;
+	frame->simulatedTime = simulatedTime;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queuedFrames.push_back(std::move(frame));
+	}
+	wakeCondition.notify_one();
+	return true;
+}
+
+FrameRecorderStats FrameRecorder::GetStats() const
+{
+	FrameRecorderStats stats;
+	stats.recordedFrames = recordedFrames.load(std::memory_order_relaxed);
+	stats.droppedFrames = droppedFrames.load(std::memory_order_relaxed);
+	stats.keyframes = keyframes.load(std::memory_order_relaxed);
+	stats.bytesWritten = bytesWritten.load(std::memory_order_relaxed);
+	stats.rawBytes = rawBytes.load(std::memory_order_relaxed);
+	stats.writeError = writeError.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void FrameRecorder::WriterLoop()
+{
+	Profiler::SetThreadName("Frame Recorder");
+
+	while (true)
+	{
+		std::unique_ptr<PendingFrame> frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [this] { return stopping || !queuedFrames.empty(); });
+
+			if (queuedFrames.empty())
+				return;
+
+			frame = std::move(queuedFrames.front());
+			queuedFrames.pop_front();
+		}
+
+		WriteFrame(*frame);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		freeFrames.push_back(std::move(frame));
+	}
+}
+
+void FrameRecorder::WriteFrame(const PendingFrame& frame)
+{
+	PROFILE_SCOPE("Encode Frame");
+
+	// Frames queued behind a failed one are dropped, the index only covers whole frames
+	if (writeError != 0)
+		return;
+
+	uint32_t idCount = static_cast<uint32_t>(frame.particles.size());
+	QuantiseFrame(header, frame.particles.data(), frame.active.data(), idCount, frame.stepIndex, frame.simulatedTime, current);
+
+	bool keyframe = frameOffsets.size() % header.keyframeInterval == 0;
+
+	encoded.clear();
+	EncodeFrame(header, current, keyframe ? nullptr : &reference, encoded);
+	if (std::fwrite(encoded.data(), 1, encoded.size(), file) != encoded.size())
+	{
+		FailWrite();
+		return;
+	}
+
+	frameOffsets.push_back(bytesWritten.load(std::memory_order_relaxed));
+	std::swap(current, reference);
+
+	uint64_t activeCount = std::count(frame.active.begin(), frame.active.end(), uint8_t(1));
+	recordedFrames.fetch_add(1, std::memory_order_relaxed);
+	keyframes.fetch_add(keyframe ? 1 : 0, std::memory_order_relaxed);
+	bytesWritten.fetch_add(encoded.size(), std::memory_order_relaxed);
+	rawBytes.fetch_add(activeCount * sizeof(float) * 6, std::memory_order_relaxed);
+}
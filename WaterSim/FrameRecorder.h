@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Recording.h"
+#include "SPHBackend.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct FrameRecorderStats
+{
+	uint64_t recordedFrames = 0;
+	uint64_t droppedFrames = 0; // Captures skipped because every frame buffer was still queued
+	uint64_t keyframes = 0;
+	uint64_t bytesWritten = 0;
+	uint64_t rawBytes = 0; // Float positions and velocities of the recorded active particles, for comparison
+	int writeError = 0; // errno of the first failed write, the recording stopped taking frames there. 0 when none failed.
+};
+
+// Streams particle frames into a recording (see Recording.h) from a background thread.
+// Capture only copies the particles into one of QUEUE_LENGTH frame buffers, the writer thread quantises, encodes
+// and writes them. When every buffer is still queued the frame is dropped instead of waiting for the disk, the
+// next delta frame is simply encoded against the last frame that was written.
+class FrameRecorder
+{
+public:
+	static constexpr unsigned int QUEUE_LENGTH = 4;
+
+	FrameRecorder() = default;
+	~FrameRecorder();
+
+	FrameRecorder(const FrameRecorder&) = delete;
+	FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+	// Opens path and starts the writer thread, every keyframeInterval-th written frame is a keyframe.
+	// smoothingRadius is the recorded simulation's, stored for replays to build their voxels with.
+	bool Start(const std::string& path, float smoothingRadius, uint32_t keyframeInterval = 60);
+
+	// Writes whatever is still queued, then the frame index, and closes the file. False when the index or the header
+	// couldn't be written, or a frame failed before. After a frame failed the index still covers the frames before it.
+	bool Stop();
+
+	bool IsRecording() const { return file != nullptr; }
+	const std::string& GetPath() const { return path; }
+
+	// One producer thread, call after the integrate pass. Returns false when the frame was dropped, or a write failed
+	// and the recording takes no more frames.
+	bool Capture(SPHBackend& backend, uint64_t stepIndex, double simulatedTime);
+
+	FrameRecorderStats GetStats() const;
+
+private:
+	struct PendingFrame
+	{
+		std::vector<ParticleState> particles;
+		std::vector<uint8_t> active;
+		uint64_t stepIndex = 0;
+		double simulatedTime = 0.0;
+	};
+
+	void WriterLoop();
+	void WriteFrame(const PendingFrame& frame);
+
+	// Keeps the first error, returns false so write checks can return it
+	bool FailWrite();
+
+	FILE* file = nullptr;
+	std::string path;
+	RecordingHeader header = {};
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::vector<std::unique_ptr<PendingFrame>> freeFrames;
+	std::deque<std::unique_ptr<PendingFrame>> queuedFrames;
+	bool stopping = false;
+
+	std::atomic<uint64_t> recordedFrames{ 0 };
+	std::atomic<uint64_t> droppedFrames{ 0 };
+	std::atomic<uint64_t> keyframes{ 0 };
+	std::atomic<uint64_t> bytesWritten{ 0 };
+	std::atomic<uint64_t> rawBytes{ 0 };
+	std::atomic<int> writeError{ 0 };
+
+	// Writer thread only
+	QuantisedFrame current;
+	QuantisedFrame reference;
+	std::vector<uint8_t> encoded;
+	std::vector<uint64_t> frameOffsets;
+};
@@ -0,0 +1,150 @@
+#include "GpuProfiler.h"
+
+GpuProfiler::GpuProfiler(ID3D11Device* device, ID3D11DeviceContext* context)
+	:
+	device(device),
+	context(context),
+	track(Profiler::CreateTrack("GPU"))
+{
+	D3D11_QUERY_DESC disjointDesc = {};
+	disjointDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+
+	D3D11_QUERY_DESC timestampDesc = {};
+	timestampDesc.Query = D3D11_QUERY_TIMESTAMP;
+
+	for (Frame& frame : frames)
+	{
+		device->CreateQuery(&disjointDesc, &frame.disjoint);
+		device->CreateQuery(&timestampDesc, &frame.frameStart);
+
+		for (Scope& scope : frame.scopes)
+		{
+			device->CreateQuery(&timestampDesc, &scope.begin);
+			device->CreateQuery(&timestampDesc, &scope.end);
+		}
+	}
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	for (Frame& frame : frames)
+	{
+		if (frame.disjoint) frame.disjoint->Release();
+		if (frame.frameStart) frame.frameStart->Release();
+
+		for (Scope& scope : frame.scopes)
+		{
+			if (scope.begin) scope.begin->Release();
+			if (scope.end) scope.end->Release();
+		}
+	}
+}
+
+void GpuProfiler::BeginFrame()
+{
+	inFrame = false;
+	openCount = 0;
+
+	if (!Profiler::IsEnabled())
+		return;
+
+	// Frame slot still waiting on the GPU, skip this frame rather than stall
+	Frame& frame = frames[currentFrame];
+	if (frame.pending)
+		return;
+
+	frame.scopeCount = 0;
+	frame.frameIndex = Profiler::GetFrameIndex();
+	frame.cpuStartNs = Profiler::Now();
+
+	context->Begin(frame.disjoint);
+	context->End(frame.frameStart);
+	inFrame = true;
+}
+
+void GpuProfiler::EndFrame()
+{
+	if (inFrame)
+	{
+		Frame& frame = frames[currentFrame];
+		context->End(frame.disjoint);
+		frame.pending = true;
+
+		currentFrame = (currentFrame + 1) % FRAMES_IN_FLIGHT;
+		inFrame = false;
+	}
+
+	Resolve();
+}
+
+void GpuProfiler::BeginScope(const char* name)
+{
+	if (openCount >= MAX_SCOPES)
+		return;
+
+	Frame& frame = frames[currentFrame];
+	if (!inFrame || frame.scopeCount >= MAX_SCOPES)
+	{
+		openScopes[openCount++] = MAX_SCOPES;
+		return;
+	}
+
+	Scope& scope = frame.scopes[frame.scopeCount];
+	scope.name = name;
+	scope.depth = openCount;
+	context->End(scope.begin);
+
+	openScopes[openCount++] = frame.scopeCount++;
+}
+
+void GpuProfiler::EndScope()
+{
+	if (openCount == 0)
+		return;
+
+	unsigned int scopeIndex = openScopes[--openCount];
+	if (!inFrame || scopeIndex == MAX_SCOPES)
+		return;
+
+	context->End(frames[currentFrame].scopes[scopeIndex].end);
+}
+
+void GpuProfiler::Resolve()
+{
+	for (Frame& frame : frames)
+	{
+		if (!frame.pending)
+			continue;
+
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjointData = {};
+		if (context->GetData(frame.disjoint, &disjointData, sizeof(disjointData), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			continue;
+
+		frame.pending = false;
+
+		// Clock changed mid frame, the timestamps are meaningless
+		if (disjointData.Disjoint || disjointData.Frequency == 0)
+			continue;
+
+		UINT64 frameStart = 0;
+		if (context->GetData(frame.frameStart, &frameStart, sizeof(frameStart), 0) != S_OK)
+			continue;
+
+		double nsPerTick = 1e9 / static_cast<double>(disjointData.Frequency);
+
+		for (unsigned int i = 0; i < frame.scopeCount; i++)
+		{
+			const Scope& scope = frame.scopes[i];
+
+			UINT64 begin = 0;
+			UINT64 end = 0;
+			if (context->GetData(scope.begin, &begin, sizeof(begin), 0) != S_OK ||
+				context->GetData(scope.end, &end, sizeof(end), 0) != S_OK)
+				continue;
+
+			uint64_t startNs = frame.cpuStartNs + static_cast<uint64_t>((begin - frameStart) * nsPerTick);
+			uint64_t endNs = frame.cpuStartNs + static_cast<uint64_t>((end - frameStart) * nsPerTick);
+			Profiler::Record(track, scope.name, startNs, endNs, scope.depth, frame.frameIndex);
+		}
+	}
+}
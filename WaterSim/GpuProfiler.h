@@ -0,0 +1,88 @@
+#pragma once
+
+#include <d3d11.h>
+
+#include "Profiler.h"
+
+// D3D11 timestamp queries around GPU work. Each frame's queries are read back a few frames later without
+// stalling and pushed onto a "GPU" profiler track. The GPU clock isn't synchronised with the CPU one, so each
+// frame is lined up on the CPU time of its BeginFrame: scopes show where GPU work sat within the frame.
+class GpuProfiler
+{
+public:
+	GpuProfiler(ID3D11Device* device, ID3D11DeviceContext* context);
+	~GpuProfiler();
+
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	// Brackets a rendered frame, scopes outside a frame (or while the profiler is off) are ignored
+	void BeginFrame();
+	void EndFrame();
+
+	void BeginScope(const char* name);
+	void EndScope();
+
+private:
+	static constexpr unsigned int FRAMES_IN_FLIGHT = 4;
+	static constexpr unsigned int MAX_SCOPES = 64;
+
+	struct Scope
+	{
+		const char* name = nullptr;
+		uint32_t depth = 0;
+		ID3D11Query* begin = nullptr;
+		ID3D11Query* end = nullptr;
+	};
+
+	struct Frame
+	{
+		ID3D11Query* disjoint = nullptr;
+		ID3D11Query* frameStart = nullptr;
+		Scope scopes[MAX_SCOPES];
+		unsigned int scopeCount = 0;
+
+		uint64_t frameIndex = 0;
+		uint64_t cpuStartNs = 0;
+		bool pending = false;
+	};
+
+	// Reads back every frame whose queries are done
+	void Resolve();
+
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+	ProfileTrack& track;
+
+	Frame frames[FRAMES_IN_FLIGHT];
+	unsigned int currentFrame = 0;
+	bool inFrame = false;
+
+	// Scope index per open BeginScope, MAX_SCOPES for ones that weren't recorded
+	unsigned int openScopes[MAX_SCOPES];
+	unsigned int openCount = 0;
+};
+
+// Times the enclosing scope on the GPU, profiler may be null
+class GpuProfileScope
+{
+public:
+	GpuProfileScope(GpuProfiler* profiler, const char* name)
+		: profiler(profiler && Profiler::IsEnabled() ? profiler : nullptr)
+	{
+		if (this->profiler)
+			this->profiler->BeginScope(name);
+	}
+
+	~GpuProfileScope()
+	{
+		if (profiler)
+			profiler->EndScope();
+	}
+
+	GpuProfileScope(const GpuProfileScope&) = delete;
+	GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+private:
+	GpuProfiler* profiler;
+};
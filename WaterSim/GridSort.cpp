@@ -0,0 +1,228 @@
+#include "GridSort.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Below this a block isn't worth a worker
+	constexpr unsigned int minRadixBlockSize = 4096;
+}
+
+void BitonicSortGridEntries(JobSystem& jobSystem, std::vector<GridEntry>& entries, unsigned int count)
+{
+	// Same (k, j) network as BitonicSort in the compute shader, one ParallelFor per dispatch
+	for (unsigned int k = 2; k <= count; k <<= 1)
+	{
+		for (unsigned int j = k >> 1; j > 0; j >>= 1)
+		{
+			jobSystem.ParallelFor(count, 4096, [&](unsigned int begin, unsigned int end, unsigned int)
+			{
+				for (unsigned int i = begin; i < end; i++)
+				{
+					unsigned int ixj = i ^ j;
+					if (ixj <= i)
+						continue;
+
+					bool ascending = ((i & k) == 0);
+
+					GridEntry& elemI = entries[i];
+					GridEntry& elemJ = entries[ixj];
+
+					if ((ascending && elemI.key > elemJ.key) || (!ascending && elemI.key < elemJ.key))
+						std::swap(elemI, elemJ);
+				}
+			});
+		}
+	}
+}
+
+void RadixSortGridEntries(JobSystem& jobSystem, std::vector<GridEntry>& entries, std::vector<GridEntry>& scratch,
+	unsigned int count, uint32_t maxKey)
+{
+	if (count < 2)
+		return;
+
+	// Kept the same size as entries so swapping them never shrinks the caller's buffer
+	if (scratch.size() < entries.size())
+		scratch.resize(entries.size());
+
+	unsigned int keyBits = 0;
+	while (keyBits < 32 && (maxKey >> keyBits) != 0)
+		keyBits++;
+
+	unsigned int passCount = (keyBits + RADIX_BITS - 1) / RADIX_BITS;
+
+	// Each block is a contiguous run of the input owned by one task for the whole pass,
+	// scattering blocks in order keeps equal keys in their original order
+	unsigned int blockCount = std::max(1u, std::min(jobSystem.GetThreadCount(), count / minRadixBlockSize));
+	unsigned int blockSize = (count + blockCount - 1) / blockCount;
+
+	std::vector<uint32_t> histograms(static_cast<size_t>(blockCount) * RADIX);
+
+	std::vector<GridEntry>* source = &entries;
+	std::vector<GridEntry>* destination = &scratch;
+
+	for (unsigned int pass = 0; pass < passCount; pass++)
+	{
+		unsigned int shift = pass * RADIX_BITS;
+
+		// Count digits per block
+		jobSystem.ParallelFor(blockCount, 1, [&](unsigned int blockBegin, unsigned int blockEnd, unsigned int)
+		{
+			for (unsigned int block = blockBegin; block < blockEnd; block++)
+			{
+				uint32_t* histogram = &histograms[static_cast<size_t>(block) * RADIX];
+				std::fill(histogram, histogram + RADIX, 0u);
+
+				const GridEntry* input = source->data();
+				unsigned int begin = block * blockSize;
+				unsigned int end = std::min(begin + blockSize, count);
+
+				for (unsigned int i = begin; i < end; i++)
+					histogram[(input[i].key >> shift) & (RADIX - 1)]++;
+			}
+		});
+
+		// Exclusive prefix sum, digit-major so every block of digit d lands before any block of digit d + 1
+		uint32_t offset = 0;
+		for (unsigned int digit = 0; digit < RADIX; digit++)
+		{
+			for (unsigned int block = 0; block < blockCount; block++)
+			{
+				uint32_t& bucket = histograms[static_cast<size_t>(block) * RADIX + digit];
+				uint32_t digitCount = bucket;
+				bucket = offset;
+				offset += digitCount;
+			}
+		}
+
+		// Scatter
+		jobSystem.ParallelFor(blockCount, 1, [&](unsigned int blockBegin, unsigned int blockEnd, unsigned int)
+		{
+			for (unsigned int block = blockBegin; block < blockEnd; block++)
+			{
+				uint32_t* offsets = &histograms[static_cast<size_t>(block) * RADIX];
+
+				const GridEntry* input = source->data();
+				GridEntry* output = destination->data();
+				unsigned int begin = block * blockSize;
+				unsigned int end = std::min(begin + blockSize, count);
+
+				for (unsigned int i = begin; i < end; i++)
+					output[offsets[(input[i].key >> shift) & (RADIX - 1)]++] = input[i];
+			}
+		});
+
+		std::swap(source, destination);
+	}
+
+	// Odd number of passes leaves the result in scratch
+	if (source != &entries)
+		std::swap(entries, scratch);
+}
+
+void CountingSortGridEntries(JobSystem& jobSystem, std::vector<GridEntry>& entries, std::vector<GridEntry>& scratch,
+	unsigned int count, unsigned int keyCount, std::vector<uint32_t>& keyStarts)
+{
+	keyStarts.resize(static_cast<size_t>(keyCount) + 1);
+
+	if (scratch.size() < entries.size())
+		scratch.resize(entries.size());
+
+	// Same block layout as a single radix pass with keyCount digits
+	unsigned int blockCount = std::max(1u, std::min(jobSystem.GetThreadCount(), count / minRadixBlockSize));
+	unsigned int blockSize = (count + blockCount - 1) / blockCount;
+
+	std::vector<uint32_t> histograms(static_cast<size_t>(blockCount) * keyCount);
+
+	// Count keys per block
+	jobSystem.ParallelFor(blockCount, 1, [&](unsigned int blockBegin, unsigned int blockEnd, unsigned int)
+	{
+		for (unsigned int block = blockBegin; block < blockEnd; block++)
+		{
+			uint32_t* histogram = &histograms[static_cast<size_t>(block) * keyCount];
+
+			const GridEntry* input = entries.data();
+			unsigned int begin = block * blockSize;
+			unsigned int end = std::min(begin + blockSize, count);
+
+			for (unsigned int i = begin; i < end; i++)
+				histogram[input[i].key]++;
+		}
+	});
+
+	// Exclusive prefix sum over keys in two sweeps: total of each key range, then the ranges are offset by the
+	// totals before them while each block's histogram is turned into its scatter offsets
+	unsigned int rangeCount = std::max(1u, std::min(jobSystem.GetThreadCount() * 4, keyCount / minRadixBlockSize));
+	unsigned int rangeSize = (keyCount + rangeCount - 1) / rangeCount;
+	std::vector<uint32_t> rangeStarts(rangeCount);
+
+	jobSystem.ParallelFor(rangeCount, 1, [&](unsigned int rangeBegin, unsigned int rangeEnd, unsigned int)
+	{
+		for (unsigned int range = rangeBegin; range < rangeEnd; range++)
+		{
+			unsigned int begin = range * rangeSize;
+			unsigned int end = std::min(begin + rangeSize, keyCount);
+
+			uint32_t total = 0;
+			for (unsigned int block = 0; block < blockCount; block++)
+			{
+				const uint32_t* histogram = &histograms[static_cast<size_t>(block) * keyCount];
+				for (unsigned int key = begin; key < end; key++)
+					total += histogram[key];
+			}
+			rangeStarts[range] = total;
+		}
+	});
+
+	uint32_t offset = 0;
+	for (uint32_t& rangeStart : rangeStarts)
+	{
+		uint32_t rangeTotal = rangeStart;
+		rangeStart = offset;
+		offset += rangeTotal;
+	}
+
+	jobSystem.ParallelFor(rangeCount, 1, [&](unsigned int rangeBegin, unsigned int rangeEnd, unsigned int)
+	{
+		for (unsigned int range = rangeBegin; range < rangeEnd; range++)
+		{
+			unsigned int begin = range * rangeSize;
+			unsigned int end = std::min(begin + rangeSize, keyCount);
+
+			// Block-major within a key keeps equal keys in input order
+			uint32_t keyOffset = rangeStarts[range];
+			for (unsigned int key = begin; key < end; key++)
+			{
+				keyStarts[key] = keyOffset;
+				for (unsigned int block = 0; block < blockCount; block++)
+				{
+					uint32_t& bucket = histograms[static_cast<size_t>(block) * keyCount + key];
+					uint32_t keyTotal = bucket;
+					bucket = keyOffset;
+					keyOffset += keyTotal;
+				}
+			}
+		}
+	});
+	keyStarts[keyCount] = count;
+
+	// Scatter
+	jobSystem.ParallelFor(blockCount, 1, [&](unsigned int blockBegin, unsigned int blockEnd, unsigned int)
+	{
+		for (unsigned int block = blockBegin; block < blockEnd; block++)
+		{
+			uint32_t* offsets = &histograms[static_cast<size_t>(block) * keyCount];
+
+			const GridEntry* input = entries.data();
+			GridEntry* output = scratch.data();
+			unsigned int begin = block * blockSize;
+			unsigned int end = std::min(begin + blockSize, count);
+
+			for (unsigned int i = begin; i < end; i++)
+				output[offsets[input[i].key]++] = input[i];
+		}
+	});
+
+	std::swap(entries, scratch);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "SPHCommon.h"
+#include "JobSystem.h"
+
+#include <vector>
+
+// Sorts of the spatial grid (key, hash, particleIndex) entries by key, used by SPHCPU::UpdateSortGrid
+
+enum class SortMode
+{
+	Bitonic, // Same network as BitonicSort in SPHComputeShader.hlsl, needs a power of two count
+	Radix    // Stable LSD radix sort, any count
+};
+
+enum class GridMode
+{
+	Hashed, // hash % numParticles keys with start offsets, same as the GPU grid
+	Dense   // Bounded cell grid with exact [start, end) ranges per cell
+};
+
+// In place bitonic network over entries[0, count). count must be a power of two, pad with UINT32_MAX keys.
+void BitonicSortGridEntries(JobSystem& jobSystem, std::vector<GridEntry>& entries, unsigned int count);
+
+// Stable LSD radix sort of entries[0, count) on key, RADIX_BITS per pass.
+// Only the passes needed to cover maxKey are run. scratch is resized as needed and the
+// two vectors may be swapped, the sorted result always ends up in entries.
+void RadixSortGridEntries(JobSystem& jobSystem, std::vector<GridEntry>& entries, std::vector<GridEntry>& scratch,
+	unsigned int count, uint32_t maxKey);
+
+// Stable counting sort of entries[0, count) on key, every key must be below keyCount.
+// keyStarts is resized to keyCount + 1, the entries of key k end up in [keyStarts[k], keyStarts[k + 1]).
+void CountingSortGridEntries(JobSystem& jobSystem, std::vector<GridEntry>& entries, std::vector<GridEntry>& scratch,
+	unsigned int count, unsigned int keyCount, std::vector<uint32_t>& keyStarts);
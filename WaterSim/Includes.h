@@ -3,19 +3,8 @@
 #include <d3d11.h>
 #pragma comment(lib, "d3d11.lib")
 
-//constexpr UINT NUM_OF_PARTICLES = 256;
-//constexpr UINT NUM_OF_PARTICLES = 4096;
-//constexpr UINT NUM_OF_PARTICLES = 8192;
-//constexpr UINT NUM_OF_PARTICLES = 16384;
-constexpr UINT NUM_OF_PARTICLES = 131072;
-//constexpr UINT NUM_OF_PARTICLES = 262144;
-constexpr FLOAT SMOOTHING_RADIUS = 2.1f;
-constexpr UINT THREADS_PER_GROUPs = 256;
-
-constexpr int threadGroupCountX = (NUM_OF_PARTICLES + THREADS_PER_GROUPs - 1) / THREADS_PER_GROUPs;
-
-constexpr UINT RADIX_BITS = 4; 
-constexpr UINT RADIX = (1 << RADIX_BITS); 
+// Simulation constants shared with the CPU backend
+#include "SPHCommon.h"
 
 // DirectX
 #include <windows.h>
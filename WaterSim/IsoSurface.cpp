@@ -0,0 +1,703 @@
+#include "IsoSurface.h"
+#include "MarchingCubeTable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace
+{
+	const int edgeIndexPairs[12][2] = {
+		{0,1}, {1,2}, {2,3}, {3,0},
+		{4,5}, {5,6}, {6,7}, {7,4},
+		{0,4}, {1,5}, {2,6}, {3,7}
+	};
+
+	const int cornerOffsets[8][3] = {
+		{0,0,0}, {1,0,0}, {1,1,0}, {0,1,0},
+		{0,0,1}, {1,0,1}, {1,1,1}, {0,1,1}
+	};
+
+	// Corner of each edge nearest the origin and the axis the edge runs along, so neighbouring cells name a shared edge alike
+	const int edgeLowerCorner[12] = { 0, 1, 3, 0, 4, 5, 7, 4, 0, 1, 2, 3 };
+	const int edgeAxis[12] = { 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2 };
+
+	constexpr uint32_t noVertex = 0xFFFFFFFF;
+
+	Float3 VertexInterp(float isoLevel, const Float3& p1, const Float3& p2, float valp1, float valp2)
+	{
+		if (std::abs(isoLevel - valp1) < 0.00001f)
+			return p1;
+		if (std::abs(isoLevel - valp2) < 0.00001f)
+			return p2;
+		if (std::abs(valp1 - valp2) < 0.00001f)
+			return p1;
+
+		float mu = (isoLevel - valp1) / (valp2 - valp1);
+		return { p1.x + mu * (p2.x - p1.x), p1.y + mu * (p2.y - p1.y), p1.z + mu * (p2.z - p1.z) };
+	}
+
+	// Same cases as VertexInterp, how far along the edge its vertex sits
+	float EdgeFraction(float isoLevel, float valp1, float valp2)
+	{
+		if (std::abs(isoLevel - valp1) < 0.00001f)
+			return 0.0f;
+		if (std::abs(isoLevel - valp2) < 0.00001f)
+			return 1.0f;
+		if (std::abs(valp1 - valp2) < 0.00001f)
+			return 0.0f;
+
+		return (isoLevel - valp1) / (valp2 - valp1);
+	}
+
+	int GetCubeIndex(const float corners[8], float isoLevel)
+	{
+		int cubeIndex = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			if (corners[i] < isoLevel)
+				cubeIndex |= (1 << i);
+		}
+		return cubeIndex;
+	}
+
+	// Field gradient at a sample in samples, central differences that turn one sided on the faces
+	template <typename Sample>
+	Float3 SampleGradient(const Sample& sample, int sizeX, int sizeY, int sizeZ, int x, int y, int z)
+	{
+		int lowX = std::max(x - 1, 0), highX = std::min(x + 1, sizeX - 1);
+		int lowY = std::max(y - 1, 0), highY = std::min(y + 1, sizeY - 1);
+		int lowZ = std::max(z - 1, 0), highZ = std::min(z + 1, sizeZ - 1);
+
+		return {
+			(sample(highX, y, z) - sample(lowX, y, z)) / std::max(highX - lowX, 1),
+			(sample(x, highY, z) - sample(x, lowY, z)) / std::max(highY - lowY, 1),
+			(sample(x, y, highZ) - sample(x, y, lowZ)) / std::max(highZ - lowZ, 1)
+		};
+	}
+
+	// Vertex of the edge leaving sample (x, y, z) along axis. The density falls off outwards, so the normal is the
+	// negated gradient interpolated like the position.
+	template <typename Sample>
+	IsoSurfaceVertex WeldedEdgeVertex(const Sample& sample, int sizeX, int sizeY, int sizeZ, int x, int y, int z, int axis,
+		const Float3& origin, float cellSize, float isoLevel)
+	{
+		int x2 = x + (axis == 0);
+		int y2 = y + (axis == 1);
+		int z2 = z + (axis == 2);
+
+		Float3 p1 = { origin.x + x * cellSize, origin.y + y * cellSize, origin.z + z * cellSize };
+		Float3 p2 = { origin.x + x2 * cellSize, origin.y + y2 * cellSize, origin.z + z2 * cellSize };
+		float valp1 = sample(x, y, z);
+		float valp2 = sample(x2, y2, z2);
+
+		Float3 gradient1 = SampleGradient(sample, sizeX, sizeY, sizeZ, x, y, z);
+		Float3 gradient2 = SampleGradient(sample, sizeX, sizeY, sizeZ, x2, y2, z2);
+		Float3 gradient = gradient1 + (gradient2 - gradient1) * EdgeFraction(isoLevel, valp1, valp2);
+
+		// Flat spots keep a zero normal
+		float length = std::sqrt(Dot(gradient, gradient));
+		Float3 normal = length > 0.0f ? gradient * (-1.0f / length) : Float3{ 0.0f, 0.0f, 0.0f };
+
+		return { VertexInterp(isoLevel, p1, p2, valp1, valp2), normal };
+	}
+
+	// Indices of the cube's triangles, edgeVertex(edge) giving the vertex of a crossed edge
+	template <typename EdgeVertex>
+	void EmitWeldedTriangles(int cubeIndex, const EdgeVertex& edgeVertex, std::vector<uint32_t>& outIndices)
+	{
+		for (int i = 0; TRI_TABLE[cubeIndex][i] != -1; ++i)
+			outIndices.push_back(edgeVertex(TRI_TABLE[cubeIndex][i]));
+	}
+
+	int GetTriangleCount(int cubeIndex)
+	{
+		int count = 0;
+		while (TRI_TABLE[cubeIndex][count * 3] != -1)
+			count++;
+		return count;
+	}
+
+	// Writes the separate vertices of the cell whose lowest corner is (x, y, z), corners[i] holding the value at
+	// cornerOffsets[i], three per triangle and at most 15. Returns how many were written.
+	int WriteCellTriangles(int x, int y, int z, const float corners[8], int cubeIndex, const Float3& origin, float cellSize,
+		float isoLevel, IsoSurfaceVertex* outVertices)
+	{
+		int edgeFlags = EDGE_TABLE[cubeIndex];
+		if (edgeFlags == 0)
+			return 0;
+
+		Float3 cubeVerts[8];
+		for (int i = 0; i < 8; ++i)
+		{
+			cubeVerts[i] = {
+				origin.x + (x + cornerOffsets[i][0]) * cellSize,
+				origin.y + (y + cornerOffsets[i][1]) * cellSize,
+				origin.z + (z + cornerOffsets[i][2]) * cellSize
+			};
+		}
+
+		Float3 edgeVertices[12];
+		for (int i = 0; i < 12; ++i)
+		{
+			if (edgeFlags & (1 << i))
+			{
+				int v1 = edgeIndexPairs[i][0];
+				int v2 = edgeIndexPairs[i][1];
+				edgeVertices[i] = VertexInterp(isoLevel, cubeVerts[v1], cubeVerts[v2], corners[v1], corners[v2]);
+			}
+		}
+
+		int count = 0;
+		for (; TRI_TABLE[cubeIndex][count] != -1; ++count)
+			outVertices[count] = { edgeVertices[TRI_TABLE[cubeIndex][count]], { 0.0f, 0.0f, 0.0f } };
+		return count;
+	}
+
+	// Appends the triangles of the cell whose lowest corner is (x, y, z), corners[i] holding the value at cornerOffsets[i]
+	void PolygoniseCell(int x, int y, int z, const float corners[8], const Float3& origin, float cellSize, float isoLevel,
+		std::vector<IsoSurfaceVertex>& outVertices, std::vector<uint32_t>& outIndices)
+	{
+		IsoSurfaceVertex cellVertices[15];
+		int count = WriteCellTriangles(x, y, z, corners, GetCubeIndex(corners, isoLevel), origin, cellSize, isoLevel, cellVertices);
+
+		for (int i = 0; i < count; ++i)
+		{
+			outIndices.push_back(static_cast<uint32_t>(outVertices.size()));
+			outVertices.push_back(cellVertices[i]);
+		}
+	}
+
+	// Each crossed edge's welded vertex belongs to one cell: the cell named by the edge's lower corner, or the last cell
+	// along an axis where that corner is on the field's upper face. Returns the crossed edges the cell owns as flags.
+	int GetOwnedEdges(int cubeIndex, int x, int y, int z, int sizeX, int sizeY, int sizeZ)
+	{
+		int ownedEdges = 0;
+		for (int edge = 0; edge < 12; ++edge)
+		{
+			const int* corner = cornerOffsets[edgeLowerCorner[edge]];
+			if ((EDGE_TABLE[cubeIndex] & (1 << edge)) && (corner[0] == 0 || x == sizeX - 2) &&
+				(corner[1] == 0 || y == sizeY - 2) && (corner[2] == 0 || z == sizeZ - 2))
+			{
+				ownedEdges |= 1 << edge;
+			}
+		}
+		return ownedEdges;
+	}
+
+	// The cell GetOwnedEdges gives the welded vertex of the edge leaving sample (x, y, z) along axis, and the edge's
+	// number within that cell
+	void GetEdgeOwner(int x, int y, int z, int axis, int sizeX, int sizeY, int sizeZ, Int3& outCell, int& outEdge)
+	{
+		outCell = { std::min(x, sizeX - 2), std::min(y, sizeY - 2), std::min(z, sizeZ - 2) };
+		outEdge = 0;
+		for (int edge = 0; edge < 12; ++edge)
+		{
+			const int* corner = cornerOffsets[edgeLowerCorner[edge]];
+			if (edgeAxis[edge] == axis && outCell.x + corner[0] == x && outCell.y + corner[1] == y && outCell.z + corner[2] == z)
+				outEdge = edge;
+		}
+	}
+
+	// Brick coordinates of the cells touching an allocated brick, as x + bricksX * (y + bricksY * z) and ascending.
+	// A cell is named by its lowest corner, so the cells touching a brick start in it or in the bricks just below it.
+	void GetCellBricks(const BrickVolume& volume, std::vector<uint32_t>& outCellBricks)
+	{
+		int bricksX = volume.GetBrickCountX();
+		int bricksY = volume.GetBrickCountY();
+
+		outCellBricks.clear();
+		for (uint32_t brick = 0; brick < volume.GetBrickCount(); brick++)
+		{
+			const Int3& coord = volume.GetBrickCoord(brick);
+			for (int dz = 0; dz <= 1; dz++)
+				for (int dy = 0; dy <= 1; dy++)
+					for (int dx = 0; dx <= 1; dx++)
+					{
+						if (coord.x >= dx && coord.y >= dy && coord.z >= dz)
+							outCellBricks.push_back((coord.x - dx) + bricksX * ((coord.y - dy) + bricksY * (coord.z - dz)));
+					}
+		}
+		std::sort(outCellBricks.begin(), outCellBricks.end());
+		outCellBricks.erase(std::unique(outCellBricks.begin(), outCellBricks.end()), outCellBricks.end());
+	}
+
+	// Calls visit(x, y, z) for the cells of a cell brick that touch an allocated brick, in row order
+	template <typename Visit>
+	void ForEachCellOfBrick(const BrickVolume& volume, uint32_t cellBrick, const Visit& visit)
+	{
+		constexpr int brickSize = BrickVolume::BRICK_SIZE;
+		int bricksX = volume.GetBrickCountX();
+		int bricksY = volume.GetBrickCountY();
+
+		int brickX = cellBrick % bricksX;
+		int brickY = (cellBrick / bricksX) % bricksY;
+		int brickZ = cellBrick / (bricksX * bricksY);
+		bool allocated = volume.FindBrick(brickX, brickY, brickZ) != BrickVolume::invalidBrick;
+
+		int endX = std::min((brickX + 1) * brickSize, volume.GetSizeX() - 1);
+		int endY = std::min((brickY + 1) * brickSize, volume.GetSizeY() - 1);
+		int endZ = std::min((brickZ + 1) * brickSize, volume.GetSizeZ() - 1);
+
+		for (int z = brickZ * brickSize; z < endZ; ++z)
+			for (int y = brickY * brickSize; y < endY; ++y)
+				for (int x = brickX * brickSize; x < endX; ++x)
+				{
+					// In a missing brick only the cells on its upper faces reach into the next bricks
+					if (!allocated && x % brickSize != brickSize - 1 && y % brickSize != brickSize - 1 && z % brickSize != brickSize - 1)
+						continue;
+
+					visit(x, y, z);
+				}
+	}
+
+	// Calls visit(x, y, z) for the cells touching an allocated brick, brick by brick in brick coordinate order
+	template <typename Visit>
+	void ForEachBrickCell(const BrickVolume& volume, const Visit& visit)
+	{
+		std::vector<uint32_t> cellBricks;
+		GetCellBricks(volume, cellBricks);
+
+		for (uint32_t cellBrick : cellBricks)
+			ForEachCellOfBrick(volume, cellBrick, visit);
+	}
+
+	// Cell of (x, y, z) within its brick, x fastest
+	int GetBrickCellIndex(int x, int y, int z)
+	{
+		constexpr int brickSize = BrickVolume::BRICK_SIZE;
+		return x % brickSize + brickSize * (y % brickSize + brickSize * (z % brickSize));
+	}
+
+	int CountBits(int flags)
+	{
+		int count = 0;
+		for (; flags != 0; flags &= flags - 1)
+			count++;
+		return count;
+	}
+}
+
+void ExtractIsoSurface(const std::vector<float>& field, int sizeX, int sizeY, int sizeZ, float cellSize, float isoLevel,
+	std::vector<IsoSurfaceVertex>& outVertices, std::vector<uint32_t>& outIndices, IsoSurfaceVertices vertexMode)
+{
+	const Float3 origin = { 0.0f, 0.0f, 0.0f };
+	const size_t levelSize = size_t(sizeX) * sizeY;
+	auto sample = [&](int x, int y, int z) { return field[x + y * size_t(sizeX) + z * levelSize]; };
+
+	// Welded vertices of the edges leaving each sample of two z levels, three axes per sample. A cell's edges all leave
+	// its own level or the one above, and once the cells move up a level the lower one is reused for the next.
+	std::vector<uint32_t> edgeCache;
+	if (vertexMode == IsoSurfaceVertices::Welded)
+		edgeCache.assign(levelSize * 3 * 2, noVertex);
+
+	for (int z = 0; z < sizeZ - 1; ++z)
+	{
+		if (vertexMode == IsoSurfaceVertices::Welded)
+			std::fill_n(edgeCache.data() + ((z + 1) & 1) * levelSize * 3, levelSize * 3, noVertex);
+
+		for (int y = 0; y < sizeY - 1; ++y)
+			for (int x = 0; x < sizeX - 1; ++x)
+			{
+				float corners[8];
+				for (int i = 0; i < 8; ++i)
+					corners[i] = sample(x + cornerOffsets[i][0], y + cornerOffsets[i][1], z + cornerOffsets[i][2]);
+
+				if (vertexMode == IsoSurfaceVertices::Separate)
+				{
+					PolygoniseCell(x, y, z, corners, origin, cellSize, isoLevel, outVertices, outIndices);
+					continue;
+				}
+
+				int cubeIndex = GetCubeIndex(corners, isoLevel);
+				if (EDGE_TABLE[cubeIndex] == 0)
+					continue;
+
+				EmitWeldedTriangles(cubeIndex, [&](int edge)
+				{
+					const int* corner = cornerOffsets[edgeLowerCorner[edge]];
+					int edgeX = x + corner[0];
+					int edgeY = y + corner[1];
+					int edgeZ = z + corner[2];
+
+					uint32_t& vertex = edgeCache[((edgeZ & 1) * levelSize + edgeX + edgeY * size_t(sizeX)) * 3 + edgeAxis[edge]];
+					if (vertex == noVertex)
+					{
+						vertex = static_cast<uint32_t>(outVertices.size());
+						outVertices.push_back(WeldedEdgeVertex(sample, sizeX, sizeY, sizeZ, edgeX, edgeY, edgeZ, edgeAxis[edge], origin, cellSize, isoLevel));
+					}
+					return vertex;
+				}, outIndices);
+			}
+	}
+}
+
+void ExtractIsoSurface(const BrickVolume& volume, float isoLevel, std::vector<IsoSurfaceVertex>& outVertices, std::vector<uint32_t>& outIndices,
+	IsoSurfaceVertices vertexMode)
+{
+	int sizeX = volume.GetSizeX();
+	int sizeY = volume.GetSizeY();
+	int sizeZ = volume.GetSizeZ();
+	auto sample = [&](int x, int y, int z) { return volume.GetVoxel(x, y, z); };
+
+	if (vertexMode == IsoSurfaceVertices::Separate)
+	{
+		ForEachBrickCell(volume, [&](int x, int y, int z)
+		{
+			float corners[8];
+			for (int i = 0; i < 8; ++i)
+				corners[i] = sample(x + cornerOffsets[i][0], y + cornerOffsets[i][1], z + cornerOffsets[i][2]);
+
+			PolygoniseCell(x, y, z, corners, volume.GetOrigin(), volume.GetVoxelSize(), isoLevel, outVertices, outIndices);
+		});
+		return;
+	}
+
+	// Bricks aren't visited in row order, so the welded vertices are looked up by edge: sample index * 3 + axis
+	std::unordered_map<uint64_t, uint32_t> edgeCache;
+	ForEachBrickCell(volume, [&](int x, int y, int z)
+	{
+		float corners[8];
+		for (int i = 0; i < 8; ++i)
+			corners[i] = sample(x + cornerOffsets[i][0], y + cornerOffsets[i][1], z + cornerOffsets[i][2]);
+
+		int cubeIndex = GetCubeIndex(corners, isoLevel);
+		if (EDGE_TABLE[cubeIndex] == 0)
+			return;
+
+		EmitWeldedTriangles(cubeIndex, [&](int edge)
+		{
+			const int* corner = cornerOffsets[edgeLowerCorner[edge]];
+			int edgeX = x + corner[0];
+			int edgeY = y + corner[1];
+			int edgeZ = z + corner[2];
+
+			uint64_t key = ((uint64_t(edgeZ) * sizeY + edgeY) * sizeX + edgeX) * 3 + edgeAxis[edge];
+			auto [entry, added] = edgeCache.try_emplace(key, static_cast<uint32_t>(outVertices.size()));
+			if (added)
+			{
+				outVertices.push_back(WeldedEdgeVertex(sample, sizeX, sizeY, sizeZ, edgeX, edgeY, edgeZ, edgeAxis[edge],
+					volume.GetOrigin(), volume.GetVoxelSize(), isoLevel));
+			}
+			return entry->second;
+		}, outIndices);
+	});
+}
+
+void IsoSurfaceExtractor::Extract(const std::vector<float>& field, int sizeX, int sizeY, int sizeZ, float cellSize, float isoLevel,
+	std::vector<IsoSurfaceVertex>& outVertices, std::vector<uint32_t>& outIndices, IsoSurfaceVertices vertexMode)
+{
+	if (sizeX < 2 || sizeY < 2 || sizeZ < 2)
+		return;
+
+	const Float3 origin = { 0.0f, 0.0f, 0.0f };
+	const size_t levelSize = size_t(sizeX) * sizeY;
+	const bool welded = vertexMode == IsoSurfaceVertices::Welded;
+	auto sample = [&](int x, int y, int z) { return field[x + y * size_t(sizeX) + z * levelSize]; };
+
+	// A few slabs per worker so uneven surfaces still balance
+	int layers = sizeZ - 1;
+	int slabCount = std::min(layers, static_cast<int>(jobSystem.GetThreadCount()) * 4);
+	slabs.resize(slabCount);
+	for (int s = 0; s < slabCount; s++)
+	{
+		slabs[s].firstZ = layers * s / slabCount;
+		slabs[s].endZ = layers * (s + 1) / slabCount;
+	}
+
+	jobSystem.ParallelFor(slabCount, 1, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int s = begin; s < end; s++)
+		{
+			Slab& slab = slabs[s];
+			slab.cells.clear();
+			slab.cubeIndices.clear();
+			slab.vertexCount = 0;
+			slab.indexCount = 0;
+
+			for (int z = slab.firstZ; z < slab.endZ; ++z)
+				for (int y = 0; y < sizeY - 1; ++y)
+					for (int x = 0; x < sizeX - 1; ++x)
+					{
+						float corners[8];
+						for (int i = 0; i < 8; ++i)
+							corners[i] = sample(x + cornerOffsets[i][0], y + cornerOffsets[i][1], z + cornerOffsets[i][2]);
+
+						int cubeIndex = GetCubeIndex(corners, isoLevel);
+						if (EDGE_TABLE[cubeIndex] == 0)
+							continue;
+
+						slab.cells.push_back(static_cast<uint32_t>(x + y * size_t(sizeX) + z * levelSize));
+						slab.cubeIndices.push_back(static_cast<uint8_t>(cubeIndex));
+						slab.indexCount += GetTriangleCount(cubeIndex) * 3;
+
+						if (welded)
+							slab.vertexCount += CountBits(GetOwnedEdges(cubeIndex, x, y, z, sizeX, sizeY, sizeZ));
+					}
+
+			if (!welded)
+				slab.vertexCount = slab.indexCount;
+		}
+	});
+
+	uint32_t vertexBase = static_cast<uint32_t>(outVertices.size());
+	uint32_t indexBase = static_cast<uint32_t>(outIndices.size());
+	uint32_t vertexTotal = 0;
+	uint32_t indexTotal = 0;
+	for (Slab& slab : slabs)
+	{
+		slab.firstVertex = vertexBase + vertexTotal;
+		slab.firstIndex = indexBase + indexTotal;
+		vertexTotal += slab.vertexCount;
+		indexTotal += slab.indexCount;
+	}
+
+	outVertices.resize(size_t(vertexBase) + vertexTotal);
+	outIndices.resize(size_t(indexBase) + indexTotal);
+	threadEdgeCaches.resize(jobSystem.GetThreadCount());
+
+	jobSystem.ParallelFor(slabCount, 1, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+	{
+		// Welded vertices of the edges leaving each sample of three z levels, three axes per sample. Only entries
+		// written for the current cells are ever read, so the levels are reused without clearing them.
+		std::vector<uint32_t>& edgeCache = threadEdgeCaches[threadIndex];
+		if (welded)
+			edgeCache.resize(levelSize * 3 * 3);
+
+		auto cacheEntry = [&](int x, int y, int z, int axis) -> uint32_t&
+		{
+			return edgeCache[((z % 3) * levelSize + x + y * size_t(sizeX)) * 3 + axis];
+		};
+
+		for (unsigned int s = begin; s < end; s++)
+		{
+			const Slab& slab = slabs[s];
+			uint32_t* indices = outIndices.data() + slab.firstIndex;
+
+			if (!welded)
+			{
+				IsoSurfaceVertex* vertices = outVertices.data() + slab.firstVertex;
+				uint32_t vertex = slab.firstVertex;
+
+				for (size_t c = 0; c < slab.cells.size(); ++c)
+				{
+					int x = static_cast<int>(slab.cells[c] % sizeX);
+					int y = static_cast<int>((slab.cells[c] / sizeX) % sizeY);
+					int z = static_cast<int>(slab.cells[c] / levelSize);
+
+					float corners[8];
+					for (int i = 0; i < 8; ++i)
+						corners[i] = sample(x + cornerOffsets[i][0], y + cornerOffsets[i][1], z + cornerOffsets[i][2]);
+
+					int count = WriteCellTriangles(x, y, z, corners, slab.cubeIndices[c], origin, cellSize, isoLevel, vertices);
+					for (int i = 0; i < count; ++i)
+						*indices++ = vertex++;
+					vertices += count;
+				}
+				continue;
+			}
+
+			// Numbers the owned edges of the layer z cells of a slab from nextVertex, cell by cell in row order, and
+			// makes the vertices when the slab is this one. Running over the next slab's first layer the same way
+			// finds the vertices of the level shared with it.
+			auto numberLayer = [&](const Slab& layerSlab, size_t& c, int z, uint32_t nextVertex, bool owned)
+			{
+				for (; c < layerSlab.cells.size() && layerSlab.cells[c] / levelSize == size_t(z); ++c)
+				{
+					int x = static_cast<int>(layerSlab.cells[c] % sizeX);
+					int y = static_cast<int>((layerSlab.cells[c] / sizeX) % sizeY);
+
+					for (int ownedEdges = GetOwnedEdges(layerSlab.cubeIndices[c], x, y, z, sizeX, sizeY, sizeZ); ownedEdges != 0; ownedEdges &= ownedEdges - 1)
+					{
+						int edge = 0;
+						while (!(ownedEdges & (1 << edge)))
+							edge++;
+
+						const int* corner = cornerOffsets[edgeLowerCorner[edge]];
+						int edgeX = x + corner[0];
+						int edgeY = y + corner[1];
+						int edgeZ = z + corner[2];
+
+						uint32_t vertex = nextVertex++;
+						cacheEntry(edgeX, edgeY, edgeZ, edgeAxis[edge]) = vertex;
+						if (owned)
+							outVertices[vertex] = WeldedEdgeVertex(sample, sizeX, sizeY, sizeZ, edgeX, edgeY, edgeZ, edgeAxis[edge], origin, cellSize, isoLevel);
+					}
+				}
+				return nextVertex;
+			};
+
+			size_t numberCursor = 0;
+			uint32_t nextVertex = numberLayer(slab, numberCursor, slab.firstZ, slab.firstVertex, true);
+
+			size_t c = 0;
+			for (int z = slab.firstZ; z < slab.endZ; ++z)
+			{
+				// A cell's edges belong to its own layer's cells or the next layer's
+				if (z + 1 < slab.endZ)
+				{
+					nextVertex = numberLayer(slab, numberCursor, z + 1, nextVertex, true);
+				}
+				else if (s + 1 < slabs.size())
+				{
+					size_t nextCursor = 0;
+					numberLayer(slabs[s + 1], nextCursor, z + 1, slabs[s + 1].firstVertex, false);
+				}
+
+				for (; c < slab.cells.size() && slab.cells[c] / levelSize == size_t(z); ++c)
+				{
+					int x = static_cast<int>(slab.cells[c] % sizeX);
+					int y = static_cast<int>((slab.cells[c] / sizeX) % sizeY);
+					int cubeIndex = slab.cubeIndices[c];
+
+					for (int i = 0; TRI_TABLE[cubeIndex][i] != -1; ++i)
+					{
+						int edge = TRI_TABLE[cubeIndex][i];
+						const int* corner = cornerOffsets[edgeLowerCorner[edge]];
+						*indices++ = cacheEntry(x + corner[0], y + corner[1], z + corner[2], edgeAxis[edge]);
+					}
+				}
+			}
+		}
+	});
+}
+
+void IsoSurfaceExtractor::Extract(const BrickVolume& volume, float isoLevel, std::vector<IsoSurfaceVertex>& outVertices,
+	std::vector<uint32_t>& outIndices, IsoSurfaceVertices vertexMode)
+{
+	int sizeX = volume.GetSizeX();
+	int sizeY = volume.GetSizeY();
+	int sizeZ = volume.GetSizeZ();
+	if (sizeX < 2 || sizeY < 2 || sizeZ < 2)
+		return;
+
+	const bool welded = vertexMode == IsoSurfaceVertices::Welded;
+	const Float3& origin = volume.GetOrigin();
+	const float cellSize = volume.GetVoxelSize();
+	const int bricksX = volume.GetBrickCountX();
+	const int bricksY = volume.GetBrickCountY();
+	auto sample = [&](int x, int y, int z) { return volume.GetVoxel(x, y, z); };
+
+	GetCellBricks(volume, cellBricks);
+	brickCells.resize(cellBricks.size());
+
+	jobSystem.ParallelFor(static_cast<unsigned int>(cellBricks.size()), 4, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int b = begin; b < end; b++)
+		{
+			BrickCells& cells = brickCells[b];
+			cells.cubeIndices.assign(BrickVolume::BRICK_VOXELS, 0);
+			cells.ownedVertices.resize(BrickVolume::BRICK_VOXELS);
+			cells.vertexCount = 0;
+			cells.indexCount = 0;
+
+			ForEachCellOfBrick(volume, cellBricks[b], [&](int x, int y, int z)
+			{
+				float corners[8];
+				for (int i = 0; i < 8; ++i)
+					corners[i] = sample(x + cornerOffsets[i][0], y + cornerOffsets[i][1], z + cornerOffsets[i][2]);
+
+				int cubeIndex = GetCubeIndex(corners, isoLevel);
+				if (EDGE_TABLE[cubeIndex] == 0)
+					return;
+
+				int cell = GetBrickCellIndex(x, y, z);
+				cells.cubeIndices[cell] = static_cast<uint8_t>(cubeIndex);
+				cells.indexCount += GetTriangleCount(cubeIndex) * 3;
+
+				if (welded)
+				{
+					cells.ownedVertices[cell] = static_cast<uint16_t>(cells.vertexCount);
+					cells.vertexCount += CountBits(GetOwnedEdges(cubeIndex, x, y, z, sizeX, sizeY, sizeZ));
+				}
+			});
+
+			if (!welded)
+				cells.vertexCount = cells.indexCount;
+		}
+	});
+
+	uint32_t vertexBase = static_cast<uint32_t>(outVertices.size());
+	uint32_t indexBase = static_cast<uint32_t>(outIndices.size());
+	uint32_t vertexTotal = 0;
+	uint32_t indexTotal = 0;
+	for (BrickCells& cells : brickCells)
+	{
+		cells.firstVertex = vertexBase + vertexTotal;
+		cells.firstIndex = indexBase + indexTotal;
+		vertexTotal += cells.vertexCount;
+		indexTotal += cells.indexCount;
+	}
+
+	outVertices.resize(size_t(vertexBase) + vertexTotal);
+	outIndices.resize(size_t(indexBase) + indexTotal);
+
+	// Welded vertex of an edge: its owner cell's first vertex plus the owned edges before it in that cell. The owner
+	// is in this cell brick or one of the next ones, whose numbering the first pass has already finished.
+	auto edgeVertex = [&](unsigned int b, int x, int y, int z, int axis)
+	{
+		Int3 owner;
+		int ownerEdge;
+		GetEdgeOwner(x, y, z, axis, sizeX, sizeY, sizeZ, owner, ownerEdge);
+
+		constexpr int brickSize = BrickVolume::BRICK_SIZE;
+		uint32_t ownerBrick = owner.x / brickSize + bricksX * (owner.y / brickSize + bricksY * (owner.z / brickSize));
+		if (ownerBrick != cellBricks[b])
+			b = static_cast<unsigned int>(std::lower_bound(cellBricks.begin() + b, cellBricks.end(), ownerBrick) - cellBricks.begin());
+
+		const BrickCells& cells = brickCells[b];
+		int cell = GetBrickCellIndex(owner.x, owner.y, owner.z);
+		int ownedEdges = GetOwnedEdges(cells.cubeIndices[cell], owner.x, owner.y, owner.z, sizeX, sizeY, sizeZ);
+		return cells.firstVertex + cells.ownedVertices[cell] + CountBits(ownedEdges & ((1 << ownerEdge) - 1));
+	};
+
+	jobSystem.ParallelFor(static_cast<unsigned int>(cellBricks.size()), 4, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int b = begin; b < end; b++)
+		{
+			const BrickCells& cells = brickCells[b];
+			uint32_t* indices = outIndices.data() + cells.firstIndex;
+			IsoSurfaceVertex* vertices = outVertices.data() + cells.firstVertex;
+			uint32_t vertex = cells.firstVertex;
+
+			ForEachCellOfBrick(volume, cellBricks[b], [&](int x, int y, int z)
+			{
+				int cubeIndex = cells.cubeIndices[GetBrickCellIndex(x, y, z)];
+				if (cubeIndex == 0)
+					return;
+
+				if (!welded)
+				{
+					float corners[8];
+					for (int i = 0; i < 8; ++i)
+						corners[i] = sample(x + cornerOffsets[i][0], y + cornerOffsets[i][1], z + cornerOffsets[i][2]);
+
+					int count = WriteCellTriangles(x, y, z, corners, cubeIndex, origin, cellSize, isoLevel, vertices);
+					for (int i = 0; i < count; ++i)
+						*indices++ = vertex++;
+					vertices += count;
+					return;
+				}
+
+				// Owned edges in edge order, the order edgeVertex counts them in
+				for (int ownedEdges = GetOwnedEdges(cubeIndex, x, y, z, sizeX, sizeY, sizeZ); ownedEdges != 0; ownedEdges &= ownedEdges - 1)
+				{
+					int edge = 0;
+					while (!(ownedEdges & (1 << edge)))
+						edge++;
+
+					const int* corner = cornerOffsets[edgeLowerCorner[edge]];
+					*vertices++ = WeldedEdgeVertex(sample, sizeX, sizeY, sizeZ, x + corner[0], y + corner[1], z + corner[2], edgeAxis[edge],
+						origin, cellSize, isoLevel);
+				}
+
+				for (int i = 0; TRI_TABLE[cubeIndex][i] != -1; ++i)
+				{
+					int edge = TRI_TABLE[cubeIndex][i];
+					const int* corner = cornerOffsets[edgeLowerCorner[edge]];
+					*indices++ = edgeVertex(b, x + corner[0], y + corner[1], z + corner[2], edgeAxis[edge]);
+				}
+			});
+		}
+	});
+}
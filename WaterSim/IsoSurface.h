@@ -0,0 +1,86 @@
+#pragma once
+
+#include "SPHCommon.h"
+#include "BrickVolume.h"
+#include "JobSystem.h"
+
+#include <cstdint>
+#include <vector>
+
+enum class IsoSurfaceVertices
+{
+	Separate, // Three vertices per triangle with zero normals
+	Welded    // One vertex per crossed edge shared by the cells around it, normals from the field gradient
+};
+
+// Marching cubes vertex, free of D3D types so the extraction builds with the CPU backend
+struct IsoSurfaceVertex
+{
+	Float3 position;
+	Float3 normal;
+};
+
+// Marching cubes over a dense field of sizeX * sizeY * sizeZ samples, x fastest, appended to the outputs, vertices at
+// corner * cellSize. Separate vertices are what MarchingCubes::GenerateMarchingCubesMesh always produced.
+// Welded vertices are interpolated from the edge's lower corner and their normals point down the density gradient,
+// central differences clamped at the field's faces. The triangles come out in the same order either way.
+void ExtractIsoSurface(const std::vector<float>& field, int sizeX, int sizeY, int sizeZ, float cellSize, float isoLevel,
+	std::vector<IsoSurfaceVertex>& outVertices, std::vector<uint32_t>& outIndices,
+	IsoSurfaceVertices vertexMode = IsoSurfaceVertices::Separate);
+
+// The same over a brick volume, vertices at origin + corner * voxelSize. Only the cells touching an allocated brick
+// are visited, the others are all zero and have no surface. With a zero origin the triangles are those of the dense
+// extraction of CopyToDense, in brick order rather than row order.
+void ExtractIsoSurface(const BrickVolume& volume, float isoLevel,
+	std::vector<IsoSurfaceVertex>& outVertices, std::vector<uint32_t>& outIndices,
+	IsoSurfaceVertices vertexMode = IsoSurfaceVertices::Separate);
+
+// The dense extraction split into z slabs of cells run on a JobSystem. Every slab first classifies its cells and
+// counts its triangles and vertices, a prefix sum over the slabs places each one in the outputs, and the outputs grow
+// once before the slabs write their part straight into them. Appends like ExtractIsoSurface. Separate vertices come
+// out identical to it. Welded vertices are numbered by edge, level by level, instead of by first use, so the indices
+// differ but the vertices and triangles are the same.
+class IsoSurfaceExtractor
+{
+public:
+	explicit IsoSurfaceExtractor(JobSystem& jobSystem) : jobSystem(jobSystem) {}
+
+	void Extract(const std::vector<float>& field, int sizeX, int sizeY, int sizeZ, float cellSize, float isoLevel,
+		std::vector<IsoSurfaceVertex>& outVertices, std::vector<uint32_t>& outIndices,
+		IsoSurfaceVertices vertexMode = IsoSurfaceVertices::Separate);
+
+	// The brick extraction split the same way, over the bricks that hold cells touching an allocated brick. Separate
+	// vertices come out identical to ExtractIsoSurface of the volume. Welded vertices are numbered by the cell that
+	// owns their edge, brick by brick, and a cell finds a neighbour's vertex from the counts of the neighbour's brick.
+	void Extract(const BrickVolume& volume, float isoLevel, std::vector<IsoSurfaceVertex>& outVertices,
+		std::vector<uint32_t>& outIndices, IsoSurfaceVertices vertexMode = IsoSurfaceVertices::Separate);
+
+private:
+	struct Slab
+	{
+		int firstZ = 0;
+		int endZ = 0; // Cells of [firstZ, endZ), welded vertices of the edges leaving the samples at those z
+		uint32_t firstVertex = 0;
+		uint32_t vertexCount = 0;
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		std::vector<uint32_t> cells; // Cells with triangles in row order, x + sizeX * (y + sizeY * z)
+		std::vector<uint8_t> cubeIndices; // Their cases
+	};
+
+	struct BrickCells
+	{
+		uint32_t firstVertex = 0;
+		uint32_t vertexCount = 0;
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		std::vector<uint8_t> cubeIndices; // Case of every cell of the brick, x fastest, 0 without triangles
+		std::vector<uint16_t> ownedVertices; // Welded vertices the brick's earlier cells own, for cells with triangles
+	};
+
+	JobSystem& jobSystem;
+	std::vector<Slab> slabs;
+	std::vector<uint32_t> cellBricks; // Brick coordinates of brickCells, ascending
+	std::vector<BrickCells> brickCells;
+	std::vector<std::vector<uint32_t>> threadEdgeCaches; // Two z levels of welded vertices per worker
+};
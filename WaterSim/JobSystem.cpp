@@ -0,0 +1,144 @@
+#include "JobSystem.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <string>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool PinCurrentThread(unsigned int processor)
+{
+	if (processor >= std::thread::hardware_concurrency())
+		return false;
+
+#if defined(_WIN32)
+	// Only the calling thread's processor group is reachable through the mask
+	if (processor >= sizeof(DWORD_PTR) * 8)
+		return false;
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << processor) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(processor, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+JobSystem::JobSystem(unsigned int threadCount, int firstProcessor)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	this->threadCount = threadCount;
+
+	// Thread 0 is whoever calls ParallelFor
+	workers.reserve(threadCount - 1);
+	for (unsigned int i = 1; i < threadCount; i++)
+	{
+		workers.emplace_back(&JobSystem::WorkerLoop, this, i, firstProcessor < 0 ? -1 : firstProcessor + static_cast<int>(i));
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shuttingDown = true;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void JobSystem::ParallelFor(unsigned int count, unsigned int grainSize, const RangeFunction& func)
+{
+	if (count == 0)
+		return;
+
+	grainSize = std::max(1u, grainSize);
+	unsigned int chunks = (count + grainSize - 1) / grainSize;
+
+	// Not worth waking anyone up
+	if (workers.empty() || chunks == 1)
+	{
+		func(0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentJob = &func;
+		jobCount = count;
+		jobGrain = grainSize;
+		chunkCount = chunks;
+		nextChunk.store(0, std::memory_order_relaxed);
+		pendingWorkers = static_cast<unsigned int>(workers.size());
+		generation++;
+	}
+	wakeCondition.notify_all();
+
+	RunChunks(0);
+
+	// Every worker has to check in before func goes out of scope
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return pendingWorkers == 0; });
+	currentJob = nullptr;
+}
+
+void JobSystem::RunChunks(unsigned int threadIndex)
+{
+	PROFILE_SCOPE_ARG("ParallelFor", "items", jobCount);
+
+	while (true)
+	{
+		unsigned int chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+		if (chunk >= chunkCount)
+			break;
+
+		unsigned int begin = chunk * jobGrain;
+		unsigned int end = std::min(begin + jobGrain, jobCount);
+		(*currentJob)(begin, end, threadIndex);
+	}
+}
+
+void JobSystem::WorkerLoop(unsigned int threadIndex, int processor)
+{
+	uint64_t seenGeneration = 0;
+
+	if (processor >= 0)
+		PinCurrentThread(static_cast<unsigned int>(processor));
+
+	std::string threadName = "Worker " + std::to_string(threadIndex);
+	Profiler::SetThreadName(threadName.c_str());
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] { return shuttingDown || generation != seenGeneration; });
+
+			if (shuttingDown)
+				return;
+
+			seenGeneration = generation;
+		}
+
+		RunChunks(threadIndex);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pendingWorkers == 0)
+			doneCondition.notify_one();
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Pins the calling thread to one logical processor. False if the processor doesn't exist or the platform can't pin.
+bool PinCurrentThread(unsigned int processor);
+
+// Fixed pool of worker threads used by the CPU simulation passes.
+// The calling thread takes part in every ParallelFor as thread index 0, so a pool of one thread runs inline.
+class JobSystem
+{
+public:
+	using RangeFunction = std::function<void(unsigned int begin, unsigned int end, unsigned int threadIndex)>;
+
+	// threadCount of 0 uses std::thread::hardware_concurrency(). With firstProcessor set, worker i is pinned to
+	// logical processor firstProcessor + i. Thread 0 belongs to the caller, which pins itself if it wants to.
+	explicit JobSystem(unsigned int threadCount = 0, int firstProcessor = -1);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	unsigned int GetThreadCount() const { return threadCount; }
+
+	// Splits [0, count) into chunks of grainSize and blocks until every chunk has run.
+	// Not re-entrant: func must not call ParallelFor on the same JobSystem.
+	void ParallelFor(unsigned int count, unsigned int grainSize, const RangeFunction& func);
+
+private:
+	void WorkerLoop(unsigned int threadIndex, int processor);
+	void RunChunks(unsigned int threadIndex);
+
+	unsigned int threadCount = 1;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+
+	// Current job, only valid while a ParallelFor is in flight
+	const RangeFunction* currentJob = nullptr;
+	unsigned int jobCount = 0;
+	unsigned int jobGrain = 1;
+	unsigned int chunkCount = 0;
+	std::atomic<unsigned int> nextChunk{ 0 };
+
+	unsigned int pendingWorkers = 0;
+	uint64_t generation = 0;
+	bool shuttingDown = false;
+};
@@ -16,6 +16,8 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
         return -1;
     }
 
+    theApp->SetTimestep(&deltaTime);
+
     MSG msg = { 0 };
 
     // Main message and game loop
@@ -42,7 +44,17 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
         // Calculate timestep
         deltaTime.CalculateTimestep();
 
-        // Fixed timestep updates
+        // Fixed timestep updates, every owed step that fits in the frame budget
+        if (theApp->IsAdaptiveTimestep())
+        {
+            float owedTime = deltaTime.GetOwedTime();
+            if (owedTime > 0.0f)
+            {
+                theApp->UpdatePhysics(owedTime); // Physics, CFL substeps cover the owed time
+                deltaTime.ConsumeOwedTime();
+            }
+        }
+
         while (deltaTime.IsReadyForPhysicsUpdate())
         {
             theApp->UpdatePhysics(deltaTime.GetFixedTimeStep()); // Physics
@@ -54,6 +66,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
 
         theApp->Update();           // Camera
         theApp->Draw();             // Rendering
+        theApp->EndFrame();         // Profiler frame boundary
     }
 
     // Cleanup
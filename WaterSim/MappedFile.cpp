@@ -0,0 +1,104 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	// The mapping object keeps the file open
+	HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!fileMapping)
+		return false;
+
+	void* view = MapViewOfFile(fileMapping, FILE_MAP_COPY, 0, 0, 0);
+	if (!view)
+	{
+		CloseHandle(fileMapping);
+		return false;
+	}
+
+	mapping = fileMapping;
+	data = static_cast<unsigned char*>(view);
+	size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+
+	data = nullptr;
+	mapping = nullptr;
+	size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size == 0)
+	{
+		close(file);
+		return false;
+	}
+
+	// The mapping keeps its own reference to the file
+	void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	close(file);
+	if (view == MAP_FAILED)
+		return false;
+
+	data = static_cast<unsigned char*>(view);
+	size = static_cast<size_t>(status.st_size);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+		munmap(data, size);
+
+	data = nullptr;
+	size = 0;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Whole file mapped into memory, copy-on-write: writes through Data() stay private to this process and never
+// reach the file, so mapped data can be used in place as working memory.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// False if the file can't be opened, is empty or can't be mapped
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const { return data != nullptr; }
+	unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	unsigned char* data = nullptr;
+	size_t size = 0;
+
+	void* mapping = nullptr; // File mapping object on Windows, unused elsewhere
+};
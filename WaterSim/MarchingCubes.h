@@ -2,8 +2,11 @@
 
 #include "Includes.h"
 
-#include "MarchingCubeTable.h"
+#include "IsoSurface.h"
 #include "Particle.h"
+#include "ScalarField.h"
+
+#include <memory>
 
 
 using namespace DirectX;
@@ -17,14 +20,25 @@ public:
 	~MarchingCubes();
 
 
+    // Extracts the field's slabs in parallel, see IsoSurfaceExtractor
     void GenerateMarchingCubesMesh(
         const std::vector<float>& scalarField,
         int gridSizeX, int gridSizeY, int gridSizeZ,
         float cellSize,
         float isoLevel,
         std::vector<SimpleVertex>& outVertices,
-        std::vector<DWORD>& outIndices);
-
+        std::vector<DWORD>& outIndices,
+        IsoSurfaceVertices vertexMode = IsoSurfaceVertices::Separate);
+
+	// Only visits the cells around the volume's allocated bricks, in parallel over their bricks, see IsoSurfaceExtractor
+	void GenerateMarchingCubesMesh(
+		const BrickVolume& volume,
+		float isoLevel,
+		std::vector<SimpleVertex>& outVertices,
+		std::vector<DWORD>& outIndices,
+		IsoSurfaceVertices vertexMode = IsoSurfaceVertices::Separate);
+
+	// Splats each particle into the voxels it reaches, see ScalarFieldBuilder::Splat
 	std::vector<float> GenerateScalarField(
 		const std::vector<Particle*>& particles,
 		int gridSizeX, int gridSizeY, int gridSizeZ,
@@ -32,9 +46,13 @@ public:
 		float smoothingRadius, float isoLevel, XMFLOAT3 gridOrigin);
 
 private:
-
-	XMFLOAT3 VertexInterp(float isoLevel, const XMFLOAT3& p1, const XMFLOAT3& p2, float valp1, float valp2);
-
-
+	// Created on first use
+	void CreateWorkers();
+
+	std::unique_ptr<JobSystem> jobSystem;
+	std::unique_ptr<ScalarFieldBuilder> scalarFieldBuilder;
+	std::unique_ptr<IsoSurfaceExtractor> isoSurfaceExtractor;
+	std::vector<Float3> fieldPositions;
+	std::vector<float> fieldDensities;
 };
 
@@ -0,0 +1,92 @@
+#include "ParticleSoA.h"
+
+#include <algorithm>
+
+void ParticleSoA::Resize(unsigned int newCount)
+{
+	if (newCount > capacity)
+	{
+		unsigned int newCapacity = std::max(newCount, capacity * 2);
+		newCapacity = (newCapacity + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+		for (AlignedArray<float>* array : { &x, &y, &z, &vx, &vy, &vz, &density, &nearDensity, &pressure, &nearPressure })
+			array->Reallocate(newCapacity, count);
+
+		capacity = newCapacity;
+	}
+
+	count = newCount;
+}
+
+void ParticleSoA::Borrow(unsigned int newCount, unsigned int newCapacity, float* const attributes[8])
+{
+	AlignedArray<float>* borrowed[8] = { &x, &y, &z, &vx, &vy, &vz, &density, &nearDensity };
+	for (unsigned int i = 0; i < 8; i++)
+		borrowed[i]->Borrow(attributes[i]);
+
+	pressure.Reallocate(newCapacity, 0);
+	nearPressure.Reallocate(newCapacity, 0);
+
+	count = newCount;
+	capacity = newCapacity;
+}
+
+bool ParticleSoA::IsBorrowed() const
+{
+	// Borrow always replaces every attribute and Reallocate every array, so they agree
+	return x.IsBorrowed();
+}
+
+void ParticleSoA::Detach()
+{
+	if (!IsBorrowed())
+		return;
+
+	for (AlignedArray<float>* array : { &x, &y, &z, &vx, &vy, &vz, &density, &nearDensity })
+		array->Reallocate(capacity, count);
+}
+
+ParticleState ParticleSoA::Get(unsigned int index) const
+{
+	ParticleState particle;
+	particle.position = GetPosition(index);
+	particle.velocity = GetVelocity(index);
+	particle.density = density[index];
+	particle.nearDensity = nearDensity[index];
+	return particle;
+}
+
+void ParticleSoA::Set(unsigned int index, const ParticleState& particle)
+{
+	x[index] = particle.position.x;
+	y[index] = particle.position.y;
+	z[index] = particle.position.z;
+
+	vx[index] = particle.velocity.x;
+	vy[index] = particle.velocity.y;
+	vz[index] = particle.velocity.z;
+
+	density[index] = particle.density;
+	nearDensity[index] = particle.nearDensity;
+}
+
+void ParticleSoA::Copy(unsigned int index, const ParticleSoA& source, unsigned int sourceIndex)
+{
+	x[index] = source.x[sourceIndex];
+	y[index] = source.y[sourceIndex];
+	z[index] = source.z[sourceIndex];
+
+	vx[index] = source.vx[sourceIndex];
+	vy[index] = source.vy[sourceIndex];
+	vz[index] = source.vz[sourceIndex];
+
+	density[index] = source.density[sourceIndex];
+	nearDensity[index] = source.nearDensity[sourceIndex];
+	pressure[index] = source.pressure[sourceIndex];
+	nearPressure[index] = source.nearPressure[sourceIndex];
+}
+
+size_t ParticleSoA::GetMemoryUsage() const
+{
+	return static_cast<size_t>(capacity) * sizeof(float) * 10;
+}
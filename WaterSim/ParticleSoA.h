@@ -0,0 +1,104 @@
+#pragma once
+
+#include "SPHCommon.h"
+
+#include <cstddef>
+#include <memory>
+
+// Heap array aligned for full-width vector loads, zero-filled on growth.
+// Can also borrow memory it doesn't own, which is never freed here and is copied out of on the next Reallocate.
+template <typename T>
+class AlignedArray
+{
+public:
+	static constexpr size_t alignment = 64;
+
+	AlignedArray() = default;
+
+	T* data() { return values.get(); }
+	const T* data() const { return values.get(); }
+
+	T& operator[](size_t index) { return values[index]; }
+	const T& operator[](size_t index) const { return values[index]; }
+
+	// Keeps the first keepCount elements, everything past them is zeroed
+	void Reallocate(size_t capacity, size_t keepCount)
+	{
+		T* memory = static_cast<T*>(::operator new[](capacity * sizeof(T), std::align_val_t(alignment)));
+		for (size_t i = 0; i < capacity; i++)
+			memory[i] = (i < keepCount && values) ? values[i] : T();
+
+		values = std::unique_ptr<T[], Deleter>(memory, Deleter{ true });
+	}
+
+	// memory must be aligned and outlive this array or its next Reallocate
+	void Borrow(T* memory) { values = std::unique_ptr<T[], Deleter>(memory, Deleter{ false }); }
+	bool IsBorrowed() const { return values && !values.get_deleter().owned; }
+
+private:
+	struct Deleter
+	{
+		bool owned = true;
+
+		void operator()(T* memory) const
+		{
+			if (owned)
+				::operator delete[](memory, std::align_val_t(alignment));
+		}
+	};
+
+	std::unique_ptr<T[], Deleter> values;
+};
+
+// Structure-of-arrays particle store used by the CPU backend.
+// The neighbour loops only touch the attributes they need (positions for density, positions,
+// velocities and pressures for the pressure force) instead of pulling whole ParticleAttributes.
+// Every array is 64-byte aligned and padded to a multiple of SIMD_WIDTH so kernels can run full vectors.
+class ParticleSoA
+{
+public:
+	// Lanes in the widest kernel (AVX-512 floats)
+	static constexpr unsigned int SIMD_WIDTH = 16;
+
+	ParticleSoA() = default;
+
+	// Grows geometrically and keeps existing particles
+	void Resize(unsigned int count);
+
+	// Uses attributes[i] for x, y, z, vx, vy, vz, density and nearDensity in that order, e.g. straight out of a mapped
+	// checkpoint. Each needs capacity floats and must stay valid until Detach or a Resize past capacity.
+	// The derived pressures get fresh storage.
+	void Borrow(unsigned int count, unsigned int capacity, float* const attributes[8]);
+	bool IsBorrowed() const;
+
+	// Copies borrowed attributes into owned storage
+	void Detach();
+
+	unsigned int Size() const { return count; }
+	unsigned int Capacity() const { return capacity; }
+
+	ParticleState Get(unsigned int index) const;
+	void Set(unsigned int index, const ParticleState& particle);
+
+	// Copies every attribute of source[sourceIndex] into index
+	void Copy(unsigned int index, const ParticleSoA& source, unsigned int sourceIndex);
+
+	Float3 GetPosition(unsigned int index) const { return { x[index], y[index], z[index] }; }
+	Float3 GetVelocity(unsigned int index) const { return { vx[index], vy[index], vz[index] }; }
+
+	size_t GetMemoryUsage() const;
+
+public:
+	AlignedArray<float> x, y, z;
+	AlignedArray<float> vx, vy, vz;
+	AlignedArray<float> density;
+	AlignedArray<float> nearDensity;
+
+	// Derived per step from density / nearDensity so the pressure kernel doesn't recompute them per neighbour
+	AlignedArray<float> pressure;
+	AlignedArray<float> nearPressure;
+
+private:
+	unsigned int count = 0;
+	unsigned int capacity = 0;
+};
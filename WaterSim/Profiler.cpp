@@ -0,0 +1,202 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+std::atomic<bool> Profiler::enabledFlag{ false };
+std::atomic<uint64_t> Profiler::frameIndex{ 0 };
+
+std::mutex Profiler::tracksMutex;
+std::vector<std::unique_ptr<ProfileTrack>> Profiler::tracks;
+
+ProfileTrack::ProfileTrack(uint32_t id, std::string name)
+	:
+	id(id),
+	name(std::move(name)),
+	events(new ProfileEvent[CAPACITY])
+{
+}
+
+void ProfileTrack::Drain(std::vector<ProfileEvent>& outEvents)
+{
+	uint64_t end = head.load(std::memory_order_acquire);
+	uint64_t begin = std::max(readPosition, end > CAPACITY ? end - CAPACITY : 0);
+	dropped += begin - readPosition;
+
+	size_t firstCopied = outEvents.size();
+	for (uint64_t position = begin; position < end; position++)
+		outEvents.push_back(events[position & (CAPACITY - 1)]);
+
+	// The producer may have lapped the oldest slots while they were being copied, throw those away
+	uint64_t after = head.load(std::memory_order_acquire);
+	uint64_t firstIntact = after > CAPACITY ? after - CAPACITY : 0;
+	if (firstIntact > begin)
+	{
+		uint64_t torn = std::min(firstIntact, end) - begin;
+		outEvents.erase(outEvents.begin() + firstCopied, outEvents.begin() + firstCopied + static_cast<size_t>(torn));
+		dropped += torn;
+	}
+
+	readPosition = end;
+}
+
+void Profiler::BeginFrame()
+{
+	frameIndex.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Profiler::Now()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+ProfileTrack& Profiler::AddTrack(std::string name)
+{
+	std::lock_guard<std::mutex> lock(tracksMutex);
+	uint32_t id = static_cast<uint32_t>(tracks.size());
+	if (name.empty())
+		name = "Thread " + std::to_string(id);
+
+	tracks.push_back(std::make_unique<ProfileTrack>(id, std::move(name)));
+	return *tracks.back();
+}
+
+ProfileTrack& Profiler::GetThreadTrack()
+{
+	// Only the first scope on a thread takes the lock
+	thread_local ProfileTrack* track = &AddTrack(std::string());
+	return *track;
+}
+
+void Profiler::SetThreadName(const char* name)
+{
+	ProfileTrack& track = GetThreadTrack();
+
+	std::lock_guard<std::mutex> lock(tracksMutex);
+	track.SetName(name);
+}
+
+ProfileTrack& Profiler::CreateTrack(const char* name)
+{
+	return AddTrack(name);
+}
+
+void Profiler::Record(ProfileTrack& track, const char* name, uint64_t startNs, uint64_t endNs, uint32_t depth, uint64_t frame,
+	const char* argName, int64_t argValue)
+{
+	ProfileEvent event;
+	event.name = name;
+	event.startNs = startNs;
+	event.endNs = endNs;
+	event.frame = frame;
+	event.track = track.GetId();
+	event.depth = depth;
+	event.argName = argName;
+	event.argValue = argValue;
+	track.Push(event);
+}
+
+void Profiler::Collect(std::vector<ProfileEvent>& outEvents)
+{
+	std::lock_guard<std::mutex> lock(tracksMutex);
+	for (std::unique_ptr<ProfileTrack>& track : tracks)
+		track->Drain(outEvents);
+}
+
+std::string Profiler::GetTrackName(uint32_t track)
+{
+	std::lock_guard<std::mutex> lock(tracksMutex);
+	return track < tracks.size() ? tracks[track]->GetName() : std::string();
+}
+
+ProfilerHistory::ProfilerHistory(unsigned int delay)
+	:
+	delay(delay)
+{
+}
+
+void ProfilerHistory::Update()
+{
+	collected.clear();
+	Profiler::Collect(collected);
+	pending.insert(pending.end(), collected.begin(), collected.end());
+
+	// Frames that never advance (nobody calls BeginFrame) must not grow this forever
+	constexpr size_t maxPending = 1 << 20;
+	if (pending.size() > maxPending)
+		pending.erase(pending.begin(), pending.end() - maxPending);
+
+	uint64_t newestFrame = Profiler::GetFrameIndex();
+	if (newestFrame < delay)
+		return;
+
+	uint64_t lastFrameToFold = newestFrame - delay;
+
+	// Nothing useful to fold from frames older than the whole history, e.g. after the profiler was off for a while
+	if (lastFrameToFold > nextFrameToFold + HISTORY_LENGTH)
+		nextFrameToFold = lastFrameToFold - HISTORY_LENGTH;
+
+	while (nextFrameToFold <= lastFrameToFold)
+		FoldFrame(nextFrameToFold++);
+}
+
+void ProfilerHistory::FoldFrame(uint64_t frame)
+{
+	std::vector<ProfileEvent> frameEvents;
+
+	auto firstLater = std::partition(pending.begin(), pending.end(), [&](const ProfileEvent& event) { return event.frame <= frame; });
+	for (auto it = pending.begin(); it != firstLater; ++it)
+	{
+		if (it->frame == frame)
+			frameEvents.push_back(*it);
+	}
+	pending.erase(pending.begin(), firstLater);
+
+	for (ScopeStats& scope : scopes)
+	{
+		std::memmove(scope.history, scope.history + 1, sizeof(float) * (HISTORY_LENGTH - 1));
+		scope.history[HISTORY_LENGTH - 1] = 0.0f;
+	}
+
+	for (const ProfileEvent& event : frameEvents)
+	{
+		auto scope = std::find_if(scopes.begin(), scopes.end(), [&](const ScopeStats& stats)
+		{
+			return stats.track == event.track && std::strcmp(stats.name, event.name) == 0;
+		});
+
+		if (scope == scopes.end())
+		{
+			ScopeStats stats;
+			stats.track = event.track;
+			stats.name = event.name;
+			scopes.push_back(stats);
+			scope = scopes.end() - 1;
+		}
+
+		scope->history[HISTORY_LENGTH - 1] += (event.endNs - event.startNs) * 1e-6f;
+	}
+
+	for (ScopeStats& scope : scopes)
+	{
+		float sum = 0.0f;
+		for (float value : scope.history)
+			sum += value;
+
+		scope.average = sum / HISTORY_LENGTH;
+		scope.last = scope.history[HISTORY_LENGTH - 1];
+	}
+
+	std::sort(frameEvents.begin(), frameEvents.end(), [](const ProfileEvent& a, const ProfileEvent& b)
+	{
+		return a.track != b.track ? a.track < b.track : a.startNs < b.startNs;
+	});
+
+	if (!frameEvents.empty())
+	{
+		timelineFrame = std::move(frameEvents);
+		timelineFrameIndex = frame;
+	}
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped wall-clock profiler.
+// Every thread records into its own fixed-size ring buffer with a single atomic store per scope, readers drain all
+// buffers through Profiler::Collect. When the profiler is disabled a scope costs one relaxed load and a branch,
+// building with WATERSIM_PROFILER=0 removes the scopes entirely.
+
+#ifndef WATERSIM_PROFILER
+#define WATERSIM_PROFILER 1
+#endif
+
+struct ProfileEvent
+{
+	const char* name; // Must outlive the profiler, normally a string literal
+	uint64_t startNs;
+	uint64_t endNs;
+	uint64_t frame; // Profiler frame the scope started in
+	uint32_t track;
+	uint32_t depth; // Nesting level within the track
+	const char* argName; // Optional numeric argument, e.g. the particle count, null when there is none
+	int64_t argValue;
+};
+
+// One producer (the owning thread, or whoever feeds a custom track such as GPU timestamps) and one consumer.
+// The producer never waits: when the consumer falls behind the oldest events are overwritten and counted as dropped.
+class ProfileTrack
+{
+public:
+	static constexpr uint32_t CAPACITY = 1 << 14;
+
+	ProfileTrack(uint32_t id, std::string name);
+
+	uint32_t GetId() const { return id; }
+	// Guarded by the profiler's track lock
+	const std::string& GetName() const { return name; }
+	void SetName(std::string newName) { name = std::move(newName); }
+
+	void Push(const ProfileEvent& event)
+	{
+		uint64_t position = head.load(std::memory_order_relaxed);
+		events[position & (CAPACITY - 1)] = event;
+		head.store(position + 1, std::memory_order_release);
+	}
+
+	// Appends everything pushed since the last drain, consumer side only
+	void Drain(std::vector<ProfileEvent>& outEvents);
+
+	uint64_t GetDroppedCount() const { return dropped; }
+
+	// Current nesting level of scopes on this track, only touched by the producer
+	uint32_t depth = 0;
+
+private:
+	uint32_t id;
+	std::string name;
+
+	std::unique_ptr<ProfileEvent[]> events;
+	std::atomic<uint64_t> head{ 0 };
+
+	uint64_t readPosition = 0;
+	uint64_t dropped = 0;
+};
+
+class Profiler
+{
+public:
+	static void SetEnabled(bool enabled) { enabledFlag.store(enabled, std::memory_order_relaxed); }
+	static bool IsEnabled() { return enabledFlag.load(std::memory_order_relaxed); }
+
+	// Call once per rendered frame (or benchmark step), events are tagged with the current frame
+	static void BeginFrame();
+	static uint64_t GetFrameIndex() { return frameIndex.load(std::memory_order_relaxed); }
+
+	// Nanoseconds on the steady clock, the timebase of every event
+	static uint64_t Now();
+
+	// Track of the calling thread, created on first use. Names it when it doesn't have one yet.
+	static ProfileTrack& GetThreadTrack();
+	static void SetThreadName(const char* name);
+
+	// Extra track fed by something other than a thread's scopes, e.g. resolved GPU timestamps
+	static ProfileTrack& CreateTrack(const char* name);
+
+	static void Record(ProfileTrack& track, const char* name, uint64_t startNs, uint64_t endNs, uint32_t depth, uint64_t frame,
+		const char* argName = nullptr, int64_t argValue = 0);
+
+	// Drains every track, a single consumer at a time
+	static void Collect(std::vector<ProfileEvent>& outEvents);
+
+	// Name of a track id found in an event
+	static std::string GetTrackName(uint32_t track);
+
+private:
+	static ProfileTrack& AddTrack(std::string name);
+
+	static std::atomic<bool> enabledFlag;
+	static std::atomic<uint64_t> frameIndex;
+
+	static std::mutex tracksMutex;
+	static std::vector<std::unique_ptr<ProfileTrack>> tracks;
+};
+
+// Records the enclosing scope on the calling thread's track
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name, const char* argName = nullptr, int64_t argValue = 0)
+	{
+		if (!Profiler::IsEnabled())
+			return;
+
+		this->name = name;
+		this->argName = argName;
+		this->argValue = argValue;
+		track = &Profiler::GetThreadTrack();
+		depth = track->depth++;
+		frame = Profiler::GetFrameIndex();
+		startNs = Profiler::Now();
+	}
+
+	~ProfileScope()
+	{
+		if (!name)
+			return;
+
+		track->depth--;
+		Profiler::Record(*track, name, startNs, Profiler::Now(), depth, frame, argName, argValue);
+	}
+
+	// Replaces the argument, for values only known once the scope has started
+	void SetArg(const char* newArgName, int64_t newArgValue)
+	{
+		argName = newArgName;
+		argValue = newArgValue;
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* name = nullptr;
+	const char* argName = nullptr;
+	int64_t argValue = 0;
+	ProfileTrack* track = nullptr;
+	uint32_t depth = 0;
+	uint64_t frame = 0;
+	uint64_t startNs = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if WATERSIM_PROFILER
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __COUNTER__)(name)
+#define PROFILE_SCOPE_ARG(name, argName, argValue) ProfileScope PROFILE_CONCAT(profileScope, __COUNTER__)(name, argName, static_cast<int64_t>(argValue))
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_SCOPE_ARG(name, argName, argValue)
+#endif
+
+// Rolling per-scope statistics and recent frames for the debug UI.
+// A frame is only folded in once it is delay frames old, so late producers (GPU timestamps) have landed.
+class ProfilerHistory
+{
+public:
+	static constexpr unsigned int HISTORY_LENGTH = 120;
+
+	struct ScopeStats
+	{
+		uint32_t track;
+		const char* name;
+		float history[HISTORY_LENGTH] = {}; // Total milliseconds per frame, oldest first
+		float average = 0.0f;
+		float last = 0.0f;
+	};
+
+	explicit ProfilerHistory(unsigned int delay = 4);
+
+	// Drains the profiler, call once per frame from the thread that owns the history
+	void Update();
+
+	// Everything the last Update drained, for other consumers such as the trace exporter
+	const std::vector<ProfileEvent>& GetCollected() const { return collected; }
+
+	const std::vector<ScopeStats>& GetScopes() const { return scopes; }
+
+	// Events of the newest folded frame, sorted by track then start time
+	const std::vector<ProfileEvent>& GetTimelineFrame() const { return timelineFrame; }
+	uint64_t GetTimelineFrameIndex() const { return timelineFrameIndex; }
+
+private:
+	void FoldFrame(uint64_t frame);
+
+	unsigned int delay;
+	std::vector<ProfileEvent> pending;
+	std::vector<ProfileEvent> collected;
+	std::vector<ScopeStats> scopes;
+
+	std::vector<ProfileEvent> timelineFrame;
+	uint64_t timelineFrameIndex = 0;
+	uint64_t nextFrameToFold = 0;
+};
@@ -0,0 +1,180 @@
+#include "ProfilerView.h"
+
+#include "imgui/imgui.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <string>
+
+namespace
+{
+	// Stable colour per scope name so a stage keeps its colour across frames
+	ImU32 GetScopeColour(const char* name)
+	{
+		uint32_t hash = 2166136261u;
+		for (const char* c = name; *c; c++)
+			hash = (hash ^ static_cast<unsigned char>(*c)) * 16777619u;
+
+		float hue = (hash % 360) / 360.0f;
+		float r, g, b;
+		ImGui::ColorConvertHSVtoRGB(hue, 0.55f, 0.85f, r, g, b);
+		return ImGui::ColorConvertFloat4ToU32(ImVec4(r, g, b, 1.0f));
+	}
+
+	void DrawTimeline(const ProfilerHistory& history)
+	{
+		const std::vector<ProfileEvent>& events = history.GetTimelineFrame();
+		if (events.empty())
+		{
+			ImGui::TextDisabled("No frames recorded yet");
+			return;
+		}
+
+		uint64_t frameStart = events.front().startNs;
+		uint64_t frameEnd = events.front().endNs;
+		uint32_t trackCount = 0;
+		uint32_t maxDepth = 0;
+		for (const ProfileEvent& event : events)
+		{
+			frameStart = std::min(frameStart, event.startNs);
+			frameEnd = std::max(frameEnd, event.endNs);
+			trackCount = std::max(trackCount, event.track + 1);
+			maxDepth = std::max(maxDepth, event.depth);
+		}
+
+		double frameLength = static_cast<double>(std::max<uint64_t>(frameEnd - frameStart, 1));
+		ImGui::Text("Frame %llu, %.3f ms", static_cast<unsigned long long>(history.GetTimelineFrameIndex()), frameLength * 1e-6);
+
+		const float labelWidth = 90.0f;
+		const float barHeight = ImGui::GetTextLineHeight() + 2.0f;
+		const float rowHeight = barHeight * (maxDepth + 1) + 4.0f;
+
+		ImVec2 origin = ImGui::GetCursorScreenPos();
+		float width = std::max(ImGui::GetContentRegionAvail().x - labelWidth, 50.0f);
+		float height = rowHeight * trackCount;
+
+		ImDrawList* drawList = ImGui::GetWindowDrawList();
+		ImGui::InvisibleButton("ProfilerTimeline", ImVec2(labelWidth + width, height));
+		bool hovered = ImGui::IsItemHovered();
+		ImVec2 mouse = ImGui::GetMousePos();
+
+		// Track rows only exist for tracks that recorded something this frame
+		std::vector<bool> usedTracks(trackCount, false);
+		for (const ProfileEvent& event : events)
+			usedTracks[event.track] = true;
+
+		for (uint32_t track = 0; track < trackCount; track++)
+		{
+			if (!usedTracks[track])
+				continue;
+
+			float rowY = origin.y + track * rowHeight;
+			drawList->AddRectFilled(ImVec2(origin.x, rowY), ImVec2(origin.x + labelWidth + width, rowY + rowHeight - 2.0f), IM_COL32(40, 40, 40, 255));
+			drawList->AddText(ImVec2(origin.x + 2.0f, rowY + 2.0f), IM_COL32(220, 220, 220, 255), Profiler::GetTrackName(track).c_str());
+		}
+
+		const ProfileEvent* hoveredEvent = nullptr;
+		for (const ProfileEvent& event : events)
+		{
+			float x0 = origin.x + labelWidth + static_cast<float>((event.startNs - frameStart) / frameLength * width);
+			float x1 = origin.x + labelWidth + static_cast<float>((event.endNs - frameStart) / frameLength * width);
+			x1 = std::max(x1, x0 + 1.0f);
+
+			float y0 = origin.y + event.track * rowHeight + 2.0f + event.depth * barHeight;
+			float y1 = y0 + barHeight - 1.0f;
+
+			drawList->AddRectFilled(ImVec2(x0, y0), ImVec2(x1, y1), GetScopeColour(event.name));
+
+			// Only label bars wide enough to read
+			ImVec2 textSize = ImGui::CalcTextSize(event.name);
+			if (x1 - x0 > textSize.x + 4.0f)
+				drawList->AddText(ImVec2(x0 + 2.0f, y0), IM_COL32(0, 0, 0, 255), event.name);
+
+			if (hovered && mouse.x >= x0 && mouse.x < x1 && mouse.y >= y0 && mouse.y < y1)
+				hoveredEvent = &event;
+		}
+
+		if (hoveredEvent)
+		{
+			ImGui::BeginTooltip();
+			ImGui::Text("%s", hoveredEvent->name);
+			ImGui::Text("%s", Profiler::GetTrackName(hoveredEvent->track).c_str());
+			ImGui::Text("%.3f ms", (hoveredEvent->endNs - hoveredEvent->startNs) * 1e-6);
+			ImGui::EndTooltip();
+		}
+	}
+
+	void DrawTraceCapture(ChromeTraceExporter& exporter)
+	{
+		static char tracePath[260] = "WaterSimTrace.json";
+
+		if (!exporter.IsCapturing())
+		{
+			ImGui::InputText("Trace File", tracePath, sizeof(tracePath));
+			if (ImGui::Button("Start Trace Capture"))
+			{
+				// A capture without events is useless, so it turns the profiler on
+				if (exporter.Start(tracePath))
+					Profiler::SetEnabled(true);
+			}
+			return;
+		}
+
+		ImGui::Text("Capturing to %s (%llu events written)", exporter.GetPath().c_str(), static_cast<unsigned long long>(exporter.GetEventCount()));
+		if (ImGui::Button("Stop Trace Capture"))
+			exporter.Stop();
+	}
+
+	void DrawScopeTable(const ProfilerHistory& history)
+	{
+		const std::vector<ProfilerHistory::ScopeStats>& scopes = history.GetScopes();
+		if (scopes.empty())
+			return;
+
+		if (!ImGui::BeginTable("ProfilerScopes", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingStretchProp))
+			return;
+
+		ImGui::TableSetupColumn("Scope");
+		ImGui::TableSetupColumn("Avg ms");
+		ImGui::TableSetupColumn("Last ms");
+		ImGui::TableSetupColumn("History");
+		ImGui::TableHeadersRow();
+
+		for (const ProfilerHistory::ScopeStats& scope : scopes)
+		{
+			ImGui::PushID(&scope);
+			ImGui::TableNextRow();
+
+			ImGui::TableNextColumn();
+			std::string trackName = Profiler::GetTrackName(scope.track);
+			ImGui::Text("%s / %s", trackName.c_str(), scope.name);
+
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", scope.average);
+
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", scope.last);
+
+			ImGui::TableNextColumn();
+			ImGui::SetNextItemWidth(-FLT_MIN);
+			ImGui::PlotLines("##History", scope.history, ProfilerHistory::HISTORY_LENGTH, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, ImGui::GetTextLineHeight()));
+
+			ImGui::PopID();
+		}
+
+		ImGui::EndTable();
+	}
+}
+
+void DrawProfilerView(ProfilerHistory& history, ChromeTraceExporter* exporter)
+{
+	bool enabled = Profiler::IsEnabled();
+	if (ImGui::Checkbox("Enable Profiler", &enabled))
+		Profiler::SetEnabled(enabled);
+
+	if (exporter)
+		DrawTraceCapture(*exporter);
+
+	DrawTimeline(history);
+	DrawScopeTable(history);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Profiler.h"
+#include "ChromeTraceExporter.h"
+
+// ImGui panel for the profiler: enable toggle, trace capture, timeline of the newest complete frame and per-scope timings.
+// exporter may be null to hide the capture controls.
+void DrawProfilerView(ProfilerHistory& history, ChromeTraceExporter* exporter = nullptr);
@@ -0,0 +1,347 @@
+#include "Recording.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	uint64_t ZigZag(int64_t value)
+	{
+		return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+	}
+
+	int64_t UnZigZag(uint64_t value)
+	{
+		return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+	}
+
+	void WriteVarint(std::vector<uint8_t>& out, int64_t signedValue)
+	{
+		uint64_t value = ZigZag(signedValue);
+		while (value >= 0x80)
+		{
+			out.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(value));
+	}
+
+	// Bounds checked, a read past the end clears ok and returns 0
+	struct PayloadReader
+	{
+		const uint8_t* data;
+		const uint8_t* end;
+		bool ok = true;
+
+		int64_t ReadVarint()
+		{
+			uint64_t value = 0;
+			for (unsigned int shift = 0; shift < 64; shift += 7)
+			{
+				if (data == end)
+					break;
+
+				uint8_t byte = *data++;
+				value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				if (!(byte & 0x80))
+					return UnZigZag(value);
+			}
+
+			ok = false;
+			return 0;
+		}
+
+		uint16_t ReadUInt16()
+		{
+			if (end - data < 2)
+			{
+				ok = false;
+				return 0;
+			}
+
+			uint16_t value = static_cast<uint16_t>(data[0] | (data[1] << 8));
+			data += 2;
+			return value;
+		}
+	};
+
+	int32_t Quantise(double value, double scale)
+	{
+		double steps = std::round(value * scale);
+		return static_cast<int32_t>(std::clamp(steps, -2147483648.0, 2147483647.0));
+	}
+
+	// Absolute position as cell index plus the raw 16-bit offset inside the cell, and the velocity
+	void WriteAbsolute(std::vector<uint8_t>& out, const int32_t* position, const int32_t* velocity)
+	{
+		for (unsigned int axis = 0; axis < 3; axis++)
+		{
+			WriteVarint(out, position[axis] >> 16);
+			uint16_t offset = static_cast<uint16_t>(position[axis] & 0xFFFF);
+			out.push_back(static_cast<uint8_t>(offset));
+			out.push_back(static_cast<uint8_t>(offset >> 8));
+		}
+
+		for (unsigned int axis = 0; axis < 3; axis++)
+			WriteVarint(out, velocity[axis]);
+	}
+
+	void ReadAbsolute(PayloadReader& reader, int32_t* position, int32_t* velocity)
+	{
+		for (unsigned int axis = 0; axis < 3; axis++)
+		{
+			int64_t cell = reader.ReadVarint();
+			uint16_t offset = reader.ReadUInt16();
+			position[axis] = static_cast<int32_t>(static_cast<uint32_t>(cell) << 16 | offset);
+		}
+
+		for (unsigned int axis = 0; axis < 3; axis++)
+			velocity[axis] = static_cast<int32_t>(reader.ReadVarint());
+	}
+
+	// The integrator moves particles by their new velocity, so that is what the previous position is advanced by
+	int64_t Predict(int32_t position, int32_t velocity, double predictionScale)
+	{
+		return position + std::llround(velocity * predictionScale);
+	}
+}
+
+RecordingHeader MakeRecordingHeader(float smoothingRadius, uint32_t keyframeInterval)
+{
+	RecordingHeader header = {};
+	std::memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+	header.version = RECORDING_VERSION;
+	header.headerSize = sizeof(RecordingHeader);
+
+	// The CPU backend's world box
+	header.origin = { -50.0f, -30.0f, -50.0f };
+	header.cellSize = SMOOTHING_RADIUS;
+	header.velocityStep = 1.0f / 256.0f;
+	header.keyframeInterval = std::max(1u, keyframeInterval);
+	header.smoothingRadius = smoothingRadius;
+	return header;
+}
+
+void QuantiseFrame(const RecordingHeader& header, const ParticleState* particles, const uint8_t* active, uint32_t idCount,
+	uint64_t stepIndex, double simulatedTime, QuantisedFrame& outFrame)
+{
+	outFrame.idCount = idCount;
+	outFrame.stepIndex = stepIndex;
+	outFrame.simulatedTime = simulatedTime;
+	outFrame.active.resize(idCount);
+	outFrame.positions.resize(size_t(idCount) * 3);
+	outFrame.velocities.resize(size_t(idCount) * 3);
+
+	double positionScale = RECORDING_CELL_STEPS / double(header.cellSize);
+	double velocityScale = 1.0 / header.velocityStep;
+
+	for (uint32_t id = 0; id < idCount; id++)
+	{
+		bool isActive = !active || active[id];
+		outFrame.active[id] = isActive;
+
+		int32_t* position = &outFrame.positions[size_t(id) * 3];
+		int32_t* velocity = &outFrame.velocities[size_t(id) * 3];
+
+		if (!isActive)
+		{
+			std::fill(position, position + 3, 0);
+			std::fill(velocity, velocity + 3, 0);
+			continue;
+		}
+
+		const ParticleState& particle = particles[id];
+		position[0] = Quantise(double(particle.position.x) - header.origin.x, positionScale);
+		position[1] = Quantise(double(particle.position.y) - header.origin.y, positionScale);
+		position[2] = Quantise(double(particle.position.z) - header.origin.z, positionScale);
+		velocity[0] = Quantise(particle.velocity.x, velocityScale);
+		velocity[1] = Quantise(particle.velocity.y, velocityScale);
+		velocity[2] = Quantise(particle.velocity.z, velocityScale);
+	}
+}
+
+void DequantisePositions(const RecordingHeader& header, const QuantisedFrame& frame, std::vector<Float4>& outPositions)
+{
+	outPositions.resize(frame.idCount);
+	double positionStep = double(header.cellSize) / RECORDING_CELL_STEPS;
+
+	for (uint32_t id = 0; id < frame.idCount; id++)
+	{
+		if (!frame.active[id])
+		{
+			outPositions[id] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			continue;
+		}
+
+		const int32_t* position = &frame.positions[size_t(id) * 3];
+		outPositions[id] = {
+			static_cast<float>(header.origin.x + position[0] * positionStep),
+			static_cast<float>(header.origin.y + position[1] * positionStep),
+			static_cast<float>(header.origin.z + position[2] * positionStep),
+			1.0f
+		};
+	}
+}
+
+void DequantiseParticles(const RecordingHeader& header, const QuantisedFrame& frame, std::vector<ParticleState>& outParticles)
+{
+	outParticles.assign(frame.idCount, ParticleState());
+	double positionStep = double(header.cellSize) / RECORDING_CELL_STEPS;
+
+	for (uint32_t id = 0; id < frame.idCount; id++)
+	{
+		if (!frame.active[id])
+			continue;
+
+		const int32_t* position = &frame.positions[size_t(id) * 3];
+		const int32_t* velocity = &frame.velocities[size_t(id) * 3];
+
+		ParticleState& particle = outParticles[id];
+		particle.position = {
+			static_cast<float>(header.origin.x + position[0] * positionStep),
+			static_cast<float>(header.origin.y + position[1] * positionStep),
+			static_cast<float>(header.origin.z + position[2] * positionStep)
+		};
+		particle.velocity = { velocity[0] * header.velocityStep, velocity[1] * header.velocityStep, velocity[2] * header.velocityStep };
+	}
+}
+
+void EncodeFrame(const RecordingHeader& header, const QuantisedFrame& frame, const QuantisedFrame* reference, std::vector<uint8_t>& out)
+{
+	RecordingFrameHeader frameHeader = {};
+	frameHeader.type = reference ? RecordingFrameType::Delta : RecordingFrameType::Keyframe;
+	frameHeader.idCount = frame.idCount;
+	frameHeader.activeCount = static_cast<uint32_t>(std::count(frame.active.begin(), frame.active.end(), uint8_t(1)));
+	frameHeader.stepIndex = frame.stepIndex;
+	frameHeader.simulatedTime = frame.simulatedTime;
+
+	bool sameActive = reference && reference->idCount == frame.idCount && reference->active == frame.active;
+	if (sameActive)
+		frameHeader.flags |= RECORDING_FRAME_SAME_ACTIVE;
+
+	// Stored rather than recomputed by the decoder, so both sides predict with exactly the same number
+	if (reference)
+	{
+		double positionStep = double(header.cellSize) / RECORDING_CELL_STEPS;
+		frameHeader.predictionScale = (frame.simulatedTime - reference->simulatedTime) * header.velocityStep / positionStep;
+	}
+
+	size_t headerStart = out.size();
+	out.resize(headerStart + sizeof(RecordingFrameHeader));
+	size_t payloadStart = out.size();
+
+	if (!sameActive)
+	{
+		size_t maskStart = out.size();
+		out.resize(maskStart + (frame.idCount + 7) / 8, 0);
+		for (uint32_t id = 0; id < frame.idCount; id++)
+			if (frame.active[id])
+				out[maskStart + id / 8] |= static_cast<uint8_t>(1 << (id % 8));
+	}
+
+	for (uint32_t id = 0; id < frame.idCount; id++)
+	{
+		if (!frame.active[id])
+			continue;
+
+		const int32_t* position = &frame.positions[size_t(id) * 3];
+		const int32_t* velocity = &frame.velocities[size_t(id) * 3];
+
+		// Particles that just appeared have nothing to be predicted from
+		if (!reference || id >= reference->idCount || !reference->active[id])
+		{
+			WriteAbsolute(out, position, velocity);
+			continue;
+		}
+
+		const int32_t* previousPosition = &reference->positions[size_t(id) * 3];
+		const int32_t* previousVelocity = &reference->velocities[size_t(id) * 3];
+
+		for (unsigned int axis = 0; axis < 3; axis++)
+			WriteVarint(out, int64_t(velocity[axis]) - previousVelocity[axis]);
+
+		for (unsigned int axis = 0; axis < 3; axis++)
+			WriteVarint(out, position[axis] - Predict(previousPosition[axis], velocity[axis], frameHeader.predictionScale));
+	}
+
+	frameHeader.payloadSize = out.size() - payloadStart;
+	std::memcpy(out.data() + headerStart, &frameHeader, sizeof(frameHeader));
+}
+
+size_t DecodeFrame(const uint8_t* data, size_t size, const QuantisedFrame* reference, QuantisedFrame& outFrame)
+{
+	RecordingFrameHeader frameHeader;
+	if (size < sizeof(frameHeader))
+		return 0;
+
+	std::memcpy(&frameHeader, data, sizeof(frameHeader));
+	if (frameHeader.payloadSize > size - sizeof(frameHeader))
+		return 0;
+
+	bool isDelta = frameHeader.type == RecordingFrameType::Delta;
+	bool sameActive = (frameHeader.flags & RECORDING_FRAME_SAME_ACTIVE) != 0;
+	if ((isDelta || sameActive) && (!reference || (sameActive && reference->idCount != frameHeader.idCount)))
+		return 0;
+
+	if (!isDelta)
+		reference = nullptr;
+
+	PayloadReader reader = { data + sizeof(frameHeader), data + sizeof(frameHeader) + frameHeader.payloadSize };
+
+	uint32_t idCount = frameHeader.idCount;
+	outFrame.idCount = idCount;
+	outFrame.stepIndex = frameHeader.stepIndex;
+	outFrame.simulatedTime = frameHeader.simulatedTime;
+	outFrame.positions.resize(size_t(idCount) * 3);
+	outFrame.velocities.resize(size_t(idCount) * 3);
+
+	if (sameActive)
+	{
+		outFrame.active = reference->active;
+	}
+	else
+	{
+		size_t maskSize = (idCount + 7) / 8;
+		if (size_t(reader.end - reader.data) < maskSize)
+			return 0;
+
+		outFrame.active.resize(idCount);
+		for (uint32_t id = 0; id < idCount; id++)
+			outFrame.active[id] = (reader.data[id / 8] >> (id % 8)) & 1;
+		reader.data += maskSize;
+	}
+
+	for (uint32_t id = 0; id < idCount && reader.ok; id++)
+	{
+		int32_t* position = &outFrame.positions[size_t(id) * 3];
+		int32_t* velocity = &outFrame.velocities[size_t(id) * 3];
+
+		if (!outFrame.active[id])
+		{
+			std::fill(position, position + 3, 0);
+			std::fill(velocity, velocity + 3, 0);
+			continue;
+		}
+
+		if (!reference || id >= reference->idCount || !reference->active[id])
+		{
+			ReadAbsolute(reader, position, velocity);
+			continue;
+		}
+
+		const int32_t* previousPosition = &reference->positions[size_t(id) * 3];
+		const int32_t* previousVelocity = &reference->velocities[size_t(id) * 3];
+
+		for (unsigned int axis = 0; axis < 3; axis++)
+			velocity[axis] = static_cast<int32_t>(previousVelocity[axis] + reader.ReadVarint());
+
+		for (unsigned int axis = 0; axis < 3; axis++)
+			position[axis] = static_cast<int32_t>(Predict(previousPosition[axis], velocity[axis], frameHeader.predictionScale) + reader.ReadVarint());
+	}
+
+	if (!reader.ok)
+		return 0;
+
+	return sizeof(frameHeader) + frameHeader.payloadSize;
+}
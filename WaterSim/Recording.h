@@ -0,0 +1,95 @@
+#pragma once
+
+#include "SPHCommon.h"
+
+#include <cstddef>
+#include <vector>
+
+// Compact particle recordings, shared by FrameRecorder (writing), RecordingPlayer (reading) and the rewind buffer.
+//
+// Positions are quantised to a fixed-point grid: every cellSize cell is split into 65536 steps per axis, so a
+// position is its cell index (high bits) and its offset in the cell (low 16 bits). Velocities are quantised to
+// velocityStep. A keyframe stores every active particle on its own, a delta frame only the differences from the
+// previous frame: the velocity change, and the position residual after moving the previous position by the new
+// velocity. Both are small integers, written as zigzag varints, so a settled particle costs a few bytes.
+// Encoder and decoder both work on the quantised values, so errors never accumulate across delta frames.
+//
+// File layout: RecordingHeader, then each frame as a RecordingFrameHeader plus payload, then an index of every
+// frame's offset once the recording is closed. Frame f always depends on keyframe f - f % keyframeInterval.
+
+constexpr char RECORDING_MAGIC[8] = { 'W', 'S', 'I', 'M', 'R', 'E', 'C', 'D' };
+constexpr uint32_t RECORDING_VERSION = 2;
+constexpr uint32_t RECORDING_VERSION_NO_RADIUS = 1; // Headers end before smoothingRadius, recorded by SPHCPU at the SPHSettings default
+
+struct RecordingHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+
+	Float3 origin; // Corner cell indices are counted from
+	float cellSize;
+	float velocityStep; // Units per second of one velocity step
+	uint32_t keyframeInterval;
+
+	uint64_t frameCount; // Both 0 until the recording is closed
+	uint64_t indexOffset; // frameCount uint64 file offsets, one per frame
+
+	float smoothingRadius; // Of the recorded simulation, replays splat their voxels with it
+};
+
+enum class RecordingFrameType : uint32_t
+{
+	Keyframe,
+	Delta
+};
+
+enum RecordingFrameFlags : uint32_t
+{
+	RECORDING_FRAME_SAME_ACTIVE = 1 << 0 // No activity mask, the active ids are the previous frame's
+};
+
+struct RecordingFrameHeader
+{
+	RecordingFrameType type;
+	uint32_t flags;
+	uint32_t idCount;
+	uint32_t activeCount;
+	uint64_t stepIndex;
+	double simulatedTime;
+	double predictionScale; // Position steps moved per velocity step since the previous frame, set by the encoder
+	uint64_t payloadSize;
+};
+
+// Position steps per cell
+constexpr int32_t RECORDING_CELL_STEPS = 1 << 16;
+
+// Every id's quantised state, what an encoder keeps as its reference and a decoder produces
+struct QuantisedFrame
+{
+	uint32_t idCount = 0;
+	uint64_t stepIndex = 0;
+	double simulatedTime = 0.0;
+	std::vector<uint8_t> active; // 1 per id
+	std::vector<int32_t> positions; // xyz per id, 0 for inactive ids
+	std::vector<int32_t> velocities;
+};
+
+// Header with the default quantisation: one SMOOTHING_RADIUS per cell from the world's min corner, 1/256 unit/s.
+// smoothingRadius is the recorded simulation's.
+RecordingHeader MakeRecordingHeader(float smoothingRadius, uint32_t keyframeInterval = 60);
+
+// particles and active are indexed by id, active may be null when every id is
+void QuantiseFrame(const RecordingHeader& header, const ParticleState* particles, const uint8_t* active, uint32_t idCount,
+	uint64_t stepIndex, double simulatedTime, QuantisedFrame& outFrame);
+
+// Positions by id with w = 1 for active ids and 0 for inactive ones, like g_ParticlePositions
+void DequantisePositions(const RecordingHeader& header, const QuantisedFrame& frame, std::vector<Float4>& outPositions);
+void DequantiseParticles(const RecordingHeader& header, const QuantisedFrame& frame, std::vector<ParticleState>& outParticles);
+
+// Appends frame's header and payload to out. A null reference writes a keyframe.
+void EncodeFrame(const RecordingHeader& header, const QuantisedFrame& frame, const QuantisedFrame* reference, std::vector<uint8_t>& out);
+
+// Decodes one frame starting at data, reference must be the frame before it unless it is a keyframe, and can't be outFrame.
+// Returns the bytes consumed, 0 if the frame is malformed or needs a reference that wasn't given.
+size_t DecodeFrame(const uint8_t* data, size_t size, const QuantisedFrame* reference, QuantisedFrame& outFrame);
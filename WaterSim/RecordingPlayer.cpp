@@ -0,0 +1,327 @@
+#include "RecordingPlayer.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+RecordingPlayer::RecordingPlayer(unsigned int workerCount, unsigned int lookahead)
+	:
+	lookahead(std::max(1u, lookahead))
+{
+	// The render thread only waits on the workers, so one hardware thread is left for it
+	if (workerCount == 0)
+		workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+	this->workerCount = std::max(1u, workerCount);
+}
+
+RecordingPlayer::~RecordingPlayer()
+{
+	Close();
+}
+
+bool RecordingPlayer::Open(const std::string& path, bool newBuildVoxels)
+{
+	Close();
+
+	// Version 1 headers stop before smoothingRadius
+	constexpr size_t noRadiusHeaderSize = offsetof(RecordingHeader, smoothingRadius);
+	if (!file.Open(path) || file.Size() < noRadiusHeaderSize)
+	{
+		file.Close();
+		return false;
+	}
+
+	header = {};
+	std::memcpy(&header, file.Data(), std::min<size_t>(sizeof(header), file.Size()));
+	// Every version 1 recording came from SPHCPU at its default radius
+	if (header.version == RECORDING_VERSION_NO_RADIUS)
+		header.smoothingRadius = SPHSettings().smoothingRadius;
+
+	bool valid = std::memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) == 0 &&
+		((header.version == RECORDING_VERSION && header.headerSize == sizeof(RecordingHeader)) ||
+			(header.version == RECORDING_VERSION_NO_RADIUS && header.headerSize == noRadiusHeaderSize)) &&
+		header.smoothingRadius > 0.0f &&
+		header.keyframeInterval > 0 &&
+		header.frameCount > 0 && // 0 until FrameRecorder::Stop wrote the index
+		header.indexOffset <= file.Size() &&
+		header.frameCount <= (file.Size() - header.indexOffset) / sizeof(uint64_t);
+
+	// Frames are written back to back, so the offsets only grow and end at the index
+	uint64_t previousOffset = header.headerSize;
+	for (uint64_t f = 0; f < header.frameCount && valid; f++)
+	{
+		uint64_t offset = GetFrameOffset(f);
+		valid = offset >= previousOffset && offset + sizeof(RecordingFrameHeader) <= header.indexOffset;
+		previousOffset = offset + sizeof(RecordingFrameHeader);
+	}
+
+	if (!valid)
+	{
+		file.Close();
+		return false;
+	}
+
+	frameCount = header.frameCount;
+	buildVoxels = newBuildVoxels;
+	stopping = false;
+	decodedFrames = 0;
+
+	workerGroups.assign(workerCount, noGroup);
+	workerCursors.assign(workerCount, UINT64_MAX);
+	for (unsigned int i = 0; i < workerCount; i++)
+		workers.emplace_back(&RecordingPlayer::WorkerLoop, this, i);
+
+	return true;
+}
+
+void RecordingPlayer::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+
+	cache.clear();
+	spareFrames.clear();
+	frameCount = 0;
+	file.Close();
+}
+
+std::shared_ptr<const ReplayFrame> RecordingPlayer::GetFrame(uint64_t frameIndex)
+{
+	if (frameCount == 0)
+		return nullptr;
+
+	frameIndex = std::min(frameIndex, frameCount - 1);
+	uint64_t windowEnd = std::min(frameIndex + lookahead, frameCount);
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// Frames that fell out of the window go, a worker still decoding one drops it when it is done
+	for (auto it = cache.begin(); it != cache.end();)
+	{
+		if (it->first >= frameIndex && it->first < windowEnd)
+		{
+			++it;
+			continue;
+		}
+
+		if (it->second.frame && it->second.frame.use_count() == 1)
+			spareFrames.push_back(std::move(it->second.frame));
+		it = cache.erase(it);
+	}
+
+	bool queued = false;
+	for (uint64_t f = frameIndex; f < windowEnd; f++)
+		queued |= cache.try_emplace(f).second;
+
+	if (queued)
+		wakeCondition.notify_all();
+
+	CachedFrame& cached = cache[frameIndex];
+	if (cached.state != FrameState::Ready)
+	{
+		PROFILE_SCOPE("Wait For Replay Frame");
+		readyCondition.wait(lock, [&] { return cached.state == FrameState::Ready; });
+	}
+
+	return cached.frame;
+}
+
+void RecordingPlayer::WorkerLoop(unsigned int workerIndex)
+{
+	Profiler::SetThreadName("Replay Worker");
+
+	Decoder decoder;
+	while (true)
+	{
+		uint64_t begin = 0;
+		uint64_t end = 0;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] { return stopping || ClaimFrames(workerIndex, begin, end); });
+
+			if (stopping)
+				return;
+		}
+
+		DecodeFrames(workerIndex, decoder, begin, end);
+	}
+}
+
+bool RecordingPlayer::ClaimFrames(unsigned int workerIndex, uint64_t& outBegin, uint64_t& outEnd)
+{
+	uint64_t interval = header.keyframeInterval;
+
+	auto first = cache.end();
+	for (auto it = cache.begin(); it != cache.end() && first == cache.end(); ++it)
+	{
+		if (it->second.state != FrameState::Queued)
+			continue;
+
+		// Left to whichever worker gets there with the least decoding, the one already in the group or closer in it
+		uint64_t group = it->first / interval;
+		uint64_t distance = GetDecodeDistance(workerCursors[workerIndex], it->first);
+		bool closest = true;
+		for (unsigned int other = 0; other < workerCount && closest; other++)
+		{
+			if (other != workerIndex)
+				closest = workerGroups[other] != group && GetDecodeDistance(workerCursors[other], it->first) >= distance;
+		}
+
+		if (closest)
+			first = it;
+	}
+
+	if (first == cache.end())
+		return false;
+
+	uint64_t group = first->first / interval;
+	outBegin = first->first;
+	outEnd = outBegin;
+	for (auto it = first; it != cache.end() && it->first == outEnd && it->first / interval == group && it->second.state == FrameState::Queued; ++it)
+	{
+		it->second.state = FrameState::Decoding;
+		outEnd++;
+	}
+
+	workerGroups[workerIndex] = group;
+	return true;
+}
+
+void RecordingPlayer::DecodeFrames(unsigned int workerIndex, Decoder& decoder, uint64_t begin, uint64_t end)
+{
+	PROFILE_SCOPE_ARG("Decode Replay Frames", "frames", static_cast<unsigned int>(end - begin));
+
+	uint64_t next = begin - GetDecodeDistance(decoder.frameIndex, begin);
+
+	for (uint64_t f = next; f < end; f++)
+	{
+		if (f >= begin)
+		{
+			// Stop early once the playhead has moved past everything that is left
+			std::lock_guard<std::mutex> lock(mutex);
+			auto wanted = cache.lower_bound(f);
+			if (wanted == cache.end() || wanted->first >= end || stopping)
+				break;
+		}
+
+		if (!DecodeNext(decoder, f))
+		{
+			// Everything after a corrupt frame depends on it
+			decoder.frameIndex = UINT64_MAX;
+			for (uint64_t failed = std::max(f, begin); failed < end; failed++)
+				Publish(failed, nullptr);
+			break;
+		}
+
+		if (f < begin)
+			continue;
+
+		std::shared_ptr<ReplayFrame> frame;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!spareFrames.empty())
+			{
+				frame = std::move(spareFrames.back());
+				spareFrames.pop_back();
+			}
+		}
+		if (!frame)
+			frame = std::make_shared<ReplayFrame>();
+
+		const QuantisedFrame& decoded = decoder.frames[decoder.current];
+		frame->frameIndex = f;
+		frame->stepIndex = decoded.stepIndex;
+		frame->simulatedTime = decoded.simulatedTime;
+		frame->particleCount = static_cast<unsigned int>(std::count(decoded.active.begin(), decoded.active.end(), uint8_t(1)));
+		DequantisePositions(header, decoded, frame->positions);
+
+		if (buildVoxels)
+		{
+			PROFILE_SCOPE("Replay Voxels");
+			frame->voxels.assign(VOXEL_GRID_COUNT, 0.0f);
+			for (const Float4& position : frame->positions)
+			{
+				if (position.w != 0.0f)
+					SplatDensityVoxels(frame->voxels.data(), { position.x, position.y, position.z }, header.smoothingRadius);
+			}
+		}
+
+		Publish(f, std::move(frame));
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	workerGroups[workerIndex] = noGroup;
+	workerCursors[workerIndex] = decoder.frameIndex;
+
+	// Frames given up on above go back to the queue if they are still wanted
+	for (auto it = cache.lower_bound(begin); it != cache.end() && it->first < end; ++it)
+	{
+		if (it->second.state == FrameState::Decoding)
+			it->second.state = FrameState::Queued;
+	}
+	wakeCondition.notify_all();
+}
+
+bool RecordingPlayer::DecodeNext(Decoder& decoder, uint64_t frameIndex)
+{
+	bool keyframe = frameIndex % header.keyframeInterval == 0;
+	if (!keyframe && decoder.frameIndex != frameIndex - 1)
+		return false;
+
+	uint64_t offset = GetFrameOffset(frameIndex);
+	uint64_t frameEnd = frameIndex + 1 < frameCount ? GetFrameOffset(frameIndex + 1) : header.indexOffset;
+
+	unsigned int target = decoder.current ^ 1;
+	const QuantisedFrame* reference = keyframe ? nullptr : &decoder.frames[decoder.current];
+	size_t used = DecodeFrame(file.Data() + offset, static_cast<size_t>(frameEnd - offset), reference, decoder.frames[target]);
+	if (used != frameEnd - offset)
+		return false;
+
+	decoder.current = target;
+	decoder.frameIndex = frameIndex;
+	decodedFrames.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void RecordingPlayer::Publish(uint64_t frameIndex, std::shared_ptr<ReplayFrame> frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = cache.find(frameIndex);
+		if (it == cache.end() || it->second.state == FrameState::Ready)
+		{
+			if (frame)
+				spareFrames.push_back(std::move(frame));
+			return;
+		}
+
+		it->second.state = FrameState::Ready;
+		it->second.frame = std::move(frame);
+	}
+	readyCondition.notify_all();
+}
+
+uint64_t RecordingPlayer::GetDecodeDistance(uint64_t cursor, uint64_t frameIndex) const
+{
+	uint64_t keyframe = frameIndex - frameIndex % header.keyframeInterval;
+	if (cursor != UINT64_MAX && cursor >= keyframe && cursor < frameIndex)
+		return frameIndex - cursor - 1;
+	return frameIndex - keyframe;
+}
+
+uint64_t RecordingPlayer::GetFrameOffset(uint64_t frameIndex) const
+{
+	// The index follows variable sized frames, so it is not necessarily aligned
+	uint64_t offset = 0;
+	std::memcpy(&offset, file.Data() + header.indexOffset + frameIndex * sizeof(uint64_t), sizeof(offset));
+	return offset;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "Recording.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One decoded recording frame, laid out like the simulation's own output
+struct ReplayFrame
+{
+	uint64_t frameIndex = 0;
+	uint64_t stepIndex = 0;
+	double simulatedTime = 0.0;
+	unsigned int particleCount = 0;
+	std::vector<Float4> positions; // Indexed by particle id, w is 0 for inactive ids, like g_ParticlePositions
+	std::vector<float> voxels; // Density grid like SPHCPU::GetVoxels, empty unless the player builds voxels
+};
+
+// Plays back a recording written by FrameRecorder instead of re-simulating the run.
+// The file is memory-mapped and its frame index gives every frame's offset, so any frame is reached by decoding
+// from its keyframe: at most keyframeInterval frames wherever it is. Worker threads keep the frames after the
+// playhead decoded, each keyframe group is independent of the others so groups decode in parallel.
+class RecordingPlayer
+{
+public:
+	// workerCount of 0 uses all but one hardware thread, lookahead is how many frames from the playhead are kept
+	explicit RecordingPlayer(unsigned int workerCount = 0, unsigned int lookahead = 8);
+	~RecordingPlayer();
+
+	RecordingPlayer(const RecordingPlayer&) = delete;
+	RecordingPlayer& operator=(const RecordingPlayer&) = delete;
+
+	// False if the file isn't a finished recording. buildVoxels also fills ReplayFrame::voxels on the workers.
+	bool Open(const std::string& path, bool buildVoxels = false);
+	void Close();
+
+	bool IsOpen() const { return file.IsOpen(); }
+	uint64_t GetFrameCount() const { return frameCount; }
+	const RecordingHeader& GetHeader() const { return header; }
+
+	// Moves the playhead to frameIndex (clamped to the recording) and returns that frame, only waiting if the
+	// workers haven't decoded it yet. Null if the frame is corrupt. The frame stays valid while it is held.
+	std::shared_ptr<const ReplayFrame> GetFrame(uint64_t frameIndex);
+
+	// Frames decoded since Open, including the ones between a keyframe and a seek target
+	uint64_t GetDecodedFrameCount() const { return decodedFrames.load(std::memory_order_relaxed); }
+
+private:
+	enum class FrameState
+	{
+		Queued,
+		Decoding,
+		Ready
+	};
+
+	struct CachedFrame
+	{
+		FrameState state = FrameState::Queued;
+		std::shared_ptr<ReplayFrame> frame; // Null while not ready, or when the frame failed to decode
+	};
+
+	// A worker's position in the recording, continuing from it is cheaper than starting at the keyframe again
+	struct Decoder
+	{
+		QuantisedFrame frames[2];
+		unsigned int current = 0;
+		uint64_t frameIndex = UINT64_MAX; // Frame in frames[current], none yet
+	};
+
+	static constexpr uint64_t noGroup = UINT64_MAX;
+
+	void WorkerLoop(unsigned int workerIndex);
+
+	// With mutex held: picks the frames a worker decodes next, all from one keyframe group. False if there are none.
+	bool ClaimFrames(unsigned int workerIndex, uint64_t& outBegin, uint64_t& outEnd);
+
+	// Frames a worker at cursor has to decode before it reaches frameIndex
+	uint64_t GetDecodeDistance(uint64_t cursor, uint64_t frameIndex) const;
+
+	void DecodeFrames(unsigned int workerIndex, Decoder& decoder, uint64_t begin, uint64_t end);
+	bool DecodeNext(Decoder& decoder, uint64_t frameIndex);
+	void Publish(uint64_t frameIndex, std::shared_ptr<ReplayFrame> frame);
+
+	uint64_t GetFrameOffset(uint64_t frameIndex) const;
+
+	MappedFile file;
+	RecordingHeader header = {};
+	uint64_t frameCount = 0;
+	bool buildVoxels = false;
+
+	unsigned int workerCount = 1;
+	unsigned int lookahead = 8;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition; // Workers, frames were queued
+	std::condition_variable readyCondition; // GetFrame, a frame was published
+	std::map<uint64_t, CachedFrame> cache; // [playhead, playhead + lookahead)
+	std::vector<uint64_t> workerGroups; // Keyframe group each worker is decoding, so the others leave it alone
+	std::vector<uint64_t> workerCursors; // Decoder::frameIndex of each worker as of its last batch
+	std::vector<std::shared_ptr<ReplayFrame>> spareFrames; // Evicted frames nobody holds, reused for their memory
+	bool stopping = false;
+
+	std::atomic<uint64_t> decodedFrames{ 0 };
+};
@@ -0,0 +1,327 @@
+#include "RewindBuffer.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+RewindBuffer::RewindBuffer(size_t capacity, uint32_t keyframeInterval)
+	:
+	// Only the GPU simulation keeps a rewind history, and it runs at SMOOTHING_RADIUS
+	header(MakeRecordingHeader(SMOOTHING_RADIUS, std::max(1u, keyframeInterval))),
+	ring(capacity)
+{
+	for (unsigned int i = 0; i < QUEUE_LENGTH; i++)
+		freeFrames.push_back(std::make_unique<PendingFrame>());
+
+	encoder = std::thread(&RewindBuffer::EncoderLoop, this);
+}
+
+RewindBuffer::~RewindBuffer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_one();
+	encoder.join();
+}
+
+bool RewindBuffer::Capture(std::vector<ParticleState>& particles, const uint8_t* active, uint64_t stepIndex, double simulatedTime)
+{
+	PROFILE_SCOPE("Rewind Capture");
+
+	std::unique_ptr<PendingFrame> frame = TakeFreeFrame();
+	if (!frame)
+		return false;
+
+	frame->particles.swap(particles);
+	if (active)
+		frame->active.assign(active, active + frame->particles.size());
+	else
+		frame->active.clear();
+
+	frame->stepIndex = stepIndex;
+	frame->simulatedTime = simulatedTime;
+	QueueFrame(std::move(frame));
+	return true;
+}
+
+bool RewindBuffer::CaptureBorrowed(const ParticleState* particles, uint32_t idCount, uint64_t stepIndex, double simulatedTime)
+{
+	PROFILE_SCOPE("Rewind Capture");
+
+	std::unique_ptr<PendingFrame> frame = TakeFreeFrame();
+	if (!frame)
+		return false;
+
+	frame->borrowed = particles;
+	frame->borrowedCount = idCount;
+	frame->active.clear();
+	frame->stepIndex = stepIndex;
+	frame->simulatedTime = simulatedTime;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		borrowedFrames++;
+	}
+	QueueFrame(std::move(frame));
+	return true;
+}
+
+bool RewindBuffer::IsBorrowing() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return borrowedFrames > 0;
+}
+
+void RewindBuffer::WaitForBorrowed()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idleCondition.wait(lock, [this] { return borrowedFrames == 0; });
+}
+
+std::unique_ptr<RewindBuffer::PendingFrame> RewindBuffer::TakeFreeFrame()
+{
+	std::unique_ptr<PendingFrame> frame;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!freeFrames.empty())
+		{
+			frame = std::move(freeFrames.back());
+			freeFrames.pop_back();
+		}
+	}
+
+	if (!frame)
+		droppedFrames.fetch_add(1, std::memory_order_relaxed);
+	return frame;
+}
+
+void RewindBuffer::QueueFrame(std::unique_ptr<PendingFrame> frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queuedFrames.push_back(std::move(frame));
+	}
+	wakeCondition.notify_one();
+}
+
+void RewindBuffer::ReleaseFrame(std::unique_ptr<PendingFrame> frame)
+{
+	if (frame->borrowed)
+	{
+		frame->borrowed = nullptr;
+		borrowedFrames--;
+	}
+	freeFrames.push_back(std::move(frame));
+}
+
+void RewindBuffer::Flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idleCondition.wait(lock, [this] { return queuedFrames.empty() && !encoding; });
+}
+
+size_t RewindBuffer::GetFrameCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+uint64_t RewindBuffer::GetFrameStep(size_t frame) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return frame < entries.size() ? entries[frame].stepIndex : 0;
+}
+
+double RewindBuffer::GetFrameTime(size_t frame) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return frame < entries.size() ? entries[frame].simulatedTime : 0.0;
+}
+
+size_t RewindBuffer::GetBytesUsed() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	size_t used = 0;
+	for (const Entry& entry : entries)
+		used += entry.size;
+	return used;
+}
+
+bool RewindBuffer::Restore(size_t frame, std::vector<ParticleState>& outParticles, std::vector<uint8_t>* outActive)
+{
+	PROFILE_SCOPE("Rewind Restore");
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (frame >= entries.size())
+		return false;
+
+	// Entries always start with a keyframe, the eviction keeps it that way
+	size_t keyframe = frame;
+	while (!entries[keyframe].keyframe)
+		keyframe--;
+
+	size_t next = keyframe;
+	uint64_t firstSerial = entries.front().serial;
+	if (decodedSerial != UINT64_MAX && decodedSerial >= entries[keyframe].serial && decodedSerial <= entries[frame].serial)
+		next = static_cast<size_t>(decodedSerial - firstSerial) + 1;
+
+	for (; next <= frame; next++)
+	{
+		const Entry& entry = entries[next];
+		unsigned int target = decodedCurrent ^ 1;
+		const QuantisedFrame* previous = entry.keyframe ? nullptr : &decoded[decodedCurrent];
+
+		if (DecodeFrame(ring.data() + entry.offset, entry.size, previous, decoded[target]) != entry.size)
+		{
+			decodedSerial = UINT64_MAX;
+			return false;
+		}
+
+		decodedCurrent = target;
+		decodedSerial = entry.serial;
+	}
+
+	DequantiseParticles(header, decoded[decodedCurrent], outParticles);
+	if (outActive)
+		*outActive = decoded[decodedCurrent].active;
+	return true;
+}
+
+void RewindBuffer::Truncate(size_t frameCount)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (frameCount < entries.size())
+	{
+		entries.resize(frameCount);
+		writeOffset = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+
+		// Serials stay contiguous, so a frame's index is its serial minus the oldest one's
+		if (!entries.empty())
+			nextSerial = entries.back().serial + 1;
+		if (decodedSerial >= nextSerial || entries.empty())
+			decodedSerial = UINT64_MAX;
+	}
+
+	// Queued frames belong to the timeline being dropped, a frame being encoded is thrown away by its generation
+	while (!queuedFrames.empty())
+	{
+		ReleaseFrame(std::move(queuedFrames.front()));
+		queuedFrames.pop_front();
+	}
+
+	generation++;
+	startGroup = true;
+	idleCondition.notify_all();
+}
+
+void RewindBuffer::EncoderLoop()
+{
+	Profiler::SetThreadName("Rewind Encoder");
+
+	while (true)
+	{
+		std::unique_ptr<PendingFrame> frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [this] { return stopping || !queuedFrames.empty(); });
+
+			if (queuedFrames.empty())
+				return;
+
+			frame = std::move(queuedFrames.front());
+			queuedFrames.pop_front();
+			encoding = true;
+		}
+
+		StoreFrame(*frame);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ReleaseFrame(std::move(frame));
+			encoding = false;
+		}
+		idleCondition.notify_all();
+	}
+}
+
+void RewindBuffer::StoreFrame(PendingFrame& frame)
+{
+	PROFILE_SCOPE("Rewind Encode");
+
+	uint64_t frameGeneration;
+	bool keyframe;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frameGeneration = generation;
+		keyframe = startGroup || framesSinceKeyframe >= header.keyframeInterval;
+	}
+
+	const ParticleState* particles = frame.borrowed ? frame.borrowed : frame.particles.data();
+	uint32_t idCount = frame.borrowed ? frame.borrowedCount : static_cast<uint32_t>(frame.particles.size());
+	QuantiseFrame(header, particles, frame.active.empty() ? nullptr : frame.active.data(), idCount,
+		frame.stepIndex, frame.simulatedTime, current);
+
+	// The rest works from current, so borrowed particles go back to the caller now
+	if (frame.borrowed)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			frame.borrowed = nullptr;
+			borrowedFrames--;
+		}
+		idleCondition.notify_all();
+	}
+
+	// Deltas need the same ids on both sides
+	keyframe |= reference.idCount != current.idCount;
+
+	encoded.clear();
+	EncodeFrame(header, current, keyframe ? nullptr : &reference, encoded);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (frameGeneration != generation)
+		return;
+
+	// A delta frame whose keyframe had to make room for it can't be kept either, and nothing after it can refer to it
+	if (!Reserve(encoded.size()) || (!keyframe && entries.empty()))
+	{
+		droppedFrames.fetch_add(1, std::memory_order_relaxed);
+		startGroup = true;
+		return;
+	}
+
+	std::copy(encoded.begin(), encoded.end(), ring.begin() + writeOffset);
+	entries.push_back({ writeOffset, encoded.size(), nextSerial++, frame.stepIndex, frame.simulatedTime, keyframe });
+	writeOffset += encoded.size();
+
+	std::swap(current, reference);
+	framesSinceKeyframe = keyframe ? 1 : framesSinceKeyframe + 1;
+	startGroup = false;
+}
+
+bool RewindBuffer::Reserve(size_t size)
+{
+	if (size > ring.size())
+		return false;
+
+	// Entries from the previous lap start at writeOffset and come first, in ring order
+	if (writeOffset + size > ring.size())
+	{
+		// The end of the ring is too short, its frames go and writing carries on at the start
+		while (!entries.empty() && entries.front().offset >= writeOffset)
+			entries.pop_front();
+		writeOffset = 0;
+	}
+
+	while (!entries.empty() && entries.front().offset >= writeOffset && entries.front().offset < writeOffset + size)
+		entries.pop_front();
+
+	// A delta frame is no use without its keyframe
+	while (!entries.empty() && !entries.front().keyframe)
+		entries.pop_front();
+
+	return true;
+}
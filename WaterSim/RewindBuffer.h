@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Recording.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The last few seconds of a simulation kept in memory, so an interactive session can step back without a checkpoint.
+// Frames use the recording codec (see Recording.h) and live in one ring of capacity bytes: a keyframe every
+// keyframeInterval frames with delta frames in between, the oldest keyframe group going first when the ring is full.
+// Capture hands the particles to an encoder thread like FrameRecorder, so the simulation only pays for a buffer swap.
+// CaptureBorrowed goes further and has the encoder read the caller's memory, e.g. a mapped staging buffer, in place.
+class RewindBuffer
+{
+public:
+	static constexpr unsigned int QUEUE_LENGTH = 4;
+
+	explicit RewindBuffer(size_t capacity = size_t(256) << 20, uint32_t keyframeInterval = 30);
+	~RewindBuffer();
+
+	RewindBuffer(const RewindBuffer&) = delete;
+	RewindBuffer& operator=(const RewindBuffer&) = delete;
+
+	// particles (indexed by id) is swapped with a spare buffer instead of copied, so afterwards it holds old data
+	// of about the same size. active may be null when every id is. Returns false when the frame was dropped.
+	bool Capture(std::vector<ParticleState>& particles, const uint8_t* active, uint64_t stepIndex, double simulatedTime);
+
+	// Capture without the copy: the encoder quantises straight from particles, which must stay valid and unchanged
+	// until IsBorrowing returns false. Returns false when the frame was dropped, and particles is free again.
+	bool CaptureBorrowed(const ParticleState* particles, uint32_t idCount, uint64_t stepIndex, double simulatedTime);
+
+	// True while the encoder may still read memory given to CaptureBorrowed
+	bool IsBorrowing() const;
+	void WaitForBorrowed();
+
+	// Waits until every captured frame is in the ring
+	void Flush();
+
+	// Frames from the oldest kept (0) to the newest
+	size_t GetFrameCount() const;
+	uint64_t GetFrameStep(size_t frame) const;
+	double GetFrameTime(size_t frame) const;
+
+	size_t GetBytesUsed() const;
+	size_t GetCapacity() const { return ring.size(); }
+	uint64_t GetDroppedFrames() const { return droppedFrames.load(std::memory_order_relaxed); }
+
+	// Decodes frame into outParticles indexed by id, retired ids zeroed, and outActive if given.
+	// Stepping to the next frame continues from the last one restored instead of decoding from the keyframe.
+	bool Restore(size_t frame, std::vector<ParticleState>& outParticles, std::vector<uint8_t>* outActive = nullptr);
+
+	// Forgets the frames from frameCount on and anything still queued, for when the simulation carries on from a
+	// restored frame. The next capture starts a keyframe group.
+	void Truncate(size_t frameCount);
+	void Clear() { Truncate(0); }
+
+private:
+	struct PendingFrame
+	{
+		std::vector<ParticleState> particles;
+		std::vector<uint8_t> active; // Empty when every id is
+		const ParticleState* borrowed = nullptr; // Read instead of particles, see CaptureBorrowed
+		uint32_t borrowedCount = 0;
+		uint64_t stepIndex = 0;
+		double simulatedTime = 0.0;
+	};
+
+	struct Entry
+	{
+		size_t offset;
+		size_t size;
+		uint64_t serial; // Counts every stored frame, so decoded frames stay identifiable as older ones leave
+		uint64_t stepIndex;
+		double simulatedTime;
+		bool keyframe;
+	};
+
+	std::unique_ptr<PendingFrame> TakeFreeFrame();
+	void QueueFrame(std::unique_ptr<PendingFrame> frame);
+	// With mutex held: frees frame, returning its borrowed particles if it had any
+	void ReleaseFrame(std::unique_ptr<PendingFrame> frame);
+
+	void EncoderLoop();
+	void StoreFrame(PendingFrame& frame);
+
+	// With mutex held: makes room for size bytes at writeOffset, returns false if the ring can never hold them
+	bool Reserve(size_t size);
+
+	RecordingHeader header;
+	std::vector<uint8_t> ring;
+	size_t writeOffset = 0;
+	std::deque<Entry> entries;
+	uint64_t nextSerial = 0;
+
+	std::thread encoder;
+	mutable std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable idleCondition; // Flush and WaitForBorrowed, the encoder ran out of frames or borrowed ones
+	std::vector<std::unique_ptr<PendingFrame>> freeFrames;
+	std::deque<std::unique_ptr<PendingFrame>> queuedFrames;
+	bool encoding = false;
+	unsigned int borrowedFrames = 0; // Queued or being encoded, until their particles are quantised
+	uint64_t generation = 0; // Bumped by Truncate, frames captured before it are dropped
+	bool stopping = false;
+
+	std::atomic<uint64_t> droppedFrames{ 0 };
+
+	// Encoder thread only, apart from Truncate resetting the group under the mutex
+	QuantisedFrame current;
+	QuantisedFrame reference;
+	std::vector<uint8_t> encoded;
+	uint32_t framesSinceKeyframe = 0;
+	bool startGroup = true;
+
+	// Restore's decoder, decodedSerial is the entry in decoded[decodedCurrent]
+	QuantisedFrame decoded[2];
+	unsigned int decodedCurrent = 0;
+	uint64_t decodedSerial = UINT64_MAX;
+};
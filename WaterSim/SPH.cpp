@@ -1,7 +1,9 @@
 #include "SPH.h"
 
-SPH::SPH(ID3D11DeviceContext* contextdevice, ID3D11Device* device)
+SPH::SPH(ID3D11DeviceContext* contextdevice, ID3D11Device* device, UINT numParticles)
 	:
+	numParticles(numParticles),
+	threadGroupCount((numParticles + THREADS_PER_GROUPs - 1) / THREADS_PER_GROUPs),
 	deviceContext(contextdevice),
 	device(device)
 {
@@ -11,8 +13,8 @@ SPH::SPH(ID3D11DeviceContext* contextdevice, ID3D11Device* device)
 	);
 
 
-	particleList.reserve(NUM_OF_PARTICLES);
-	predictedPositions.resize(NUM_OF_PARTICLES);
+	particleList.reserve(numParticles);
+	predictedPositions.resize(numParticles);
 
 	// Particle Initialization
 	InitParticles();
@@ -47,19 +49,52 @@ SPH::~SPH()
 	if (outputUAVSpatialGridCountB) outputUAVSpatialGridCountB->Release();
 
 	if (SpatialGridConstantBuffer) SpatialGridConstantBuffer->Release();
+
+	// Released too now that the simulation can be rebuilt at a new size
+	if (GridOffsetsShader) GridOffsetsShader->Release();
+	if (MarchingCubesShader) MarchingCubesShader->Release();
+
+	if (BitonicSortConstantBuffer) BitonicSortConstantBuffer->Release();
+	if (MCConstantBuffer) MCConstantBuffer->Release();
+
+	if (g_pParticlePositionSRV) g_pParticlePositionSRV->Release();
+	if (g_pParticlePositionUAV) g_pParticlePositionUAV->Release();
+	if (g_pParticlePositionBuffer) g_pParticlePositionBuffer->Release();
+	if (previousParticlePositionSRV) previousParticlePositionSRV->Release();
+	if (previousParticlePositionBuffer) previousParticlePositionBuffer->Release();
+
+	if (outputSRVSpatialGridA) outputSRVSpatialGridA->Release();
+	if (outputSRVSpatialGridB) outputSRVSpatialGridB->Release();
+	if (SpatialGridOutputBufferA) SpatialGridOutputBufferA->Release();
+	if (SpatialGridOutputBufferB) SpatialGridOutputBufferB->Release();
+	if (SpatialGridOutputBufferCount) SpatialGridOutputBufferCount->Release();
+	if (SpatialGridResultOutputBufferCount) SpatialGridResultOutputBufferCount->Release();
+
+	if (motionBoundsUAV) motionBoundsUAV->Release();
+	if (motionBoundsBuffer) motionBoundsBuffer->Release();
+	for (ID3D11Buffer* staging : motionBoundsStaging)
+		if (staging) staging->Release();
+	for (ID3D11Buffer* staging : particleStaging)
+		if (staging) staging->Release();
+
+	if (voxelSRV) voxelSRV->Release();
+	if (voxelUAV) voxelUAV->Release();
+	if (voxelBuffer) voxelBuffer->Release();
+
+	if (g_Annotation) g_Annotation->Release();
 }
 
 void SPH::InitParticles()
 {
 	// Particle Initialization
 	float spacing = SMOOTHING_RADIUS;
-	int particlesPerDimension = static_cast<int>(std::cbrt(NUM_OF_PARTICLES));
+	int particlesPerDimension = static_cast<int>(std::cbrt(numParticles));
 
 	float offsetX = -spacing * (particlesPerDimension - 1) / 2.0f;
 	float offsetY = -spacing * (particlesPerDimension - 1) / 2.0f;
 	float offsetZ = -spacing * (particlesPerDimension - 1) / 2.0f;
 
-	for (int i = 0; i < NUM_OF_PARTICLES; i++)
+	for (UINT i = 0; i < numParticles; i++)
 	{
 		Particle newParticle = Particle(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(1.0f, 1.0f, 1.0f), 1.0f, XMFLOAT3(1.0f, 1.0f, 1.0f), SMOOTHING_RADIUS, XMFLOAT3(0.0f, 0.0f, 0.0f));
 
@@ -102,7 +137,7 @@ void SPH::InitGPUResources()
 	MCConstantBuffer = CreateConstantBuffer(sizeof(MCGridParams), device, false);
 
 	// Structure Buffers
-	std::vector<ParticleAttributes> position(NUM_OF_PARTICLES);
+	std::vector<ParticleAttributes> position(numParticles);
 	for (int i = 0; i < particleList.size(); i++)
 	{
 		Particle particle = particleList[i];
@@ -113,7 +148,7 @@ void SPH::InitGPUResources()
 		position[i].nearDensity =	particle.nearDensity;
 	}
 
-	inputBuffer = CreateStructureBuffer(sizeof(ParticleAttributes), (float*)position.data(), NUM_OF_PARTICLES, device);
+	inputBuffer = CreateStructureBuffer(sizeof(ParticleAttributes), (float*)position.data(), numParticles, device);
 
 	// Position GPU Buffer (float4 per particle)
 	D3D11_BUFFER_DESC descPositions = {};
@@ -122,25 +157,30 @@ void SPH::InitGPUResources()
 	descPositions.CPUAccessFlags = 0;
 	descPositions.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
 	descPositions.StructureByteStride = sizeof(XMFLOAT4);
-	descPositions.ByteWidth = descPositions.StructureByteStride * NUM_OF_PARTICLES;
+	descPositions.ByteWidth = descPositions.StructureByteStride * numParticles;
 	hr = device->CreateBuffer(&descPositions, nullptr, &g_pParticlePositionBuffer);
 
 	// Create UAV
 	D3D11_UNORDERED_ACCESS_VIEW_DESC uavDescPositions = {};
 	uavDescPositions.Format = DXGI_FORMAT_UNKNOWN;
 	uavDescPositions.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-	uavDescPositions.Buffer.NumElements = NUM_OF_PARTICLES;
+	uavDescPositions.Buffer.NumElements = numParticles;
 	device->CreateUnorderedAccessView(g_pParticlePositionBuffer, &uavDescPositions, &g_pParticlePositionUAV);
 
 	// Create SRV
 	D3D11_SHADER_RESOURCE_VIEW_DESC srvDescPositions = {};
 	srvDescPositions.Format = DXGI_FORMAT_UNKNOWN;
 	srvDescPositions.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-	srvDescPositions.Buffer.NumElements = NUM_OF_PARTICLES;
+	srvDescPositions.Buffer.NumElements = numParticles;
 	device->CreateShaderResourceView(g_pParticlePositionBuffer, &srvDescPositions, &g_pParticlePositionSRV);
 
+	// Previous Positions for render interpolation, only ever written by CopyResource
+	descPositions.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	hr = device->CreateBuffer(&descPositions, nullptr, &previousParticlePositionBuffer);
+	device->CreateShaderResourceView(previousParticlePositionBuffer, &srvDescPositions, &previousParticlePositionSRV);
+
 	// Spatial Grid
-	UINT elementCount = NUM_OF_PARTICLES;
+	UINT elementCount = numParticles;
 	UINT stride = (sizeof(unsigned int) * 3); // 16
 	UINT byteWidth = elementCount * stride;
 
@@ -181,7 +221,7 @@ void SPH::InitGPUResources()
 	// Spatial Grid Count
 	D3D11_BUFFER_DESC outputDesc;
 	outputDesc.Usage = D3D11_USAGE_DEFAULT;
-	outputDesc.ByteWidth = sizeof(unsigned int) * NUM_OF_PARTICLES;
+	outputDesc.ByteWidth = sizeof(unsigned int) * numParticles;
 	outputDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
 	outputDesc.CPUAccessFlags = 0;
 	outputDesc.StructureByteStride = sizeof(unsigned int);
@@ -195,7 +235,7 @@ void SPH::InitGPUResources()
 
 	uavDesc.Buffer.FirstElement = 0;
 	uavDesc.Buffer.Flags = 0;
-	uavDesc.Buffer.NumElements = NUM_OF_PARTICLES;
+	uavDesc.Buffer.NumElements = numParticles;
 	uavDesc.Format = DXGI_FORMAT_UNKNOWN;
 	uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
 
@@ -204,7 +244,7 @@ void SPH::InitGPUResources()
 
 	// UAV
 	outputDesc.Usage = D3D11_USAGE_DEFAULT;
-	outputDesc.ByteWidth = sizeof(ParticleAttributes) * NUM_OF_PARTICLES;
+	outputDesc.ByteWidth = sizeof(ParticleAttributes) * numParticles;
 	outputDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
 	outputDesc.CPUAccessFlags = 0;
 	outputDesc.StructureByteStride = sizeof(ParticleAttributes);
@@ -220,7 +260,7 @@ void SPH::InitGPUResources()
 
 	uavDesc.Buffer.FirstElement = 0;
 	uavDesc.Buffer.Flags = 0;
-	uavDesc.Buffer.NumElements = NUM_OF_PARTICLES;
+	uavDesc.Buffer.NumElements = numParticles;
 	uavDesc.Format = DXGI_FORMAT_UNKNOWN;
 	uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
 
@@ -239,6 +279,148 @@ void SPH::InitGPUResources()
 	device->CreateBuffer(&desc, nullptr, &voxelBuffer);
 	device->CreateUnorderedAccessView(voxelBuffer, nullptr, &voxelUAV);
 	device->CreateShaderResourceView(voxelBuffer, nullptr, &voxelSRV);
+
+	// Motion Bounds
+	D3D11_BUFFER_DESC motionDesc = {};
+	motionDesc.ByteWidth = sizeof(UINT) * 2;
+	motionDesc.Usage = D3D11_USAGE_DEFAULT;
+	motionDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	motionDesc.StructureByteStride = sizeof(UINT);
+	motionDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	device->CreateBuffer(&motionDesc, nullptr, &motionBoundsBuffer);
+	device->CreateUnorderedAccessView(motionBoundsBuffer, nullptr, &motionBoundsUAV);
+
+	motionDesc.Usage = D3D11_USAGE_STAGING;
+	motionDesc.BindFlags = 0;
+	motionDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	for (ID3D11Buffer*& staging : motionBoundsStaging)
+		device->CreateBuffer(&motionDesc, nullptr, &staging);
+}
+
+void SPH::SavePreviousPositions()
+{
+	deviceContext->CopyResource(previousParticlePositionBuffer, g_pParticlePositionBuffer);
+}
+
+void SPH::ReadMotionBounds()
+{
+	// Every slot holds an unread copy, drop the oldest rather than wait for it
+	if (motionBoundsWritten - motionBoundsRead == MOTION_READBACK_COUNT)
+		motionBoundsRead++;
+
+	deviceContext->CopyResource(motionBoundsStaging[motionBoundsWritten % MOTION_READBACK_COUNT], motionBoundsBuffer);
+	motionBoundsWritten++;
+
+	while (motionBoundsRead != motionBoundsWritten)
+	{
+		ID3D11Buffer* staging = motionBoundsStaging[motionBoundsRead % MOTION_READBACK_COUNT];
+
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		if (deviceContext->Map(staging, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped) != S_OK)
+			break;
+
+		UINT bits[2];
+		memcpy(bits, mapped.pData, sizeof(bits));
+		deviceContext->Unmap(staging, 0);
+
+		memcpy(&motionBounds.maxSpeed, &bits[0], sizeof(float));
+		memcpy(&motionBounds.maxAcceleration, &bits[1], sizeof(float));
+		motionBoundsRead++;
+	}
+}
+
+void SPH::ReadParticles(std::vector<ParticleState>& outParticles)
+{
+	// Stalls until the GPU has finished the queued passes, only meant for debugging / comparing against SPHCPU
+	deviceContext->CopyResource(outputResultBuffer, outputBuffer);
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(deviceContext->Map(outputResultBuffer, 0, D3D11_MAP_READ, 0, &mapped)))
+		return;
+
+	outParticles.resize(numParticles);
+	memcpy(outParticles.data(), mapped.pData, sizeof(ParticleState) * numParticles);
+
+	deviceContext->Unmap(outputResultBuffer, 0);
+}
+
+bool SPH::MapParticlesAsync(uint64_t tag, const ParticleState*& outParticles, uint64_t& outTag)
+{
+	if (!particleStaging[0])
+	{
+		D3D11_BUFFER_DESC desc = {};
+		desc.ByteWidth = sizeof(ParticleAttributes) * numParticles;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.StructureByteStride = sizeof(ParticleAttributes);
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		for (ID3D11Buffer*& staging : particleStaging)
+			device->CreateBuffer(&desc, nullptr, &staging);
+	}
+
+	// Same scheme as ReadMotionBounds, except only the oldest finished copy is handed back per call.
+	// The oldest copy can't be overwritten while it is mapped, so a full ring skips this step's copy instead.
+	bool full = particleReadbackWritten - particleReadbackRead == PARTICLE_READBACK_COUNT;
+	if (full && !particleStagingMapped)
+	{
+		particleReadbackRead++;
+		full = false;
+	}
+
+	if (!full)
+	{
+		UINT slot = particleReadbackWritten % PARTICLE_READBACK_COUNT;
+		{
+			GpuProfileScope gpuScope(gpuProfiler, "Particle Readback Copy");
+			deviceContext->CopyResource(particleStaging[slot], outputBuffer);
+		}
+		particleStagingTags[slot] = tag;
+		particleReadbackWritten++;
+	}
+
+	if (particleStagingMapped || particleReadbackRead == particleReadbackWritten)
+		return false;
+
+	// The map doesn't wait for the GPU, and whoever reads the mapped copy does so on their own thread
+	PROFILE_SCOPE_ARG("Particle Readback Map", "bytes", sizeof(ParticleState) * numParticles);
+	ID3D11Buffer* staging = particleStaging[particleReadbackRead % PARTICLE_READBACK_COUNT];
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (deviceContext->Map(staging, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped) != S_OK)
+		return false;
+
+	particleStagingMapped = true;
+	outParticles = static_cast<const ParticleState*>(mapped.pData);
+	outTag = particleStagingTags[particleReadbackRead % PARTICLE_READBACK_COUNT];
+	return true;
+}
+
+void SPH::UnmapParticles()
+{
+	if (!particleStagingMapped)
+		return;
+
+	deviceContext->Unmap(particleStaging[particleReadbackRead % PARTICLE_READBACK_COUNT], 0);
+	particleStagingMapped = false;
+	particleReadbackRead++;
+}
+
+void SPH::WriteParticles(const std::vector<ParticleState>& particles)
+{
+	if (particles.size() != numParticles)
+		return;
+
+	deviceContext->UpdateSubresource(outputBuffer, 0, nullptr, particles.data(), 0, 0);
+
+	// Drawn straight away, and with nothing to blend from
+	std::vector<XMFLOAT4> positions(numParticles);
+	for (UINT i = 0; i < numParticles; i++)
+		positions[i] = XMFLOAT4(particles[i].position.x, particles[i].position.y, particles[i].position.z, 1.0f);
+
+	deviceContext->UpdateSubresource(g_pParticlePositionBuffer, 0, nullptr, positions.data(), 0, 0);
+	deviceContext->UpdateSubresource(previousParticlePositionBuffer, 0, nullptr, positions.data(), 0, 0);
+
+	UnmapParticles();
+	particleReadbackRead = particleReadbackWritten;
 }
 
 void SPH::UpdateSpatialGridClear(float deltaTime)
@@ -250,7 +432,7 @@ void SPH::UpdateSpatialGridClear(float deltaTime)
 	deviceContext->CSSetUnorderedAccessViews(2, 1, &outputUAVSpatialGridCountA, nullptr);
 
 	// Dispatch compute shader
-	deviceContext->Dispatch(threadGroupCountX, 1, 1);
+	deviceContext->Dispatch(threadGroupCount, 1, 1);
 
 	// Unbind UAVs
 	deviceContext->CSSetUnorderedAccessViews(1, 1, uavViewNull, nullptr);
@@ -263,7 +445,7 @@ void SPH::UpdateSpatialGridClear(float deltaTime)
 void SPH::UpdateAddParticlesToSpatialGrid(float deltaTime)
 {
 	SimulationParams cb = {};
-	cb.numParticles = NUM_OF_PARTICLES;
+	cb.numParticles = numParticles;
 	cb.minX = minX;
 	cb.minZ = minZ;
 	deviceContext->UpdateSubresource(SpatialGridConstantBuffer, 0, nullptr, &cb, 0, 0);
@@ -278,7 +460,7 @@ void SPH::UpdateAddParticlesToSpatialGrid(float deltaTime)
 
 
 	// Dispatch compute shader
-	deviceContext->Dispatch(threadGroupCountX, 1, 1);
+	deviceContext->Dispatch(threadGroupCount, 1, 1);
 
 	// Unbind resources
 	deviceContext->CSSetUnorderedAccessViews(0, 1, uavViewNull, nullptr);
@@ -292,10 +474,10 @@ void SPH::UpdateAddParticlesToSpatialGrid(float deltaTime)
 void SPH::UpdateBitonicSorting(float deltaTime)
 {
 	BitonicParams  params = {};
-	params.numElements = NUM_OF_PARTICLES;
+	params.numElements = numParticles;
 	deviceContext->UpdateSubresource(BitonicSortConstantBuffer, 0, nullptr, &params, 0, 0);
 
-	for (UINT k = 2; k <= NUM_OF_PARTICLES; k <<= 1)
+	for (UINT k = 2; k <= numParticles; k <<= 1)
 	{
 		params.k = k;
 		deviceContext->UpdateSubresource(BitonicSortConstantBuffer, 0, nullptr, &params, 0, 0);
@@ -312,7 +494,7 @@ void SPH::UpdateBitonicSorting(float deltaTime)
 			deviceContext->CSSetUnorderedAccessViews(1, 1, &outputUAVSpatialGridA, nullptr);
 
 			// Dispatch compute shader
-			deviceContext->Dispatch(threadGroupCountX, 1, 1);
+			deviceContext->Dispatch(threadGroupCount, 1, 1);
 			deviceContext->CSSetUnorderedAccessViews(1, 1, uavViewNull, nullptr);
 			deviceContext->CSSetShader(nullptr, nullptr, 0);
 		}
@@ -322,7 +504,7 @@ void SPH::UpdateBitonicSorting(float deltaTime)
 void SPH::UpdateBuildGridOffsets(float deltaTime)
 {
 	BitonicParams cb = {};
-	cb.numElements = NUM_OF_PARTICLES;
+	cb.numElements = numParticles;
 	deviceContext->UpdateSubresource(BitonicSortConstantBuffer, 0, nullptr, &cb, 0, 0);
 
 	// Bind compute shader and resources
@@ -335,7 +517,7 @@ void SPH::UpdateBuildGridOffsets(float deltaTime)
 	deviceContext->CSSetUnorderedAccessViews(2, 1, &outputUAVSpatialGridCountA, nullptr);
 
 	// Dispatch compute shader
-	deviceContext->Dispatch(threadGroupCountX, 1, 1);
+	deviceContext->Dispatch(threadGroupCount, 1, 1);
 
 	// Unbind resources
 	deviceContext->CSSetUnorderedAccessViews(1, 1, uavViewNull, nullptr);
@@ -349,7 +531,7 @@ void SPH::UpdateBuildGridOffsets(float deltaTime)
 void SPH::UpdateParticleDensities(float deltaTime)
 {
 	SimulationParams cb = {};
-	cb.numParticles = NUM_OF_PARTICLES;
+	cb.numParticles = numParticles;
 	cb.minX = minX;
 	cb.minZ = minZ;
 	cb.deltaTime = deltaTime;
@@ -365,7 +547,7 @@ void SPH::UpdateParticleDensities(float deltaTime)
 
 
 	// Dispatch compute shader
-	deviceContext->Dispatch(threadGroupCountX, 1, 1);
+	deviceContext->Dispatch(threadGroupCount, 1, 1);
 
 	// Unbind resources
 	deviceContext->CSSetUnorderedAccessViews(0, 1, uavViewNull, nullptr);
@@ -379,7 +561,7 @@ void SPH::UpdateParticleDensities(float deltaTime)
 void SPH::UpdateParticlePressure(float deltaTime)
 {
 	SimulationParams cb = {};
-	cb.numParticles = NUM_OF_PARTICLES;
+	cb.numParticles = numParticles;
 	cb.minX = minX;
 	cb.minZ = minZ;
 	cb.deltaTime = deltaTime;
@@ -389,17 +571,23 @@ void SPH::UpdateParticlePressure(float deltaTime)
 	deviceContext->CSSetShader(FluidSimCalculatePressure, nullptr, 0);
 	deviceContext->CSSetConstantBuffers(0, 1, &SpatialGridConstantBuffer);
 
+	// Motion bounds are rebuilt from zero each step
+	const UINT zeros[4] = { 0, 0, 0, 0 };
+	deviceContext->ClearUnorderedAccessViewUint(motionBoundsUAV, zeros);
+
 	deviceContext->CSSetUnorderedAccessViews(0, 1, &outputUAVIntegrateA, nullptr);
 	deviceContext->CSSetUnorderedAccessViews(1, 1, &outputUAVSpatialGridA, nullptr);
 	deviceContext->CSSetUnorderedAccessViews(2, 1, &outputUAVSpatialGridCountA, nullptr);
+	deviceContext->CSSetUnorderedAccessViews(4, 1, &motionBoundsUAV, nullptr);
 
 	// Dispatch compute shader
-	deviceContext->Dispatch(threadGroupCountX, 1, 1);
+	deviceContext->Dispatch(threadGroupCount, 1, 1);
 
 	// Unbind resources
 	deviceContext->CSSetUnorderedAccessViews(0, 1, uavViewNull, nullptr);
 	deviceContext->CSSetUnorderedAccessViews(1, 1, uavViewNull, nullptr);
 	deviceContext->CSSetUnorderedAccessViews(2, 1, uavViewNull, nullptr);
+	deviceContext->CSSetUnorderedAccessViews(4, 1, uavViewNull, nullptr);
 
 	// Unbind compute shader
 	deviceContext->CSSetShader(nullptr, nullptr, 0);
@@ -408,7 +596,7 @@ void SPH::UpdateParticlePressure(float deltaTime)
 void SPH::UpdateIntegrateComputeShader(float deltaTime, float minX, float minZ)
 {
 	SimulationParams cb = {};
-	cb.numParticles = NUM_OF_PARTICLES;
+	cb.numParticles = numParticles;
 	cb.minX = minX;
 	cb.minZ = minZ;
 	cb.deltaTime = deltaTime;
@@ -419,13 +607,15 @@ void SPH::UpdateIntegrateComputeShader(float deltaTime, float minX, float minZ)
 	deviceContext->CSSetConstantBuffers(0, 1, &SpatialGridConstantBuffer);
 
 	deviceContext->CSSetUnorderedAccessViews(0, 1, &outputUAVIntegrateA, nullptr);
+	deviceContext->CSSetUnorderedAccessViews(4, 1, &motionBoundsUAV, nullptr);
 	deviceContext->CSSetUnorderedAccessViews(7, 1, &g_pParticlePositionUAV, nullptr);
 
 	// Dispatch compute shader
-	deviceContext->Dispatch(threadGroupCountX, 1, 1);
+	deviceContext->Dispatch(threadGroupCount, 1, 1);
 
 	// Unbind resources
 	deviceContext->CSSetUnorderedAccessViews(0, 1, uavViewNull, nullptr);
+	deviceContext->CSSetUnorderedAccessViews(4, 1, uavViewNull, nullptr);
 	deviceContext->CSSetUnorderedAccessViews(7, 1, uavViewNull, nullptr);
 
 	// Unbind compute shader
@@ -447,7 +637,7 @@ void SPH::UpdateMarchingCubes()
 	deviceContext->CSSetUnorderedAccessViews(0, 1, &outputUAVIntegrateA, nullptr);
 	deviceContext->CSSetUnorderedAccessViews(3, 1, &voxelUAV, nullptr);
 
-	deviceContext->Dispatch(threadGroupCountX, 1, 1);
+	deviceContext->Dispatch(threadGroupCount, 1, 1);
 
 	deviceContext->CSSetUnorderedAccessViews(0, 1, uavViewNull, nullptr);
 	deviceContext->CSSetUnorderedAccessViews(3, 1, uavViewNull, nullptr);
@@ -456,20 +646,32 @@ void SPH::UpdateMarchingCubes()
 
 void SPH::Update(float deltaTime, float minX, float minZ)
 {
+	PROFILE_SCOPE_ARG("SPH Update", "particles", numParticles);
+
+	// CPU side records the cost of issuing the pass, the GPU scope how long it ran
+	auto profileStage = [&](SPHStage stage, auto&& pass)
+	{
+		const char* name = GetSPHStageName(stage);
+		PROFILE_SCOPE_ARG(name, "particles", numParticles);
+		GpuProfileScope gpuScope(gpuProfiler, name);
+		pass();
+	};
+
 	// SPH
-	UpdateSpatialGridClear(deltaTime);
-	UpdateAddParticlesToSpatialGrid(deltaTime);
-	UpdateBitonicSorting(deltaTime);
-	UpdateBuildGridOffsets(deltaTime);
-	UpdateParticleDensities(deltaTime);
+	profileStage(SPHStage::SpatialGridClear, [&] { UpdateSpatialGridClear(deltaTime); });
+	profileStage(SPHStage::AddParticlesToSpatialGrid, [&] { UpdateAddParticlesToSpatialGrid(deltaTime); });
+	profileStage(SPHStage::SortGrid, [&] { UpdateBitonicSorting(deltaTime); });
+	profileStage(SPHStage::BuildGridOffsets, [&] { UpdateBuildGridOffsets(deltaTime); });
+	profileStage(SPHStage::ParticleDensities, [&] { UpdateParticleDensities(deltaTime); });
 
 	if (g_Annotation)
 		g_Annotation->BeginEvent(L"SPH Pressure Pass");
-	UpdateParticlePressure(deltaTime);
+	profileStage(SPHStage::ParticlePressure, [&] { UpdateParticlePressure(deltaTime); });
 		if (g_Annotation)
 		g_Annotation->EndEvent();
 
-	UpdateIntegrateComputeShader(deltaTime, minX, minZ);
+	profileStage(SPHStage::Integrate, [&] { UpdateIntegrateComputeShader(deltaTime, minX, minZ); });
+	ReadMotionBounds();
 
-	UpdateMarchingCubes();
-}
\ No newline at end of file
+	profileStage(SPHStage::MarchingCubes, [&] { UpdateMarchingCubes(); });
+}
@@ -4,6 +4,8 @@
 
 #include "Particle.h"
 #include "MarchingCubes.h"
+#include "SPHBackend.h"
+#include "GpuProfiler.h"
 
 constexpr float dampingFactor = 0.99f;
 
@@ -20,6 +22,8 @@ struct ParticleAttributes
 	float density; // 4 bytes (16-byte aligned)
 };
 
+static_assert(sizeof(ParticleAttributes) == sizeof(ParticleState), "ParticleAttributes and ParticleState must share a layout");
+
 struct SimulationParams 
 {
 	int numParticles; // Total number of particles
@@ -57,16 +61,43 @@ struct MCGridParams
 	float voxelSize;
 };
 
-class SPH
+class SPH : public SPHBackend
 {
 public:
-	SPH(ID3D11DeviceContext* contextdevice, ID3D11Device* device);
-	~SPH();
-	void Update(float deltaTime, float minX, float minZ);
+	// numParticles must be a power of two for the bitonic sort
+	SPH(ID3D11DeviceContext* contextdevice, ID3D11Device* device, UINT numParticles = NUM_OF_PARTICLES);
+	~SPH() override;
+	void Update(float deltaTime, float minX, float minZ) override;
+
+	UINT GetParticleCount() const override { return numParticles; }
+	void ReadParticles(std::vector<ParticleState>& outParticles) override;
+	const char* GetName() const override { return "GPU"; }
+
+	// ReadParticles without the stall or the CPU copy, for capturing every step: queues a copy of the particles tagged
+	// with tag and maps the oldest copy the GPU has finished, so results trail by a few steps. outParticles points
+	// into the mapped staging buffer until UnmapParticles, and nothing else is mapped meanwhile. False if none is.
+	bool MapParticlesAsync(uint64_t tag, const ParticleState*& outParticles, uint64_t& outTag);
+	// Does nothing when no copy is mapped
+	void UnmapParticles();
+
+	// Replaces every particle's attributes and drawn position, e.g. with a state from a RewindBuffer.
+	// Copies still queued by MapParticlesAsync are of the replaced state and are dropped, a mapped one included.
+	void WriteParticles(const std::vector<ParticleState>& particles);
+
+	// Read back without waiting, so the bounds trail the simulation by a few Updates
+	MotionBounds GetMotionBounds() const override { return motionBounds; }
+	float GetSmoothingRadius() const override { return SMOOTHING_RADIUS; }
 
 	ID3D11ShaderResourceView* GetParticlePositionSRV() const { return g_pParticlePositionSRV; }
+
+	// Positions before the last Advance, w is 0 until the first step has run
+	ID3D11ShaderResourceView* GetPreviousParticlePositionSRV() const { return previousParticlePositionSRV; }
+	void SavePreviousPositions() override;
 	float GetVoxelCount() const { return VOXEL_COUNT; }
 
+	// Times every pass on the GPU when set, may be null
+	void SetGpuProfiler(GpuProfiler* profiler) { gpuProfiler = profiler; }
+
 private:
 	
 	// Initial Particle Positions
@@ -85,6 +116,9 @@ private:
 
 	void UpdateMarchingCubes();
 
+	// Queues a copy of this step's motion bounds and picks up the newest copy the GPU has finished
+	void ReadMotionBounds();
+
 	bool isBufferSwapped = false;
 
 public:
@@ -92,6 +126,9 @@ public:
 private:
 	// Particle Initialization
 
+	UINT numParticles;
+	UINT threadGroupCount;
+
 	ParticleAttributes* position;
 	float mGravity = 0.0f;
 	vector<XMFLOAT3> predictedPositions;
@@ -120,6 +157,9 @@ private:
 	ID3D11ShaderResourceView* g_pParticlePositionSRV = nullptr;
 	ID3D11UnorderedAccessView* g_pParticlePositionUAV = nullptr;
 
+	ID3D11Buffer* previousParticlePositionBuffer = nullptr;
+	ID3D11ShaderResourceView* previousParticlePositionSRV = nullptr;
+
 	// Constant Buffers
 	ID3D11Buffer*  SpatialGridConstantBuffer = nullptr;
 	ID3D11Buffer*  BitonicSortConstantBuffer = nullptr;
@@ -161,6 +201,23 @@ private:
 
 	ID3D11Buffer* MCConstantBuffer = nullptr;
 
+	// Adaptive time step, max speed and acceleration written by the pressure and integrate passes
+	static constexpr UINT MOTION_READBACK_COUNT = 3;
+	ID3D11Buffer* motionBoundsBuffer = nullptr;
+	ID3D11UnorderedAccessView* motionBoundsUAV = nullptr;
+	ID3D11Buffer* motionBoundsStaging[MOTION_READBACK_COUNT] = {};
+	UINT motionBoundsWritten = 0;
+	UINT motionBoundsRead = 0;
+	MotionBounds motionBounds;
+
+	// Particle read back for MapParticlesAsync, staging buffers are created by the first call
+	static constexpr UINT PARTICLE_READBACK_COUNT = 3;
+	ID3D11Buffer* particleStaging[PARTICLE_READBACK_COUNT] = {};
+	uint64_t particleStagingTags[PARTICLE_READBACK_COUNT] = {};
+	UINT particleReadbackWritten = 0;
+	UINT particleReadbackRead = 0;
+	bool particleStagingMapped = false; // The copy at particleReadbackRead
+
 	float worldMinX = -50;
 	float worldMaxX = 50;
 
@@ -179,5 +236,6 @@ private:
 	int VOXEL_COUNT = gridSizeX * gridSizeY * gridSizeZ;
 
 	ID3DUserDefinedAnnotation* g_Annotation = nullptr;
+	GpuProfiler* gpuProfiler = nullptr;
 };
 
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "SPHCommon.h"
+#include "AdaptiveTimestep.h"
+
+#include <vector>
+
+// Stages of one Update in execution order, the optional ones are only run by SPHCPU
+enum class SPHStage
+{
+	EmittersAndSinks,
+	ReorderParticles,
+	SpatialGridClear,
+	AddParticlesToSpatialGrid,
+	SortGrid,
+	BuildGridOffsets,
+	NeighbourLists,
+	ParticleDensities,
+	ParticlePressure,
+	Integrate,
+	MarchingCubes,
+	Count
+};
+
+constexpr unsigned int SPH_STAGE_COUNT = static_cast<unsigned int>(SPHStage::Count);
+
+inline const char* GetSPHStageName(SPHStage stage)
+{
+	static const char* const names[SPH_STAGE_COUNT] =
+	{
+		"EmittersAndSinks",
+		"ReorderParticles",
+		"SpatialGridClear",
+		"AddParticlesToSpatialGrid",
+		"SortGrid",
+		"BuildGridOffsets",
+		"NeighbourLists",
+		"ParticleDensities",
+		"ParticlePressure",
+		"Integrate",
+		"MarchingCubes"
+	};
+	return names[static_cast<unsigned int>(stage)];
+}
+
+// Common interface for the simulation backends.
+// SPH drives the passes in SPHComputeShader.hlsl on a D3D11 device, SPHCPU runs the same passes on the CPU.
+class SPHBackend
+{
+public:
+	virtual ~SPHBackend() = default;
+
+	// Runs one full step: grid build, sort, offsets, density, pressure, integrate and the marching cubes density grid
+	virtual void Update(float deltaTime, float minX, float minZ) = 0;
+
+	virtual unsigned int GetParticleCount() const = 0;
+
+	// Copies the current particle attributes into CPU memory (in particle index order)
+	virtual void ReadParticles(std::vector<ParticleState>& outParticles) = 0;
+
+	// Whether an index of ReadParticles' output is a live particle, backends that never retire any use the default
+	virtual bool IsParticleActive(uint32_t id) const { return id < GetParticleCount(); }
+
+	virtual const char* GetName() const = 0;
+
+	// Largest particle speed and acceleration seen by the last Update
+	virtual MotionBounds GetMotionBounds() const = 0;
+	virtual float GetSmoothingRadius() const = 0;
+
+	// Keeps the particle positions as they are now, so a renderer can blend between them and the next Advance
+	virtual void SavePreviousPositions() = 0;
+
+	// Advances the simulation by frameTime seconds. With adaptive stepping off that is a single Update, otherwise
+	// the frame is split into substeps no longer than the CFL step of the latest motion bounds.
+	void Advance(float frameTime, float minX, float minZ)
+	{
+		adaptiveStats = AdaptiveTimestepStats();
+		SavePreviousPositions();
+
+		if (!adaptiveSettings.enabled)
+		{
+			currentSubstep = 0;
+			Update(frameTime, minX, minZ);
+			adaptiveStats.substeps = 1;
+			adaptiveStats.smallestStep = adaptiveStats.largestStep = frameTime;
+			adaptiveStats.bounds = GetMotionBounds();
+			return;
+		}
+
+		float remaining = frameTime;
+		// Float rounding of the even split can leave a tiny remainder, which is not worth a whole extra step
+		float negligible = frameTime * 1e-4f;
+
+		for (currentSubstep = 0; remaining > negligible && currentSubstep < adaptiveSettings.maxSubsteps; currentSubstep++)
+		{
+			MotionBounds bounds = GetMotionBounds();
+			float step = ComputeCFLTimestep(bounds, GetSmoothingRadius(), adaptiveSettings);
+
+			// Spread what is left evenly rather than ending on a sliver of a step
+			float stepsLeft = std::ceil(remaining / step);
+			step = stepsLeft > 1.0f ? remaining / stepsLeft : remaining;
+
+			Update(step, minX, minZ);
+			remaining -= step;
+
+			adaptiveStats.smallestStep = currentSubstep == 0 ? step : std::min(adaptiveStats.smallestStep, step);
+			adaptiveStats.largestStep = std::max(adaptiveStats.largestStep, step);
+			adaptiveStats.bounds = bounds;
+		}
+
+		adaptiveStats.substeps = currentSubstep;
+		adaptiveStats.droppedTime = remaining > negligible ? remaining : 0.0f;
+		currentSubstep = 0;
+	}
+
+	void SetAdaptiveTimestep(const AdaptiveTimestepSettings& settings) { adaptiveSettings = settings; }
+	const AdaptiveTimestepSettings& GetAdaptiveTimestep() const { return adaptiveSettings; }
+	const AdaptiveTimestepStats& GetAdaptiveTimestepStats() const { return adaptiveStats; }
+
+protected:
+	// Index of the substep Update is running within Advance, 0 outside of it
+	unsigned int currentSubstep = 0;
+
+private:
+	AdaptiveTimestepSettings adaptiveSettings;
+	AdaptiveTimestepStats adaptiveStats;
+};
@@ -0,0 +1,1187 @@
+#include "SPHCPU.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
+namespace
+{
+	// Particles handed to a worker at a time, roughly a D3D thread group's worth of work per chunk
+	constexpr unsigned int particleGrain = 1024;
+
+	constexpr uint32_t invalidOffset = 0xFFFFFFFF;
+
+	// xorshift32, emitters only need a cheap uniform spread
+	float NextRandom(uint32_t& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+
+	unsigned int NextPowerOfTwo(unsigned int value)
+	{
+		unsigned int result = 1;
+		while (result < value)
+			result <<= 1;
+		return result;
+	}
+}
+
+SPHCPU::SPHCPU(unsigned int numParticles, unsigned int threadCount, const SPHSettings& settings)
+	:
+	numParticles(numParticles),
+	sortCount(NextPowerOfTwo(numParticles)),
+	settings(settings),
+	kernels(settings.smoothingRadius),
+	jobSystem(threadCount),
+	kernelTable(&GetSPHKernelTable(DetectSIMDLevel())),
+	fastKernelTable(kernelTable)
+{
+	ResizeActiveParticles(numParticles);
+	particlePositions.resize(numParticles);
+	idToSlot.resize(numParticles);
+
+	SetNeighbourListSkin(0.0f);
+
+	voxels.resize(VOXEL_COUNT);
+	threadVoxels.resize(jobSystem.GetThreadCount());
+	threadNeighbours.resize(jobSystem.GetThreadCount());
+	threadSortedNeighbours.resize(jobSystem.GetThreadCount());
+	threadMaxDisplacements.resize(jobSystem.GetThreadCount());
+	threadMotionBounds.resize(jobSystem.GetThreadCount());
+	threadRetiredSlots.resize(jobSystem.GetThreadCount());
+
+	// Particle Initialization
+	InitParticles();
+}
+
+SPHCPU::~SPHCPU()
+{
+}
+
+void SPHCPU::InitParticles()
+{
+	// Same starting cube as SPH::InitParticles
+	float spacing = SMOOTHING_RADIUS;
+	int particlesPerDimension = static_cast<int>(std::cbrt(numParticles));
+
+	float offsetX = -spacing * (particlesPerDimension - 1) / 2.0f;
+	float offsetY = -spacing * (particlesPerDimension - 1) / 2.0f;
+	float offsetZ = -spacing * (particlesPerDimension - 1) / 2.0f;
+
+	for (unsigned int i = 0; i < numParticles; i++)
+	{
+		int xIndex = i % particlesPerDimension;
+		int yIndex = (i / particlesPerDimension) % particlesPerDimension;
+		int zIndex = i / (particlesPerDimension * particlesPerDimension);
+
+		ParticleState particle;
+		particle.position = { offsetX + xIndex * spacing, offsetY + yIndex * spacing, offsetZ + zIndex * spacing };
+		particle.velocity = { 1.0f, 1.0f, 1.0f };
+		particle.density = 1.0f;
+		particle.nearDensity = 0.0f;
+		particles.Set(i, particle);
+
+		particlePositions[i] = { particle.position.x, particle.position.y, particle.position.z, 1.0f };
+
+		slotToId[i] = i;
+		idToSlot[i] = i;
+	}
+}
+
+void SPHCPU::SetNeighbourListSkin(float skin)
+{
+	neighbourSkin = std::max(skin, 0.0f);
+	neighbourListsValid = false;
+	neighbourStats = NeighbourListStats();
+
+	if (neighbourSkin == 0.0f)
+	{
+		std::vector<std::vector<uint32_t>>().swap(neighbourChunks);
+		std::vector<uint32_t>().swap(neighbourOffsets);
+		std::vector<uint32_t>().swap(neighbourCounts);
+		std::vector<Float3>().swap(neighbourListPositions);
+	}
+
+	// Neighbours up to the list radius must still be within one cell
+	gridCellSize = settings.smoothingRadius + neighbourSkin;
+
+	cellCountX = static_cast<int>(std::ceil((worldMaxX - worldMinX) / gridCellSize));
+	cellCountY = static_cast<int>(std::ceil((worldMaxY - worldMinY) / gridCellSize));
+	cellCountZ = static_cast<int>(std::ceil((worldMaxZ - worldMinZ) / gridCellSize));
+}
+
+NeighbourListStats SPHCPU::GetNeighbourListStats() const
+{
+	NeighbourListStats stats = neighbourStats;
+	stats.entryCount = 0;
+	stats.memoryBytes = 0;
+
+	for (const std::vector<uint32_t>& chunk : neighbourChunks)
+	{
+		stats.entryCount += chunk.size();
+		stats.memoryBytes += chunk.capacity() * sizeof(uint32_t);
+	}
+
+	stats.memoryBytes += neighbourChunks.capacity() * sizeof(std::vector<uint32_t>);
+	stats.memoryBytes += (neighbourOffsets.capacity() + neighbourCounts.capacity()) * sizeof(uint32_t);
+	stats.memoryBytes += neighbourListPositions.capacity() * sizeof(Float3);
+	return stats;
+}
+
+void SPHCPU::SetSIMDLevel(SIMDLevel level)
+{
+	fastKernelTable = &GetSPHKernelTable(level);
+	if (!deterministic)
+		kernelTable = fastKernelTable;
+}
+
+void SPHCPU::SetDeterministic(bool enabled)
+{
+	deterministic = enabled;
+	kernelTable = deterministic ? &GetDeterministicKernelTable() : fastKernelTable;
+
+	if (deterministic && threadVoxels.size() < DETERMINISTIC_VOXEL_GRIDS)
+		threadVoxels.resize(DETERMINISTIC_VOXEL_GRIDS);
+}
+
+void SPHCPU::SetSparseVoxels(bool enabled, float voxelSize)
+{
+	sparseVoxels = enabled;
+
+	if (sparseVoxels)
+	{
+		// Same box as the dense grid, cells counted from the origin like the shader
+		int sizeX = static_cast<int>((worldMaxX - worldMinX) / voxelSize);
+		int sizeY = static_cast<int>((worldMaxY - worldMinY) / voxelSize);
+		int sizeZ = static_cast<int>((worldMaxZ - worldMinZ) / voxelSize);
+		brickVoxels.Reset(sizeX, sizeY, sizeZ, voxelSize);
+		threadBrickVoxels.assign(threadVoxels.size(), BrickVolume(sizeX, sizeY, sizeZ, voxelSize));
+
+		std::vector<float>().swap(voxels);
+		for (std::vector<float>& grid : threadVoxels)
+			std::vector<float>().swap(grid);
+	}
+	else
+	{
+		brickVoxels = BrickVolume();
+		std::vector<BrickVolume>().swap(threadBrickVoxels);
+		voxels.assign(VOXEL_COUNT, 0.0f);
+	}
+}
+
+size_t SPHCPU::GetVoxelMemoryBytes() const
+{
+	size_t bytes = voxels.capacity() * sizeof(float) + brickVoxels.GetMemoryBytes();
+	for (const std::vector<float>& grid : threadVoxels)
+		bytes += grid.capacity() * sizeof(float);
+	for (const BrickVolume& part : threadBrickVoxels)
+		bytes += part.GetMemoryBytes();
+	return bytes;
+}
+
+uint64_t SPHCPU::ComputeStateChecksum()
+{
+	// FNV-1a over fixed id ranges, so the chunk hashes and the order they are combined in don't depend on the threads
+	constexpr uint64_t fnvOffset = 0xCBF29CE484222325ull;
+	constexpr uint64_t fnvPrime = 0x100000001B3ull;
+	constexpr unsigned int chunkSize = 4096;
+
+	auto hashBytes = [](uint64_t hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= fnvPrime;
+		}
+		return hash;
+	};
+
+	unsigned int idCount = GetParticleIdCount();
+	unsigned int chunkCount = (idCount + chunkSize - 1) / chunkSize;
+	std::vector<uint64_t> chunkHashes(chunkCount);
+
+	jobSystem.ParallelFor(chunkCount, 1, [&](unsigned int chunkBegin, unsigned int chunkEnd, unsigned int)
+	{
+		for (unsigned int chunk = chunkBegin; chunk < chunkEnd; chunk++)
+		{
+			uint64_t hash = fnvOffset;
+			unsigned int end = std::min((chunk + 1) * chunkSize, idCount);
+
+			for (unsigned int id = chunk * chunkSize; id < end; id++)
+			{
+				uint32_t slot = idToSlot[id];
+				uint8_t active = slot != invalidSlot;
+				hash = hashBytes(hash, &active, sizeof(active));
+
+				if (!active)
+					continue;
+
+				float state[8] = {
+					particles.x[slot], particles.y[slot], particles.z[slot],
+					particles.vx[slot], particles.vy[slot], particles.vz[slot],
+					particles.density[slot], particles.nearDensity[slot]
+				};
+				hash = hashBytes(hash, state, sizeof(state));
+			}
+
+			chunkHashes[chunk] = hash;
+		}
+	});
+
+	uint64_t hash = hashBytes(fnvOffset, &idCount, sizeof(idCount));
+	for (uint64_t chunkHash : chunkHashes)
+		hash = hashBytes(hash, &chunkHash, sizeof(chunkHash));
+
+	return hash;
+}
+
+// Checkpoints store emitters and sinks as raw bytes
+static_assert(std::is_trivially_copyable_v<ParticleEmitter> && std::is_trivially_copyable_v<ParticleSink>, "Checkpoint sections must be plain data");
+
+bool SPHCPU::SaveCheckpoint(const std::string& path, float wallMinX, float wallMinZ)
+{
+	PROFILE_SCOPE_ARG("SaveCheckpoint", "particles", numParticles);
+
+	// Windows can't replace a file that is still mapped, which it is when saving over the loaded checkpoint
+	particles.Detach();
+	reorderScratch.Detach();
+	checkpointFile.reset();
+
+	CheckpointHeader header = {};
+	header.stepIndex = stepIndex;
+	header.simulatedTime = simulatedTime;
+	header.particleCount = numParticles;
+	header.particleCapacity = particles.Capacity();
+	header.idCount = GetParticleIdCount();
+	header.freeIdCount = static_cast<uint32_t>(freeIds.size());
+	header.emitterCount = static_cast<uint32_t>(emitters.size());
+	header.sinkCount = static_cast<uint32_t>(sinks.size());
+	header.emitterRandomState = emitterRandomState;
+	header.wallMinX = wallMinX;
+	header.wallMinZ = wallMinZ;
+	header.settings = settings;
+
+	const float* attributes[CHECKPOINT_ATTRIBUTE_COUNT] = {
+		particles.x.data(), particles.y.data(), particles.z.data(),
+		particles.vx.data(), particles.vy.data(), particles.vz.data(),
+		particles.density.data(), particles.nearDensity.data()
+	};
+
+	const void* sections[CHECKPOINT_SECTION_COUNT];
+	for (unsigned int i = 0; i < CHECKPOINT_ATTRIBUTE_COUNT; i++)
+	{
+		sections[i] = attributes[i];
+		header.sections[i].size = uint64_t(header.particleCapacity) * sizeof(float);
+	}
+
+	auto setSection = [&](CheckpointSection section, const void* data, size_t size)
+	{
+		sections[static_cast<uint32_t>(section)] = data;
+		header.sections[static_cast<uint32_t>(section)].size = size;
+	};
+
+	setSection(CheckpointSection::SlotToId, slotToId.data(), numParticles * sizeof(uint32_t));
+	setSection(CheckpointSection::FreeIds, freeIds.data(), freeIds.size() * sizeof(uint32_t));
+	setSection(CheckpointSection::Emitters, emitters.data(), emitters.size() * sizeof(ParticleEmitter));
+	setSection(CheckpointSection::Sinks, sinks.data(), sinks.size() * sizeof(ParticleSink));
+
+	return WriteCheckpoint(path, header, sections);
+}
+
+bool SPHCPU::LoadCheckpoint(const std::string& path, float* outWallMinX, float* outWallMinZ)
+{
+	PROFILE_SCOPE("LoadCheckpoint");
+
+	std::unique_ptr<CheckpointFile> file = std::make_unique<CheckpointFile>();
+	if (!file->Open(path))
+		return false;
+
+	const CheckpointHeader& header = file->GetHeader();
+
+	auto sectionSize = [&](CheckpointSection section) { return header.sections[static_cast<uint32_t>(section)].size; };
+
+	bool valid = sectionSize(CheckpointSection::SlotToId) == uint64_t(header.particleCount) * sizeof(uint32_t) &&
+		sectionSize(CheckpointSection::FreeIds) == uint64_t(header.freeIdCount) * sizeof(uint32_t) &&
+		sectionSize(CheckpointSection::Emitters) == uint64_t(header.emitterCount) * sizeof(ParticleEmitter) &&
+		sectionSize(CheckpointSection::Sinks) == uint64_t(header.sinkCount) * sizeof(ParticleSink) &&
+		header.particleCount + uint64_t(header.freeIdCount) == header.idCount;
+
+	for (unsigned int i = 0; i < CHECKPOINT_ATTRIBUTE_COUNT; i++)
+		valid = valid && sectionSize(static_cast<CheckpointSection>(i)) == uint64_t(header.particleCapacity) * sizeof(float);
+
+	if (!valid)
+		return false;
+
+	// Every id has to be either active in exactly one slot or free exactly once
+	const uint32_t* ids = file->GetSection<uint32_t>(CheckpointSection::SlotToId);
+	const uint32_t* savedFreeIds = file->GetSection<uint32_t>(CheckpointSection::FreeIds);
+	constexpr uint32_t freeMark = invalidSlot - 1;
+
+	std::vector<uint32_t> loadedIdToSlot(header.idCount, invalidSlot);
+	for (uint32_t slot = 0; slot < header.particleCount; slot++)
+	{
+		uint32_t id = ids[slot];
+		if (id >= header.idCount || loadedIdToSlot[id] != invalidSlot)
+			return false;
+		loadedIdToSlot[id] = slot;
+	}
+
+	for (uint32_t i = 0; i < header.freeIdCount; i++)
+	{
+		uint32_t id = savedFreeIds[i];
+		if (id >= header.idCount || loadedIdToSlot[id] != invalidSlot)
+			return false;
+		loadedIdToSlot[id] = freeMark;
+	}
+
+	for (uint32_t i = 0; i < header.freeIdCount; i++)
+		loadedIdToSlot[savedFreeIds[i]] = invalidSlot;
+
+	// Valid from here on, nothing below can fail
+	settings = header.settings;
+	kernels = SmoothingKernels(settings.smoothingRadius);
+	SetNeighbourListSkin(neighbourSkin);
+
+	float* attributes[CHECKPOINT_ATTRIBUTE_COUNT];
+	for (unsigned int i = 0; i < CHECKPOINT_ATTRIBUTE_COUNT; i++)
+		attributes[i] = file->GetSection<float>(static_cast<CheckpointSection>(i));
+
+	// The scratch store may still borrow from the previous checkpoint
+	reorderScratch = ParticleSoA();
+	particles.Borrow(header.particleCount, header.particleCapacity, attributes);
+
+	slotToId.assign(ids, ids + header.particleCount);
+	ResizeActiveParticles(header.particleCount);
+
+	idToSlot = std::move(loadedIdToSlot);
+	freeIds.assign(savedFreeIds, savedFreeIds + header.freeIdCount);
+
+	const ParticleEmitter* savedEmitters = file->GetSection<ParticleEmitter>(CheckpointSection::Emitters);
+	const ParticleSink* savedSinks = file->GetSection<ParticleSink>(CheckpointSection::Sinks);
+	emitters.assign(savedEmitters, savedEmitters + header.emitterCount);
+	sinks.assign(savedSinks, savedSinks + header.sinkCount);
+	emitterRandomState = header.emitterRandomState;
+
+	stepIndex = header.stepIndex;
+	simulatedTime = header.simulatedTime;
+	stepsSinceReorder = 0;
+	motionBounds = MotionBounds();
+
+	particlePositions.assign(header.idCount, { 0.0f, 0.0f, 0.0f, 0.0f });
+	jobSystem.ParallelFor(numParticles, particleGrain * 4, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int i = begin; i < end; i++)
+			particlePositions[slotToId[i]] = { particles.x[i], particles.y[i], particles.z[i], 1.0f };
+	});
+	previousParticlePositions = particlePositions;
+
+	if (outWallMinX)
+		*outWallMinX = header.wallMinX;
+	if (outWallMinZ)
+		*outWallMinZ = header.wallMinZ;
+
+	checkpointFile = std::move(file);
+	return true;
+}
+
+void SPHCPU::SetParticleReorder(ParticleOrder order, unsigned int interval)
+{
+	particleOrder = order;
+	reorderInterval = std::max(interval, 1u);
+
+	// Reorder on the next step
+	stepsSinceReorder = reorderInterval;
+}
+
+void SPHCPU::ResizeActiveParticles(unsigned int count)
+{
+	particles.Resize(count);
+	numParticles = count;
+	sortCount = NextPowerOfTwo(count);
+
+	// No-ops unless the particle store just grew
+	unsigned int capacity = particles.Capacity();
+	pressureAccelerations.resize(capacity);
+	slotToId.resize(capacity);
+
+	gridIndices.resize(NextPowerOfTwo(capacity));
+	gridOffsets.resize(capacity);
+
+	// Cached lists hold slots
+	neighbourListsValid = false;
+}
+
+uint32_t SPHCPU::EmitParticle(const Float3& position, const Float3& velocity)
+{
+	uint32_t id;
+	if (!freeIds.empty())
+	{
+		id = freeIds.back();
+		freeIds.pop_back();
+	}
+	else
+	{
+		id = static_cast<uint32_t>(idToSlot.size());
+		idToSlot.push_back(invalidSlot);
+		particlePositions.push_back({ 0.0f, 0.0f, 0.0f, 0.0f });
+	}
+
+	uint32_t slot = numParticles;
+	ResizeActiveParticles(numParticles + 1);
+
+	ParticleState particle;
+	particle.position = position;
+	particle.velocity = velocity;
+	particle.density = 0.0f;
+	particle.nearDensity = 0.0f;
+	particles.Set(slot, particle);
+	particles.pressure[slot] = 0.0f;
+	particles.nearPressure[slot] = 0.0f;
+
+	slotToId[slot] = id;
+	idToSlot[id] = slot;
+	particlePositions[id] = { position.x, position.y, position.z, 1.0f };
+	return id;
+}
+
+void SPHCPU::RetireParticle(uint32_t id)
+{
+	if (id >= idToSlot.size() || idToSlot[id] == invalidSlot)
+		return;
+
+	RemoveSlot(idToSlot[id]);
+}
+
+void SPHCPU::RemoveSlot(uint32_t slot)
+{
+	uint32_t id = slotToId[slot];
+	uint32_t last = numParticles - 1;
+
+	if (slot != last)
+	{
+		particles.Copy(slot, particles, last);
+
+		uint32_t lastId = slotToId[last];
+		slotToId[slot] = lastId;
+		idToSlot[lastId] = slot;
+	}
+
+	idToSlot[id] = invalidSlot;
+	particlePositions[id] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	freeIds.push_back(id);
+
+	ResizeActiveParticles(last);
+}
+
+void SPHCPU::UpdateEmittersAndSinks(float deltaTime)
+{
+	bool anySink = std::any_of(sinks.begin(), sinks.end(), [](const ParticleSink& sink) { return sink.enabled; });
+	if (anySink)
+	{
+		jobSystem.ParallelFor(numParticles, particleGrain * 4, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+		{
+			std::vector<uint32_t>& retired = threadRetiredSlots[threadIndex];
+
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Float3 p = particles.GetPosition(i);
+				for (const ParticleSink& sink : sinks)
+				{
+					if (sink.enabled && p.x >= sink.min.x && p.x <= sink.max.x && p.y >= sink.min.y && p.y <= sink.max.y &&
+						p.z >= sink.min.z && p.z <= sink.max.z)
+					{
+						retired.push_back(i);
+						break;
+					}
+				}
+			}
+		});
+
+		std::vector<uint32_t>& retired = threadRetiredSlots[0];
+		for (size_t t = 1; t < threadRetiredSlots.size(); t++)
+		{
+			retired.insert(retired.end(), threadRetiredSlots[t].begin(), threadRetiredSlots[t].end());
+			threadRetiredSlots[t].clear();
+		}
+
+		// Highest slot first, so the particle moved into a freed slot is never one still waiting to be retired
+		std::sort(retired.begin(), retired.end(), std::greater<uint32_t>());
+		size_t freeIdsBefore = freeIds.size();
+		for (uint32_t slot : retired)
+			RemoveSlot(slot);
+
+		// Slot order depends on the storage order, so reuse the freed ids lowest first instead
+		if (deterministic)
+			std::sort(freeIds.begin() + freeIdsBefore, freeIds.end(), std::greater<uint32_t>());
+
+		retired.clear();
+	}
+
+	for (ParticleEmitter& emitter : emitters)
+	{
+		if (!emitter.enabled)
+			continue;
+
+		emitter.pending += emitter.rate * deltaTime;
+		while (emitter.pending >= 1.0f)
+		{
+			emitter.pending -= 1.0f;
+
+			Float3 position = {
+				emitter.min.x + (emitter.max.x - emitter.min.x) * NextRandom(emitterRandomState),
+				emitter.min.y + (emitter.max.y - emitter.min.y) * NextRandom(emitterRandomState),
+				emitter.min.z + (emitter.max.z - emitter.min.z) * NextRandom(emitterRandomState)
+			};
+			EmitParticle(position, emitter.velocity);
+		}
+	}
+}
+
+void SPHCPU::ReadParticles(std::vector<ParticleState>& outParticles)
+{
+	outParticles.assign(idToSlot.size(), ParticleState());
+	for (unsigned int i = 0; i < numParticles; i++)
+		outParticles[slotToId[i]] = particles.Get(i);
+}
+
+void SPHCPU::UpdateReorderParticles()
+{
+	// Curve over the dense grid cells, particles within a cell keep their relative order
+	int maxCellCount = std::max({ cellCountX, cellCountY, cellCountZ });
+	unsigned int bits = 1;
+	while ((1 << bits) < maxCellCount)
+		bits++;
+
+	unsigned int coarsen = bits > 10 ? bits - 10 : 0;
+	bits -= coarsen;
+
+	// The grid entries are rebuilt right after, so they double as the sort buffers
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			Int3 cell = GetDenseCell(particles.GetPosition(i));
+			uint32_t cellX = static_cast<uint32_t>(cell.x) >> coarsen;
+			uint32_t cellY = static_cast<uint32_t>(cell.y) >> coarsen;
+			uint32_t cellZ = static_cast<uint32_t>(cell.z) >> coarsen;
+
+			uint32_t code = particleOrder == ParticleOrder::Hilbert ? HilbertCode3D(cellX, cellY, cellZ, bits) : MortonCode3D(cellX, cellY, cellZ);
+			gridIndices[i] = { i, code, code };
+		}
+	});
+
+	RadixSortGridEntries(jobSystem, gridIndices, gridIndicesScratch, numParticles, (1u << (bits * 3)) - 1);
+
+	reorderScratch.Resize(numParticles);
+	slotToIdScratch.resize(numParticles);
+
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			uint32_t oldSlot = gridIndices[i].particleIndex;
+			reorderScratch.Copy(i, particles, oldSlot);
+
+			uint32_t id = slotToId[oldSlot];
+			slotToIdScratch[i] = id;
+			idToSlot[id] = i;
+		}
+	});
+
+	std::swap(particles, reorderScratch);
+	std::swap(slotToId, slotToIdScratch);
+
+	// The store swapped out may still point into a loaded checkpoint. Its values are stale, so it is dropped rather
+	// than detached, and the next reorder allocates its own instead of dirtying the mapping.
+	if (reorderScratch.IsBorrowed())
+		reorderScratch = ParticleSoA();
+
+	// Cached lists hold slots
+	neighbourListsValid = false;
+}
+
+void SPHCPU::UpdateSpatialGridClear()
+{
+	// The counting sort rewrites every cell range
+	if (gridMode == GridMode::Dense)
+		return;
+
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int i = begin; i < end; i++)
+			gridOffsets[i] = invalidOffset;
+	});
+
+	// Padding entries sort to the back of the bitonic network, AddParticlesToGrid overwrites the rest
+	for (unsigned int i = numParticles; i < sortCount; i++)
+		gridIndices[i] = { invalidOffset, invalidOffset, invalidOffset };
+}
+
+void SPHCPU::UpdateAddParticlesToSpatialGrid()
+{
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			if (gridMode == GridMode::Dense)
+			{
+				Int3 cell = GetDenseCell(particles.GetPosition(i));
+				uint32_t cellIndex = cell.x + cellCountX * (cell.y + cellCountY * cell.z);
+
+				gridIndices[i] = { i, cellIndex, cellIndex };
+				continue;
+			}
+
+			Int3 cell = GetCell3D(particles.GetPosition(i), gridCellSize);
+			uint32_t hash = HashCell3D(cell);
+			uint32_t key = KeyFromHash(hash, numParticles);
+
+			gridIndices[i] = { i, hash, key };
+		}
+	});
+}
+
+void SPHCPU::UpdateSortGrid()
+{
+	if (gridMode == GridMode::Dense)
+		CountingSortGridEntries(jobSystem, gridIndices, gridIndicesScratch, numParticles, cellCountX * cellCountY * cellCountZ, cellStarts);
+	else if (sortMode == SortMode::Bitonic)
+		BitonicSortGridEntries(jobSystem, gridIndices, sortCount);
+	else
+		RadixSortGridEntries(jobSystem, gridIndices, gridIndicesScratch, numParticles, numParticles - 1);
+}
+
+void SPHCPU::UpdateBuildGridOffsets()
+{
+	// Cell ranges already come out of the counting sort
+	if (gridMode == GridMode::Dense)
+		return;
+
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			// Each key run starts exactly once, so there is no write race on gridOffsets
+			uint32_t currentKey = gridIndices[i].key;
+			if (i == 0 || currentKey != gridIndices[i - 1].key)
+				gridOffsets[currentKey] = i;
+		}
+	});
+}
+
+Int3 SPHCPU::GetDenseCell(const Float3& position) const
+{
+	Int3 cell = GetCell3D({ position.x - worldMinX, position.y - worldMinY, position.z - worldMinZ }, gridCellSize);
+
+	// Clamping never moves two cells further apart, so neighbours within the radius stay in adjacent cells
+	return {
+		std::clamp(cell.x, 0, cellCountX - 1),
+		std::clamp(cell.y, 0, cellCountY - 1),
+		std::clamp(cell.z, 0, cellCountZ - 1)
+	};
+}
+
+void SPHCPU::GatherNeighbourCandidates(const Float3& position, std::vector<uint32_t>& outNeighbours) const
+{
+	outNeighbours.clear();
+
+	if (gridMode == GridMode::Dense)
+		GatherDenseNeighbourCandidates(position, outNeighbours);
+	else
+		GatherHashedNeighbourCandidates(position, outNeighbours);
+}
+
+void SPHCPU::GatherDenseNeighbourCandidates(const Float3& position, std::vector<uint32_t>& outNeighbours) const
+{
+	Int3 cell = GetDenseCell(position);
+
+	int minX = std::max(cell.x - 1, 0);
+	int maxX = std::min(cell.x + 1, cellCountX - 1);
+
+	// Cells along x are adjacent in the sorted entries, so each row of three cells is one contiguous range
+	for (int z = std::max(cell.z - 1, 0); z <= std::min(cell.z + 1, cellCountZ - 1); z++)
+	{
+		for (int y = std::max(cell.y - 1, 0); y <= std::min(cell.y + 1, cellCountY - 1); y++)
+		{
+			uint32_t row = cellCountX * (y + cellCountY * z);
+			uint32_t begin = cellStarts[row + minX];
+			uint32_t end = cellStarts[row + maxX + 1];
+
+			for (uint32_t i = begin; i < end; i++)
+				outNeighbours.push_back(gridIndices[i].particleIndex);
+		}
+	}
+}
+
+void SPHCPU::GatherHashedNeighbourCandidates(const Float3& position, std::vector<uint32_t>& outNeighbours) const
+{
+	Int3 gridIndex = GetCell3D(position, gridCellSize);
+
+	for (int i = 0; i < 27; i++)
+	{
+		Int3 cell = { gridIndex.x + offsets3D[i].x, gridIndex.y + offsets3D[i].y, gridIndex.z + offsets3D[i].z };
+		uint32_t hash = HashCell3D(cell);
+		uint32_t key = KeyFromHash(hash, numParticles);
+		uint32_t currentIndex = gridOffsets[key];
+
+		if (currentIndex == invalidOffset)
+			continue;
+
+		while (currentIndex < numParticles)
+		{
+			const GridEntry& indexData = gridIndices[currentIndex];
+			currentIndex++;
+
+			// Left this key's run
+			if (indexData.key != key)
+				break;
+
+			// Different cell hashed to the same key
+			if (indexData.hash != hash)
+				continue;
+
+			outNeighbours.push_back(indexData.particleIndex);
+		}
+	}
+}
+
+bool SPHCPU::NeighbourListsNeedRebuild()
+{
+	if (!neighbourListsValid)
+		return true;
+
+	std::fill(threadMaxDisplacements.begin(), threadMaxDisplacements.end(), 0.0f);
+
+	jobSystem.ParallelFor(numParticles, particleGrain * 4, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+	{
+		float maxSqrDisplacement = threadMaxDisplacements[threadIndex];
+		for (unsigned int i = begin; i < end; i++)
+		{
+			Float3 displacement = particles.GetPosition(i) - neighbourListPositions[i];
+			maxSqrDisplacement = std::max(maxSqrDisplacement, Dot(displacement, displacement));
+		}
+		threadMaxDisplacements[threadIndex] = maxSqrDisplacement;
+	});
+
+	// Two particles closing in on each other can each use up half the skin
+	float halfSkin = neighbourSkin * 0.5f;
+	float maxSqrDisplacement = *std::max_element(threadMaxDisplacements.begin(), threadMaxDisplacements.end());
+	return maxSqrDisplacement > halfSkin * halfSkin;
+}
+
+void SPHCPU::UpdateBuildNeighbourLists()
+{
+	unsigned int chunkCount = (numParticles + particleGrain - 1) / particleGrain;
+
+	neighbourChunks.resize(chunkCount);
+	neighbourOffsets.resize(numParticles);
+	neighbourCounts.resize(numParticles);
+	neighbourListPositions.resize(numParticles);
+
+	float listRadius = settings.smoothingRadius + neighbourSkin;
+	float sqrListRadius = listRadius * listRadius;
+
+	// Chunks are fixed particle ranges so a particle's list is always found in the same chunk buffer
+	jobSystem.ParallelFor(chunkCount, 1, [&](unsigned int chunkBegin, unsigned int chunkEnd, unsigned int threadIndex)
+	{
+		std::vector<uint32_t>& candidates = threadNeighbours[threadIndex];
+
+		for (unsigned int chunk = chunkBegin; chunk < chunkEnd; chunk++)
+		{
+			std::vector<uint32_t>& list = neighbourChunks[chunk];
+			list.clear();
+
+			unsigned int begin = chunk * particleGrain;
+			unsigned int end = std::min(begin + particleGrain, numParticles);
+
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Float3 position = particles.GetPosition(i);
+				GatherNeighbourCandidates(position, candidates);
+
+				neighbourOffsets[i] = static_cast<uint32_t>(list.size());
+				list.push_back(i);
+
+				for (uint32_t neighbourIndex : candidates)
+				{
+					if (neighbourIndex == i)
+						continue;
+
+					Float3 offset = particles.GetPosition(neighbourIndex) - position;
+					if (Dot(offset, offset) <= sqrListRadius)
+						list.push_back(neighbourIndex);
+				}
+
+				neighbourCounts[i] = static_cast<uint32_t>(list.size()) - neighbourOffsets[i];
+				neighbourListPositions[i] = position;
+			}
+		}
+	});
+
+	neighbourListsValid = true;
+	neighbourStats.rebuildCount++;
+	neighbourStats.stepsSinceRebuild = 0;
+}
+
+const uint32_t* SPHCPU::SortNeighboursById(const uint32_t* neighbours, unsigned int count, std::vector<uint32_t>& scratch) const
+{
+	scratch.assign(neighbours, neighbours + count);
+	std::sort(scratch.begin(), scratch.end(), [&](uint32_t a, uint32_t b) { return slotToId[a] < slotToId[b]; });
+	return scratch.data();
+}
+
+void SPHCPU::UpdateParticleDensities()
+{
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+	{
+		std::vector<uint32_t>& neighbours = threadNeighbours[threadIndex];
+
+		for (unsigned int i = begin; i < end; i++)
+		{
+			Float3 position = particles.GetPosition(i);
+
+			const uint32_t* neighbourIndices;
+			unsigned int neighbourCount;
+
+			if (neighbourListsValid)
+			{
+				neighbourIndices = neighbourChunks[i / particleGrain].data() + neighbourOffsets[i];
+				neighbourCount = neighbourCounts[i];
+			}
+			else
+			{
+				GatherNeighbourCandidates(position, neighbours);
+				neighbourIndices = neighbours.data();
+				neighbourCount = static_cast<unsigned int>(neighbours.size());
+			}
+
+			if (deterministic)
+				neighbourIndices = SortNeighboursById(neighbourIndices, neighbourCount, threadSortedNeighbours[threadIndex]);
+
+			DensitySample sample = kernelTable->density(particles, neighbourIndices, neighbourCount, position, kernels);
+
+			particles.density[i] = sample.density;
+			particles.nearDensity[i] = sample.nearDensity;
+		}
+	});
+}
+
+void SPHCPU::UpdateParticlePressure(float deltaTime)
+{
+	// Pressures only depend on the particle's own densities, so convert them once rather than per neighbour
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			particles.pressure[i] = ConvertDensityToPressure(particles.density[i], settings);
+			particles.nearPressure[i] = ConvertNearDensityToPressure(particles.nearDensity[i], settings);
+		}
+	});
+
+	// Accelerations go to a scratch buffer first so neighbours never see a half-updated velocity
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+	{
+		std::vector<uint32_t>& neighbours = threadNeighbours[threadIndex];
+
+		for (unsigned int i = begin; i < end; i++)
+		{
+			PressureSample particle;
+			particle.position = particles.GetPosition(i);
+			particle.velocity = particles.GetVelocity(i);
+			particle.pressure = particles.pressure[i];
+			particle.nearPressure = particles.nearPressure[i];
+
+			const uint32_t* neighbourIndices;
+			unsigned int neighbourCount;
+
+			// A particle exerts no force on itself
+			if (neighbourListsValid)
+			{
+				neighbourIndices = neighbourChunks[i / particleGrain].data() + neighbourOffsets[i] + 1;
+				neighbourCount = neighbourCounts[i] - 1;
+			}
+			else
+			{
+				GatherNeighbourCandidates(particle.position, neighbours);
+				neighbours.erase(std::remove(neighbours.begin(), neighbours.end(), i), neighbours.end());
+				neighbourIndices = neighbours.data();
+				neighbourCount = static_cast<unsigned int>(neighbours.size());
+			}
+
+			if (deterministic)
+				neighbourIndices = SortNeighboursById(neighbourIndices, neighbourCount, threadSortedNeighbours[threadIndex]);
+
+			Float3 totalForce = kernelTable->pressure(particles, neighbourIndices, neighbourCount,
+				particle, kernels, settings.viscosityCoefficient);
+
+			// acceleration = force / density
+			float density = particles.density[i];
+			float invDensity = density > 0.0001f ? 1.0f / density : 0.0f;
+			pressureAccelerations[i] = totalForce * invDensity;
+		}
+	});
+
+	// Squared magnitudes for now, UpdateIntegrate takes the roots once all workers are done
+	std::fill(threadMotionBounds.begin(), threadMotionBounds.end(), MotionBounds());
+
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+	{
+		float maxSqrAcceleration = 0.0f;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			particles.vx[i] += pressureAccelerations[i].x * deltaTime;
+			particles.vy[i] += pressureAccelerations[i].y * deltaTime;
+			particles.vz[i] += pressureAccelerations[i].z * deltaTime;
+
+			Float3 acceleration = pressureAccelerations[i];
+			acceleration.y += settings.gravity;
+			maxSqrAcceleration = std::max(maxSqrAcceleration, Dot(acceleration, acceleration));
+		}
+
+		MotionBounds& bounds = threadMotionBounds[threadIndex];
+		bounds.maxAcceleration = std::max(bounds.maxAcceleration, maxSqrAcceleration);
+	});
+}
+
+void SPHCPU::UpdateIntegrate(float deltaTime, float minX, float minZ)
+{
+	jobSystem.ParallelFor(numParticles, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+	{
+		float maxSqrSpeed = 0.0f;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			Float3 position = particles.GetPosition(i);
+			Float3 velocity = particles.GetVelocity(i);
+
+			velocity.y += settings.gravity * deltaTime;
+			position += velocity * deltaTime;
+
+			CollisionBox(position, velocity, minX, -minX, minZ, -minZ, settings);
+			maxSqrSpeed = std::max(maxSqrSpeed, Dot(velocity, velocity));
+
+			particles.vx[i] = velocity.x;
+			particles.vy[i] = velocity.y;
+			particles.vz[i] = velocity.z;
+
+			particles.x[i] = position.x;
+			particles.y[i] = position.y;
+			particles.z[i] = position.z;
+
+			particlePositions[slotToId[i]] = { position.x, position.y, position.z, 1.0f };
+		}
+
+		MotionBounds& bounds = threadMotionBounds[threadIndex];
+		bounds.maxSpeed = std::max(bounds.maxSpeed, maxSqrSpeed);
+	});
+
+	motionBounds = MotionBounds();
+	for (const MotionBounds& bounds : threadMotionBounds)
+	{
+		motionBounds.maxSpeed = std::max(motionBounds.maxSpeed, bounds.maxSpeed);
+		motionBounds.maxAcceleration = std::max(motionBounds.maxAcceleration, bounds.maxAcceleration);
+	}
+	motionBounds.maxSpeed = std::sqrt(motionBounds.maxSpeed);
+	motionBounds.maxAcceleration = std::sqrt(motionBounds.maxAcceleration);
+}
+
+void SPHCPU::InterpolatePositions(float alpha, std::vector<Float4>& outPositions) const
+{
+	outPositions.resize(particlePositions.size());
+
+	for (size_t id = 0; id < particlePositions.size(); id++)
+	{
+		const Float4& current = particlePositions[id];
+		if (id >= previousParticlePositions.size() || previousParticlePositions[id].w == 0.0f)
+		{
+			outPositions[id] = current;
+			continue;
+		}
+
+		const Float4& previous = previousParticlePositions[id];
+		outPositions[id] = {
+			previous.x + (current.x - previous.x) * alpha,
+			previous.y + (current.y - previous.y) * alpha,
+			previous.z + (current.z - previous.z) * alpha,
+			current.w
+		};
+	}
+}
+
+void SPHCPU::SplatVoxels(std::vector<float>& grid, const Float3& pos) const
+{
+	SplatDensityVoxels(grid.data(), pos, settings.smoothingRadius);
+}
+
+void SPHCPU::UpdateMarchingCubes()
+{
+	// BuildDensityGrid scatters into shared voxels, so each worker splats into its own grid and the grids are summed.
+	// Unlike the GPU buffer the grid is rebuilt from zero every step.
+	auto splatParticles = [&](auto&& splat)
+	{
+		if (deterministic)
+		{
+			// Each grid takes a fixed id range in id order, so neither the thread count nor the storage order changes the sums
+			unsigned int idCount = GetParticleIdCount();
+			jobSystem.ParallelFor(DETERMINISTIC_VOXEL_GRIDS, 1, [&](unsigned int gridBegin, unsigned int gridEnd, unsigned int)
+			{
+				for (unsigned int g = gridBegin; g < gridEnd; g++)
+				{
+					unsigned int begin = static_cast<unsigned int>(uint64_t(idCount) * g / DETERMINISTIC_VOXEL_GRIDS);
+					unsigned int end = static_cast<unsigned int>(uint64_t(idCount) * (g + 1) / DETERMINISTIC_VOXEL_GRIDS);
+
+					for (unsigned int id = begin; id < end; id++)
+					{
+						uint32_t slot = idToSlot[id];
+						if (slot != invalidSlot)
+							splat(g, particles.GetPosition(slot));
+					}
+				}
+			});
+		}
+		else
+		{
+			jobSystem.ParallelFor(numParticles, particleGrain * 4, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+			{
+				for (unsigned int i = begin; i < end; i++)
+					splat(threadIndex, particles.GetPosition(i));
+			});
+		}
+	};
+
+	if (sparseVoxels)
+	{
+		// Deterministic mode may have added partial grids since SetSparseVoxels
+		if (threadBrickVoxels.size() < threadVoxels.size())
+		{
+			BrickVolume shape(brickVoxels.GetSizeX(), brickVoxels.GetSizeY(), brickVoxels.GetSizeZ(), brickVoxels.GetVoxelSize());
+			threadBrickVoxels.resize(threadVoxels.size(), shape);
+		}
+
+		splatParticles([&](unsigned int g, const Float3& pos)
+		{
+			threadBrickVoxels[g].Splat(pos, settings.smoothingRadius);
+		});
+
+		// Allocating bricks isn't thread safe, so the union of the partial volumes is allocated first.
+		// The bricks are then summed in parallel, in the same grid order as the dense sums.
+		brickVoxels.Clear();
+		for (const BrickVolume& part : threadBrickVoxels)
+			brickVoxels.AddBricksOf(part);
+
+		jobSystem.ParallelFor(brickVoxels.GetBrickCount(), 16, [&](unsigned int begin, unsigned int end, unsigned int)
+		{
+			for (unsigned int brick = begin; brick < end; brick++)
+			{
+				const Int3& coord = brickVoxels.GetBrickCoord(brick);
+				float* sum = brickVoxels.GetBrickData(brick);
+
+				for (const BrickVolume& part : threadBrickVoxels)
+				{
+					uint32_t partBrick = part.FindBrick(coord.x, coord.y, coord.z);
+					if (partBrick == BrickVolume::invalidBrick)
+						continue;
+
+					const float* data = part.GetBrickData(partBrick);
+					for (int v = 0; v < BrickVolume::BRICK_VOXELS; v++)
+						sum[v] += data[v];
+				}
+			}
+		});
+
+		for (BrickVolume& part : threadBrickVoxels)
+			part.Clear();
+		return;
+	}
+
+	splatParticles([&](unsigned int g, const Float3& pos)
+	{
+		std::vector<float>& grid = threadVoxels[g];
+		if (grid.empty())
+			grid.resize(VOXEL_COUNT);
+
+		SplatVoxels(grid, pos);
+	});
+
+	jobSystem.ParallelFor(static_cast<unsigned int>(VOXEL_COUNT), 16384, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int v = begin; v < end; v++)
+		{
+			float sum = 0.0f;
+			for (std::vector<float>& grid : threadVoxels)
+			{
+				if (grid.empty())
+					continue;
+
+				sum += grid[v];
+				grid[v] = 0.0f;
+			}
+			voxels[v] = sum;
+		}
+	});
+}
+
+void SPHCPU::Update(float deltaTime, float minX, float minZ)
+{
+	PROFILE_SCOPE_ARG("SPHCPU Update", "particles", numParticles);
+
+	// Substeps of one Advance add up
+	if (currentSubstep == 0)
+		stageTimes.fill(0.0);
+
+	// Growing past the checkpoint's capacity or the first reorder has replaced every attribute borrowed from it
+	if (checkpointFile && !particles.IsBorrowed() && !reorderScratch.IsBorrowed())
+		checkpointFile.reset();
+
+	auto timeStage = [&](SPHStage stage, auto&& pass)
+	{
+		PROFILE_SCOPE_ARG(GetSPHStageName(stage), "particles", numParticles);
+		auto start = std::chrono::steady_clock::now();
+		pass();
+		stageTimes[static_cast<unsigned int>(stage)] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	if (!emitters.empty() || !sinks.empty())
+		timeStage(SPHStage::EmittersAndSinks, [&] { UpdateEmittersAndSinks(deltaTime); });
+
+	if (particleOrder != ParticleOrder::None && ++stepsSinceReorder >= reorderInterval)
+	{
+		timeStage(SPHStage::ReorderParticles, [&] { UpdateReorderParticles(); });
+		stepsSinceReorder = 0;
+	}
+
+	// SPH, the grid is only needed when there are no neighbour lists to reuse
+	bool rebuildGrid = neighbourSkin == 0.0f;
+	if (!rebuildGrid)
+		timeStage(SPHStage::NeighbourLists, [&] { rebuildGrid = NeighbourListsNeedRebuild(); });
+
+	if (rebuildGrid)
+	{
+		timeStage(SPHStage::SpatialGridClear, [&] { UpdateSpatialGridClear(); });
+		timeStage(SPHStage::AddParticlesToSpatialGrid, [&] { UpdateAddParticlesToSpatialGrid(); });
+		timeStage(SPHStage::SortGrid, [&] { UpdateSortGrid(); });
+		timeStage(SPHStage::BuildGridOffsets, [&] { UpdateBuildGridOffsets(); });
+
+		if (neighbourSkin > 0.0f)
+			timeStage(SPHStage::NeighbourLists, [&] { UpdateBuildNeighbourLists(); });
+	}
+	else
+	{
+		neighbourStats.stepsSinceRebuild++;
+	}
+
+	timeStage(SPHStage::ParticleDensities, [&] { UpdateParticleDensities(); });
+	timeStage(SPHStage::ParticlePressure, [&] { UpdateParticlePressure(deltaTime); });
+	timeStage(SPHStage::Integrate, [&] { UpdateIntegrate(deltaTime, minX, minZ); });
+
+	timeStage(SPHStage::MarchingCubes, [&] { UpdateMarchingCubes(); });
+
+	stepIndex++;
+	simulatedTime += deltaTime;
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "SPHBackend.h"
+#include "JobSystem.h"
+#include "ParticleSoA.h"
+#include "SPHKernelsSIMD.h"
+#include "GridSort.h"
+#include "SpaceFillingCurve.h"
+#include "Checkpoint.h"
+#include "BrickVolume.h"
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Bookkeeping of the optional Verlet neighbour lists
+struct NeighbourListStats
+{
+	unsigned int rebuildCount = 0;
+	unsigned int stepsSinceRebuild = 0;
+	size_t entryCount = 0; // Stored neighbour indices, each particle's own index included
+	size_t memoryBytes = 0; // Allocated capacity of every list buffer
+};
+
+// Box volume that spawns particles at a steady rate while enabled
+struct ParticleEmitter
+{
+	Float3 min;
+	Float3 max;
+	Float3 velocity = { 0.0f, 0.0f, 0.0f };
+	float rate = 1000.0f; // Particles per second
+	bool enabled = true;
+
+	float pending = 0.0f; // Fraction of a particle carried over to the next step
+};
+
+// Box volume that retires every particle inside it while enabled
+struct ParticleSink
+{
+	Float3 min;
+	Float3 max;
+	bool enabled = true;
+};
+
+// Headless CPU implementation of the SPHComputeShader.hlsl pipeline.
+// Each Update* pass mirrors the compute shader entry point of the same stage and runs across the JobSystem workers,
+// so it needs no D3D11 device and can be used as a reference for the GPU path.
+class SPHCPU : public SPHBackend
+{
+public:
+	static constexpr uint32_t invalidSlot = 0xFFFFFFFF;
+
+	// numParticles is only the starting count, emitters, sinks and EmitParticle / RetireParticle change it at runtime
+	SPHCPU(unsigned int numParticles = NUM_OF_PARTICLES, unsigned int threadCount = 0, const SPHSettings& settings = SPHSettings());
+	~SPHCPU() override;
+
+	void Update(float deltaTime, float minX, float minZ) override;
+
+	unsigned int GetParticleCount() const override { return numParticles; }
+	void ReadParticles(std::vector<ParticleState>& outParticles) override;
+	const char* GetName() const override { return "CPU"; }
+
+	MotionBounds GetMotionBounds() const override { return motionBounds; }
+	float GetSmoothingRadius() const override { return settings.smoothingRadius; }
+
+	// Equivalent of g_ParticlePositions, written by the integrate pass. w is 1 for active ids and 0 for retired ones
+	const std::vector<Float4>& GetParticlePositions() const { return particlePositions; }
+
+	// GetParticlePositions as it was before the last Advance, may be shorter when ids were added since
+	const std::vector<Float4>& GetPreviousParticlePositions() const { return previousParticlePositions; }
+	void SavePreviousPositions() override { previousParticlePositions = particlePositions; }
+
+	// Blends the previous and current positions, alpha 0 is the previous state. Ids that didn't exist or were
+	// inactive before the last Advance take their current position.
+	void InterpolatePositions(float alpha, std::vector<Float4>& outPositions) const;
+
+	// Equivalent of the Voxels buffer written by BuildDensityGrid, empty while the voxels are sparse
+	const std::vector<float>& GetVoxels() const { return voxels; }
+	int GetVoxelCount() const { return VOXEL_COUNT; }
+
+	// Sparse voxels splat into GetBrickVoxels instead of the dense grid, which is freed. The bricks cover the same
+	// box as the dense grid at any voxelSize, and at VOXEL_SIZE hold exactly the dense grid's values.
+	void SetSparseVoxels(bool enabled, float voxelSize = VOXEL_SIZE);
+	bool HasSparseVoxels() const { return sparseVoxels; }
+	const BrickVolume& GetBrickVoxels() const { return brickVoxels; }
+
+	// Capacity of the voxels and the workers' partial grids or volumes
+	size_t GetVoxelMemoryBytes() const;
+
+	unsigned int GetThreadCount() const { return jobSystem.GetThreadCount(); }
+
+	// Wall time of every stage of the last Update in milliseconds, 0 for stages that didn't run.
+	// Summed over the substeps when the update went through Advance.
+	const std::array<double, SPH_STAGE_COUNT>& GetStageTimes() const { return stageTimes; }
+
+	// Defaults to the best level the machine supports, lower levels are useful for comparisons
+	void SetSIMDLevel(SIMDLevel level);
+	SIMDLevel GetSIMDLevel() const { return kernelTable->level; }
+
+	// Deterministic mode gives bit identical results for any thread count. Neighbours are visited in id order and
+	// summed with the compensated scalar kernels, the marching cubes splat uses a fixed number of partial grids.
+	// A step costs a little over twice as much, see the README.
+	void SetDeterministic(bool enabled);
+	bool IsDeterministic() const { return deterministic; }
+
+	// Hash of the id count and every active particle's position, velocity and densities, in id order.
+	// Equal checksums from two runs mean their particle states are bit identical.
+	uint64_t ComputeStateChecksum();
+
+	// Updates run so far (substeps included) and the time they covered, both restored by LoadCheckpoint
+	uint64_t GetStepIndex() const { return stepIndex; }
+	double GetSimulatedTime() const { return simulatedTime; }
+
+	// Writes the particles, ids, emitters, sinks, settings, step counter and walls (Update takes them per call) to path
+	bool SaveCheckpoint(const std::string& path, float wallMinX, float wallMinZ);
+
+	// Replaces the whole state with a checkpoint and returns its walls. The particle attributes aren't read or
+	// copied, the store uses the copy-on-write mapping in place and pages are faulted in as the first step touches
+	// them. Returns false and keeps the current state when the file is missing, malformed or another version.
+	bool LoadCheckpoint(const std::string& path, float* outWallMinX = nullptr, float* outWallMinZ = nullptr);
+
+	// Radix by default, Bitonic reproduces the GPU sort
+	void SetSortMode(SortMode mode) { sortMode = mode; }
+	SortMode GetSortMode() const { return sortMode; }
+
+	// Hashed by default to match the GPU, Dense covers the world bounds and ignores the sort mode
+	void SetGridMode(GridMode mode) { gridMode = mode; }
+	GridMode GetGridMode() const { return gridMode; }
+
+	// Verlet neighbour lists, 0 (the default) disables them. With a skin the grid is built with cells of
+	// smoothingRadius + skin, everything in that range is cached per particle and reused by the density and
+	// pressure passes until some particle has moved more than half the skin.
+	void SetNeighbourListSkin(float skin);
+	float GetNeighbourListSkin() const { return neighbourSkin; }
+	NeighbourListStats GetNeighbourListStats() const;
+
+	// Every interval steps the particle attributes are permuted into curve order of their dense grid cell,
+	// so neighbour reads hit nearby memory. Particle ids stay stable: GetParticlePositions and ReadParticles
+	// are always in id order, whatever order the particles are stored in.
+	void SetParticleReorder(ParticleOrder order, unsigned int interval = 16);
+	ParticleOrder GetParticleOrder() const { return particleOrder; }
+
+	uint32_t GetParticleSlot(uint32_t id) const { return idToSlot[id]; }
+	uint32_t GetParticleId(uint32_t slot) const { return slotToId[slot]; }
+
+	// Active particles always fill slots [0, GetParticleCount()), every pass only walks that range.
+	// Capacity grows geometrically and is kept when particles retire, so refilling a tank doesn't reallocate.
+	unsigned int GetParticleCapacity() const { return particles.Capacity(); }
+
+	// Ids run up to GetParticleIdCount(). Retired ids go on a free list and are reused before new ones are made,
+	// ReadParticles and GetParticlePositions are indexed by id and leave retired ids zeroed.
+	unsigned int GetParticleIdCount() const { return static_cast<unsigned int>(idToSlot.size()); }
+	bool IsParticleActive(uint32_t id) const override { return idToSlot[id] != invalidSlot; }
+
+	uint32_t EmitParticle(const Float3& position, const Float3& velocity);
+	void RetireParticle(uint32_t id);
+
+	// Applied at the start of every Update, sinks first
+	std::vector<ParticleEmitter>& GetEmitters() { return emitters; }
+	std::vector<ParticleSink>& GetSinks() { return sinks; }
+
+private:
+	// Initial Particle Positions
+	void InitParticles();
+
+	void UpdateSpatialGridClear();
+	void UpdateAddParticlesToSpatialGrid();
+	void UpdateSortGrid();
+
+	void UpdateBuildGridOffsets();
+	void UpdateParticleDensities();
+	void UpdateParticlePressure(float deltaTime);
+	void UpdateIntegrate(float deltaTime, float minX, float minZ);
+
+	void UpdateMarchingCubes();
+
+	// Collects the particle index of every grid entry in the 27 cells around position
+	void GatherNeighbourCandidates(const Float3& position, std::vector<uint32_t>& outNeighbours) const;
+	void GatherHashedNeighbourCandidates(const Float3& position, std::vector<uint32_t>& outNeighbours) const;
+	void GatherDenseNeighbourCandidates(const Float3& position, std::vector<uint32_t>& outNeighbours) const;
+
+	void UpdateEmittersAndSinks(float deltaTime);
+	void UpdateReorderParticles();
+
+	// Sets the active particle count, growing every per slot buffer with the particle store
+	void ResizeActiveParticles(unsigned int count);
+
+	// Moves the last active particle into slot
+	void RemoveSlot(uint32_t slot);
+
+	bool NeighbourListsNeedRebuild();
+	void UpdateBuildNeighbourLists();
+
+	// Cell of position in the dense grid, clamped so particles outside the world share the edge cells
+	Int3 GetDenseCell(const Float3& position) const;
+
+	// Copies neighbours into scratch sorted by particle id, so the sums don't depend on the storage order
+	const uint32_t* SortNeighboursById(const uint32_t* neighbours, unsigned int count, std::vector<uint32_t>& scratch) const;
+
+	// Adds the BuildDensityGrid contribution of a particle at pos to grid
+	void SplatVoxels(std::vector<float>& grid, const Float3& pos) const;
+
+private:
+	unsigned int numParticles;
+	unsigned int sortCount; // numParticles rounded up to a power of two for the bitonic network
+	SortMode sortMode = SortMode::Radix;
+	GridMode gridMode = GridMode::Hashed;
+
+	SPHSettings settings;
+	SmoothingKernels kernels;
+
+	std::array<double, SPH_STAGE_COUNT> stageTimes = {};
+
+	uint64_t stepIndex = 0;
+	double simulatedTime = 0.0;
+
+	// Mapping the particle attributes were borrowed from by LoadCheckpoint, released once nothing borrows from it
+	std::unique_ptr<CheckpointFile> checkpointFile;
+
+	JobSystem jobSystem;
+	const SPHKernelTable* kernelTable;
+
+	bool deterministic = false;
+	const SPHKernelTable* fastKernelTable; // Restored when deterministic mode is turned off
+	std::vector<std::vector<uint32_t>> threadSortedNeighbours;
+
+	// Particle Data (Partricles / g_ParticlePositions)
+	ParticleSoA particles;
+	std::vector<Float4> particlePositions;
+	std::vector<Float4> previousParticlePositions;
+	std::vector<Float3> pressureAccelerations;
+
+	// Stable id of the particle stored in each slot and its inverse
+	std::vector<uint32_t> slotToId;
+	std::vector<uint32_t> idToSlot;
+	std::vector<uint32_t> freeIds;
+
+	std::vector<ParticleEmitter> emitters;
+	std::vector<ParticleSink> sinks;
+	std::vector<std::vector<uint32_t>> threadRetiredSlots;
+	uint32_t emitterRandomState = 0x9E3779B9;
+
+	ParticleOrder particleOrder = ParticleOrder::None;
+	unsigned int reorderInterval = 16;
+	unsigned int stepsSinceReorder = 0;
+	ParticleSoA reorderScratch;
+	std::vector<uint32_t> slotToIdScratch;
+
+	// Per worker neighbour candidate lists handed to the SIMD kernels
+	std::vector<std::vector<uint32_t>> threadNeighbours;
+
+	// Spatial Grid (GridIndices / GridOffsets)
+	std::vector<GridEntry> gridIndices;
+	std::vector<GridEntry> gridIndicesScratch;
+	std::vector<uint32_t> gridOffsets;
+
+	// Dense grid, cell c owns gridIndices[cellStarts[c], cellStarts[c + 1])
+	std::vector<uint32_t> cellStarts;
+	int cellCountX;
+	int cellCountY;
+	int cellCountZ;
+	float gridCellSize;
+
+	// Verlet neighbour lists, particle i's list is neighbourChunks[i / particleGrain] from neighbourOffsets[i]
+	// and always starts with i itself so the density pass can include it and the pressure pass can skip it
+	float neighbourSkin = 0.0f;
+	bool neighbourListsValid = false;
+	std::vector<std::vector<uint32_t>> neighbourChunks;
+	std::vector<uint32_t> neighbourOffsets;
+	std::vector<uint32_t> neighbourCounts;
+	std::vector<Float3> neighbourListPositions;
+	std::vector<float> threadMaxDisplacements;
+	NeighbourListStats neighbourStats;
+
+	// Gathered by the pressure and integrate passes for the adaptive time step
+	MotionBounds motionBounds;
+	std::vector<MotionBounds> threadMotionBounds;
+
+	// Marching Cubes (Voxels), one partial grid per worker which is then summed.
+	// Deterministic mode always splats into DETERMINISTIC_VOXEL_GRIDS grids over fixed id ranges instead.
+	static constexpr unsigned int DETERMINISTIC_VOXEL_GRIDS = 8;
+	std::vector<float> voxels;
+	std::vector<std::vector<float>> threadVoxels;
+
+	// Sparse voxels, with a partial volume for each partial grid the dense path would use
+	bool sparseVoxels = false;
+	BrickVolume brickVoxels;
+	std::vector<BrickVolume> threadBrickVoxels;
+
+	float worldMinX = -50;
+	float worldMaxX = 50;
+
+	float worldMinY = -30;
+	float worldMaxY = 50;
+
+	float worldMinZ = -50;
+	float worldMaxZ = 50;
+
+	int VOXEL_COUNT = VOXEL_GRID_COUNT;
+};
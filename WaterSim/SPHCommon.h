@@ -0,0 +1,265 @@
+#pragma once
+
+// Simulation constants, particle layouts and SPH maths shared by the GPU (SPH) and CPU (SPHCPU) backends.
+// This header must stay free of Windows / D3D11 includes so the CPU backend builds on any platform.
+
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+// Default scene size, both backends take the particle count at runtime
+//constexpr unsigned int NUM_OF_PARTICLES = 256;
+//constexpr unsigned int NUM_OF_PARTICLES = 4096;
+//constexpr unsigned int NUM_OF_PARTICLES = 8192;
+//constexpr unsigned int NUM_OF_PARTICLES = 16384;
+constexpr unsigned int NUM_OF_PARTICLES = 131072;
+//constexpr unsigned int NUM_OF_PARTICLES = 262144;
+constexpr float SMOOTHING_RADIUS = 2.1f;
+constexpr unsigned int THREADS_PER_GROUPs = 256;
+
+// Digit width of the CPU radix sort, 256 buckets per pass keeps each histogram in L1
+constexpr unsigned int RADIX_BITS = 8;
+constexpr unsigned int RADIX = (1 << RADIX_BITS);
+
+struct Float3
+{
+	float x, y, z;
+};
+
+struct Float4
+{
+	float x, y, z, w;
+};
+
+struct Int3
+{
+	int x, y, z;
+};
+
+inline Float3 operator+(const Float3& a, const Float3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline Float3 operator-(const Float3& a, const Float3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline Float3 operator*(const Float3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+inline Float3& operator+=(Float3& a, const Float3& b) { a.x += b.x; a.y += b.y; a.z += b.z; return a; }
+inline float Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+// CPU mirror of ParticleAttributes in SPHComputeShader.hlsl (two float4s, 32 bytes)
+struct ParticleState
+{
+	Float3 position; // 12 bytes
+	float nearDensity; // 4 bytes (16-byte aligned)
+
+	Float3 velocity; // 12 bytes
+	float density; // 4 bytes (16-byte aligned)
+};
+
+static_assert(sizeof(ParticleState) == 32, "ParticleState must match the HLSL ParticleAttributes layout");
+
+// CPU mirror of a GridIndices uint3 entry
+struct GridEntry
+{
+	uint32_t particleIndex;
+	uint32_t hash;
+	uint32_t key;
+};
+
+// Tunables, defaults match the static consts in SPHComputeShader.hlsl
+struct SPHSettings
+{
+	float targetDensity = 50.0f;
+	float stiffnessValue = 100.0f;
+	float nearStiffnessValue = 400.0f;
+	float smoothingRadius = 2.5f;
+	float viscosityCoefficient = 0.01f;
+	float gravity = -9.807f;
+	float dampingFactor = 0.99f;
+	float minY = -30.0f;
+	float maxY = 50.0f;
+};
+
+// Equation of state and wall response of the integrate pass, shared by the CPU backends
+inline float ConvertDensityToPressure(float density, const SPHSettings& settings)
+{
+	float densityError = density - settings.targetDensity;
+	return std::max(densityError, 0.0f) * settings.stiffnessValue;
+}
+
+inline float ConvertNearDensityToPressure(float nearDensity, const SPHSettings& settings)
+{
+	return std::max(nearDensity, 0.0f) * settings.nearStiffnessValue;
+}
+
+inline void CollisionBox(Float3& pos, Float3& velocity, float minX, float maxX, float minZ, float maxZ, const SPHSettings& settings)
+{
+	if (pos.x < minX)
+	{
+		pos.x = minX;
+		velocity.x *= -1.0f;
+	}
+	else if (pos.x > maxX)
+	{
+		pos.x = maxX;
+		velocity.x *= -1.0f;
+	}
+
+	if (pos.y < settings.minY)
+	{
+		pos.y = settings.minY;
+		velocity.y *= -1.0f;
+	}
+	else if (pos.y > settings.maxY)
+	{
+		pos.y = settings.maxY;
+		velocity.y *= -1.0f;
+	}
+
+	if (pos.z < minZ)
+	{
+		pos.z = minZ;
+		velocity.z *= -1.0f;
+	}
+	else if (pos.z > maxZ)
+	{
+		pos.z = maxZ;
+		velocity.z *= -1.0f;
+	}
+
+	// Apply damping to velocity after collision
+	velocity = velocity * settings.dampingFactor;
+}
+
+// Density grid of the meshing stage (Voxels, filled by BuildDensityGrid), cells counted from the origin like the shader
+constexpr float VOXEL_SIZE = 1.25f;
+constexpr int VOXEL_GRID_SIZE_X = static_cast<int>(100.0f / VOXEL_SIZE); // worldMaxX - worldMinX
+constexpr int VOXEL_GRID_SIZE_Y = static_cast<int>(80.0f / VOXEL_SIZE);
+constexpr int VOXEL_GRID_SIZE_Z = static_cast<int>(100.0f / VOXEL_SIZE);
+constexpr int VOXEL_GRID_COUNT = VOXEL_GRID_SIZE_X * VOXEL_GRID_SIZE_Y * VOXEL_GRID_SIZE_Z;
+
+// Adds the BuildDensityGrid contribution of a particle at pos to grid, which holds VOXEL_GRID_COUNT voxels
+inline void SplatDensityVoxels(float* grid, const Float3& pos, float smoothingRadius)
+{
+	int baseX = static_cast<int>(std::floor(pos.x / VOXEL_SIZE));
+	int baseY = static_cast<int>(std::floor(pos.y / VOXEL_SIZE));
+	int baseZ = static_cast<int>(std::floor(pos.z / VOXEL_SIZE));
+
+	for (int z = -1; z <= 1; z++)
+		for (int y = -1; y <= 1; y++)
+			for (int x = -1; x <= 1; x++)
+			{
+				int cellX = baseX + x;
+				int cellY = baseY + y;
+				int cellZ = baseZ + z;
+
+				if (cellX < 0 || cellY < 0 || cellZ < 0 || cellX >= VOXEL_GRID_SIZE_X || cellY >= VOXEL_GRID_SIZE_Y || cellZ >= VOXEL_GRID_SIZE_Z)
+					continue;
+
+				Float3 voxelPos = { (cellX + 0.5f) * VOXEL_SIZE, (cellY + 0.5f) * VOXEL_SIZE, (cellZ + 0.5f) * VOXEL_SIZE };
+				float dx = voxelPos.x - pos.x;
+				float dy = voxelPos.y - pos.y;
+				float dz = voxelPos.z - pos.z;
+				float dist = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+				if (dist < smoothingRadius)
+				{
+					int index = cellX + cellY * VOXEL_GRID_SIZE_X + cellZ * VOXEL_GRID_SIZE_X * VOXEL_GRID_SIZE_Y;
+					grid[index] += 1.0f - (dist / smoothingRadius);
+				}
+			}
+}
+
+// Spatial Hashing
+constexpr uint32_t hashK1 = 15823;
+constexpr uint32_t hashK2 = 9737333;
+constexpr uint32_t hashK3 = 440817757;
+
+constexpr Int3 offsets3D[27] =
+{
+	{ -1, -1, -1 }, { -1, -1, 0 }, { -1, -1, 1 },
+	{ -1, 0, -1 }, { -1, 0, 0 }, { -1, 0, 1 },
+	{ -1, 1, -1 }, { -1, 1, 0 }, { -1, 1, 1 },
+	{ 0, -1, -1 }, { 0, -1, 0 }, { 0, -1, 1 },
+	{ 0, 0, -1 }, { 0, 0, 0 }, { 0, 0, 1 },
+	{ 0, 1, -1 }, { 0, 1, 0 }, { 0, 1, 1 },
+	{ 1, -1, -1 }, { 1, -1, 0 }, { 1, -1, 1 },
+	{ 1, 0, -1 }, { 1, 0, 0 }, { 1, 0, 1 },
+	{ 1, 1, -1 }, { 1, 1, 0 }, { 1, 1, 1 }
+};
+
+inline Int3 GetCell3D(const Float3& position, float radius)
+{
+	return {
+		static_cast<int>(std::floor(position.x / radius)),
+		static_cast<int>(std::floor(position.y / radius)),
+		static_cast<int>(std::floor(position.z / radius))
+	};
+}
+
+// Unsigned wrap-around matches the uint maths in HashCell3D on the GPU
+inline uint32_t HashCell3D(const Int3& cell)
+{
+	return static_cast<uint32_t>(cell.x) * hashK1 + static_cast<uint32_t>(cell.y) * hashK2 + static_cast<uint32_t>(cell.z) * hashK3;
+}
+
+inline uint32_t KeyFromHash(uint32_t hash, uint32_t tableSize)
+{
+	return hash % tableSize;
+}
+
+// Smoothing kernels from FluidMaths.hlsl with the pow() scale factors computed once per radius
+struct SmoothingKernels
+{
+	static constexpr float XM_PI_HLSL = 3.1415926f;
+
+	float radius;
+	float sqrRadius;
+	float densityScale;
+	float nearDensityScale;
+	float pressureScale;
+	float nearDensityDerivativeScale;
+	float viscosityScale;
+
+	explicit SmoothingKernels(float smoothingRadius)
+		: radius(smoothingRadius),
+		sqrRadius(smoothingRadius * smoothingRadius),
+		densityScale(15.0f / (2.0f * XM_PI_HLSL * std::pow(smoothingRadius, 5.0f))),
+		nearDensityScale(15.0f / (XM_PI_HLSL * std::pow(smoothingRadius, 6.0f))),
+		pressureScale(15.0f / (std::pow(smoothingRadius, 5.0f) * XM_PI_HLSL)),
+		nearDensityDerivativeScale(45.0f / (std::pow(smoothingRadius, 6.0f) * XM_PI_HLSL)),
+		viscosityScale(315.0f / (64.0f * XM_PI_HLSL * std::pow(smoothingRadius, 9.0f)))
+	{
+	}
+
+	float Density(float dst) const
+	{
+		if (dst >= radius) return 0.0f;
+		float diff = radius - dst;
+		return diff * diff * densityScale;
+	}
+
+	float NearDensity(float dst) const
+	{
+		if (dst >= radius) return 0.0f;
+		float diff = radius - dst;
+		return diff * diff * diff * nearDensityScale;
+	}
+
+	float Pressure(float dst) const
+	{
+		if (dst >= radius) return 0.0f;
+		float diff = radius - dst;
+		return -diff * pressureScale;
+	}
+
+	float NearDensityDerivative(float dst) const
+	{
+		if (dst >= radius) return 0.0f;
+		float diff = radius - dst;
+		return -diff * diff * nearDensityDerivativeScale;
+	}
+
+	float Viscosity(float dst) const
+	{
+		if (dst >= radius) return 0.0f;
+		float diff = sqrRadius - dst * dst;
+		return diff * diff * diff * viscosityScale;
+	}
+};
@@ -39,6 +39,10 @@ RWStructuredBuffer<float4> g_ParticlePositions : register(u7);
 
 RWStructuredBuffer<float> Voxels : register(u3);
 
+// Largest speed [0] and acceleration [1] of the step as float bits, cleared before the pressure pass.
+// Non-negative floats order the same as their bits, so InterlockedMax on uints works.
+RWStructuredBuffer<uint> MotionBounds : register(u4);
+
 // Spatial Grid 
 StructuredBuffer<uint3> GridIndicesIn : register(t0);
 RWStructuredBuffer<uint3> GridIndices : register(u1); 
@@ -104,6 +108,14 @@ uint KeyFromHash(uint hash, uint tableSize)
    return hash % tableSize;
 }
 
+void RecordMotionBound(uint index, float value)
+{
+    // Most threads are below the current maximum, skip their atomics
+    uint bits = asuint(value);
+    if (bits > MotionBounds[index])
+        InterlockedMax(MotionBounds[index], bits);
+}
+
 uint GetBits(uint value, uint bitOffset, uint numBits)
 {
     return (value >> bitOffset) & ((1 << numBits) - 1);
@@ -175,13 +187,14 @@ void BuildGridOffsets(uint3 dispatchThreadID : SV_DispatchThreadID)
     if (i >= numElements)
         return;
 
-    uint currentHash = GridIndices[i].y;
-    uint previousHash = (i == 0) ? 0xFFFFFFFF : GridIndices[i - 1].y;
+    // Entries are sorted by key, and cells whose hashes collide on a key are interleaved,
+    // so only the first entry of each key run may write the offset
+    uint currentKey = GridIndices[i].z;
+    uint previousKey = (i == 0) ? 0xFFFFFFFF : GridIndices[i - 1].z;
 
-    if (i == 0 || currentHash != previousHash)
+    if (i == 0 || currentKey != previousKey)
     {
-        uint cellKey = KeyFromHash(currentHash, numElements);
-        GridOffsets[cellKey] = i;
+        GridOffsets[currentKey] = i;
     }
 }
 
@@ -343,6 +356,8 @@ void CalculatePressure(uint3 dispatchThreadId : SV_DispatchThreadID)
     float3 acceleration = totalForce * invDensity;
     
     Partricles[dispatchThreadId.x].velocity.xyz += acceleration * deltaTime;
+
+    RecordMotionBound(1, length(acceleration + float3(0.0f, -9.807f, 0.0f)));
 }
 
 void CollisionBox(inout float3 pos, inout float3 velocity, float minX, float maxX, float minZ, float maxZ)
@@ -405,6 +420,7 @@ void CSMain(uint3 dispatchThreadID : SV_DispatchThreadID)
     inputPosition += inputVelocity * deltaTime;
     
     CollisionBox(inputPosition, inputVelocity, minX, -minX, minZ, -minZ);
+    RecordMotionBound(0, length(inputVelocity));
     
     Partricles[dispatchThreadID.x].velocity = inputVelocity;
     Partricles[dispatchThreadID.x].position = inputPosition;
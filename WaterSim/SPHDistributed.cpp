@@ -0,0 +1,247 @@
+#include "SPHDistributed.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	// Messages are the raw arrays back to back, every rank is the same build on the same machine
+	template <typename T>
+	void AppendArray(std::vector<uint8_t>& message, const std::vector<T>& values)
+	{
+		size_t offset = message.size();
+		message.resize(offset + values.size() * sizeof(T));
+		if (!values.empty())
+			std::memcpy(message.data() + offset, values.data(), values.size() * sizeof(T));
+	}
+
+	template <typename T>
+	void ReadArray(const uint8_t* data, size_t count, std::vector<T>& outValues)
+	{
+		outValues.resize(count);
+		if (count > 0)
+			std::memcpy(outValues.data(), data, count * sizeof(T));
+	}
+}
+
+SPHDistributed::SPHDistributed(Transport& transport, unsigned int threadCount, const SPHSettings& settings)
+	:
+	transport(transport),
+	settings(settings),
+	domain(threadCount, -1, settings)
+{
+}
+
+void SPHDistributed::AddParticles(const std::vector<ParticleState>& particles, const std::vector<uint32_t>& ids)
+{
+	domain.AddParticles(particles.data(), ids.data(), static_cast<unsigned int>(std::min(particles.size(), ids.size())));
+}
+
+void SPHDistributed::Update(float deltaTime, float minX, float minZ)
+{
+	PROFILE_SCOPE_ARG("SPHDistributed Update", "particles", GetParticleCount());
+
+	if (!connected)
+		return;
+
+	// Substeps of one Advance add up
+	if (currentSubstep == 0)
+	{
+		domain.ResetStageTimes();
+		transportMs = 0.0;
+	}
+
+	float slabMin = GetSlabMin(minX);
+	float slabMax = GetSlabMax(minX);
+
+	// Everything below the slab goes to the rank below and everything above to the one above
+	for (unsigned int side = 0; side < 2; side++)
+	{
+		emigrants[side].clear();
+		emigrantIds[side].clear();
+	}
+	domain.TakeEmigrants(slabMin, std::numeric_limits<float>::max(), emigrants[0], emigrantIds[0]);
+	domain.TakeEmigrants(std::numeric_limits<float>::lowest(), slabMax, emigrants[1], emigrantIds[1]);
+
+	domain.TimeStage(DomainStage::Migrate, [&]
+	{
+		for (unsigned int side = 0; side < 2; side++)
+		{
+			outgoing[side].clear();
+			AppendArray(outgoing[side], emigrants[side]);
+			AppendArray(outgoing[side], emigrantIds[side]);
+		}
+		connected = ExchangeWithNeighbours();
+	});
+
+	for (unsigned int side = 0; side < 2 && connected; side++)
+	{
+		size_t count = incoming[side].size() / (sizeof(ParticleState) + sizeof(uint32_t));
+		ReadArray(incoming[side].data(), count, immigrants);
+		ReadArray(incoming[side].data() + count * sizeof(ParticleState), count, immigrantIds);
+		if (count > 0)
+			domain.AddParticles(immigrants.data(), immigrantIds.data(), static_cast<unsigned int>(count));
+	}
+
+	// Ownership is final now, the particles within a radius of a boundary go to the rank across it
+	float lowerLimit = GetRank() > 0 ? slabMin + settings.smoothingRadius : std::numeric_limits<float>::lowest();
+	float upperLimit = GetRank() + 1 < GetRankCount() ? slabMax - settings.smoothingRadius : std::numeric_limits<float>::max();
+	domain.PackHalo(lowerLimit, upperLimit, haloPacks[0], haloPacks[1]);
+
+	domain.TimeStage(DomainStage::HaloExchange, [&]
+	{
+		for (unsigned int side = 0; side < 2; side++)
+		{
+			outgoing[side].clear();
+			AppendArray(outgoing[side], haloPacks[side].particles);
+		}
+		connected = connected && ExchangeWithNeighbours();
+
+		for (unsigned int side = 0; side < 2; side++)
+			ReadArray(incoming[side].data(), incoming[side].size() / sizeof(ParticleState), haloParticles[side]);
+	});
+
+	if (!connected)
+		return;
+
+	domain.SetHalo(haloParticles[0], haloParticles[1]);
+	domain.BuildGrid(slabMin, slabMax, minX, minZ);
+	domain.UpdateDensities();
+
+	// The halo's densities come from their owners, in the order the particles were sent
+	domain.TimeStage(DomainStage::HaloExchange, [&]
+	{
+		for (unsigned int side = 0; side < 2; side++)
+		{
+			domain.GatherDensities(haloPacks[side].slots, haloDensities[side]);
+			outgoing[side].clear();
+			AppendArray(outgoing[side], haloDensities[side]);
+		}
+		connected = ExchangeWithNeighbours();
+
+		for (unsigned int side = 0; side < 2; side++)
+			ReadArray(incoming[side].data(), incoming[side].size() / sizeof(DensitySample), haloDensities[side]);
+	});
+
+	if (!connected)
+		return;
+
+	domain.SetHaloDensities(haloDensities[0], haloDensities[1]);
+	domain.UpdatePressure(deltaTime);
+	domain.UpdateIntegrate(deltaTime, minX, minZ, nullptr);
+
+	// Counted as Integrate, it finishes off the motion bounds the pass collected
+	domain.TimeStage(DomainStage::Integrate, [&]
+	{
+		connected = ReduceMotionBounds();
+	});
+
+	stepIndex++;
+	simulatedTime += deltaTime;
+}
+
+void SPHDistributed::ReadParticles(std::vector<ParticleState>& outParticles)
+{
+	outParticles.resize(domain.GetOwnedCount());
+	for (unsigned int i = 0; i < domain.GetOwnedCount(); i++)
+		outParticles[i] = domain.GetParticle(i);
+}
+
+std::vector<uint32_t> SPHDistributed::GetParticleIds() const
+{
+	std::vector<uint32_t> ids(domain.GetOwnedCount());
+	for (unsigned int i = 0; i < domain.GetOwnedCount(); i++)
+		ids[i] = domain.GetParticleId(i);
+	return ids;
+}
+
+float SPHDistributed::GetSlabMin(float minX) const
+{
+	if (GetRank() == 0)
+		return std::numeric_limits<float>::lowest();
+	return minX - 2.0f * minX * GetRank() / GetRankCount();
+}
+
+float SPHDistributed::GetSlabMax(float minX) const
+{
+	if (GetRank() + 1 == GetRankCount())
+		return std::numeric_limits<float>::max();
+	return minX - 2.0f * minX * (GetRank() + 1) / GetRankCount();
+}
+
+bool SPHDistributed::ExchangeWithNeighbours()
+{
+	unsigned int rank = GetRank();
+
+	peers.clear();
+	sendMessages.clear();
+	if (rank > 0)
+	{
+		peers.push_back(rank - 1);
+		sendMessages.push_back(std::move(outgoing[0]));
+	}
+	if (rank + 1 < GetRankCount())
+	{
+		peers.push_back(rank + 1);
+		sendMessages.push_back(std::move(outgoing[1]));
+	}
+
+	incoming[0].clear();
+	incoming[1].clear();
+	if (peers.empty())
+		return true;
+
+	auto start = std::chrono::steady_clock::now();
+	bool exchanged = transport.Exchange(peers, sendMessages, receiveMessages);
+	transportMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// The buffers go back where they came from to be reused
+	for (size_t i = 0; i < peers.size(); i++)
+	{
+		unsigned int side = peers[i] < rank ? 0 : 1;
+		outgoing[side] = std::move(sendMessages[i]);
+		if (exchanged)
+			incoming[side] = std::move(receiveMessages[i]);
+	}
+	return exchanged;
+}
+
+bool SPHDistributed::ReduceMotionBounds()
+{
+	motionBounds = domain.GetMotionBounds();
+	unsigned int rankCount = GetRankCount();
+	if (rankCount == 1)
+		return true;
+
+	// Every rank sends its own to every other, which for a handful of ranks beats a tree
+	std::vector<uint8_t> message(sizeof(MotionBounds));
+	std::memcpy(message.data(), &motionBounds, sizeof(MotionBounds));
+
+	peers.clear();
+	for (unsigned int rank = 0; rank < rankCount; rank++)
+	{
+		if (rank != GetRank())
+			peers.push_back(rank);
+	}
+	sendMessages.assign(peers.size(), message);
+
+	auto start = std::chrono::steady_clock::now();
+	bool exchanged = transport.Exchange(peers, sendMessages, receiveMessages);
+	transportMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if (!exchanged)
+		return false;
+
+	for (const std::vector<uint8_t>& received : receiveMessages)
+	{
+		if (received.size() != sizeof(MotionBounds))
+			return false;
+
+		MotionBounds bounds;
+		std::memcpy(&bounds, received.data(), sizeof(MotionBounds));
+		motionBounds.maxSpeed = std::max(motionBounds.maxSpeed, bounds.maxSpeed);
+		motionBounds.maxAcceleration = std::max(motionBounds.maxAcceleration, bounds.maxAcceleration);
+	}
+	return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "SPHDomain.h"
+#include "Transport.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// One rank of a simulation split across processes. The tank is cut along x into equal slabs, one per rank, and every
+// rank only ever holds its own slab's particles plus the halo copies from its neighbours, so a scene can outgrow the
+// memory of one process. Each Update trades migrants, then halo particles, then the halo's densities with the ranks
+// either side over the Transport, like SPHSlabs does in memory, and agrees on the motion bounds with every rank so
+// adaptive stepping takes the same substeps everywhere.
+// Particles only move one rank per step, one that jumps further is passed on over the following steps.
+// The marching cubes voxels and everything SPHSlabs leaves to SPHCPU aren't supported.
+class SPHDistributed : public SPHBackend
+{
+public:
+	// threadCount of 0 uses std::thread::hardware_concurrency(), which is only right with one rank per machine
+	SPHDistributed(Transport& transport, unsigned int threadCount = 0, const SPHSettings& settings = SPHSettings());
+
+	SPHDistributed(const SPHDistributed&) = delete;
+	SPHDistributed& operator=(const SPHDistributed&) = delete;
+
+	// ids are unique across all ranks. Particles outside this rank's slab move on over the first steps.
+	void AddParticles(const std::vector<ParticleState>& particles, const std::vector<uint32_t>& ids);
+
+	// Every rank has to call it with the same walls, and the same number of times
+	void Update(float deltaTime, float minX, float minZ) override;
+
+	// This rank's particles, see GetParticleIds
+	unsigned int GetParticleCount() const override { return domain.GetOwnedCount(); }
+	void ReadParticles(std::vector<ParticleState>& outParticles) override;
+	std::vector<uint32_t> GetParticleIds() const;
+	const char* GetName() const override { return "CPU Distributed"; }
+
+	// Over all ranks
+	MotionBounds GetMotionBounds() const override { return motionBounds; }
+	float GetSmoothingRadius() const override { return settings.smoothingRadius; }
+	void SavePreviousPositions() override {}
+
+	unsigned int GetRank() const { return transport.GetRank(); }
+	unsigned int GetRankCount() const { return transport.GetRankCount(); }
+	unsigned int GetThreadCount() const { return domain.GetThreadCount(); }
+	unsigned int GetHaloCount() const { return domain.GetHaloCount(); }
+
+	// This rank's slab for the given walls, the outer ranks reach past them
+	float GetSlabMin(float minX) const;
+	float GetSlabMax(float minX) const;
+
+	// This rank's time in each stage of the last Update, in milliseconds and summed over Advance substeps.
+	// Migrate and HaloExchange include waiting on the neighbours, which is also in GetTransportMs.
+	const std::array<double, DOMAIN_STAGE_COUNT>& GetStageTimes() const { return domain.GetStageTimes(); }
+	double GetTransportMs() const { return transportMs; }
+
+	// False once the transport has failed, Update does nothing from then on
+	bool IsConnected() const { return connected; }
+
+	uint64_t GetStepIndex() const { return stepIndex; }
+	double GetSimulatedTime() const { return simulatedTime; }
+
+private:
+	// Sends outgoing to the neighbours and receives theirs into incoming, index 0 is the rank below and 1 the one above
+	bool ExchangeWithNeighbours();
+	// Largest motion bounds of all the ranks
+	bool ReduceMotionBounds();
+
+	Transport& transport;
+	SPHSettings settings;
+	SPHDomain domain;
+	bool connected = true;
+
+	// Index 0 is the rank below and 1 the one above, as for the messages
+	std::vector<ParticleState> emigrants[2];
+	std::vector<uint32_t> emigrantIds[2];
+	std::vector<ParticleState> immigrants;
+	std::vector<uint32_t> immigrantIds;
+	HaloPack haloPacks[2];
+	std::vector<ParticleState> haloParticles[2];
+	std::vector<DensitySample> haloDensities[2];
+
+	std::array<std::vector<uint8_t>, 2> outgoing;
+	std::array<std::vector<uint8_t>, 2> incoming;
+	std::vector<unsigned int> peers;
+	std::vector<std::vector<uint8_t>> sendMessages;
+	std::vector<std::vector<uint8_t>> receiveMessages;
+
+	MotionBounds motionBounds;
+	double transportMs = 0.0;
+	uint64_t stepIndex = 0;
+	double simulatedTime = 0.0;
+};
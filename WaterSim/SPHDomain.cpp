@@ -0,0 +1,362 @@
+#include "SPHDomain.h"
+#include "GridSort.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Same chunking as SPHCPU
+	constexpr unsigned int particleGrain = 1024;
+}
+
+SPHDomain::SPHDomain(unsigned int threadCount, int firstProcessor, const SPHSettings& settings)
+	:
+	settings(settings),
+	kernels(settings.smoothingRadius),
+	kernelTable(&GetSPHKernelTable(DetectSIMDLevel())),
+	jobSystem(threadCount, firstProcessor)
+{
+	threadNeighbours.resize(jobSystem.GetThreadCount());
+	threadMotionBounds.resize(jobSystem.GetThreadCount());
+	threadVoxels.resize(jobSystem.GetThreadCount());
+}
+
+void SPHDomain::AddParticles(const ParticleState* newParticles, const uint32_t* newIds, unsigned int count)
+{
+	TimeStage(DomainStage::Migrate, [&]
+	{
+		// Whatever halo there was goes, it is rebuilt before the next passes anyway
+		unsigned int begin = ownedCount;
+		ownedCount += count;
+		lowerHaloCount = 0;
+		upperHaloCount = 0;
+		particles.Resize(ownedCount);
+		ids.insert(ids.end(), newIds, newIds + count);
+
+		for (unsigned int i = 0; i < count; i++)
+			particles.Set(begin + i, newParticles[i]);
+	});
+}
+
+void SPHDomain::TakeEmigrants(float minX, float maxX, std::vector<ParticleState>& outParticles, std::vector<uint32_t>& outIds)
+{
+	TimeStage(DomainStage::Migrate, [&]
+	{
+		unsigned int i = 0;
+		while (i < ownedCount)
+		{
+			float x = particles.x[i];
+			if (x >= minX && x < maxX)
+			{
+				i++;
+				continue;
+			}
+
+			outParticles.push_back(particles.Get(i));
+			outIds.push_back(ids[i]);
+
+			// The last owned particle takes the slot and is looked at next
+			unsigned int last = --ownedCount;
+			particles.Copy(i, particles, last);
+			ids[i] = ids[last];
+		}
+
+		lowerHaloCount = 0;
+		upperHaloCount = 0;
+		particles.Resize(ownedCount);
+		ids.resize(ownedCount);
+	});
+}
+
+void SPHDomain::PackHalo(float lowerLimit, float upperLimit, HaloPack& lower, HaloPack& upper)
+{
+	TimeStage(DomainStage::HaloExchange, [&]
+	{
+		for (HaloPack* pack : { &lower, &upper })
+		{
+			pack->particles.clear();
+			pack->slots.clear();
+		}
+
+		for (unsigned int i = 0; i < ownedCount; i++)
+		{
+			float x = particles.x[i];
+			if (x < lowerLimit)
+			{
+				lower.particles.push_back(particles.Get(i));
+				lower.slots.push_back(i);
+			}
+
+			// A domain narrower than two radii sends some particles both ways
+			if (x >= upperLimit)
+			{
+				upper.particles.push_back(particles.Get(i));
+				upper.slots.push_back(i);
+			}
+		}
+	});
+}
+
+void SPHDomain::SetHalo(const std::vector<ParticleState>& lower, const std::vector<ParticleState>& upper)
+{
+	TimeStage(DomainStage::HaloExchange, [&]
+	{
+		lowerHaloCount = static_cast<unsigned int>(lower.size());
+		upperHaloCount = static_cast<unsigned int>(upper.size());
+		particles.Resize(ownedCount + lowerHaloCount + upperHaloCount);
+
+		for (unsigned int i = 0; i < lowerHaloCount; i++)
+			particles.Set(ownedCount + i, lower[i]);
+		for (unsigned int i = 0; i < upperHaloCount; i++)
+			particles.Set(ownedCount + lowerHaloCount + i, upper[i]);
+	});
+}
+
+void SPHDomain::GatherDensities(const std::vector<uint32_t>& slots, std::vector<DensitySample>& outDensities) const
+{
+	outDensities.resize(slots.size());
+	for (size_t i = 0; i < slots.size(); i++)
+		outDensities[i] = { particles.density[slots[i]], particles.nearDensity[slots[i]] };
+}
+
+void SPHDomain::SetHaloDensities(const std::vector<DensitySample>& lower, const std::vector<DensitySample>& upper)
+{
+	TimeStage(DomainStage::HaloExchange, [&]
+	{
+		unsigned int lowerCount = std::min(lowerHaloCount, static_cast<unsigned int>(lower.size()));
+		for (unsigned int i = 0; i < lowerCount; i++)
+		{
+			particles.density[ownedCount + i] = lower[i].density;
+			particles.nearDensity[ownedCount + i] = lower[i].nearDensity;
+		}
+
+		unsigned int first = ownedCount + lowerHaloCount;
+		unsigned int upperCount = std::min(upperHaloCount, static_cast<unsigned int>(upper.size()));
+		for (unsigned int i = 0; i < upperCount; i++)
+		{
+			particles.density[first + i] = upper[i].density;
+			particles.nearDensity[first + i] = upper[i].nearDensity;
+		}
+	});
+}
+
+void SPHDomain::BuildGrid(float minX, float maxX, float wallMinX, float wallMinZ)
+{
+	TimeStage(DomainStage::BuildGrid, [&]
+	{
+		// Covers the domain and its halo between the walls, anything further out is clamped into the edge cells
+		float radius = settings.smoothingRadius;
+		float gridMinX = std::max(minX, wallMinX) - radius;
+		float gridMaxX = std::max(std::min(maxX, -wallMinX) + radius, gridMinX + radius);
+
+		gridOrigin = { gridMinX, settings.minY - radius, wallMinZ - radius };
+		cellCount = {
+			static_cast<int>(std::ceil((gridMaxX - gridMinX) / radius)),
+			static_cast<int>(std::ceil((settings.maxY - settings.minY) / radius)) + 2,
+			static_cast<int>(std::ceil(-2.0f * wallMinZ / radius)) + 2
+		};
+
+		unsigned int count = particles.Size();
+		if (gridEntries.size() < count)
+			gridEntries.resize(count);
+
+		jobSystem.ParallelFor(count, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Int3 cell = GetCell(particles.GetPosition(i));
+				uint32_t cellIndex = cell.x + cellCount.x * (cell.y + cellCount.y * cell.z);
+				gridEntries[i] = { i, cellIndex, cellIndex };
+			}
+		});
+
+		unsigned int cellTotal = cellCount.x * cellCount.y * cellCount.z;
+		CountingSortGridEntries(jobSystem, gridEntries, gridScratch, count, cellTotal, cellStarts);
+	});
+}
+
+void SPHDomain::UpdateDensities()
+{
+	// Halo densities would be missing the neighbours beyond the halo, their owners send them over instead
+	TimeStage(DomainStage::ParticleDensities, [&]
+	{
+		jobSystem.ParallelFor(ownedCount, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+		{
+			std::vector<uint32_t>& neighbours = threadNeighbours[threadIndex];
+
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Float3 position = particles.GetPosition(i);
+				GatherNeighbourCandidates(position, neighbours);
+
+				DensitySample sample = kernelTable->density(particles, neighbours.data(), static_cast<unsigned int>(neighbours.size()), position, kernels);
+				particles.density[i] = sample.density;
+				particles.nearDensity[i] = sample.nearDensity;
+			}
+		});
+	});
+}
+
+void SPHDomain::UpdatePressure(float deltaTime)
+{
+	std::fill(threadMotionBounds.begin(), threadMotionBounds.end(), MotionBounds());
+
+	if (pressureAccelerations.size() < ownedCount)
+		pressureAccelerations.resize(ownedCount);
+
+	TimeStage(DomainStage::ParticlePressure, [&]
+	{
+		jobSystem.ParallelFor(particles.Size(), particleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				particles.pressure[i] = ConvertDensityToPressure(particles.density[i], settings);
+				particles.nearPressure[i] = ConvertNearDensityToPressure(particles.nearDensity[i], settings);
+			}
+		});
+
+		jobSystem.ParallelFor(ownedCount, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+		{
+			std::vector<uint32_t>& neighbours = threadNeighbours[threadIndex];
+
+			for (unsigned int i = begin; i < end; i++)
+			{
+				PressureSample particle;
+				particle.position = particles.GetPosition(i);
+				particle.velocity = particles.GetVelocity(i);
+				particle.pressure = particles.pressure[i];
+				particle.nearPressure = particles.nearPressure[i];
+
+				GatherNeighbourCandidates(particle.position, neighbours);
+				neighbours.erase(std::remove(neighbours.begin(), neighbours.end(), i), neighbours.end());
+
+				Float3 totalForce = kernelTable->pressure(particles, neighbours.data(), static_cast<unsigned int>(neighbours.size()),
+					particle, kernels, settings.viscosityCoefficient);
+
+				float density = particles.density[i];
+				float invDensity = density > 0.0001f ? 1.0f / density : 0.0f;
+				pressureAccelerations[i] = totalForce * invDensity;
+			}
+		});
+
+		jobSystem.ParallelFor(ownedCount, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+		{
+			float maxSqrAcceleration = 0.0f;
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Float3 acceleration = pressureAccelerations[i];
+				particles.vx[i] += acceleration.x * deltaTime;
+				particles.vy[i] += acceleration.y * deltaTime;
+				particles.vz[i] += acceleration.z * deltaTime;
+
+				acceleration.y += settings.gravity;
+				maxSqrAcceleration = std::max(maxSqrAcceleration, Dot(acceleration, acceleration));
+			}
+
+			MotionBounds& bounds = threadMotionBounds[threadIndex];
+			bounds.maxAcceleration = std::max(bounds.maxAcceleration, maxSqrAcceleration);
+		});
+	});
+}
+
+void SPHDomain::UpdateIntegrate(float deltaTime, float wallMinX, float wallMinZ, Float4* positionsById)
+{
+	TimeStage(DomainStage::Integrate, [&]
+	{
+		jobSystem.ParallelFor(ownedCount, particleGrain, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+		{
+			float maxSqrSpeed = 0.0f;
+			for (unsigned int i = begin; i < end; i++)
+			{
+				Float3 position = particles.GetPosition(i);
+				Float3 velocity = particles.GetVelocity(i);
+
+				velocity.y += settings.gravity * deltaTime;
+				position += velocity * deltaTime;
+
+				CollisionBox(position, velocity, wallMinX, -wallMinX, wallMinZ, -wallMinZ, settings);
+				maxSqrSpeed = std::max(maxSqrSpeed, Dot(velocity, velocity));
+
+				particles.vx[i] = velocity.x;
+				particles.vy[i] = velocity.y;
+				particles.vz[i] = velocity.z;
+
+				particles.x[i] = position.x;
+				particles.y[i] = position.y;
+				particles.z[i] = position.z;
+
+				if (positionsById)
+					positionsById[ids[i]] = { position.x, position.y, position.z, 1.0f };
+			}
+
+			MotionBounds& bounds = threadMotionBounds[threadIndex];
+			bounds.maxSpeed = std::max(bounds.maxSpeed, maxSqrSpeed);
+		});
+	});
+}
+
+void SPHDomain::SplatVoxels()
+{
+	TimeStage(DomainStage::MarchingCubes, [&]
+	{
+		jobSystem.ParallelFor(ownedCount, particleGrain * 4, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+		{
+			std::vector<float>& grid = threadVoxels[threadIndex];
+			if (grid.empty())
+				grid.resize(VOXEL_GRID_COUNT);
+
+			for (unsigned int i = begin; i < end; i++)
+				SplatDensityVoxels(grid.data(), particles.GetPosition(i), settings.smoothingRadius);
+		});
+	});
+}
+
+MotionBounds SPHDomain::GetMotionBounds() const
+{
+	MotionBounds result;
+	for (const MotionBounds& bounds : threadMotionBounds)
+	{
+		result.maxSpeed = std::max(result.maxSpeed, bounds.maxSpeed);
+		result.maxAcceleration = std::max(result.maxAcceleration, bounds.maxAcceleration);
+	}
+
+	// The passes keep squared values until here
+	result.maxSpeed = std::sqrt(result.maxSpeed);
+	result.maxAcceleration = std::sqrt(result.maxAcceleration);
+	return result;
+}
+
+Int3 SPHDomain::GetCell(const Float3& position) const
+{
+	Int3 cell = GetCell3D(position - gridOrigin, settings.smoothingRadius);
+
+	// Clamping never moves two cells further apart, so neighbours within the radius stay in adjacent cells
+	return {
+		std::clamp(cell.x, 0, cellCount.x - 1),
+		std::clamp(cell.y, 0, cellCount.y - 1),
+		std::clamp(cell.z, 0, cellCount.z - 1)
+	};
+}
+
+void SPHDomain::GatherNeighbourCandidates(const Float3& position, std::vector<uint32_t>& outNeighbours) const
+{
+	outNeighbours.clear();
+
+	Int3 cell = GetCell(position);
+	int minX = std::max(cell.x - 1, 0);
+	int maxX = std::min(cell.x + 1, cellCount.x - 1);
+
+	// Cells along x are adjacent in the sorted entries, so each row of three cells is one contiguous range
+	for (int z = std::max(cell.z - 1, 0); z <= std::min(cell.z + 1, cellCount.z - 1); z++)
+	{
+		for (int y = std::max(cell.y - 1, 0); y <= std::min(cell.y + 1, cellCount.y - 1); y++)
+		{
+			uint32_t row = cellCount.x * (y + cellCount.y * z);
+			uint32_t begin = cellStarts[row + minX];
+			uint32_t end = cellStarts[row + maxX + 1];
+
+			for (uint32_t i = begin; i < end; i++)
+				outNeighbours.push_back(gridEntries[i].particleIndex);
+		}
+	}
+}
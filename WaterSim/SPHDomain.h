@@ -0,0 +1,145 @@
+#pragma once
+
+#include "SPHBackend.h"
+#include "JobSystem.h"
+#include "ParticleSoA.h"
+#include "SPHKernelsSIMD.h"
+#include "Profiler.h"
+
+#include <array>
+#include <chrono>
+#include <vector>
+
+// Stages of a decomposed step, each timed per domain
+enum class DomainStage
+{
+	Migrate,      // Particles that crossed a boundary move to their new domain
+	HaloExchange, // Copies of the particles near each boundary, and later their densities, go to the neighbour domain
+	BuildGrid,
+	ParticleDensities,
+	ParticlePressure,
+	Integrate,
+	MarchingCubes,
+	Count
+};
+
+constexpr unsigned int DOMAIN_STAGE_COUNT = static_cast<unsigned int>(DomainStage::Count);
+
+inline const char* GetDomainStageName(DomainStage stage)
+{
+	static const char* const names[DOMAIN_STAGE_COUNT] =
+	{
+		"Migrate",
+		"HaloExchange",
+		"BuildGrid",
+		"ParticleDensities",
+		"ParticlePressure",
+		"Integrate",
+		"MarchingCubes"
+	};
+	return names[static_cast<unsigned int>(stage)];
+}
+
+// Boundary particles packed for one neighbour domain
+struct HaloPack
+{
+	std::vector<ParticleState> particles;
+	std::vector<uint32_t> slots; // Owner's slot of each, for sending its density after the density pass
+};
+
+// One slab of a simulation decomposed along x, with SPHCPU's passes restricted to it.
+// The owned particles come first, followed by the halo copies from the domain below and then the one above.
+// How migrants, halos and densities travel between domains is up to the owner: SPHSlabs hands them over in memory,
+// SPHDistributed sends them to other processes.
+class SPHDomain
+{
+public:
+	// firstProcessor as in JobSystem, the thread calling the passes is thread 0 and pins itself
+	SPHDomain(unsigned int threadCount, int firstProcessor, const SPHSettings& settings);
+
+	SPHDomain(const SPHDomain&) = delete;
+	SPHDomain& operator=(const SPHDomain&) = delete;
+
+	unsigned int GetThreadCount() const { return jobSystem.GetThreadCount(); }
+	unsigned int GetOwnedCount() const { return ownedCount; }
+	unsigned int GetHaloCount() const { return lowerHaloCount + upperHaloCount; }
+
+	ParticleState GetParticle(uint32_t slot) const { return particles.Get(slot); }
+	uint32_t GetParticleId(uint32_t slot) const { return ids[slot]; }
+
+	// Appends owned particles
+	void AddParticles(const ParticleState* newParticles, const uint32_t* newIds, unsigned int count);
+
+	// Moves every owned particle outside [minX, maxX) to the end of outParticles and outIds
+	void TakeEmigrants(float minX, float maxX, std::vector<ParticleState>& outParticles, std::vector<uint32_t>& outIds);
+
+	// Packs the owned particles below lowerLimit into lower and those at or above upperLimit into upper
+	void PackHalo(float lowerLimit, float upperLimit, HaloPack& lower, HaloPack& upper);
+
+	// Replaces the halo, which then takes part in the grid and as neighbours in the passes
+	void SetHalo(const std::vector<ParticleState>& lower, const std::vector<ParticleState>& upper);
+
+	// Densities of owned slots from the last UpdateDensities, and the halo's copies of its owners' densities.
+	// GatherDensities isn't timed, it is called on the neighbour's behalf and is safe while the domain is in UpdatePressure.
+	void GatherDensities(const std::vector<uint32_t>& slots, std::vector<DensitySample>& outDensities) const;
+	void SetHaloDensities(const std::vector<DensitySample>& lower, const std::vector<DensitySample>& upper);
+
+	// The passes in the order they run. The grid covers [minX, maxX) and the halo, clamped to the walls.
+	void BuildGrid(float minX, float maxX, float wallMinX, float wallMinZ);
+	void UpdateDensities();
+	void UpdatePressure(float deltaTime);
+	// positionsById, if given, gets every owned particle's new position with w = 1
+	void UpdateIntegrate(float deltaTime, float wallMinX, float wallMinZ, Float4* positionsById);
+	// Adds the owned particles to GetThreadVoxels, each VOXEL_GRID_COUNT voxels. Whoever sums them clears them.
+	void SplatVoxels();
+
+	std::vector<std::vector<float>>& GetThreadVoxels() { return threadVoxels; }
+	JobSystem& GetJobSystem() { return jobSystem; }
+
+	// Of the last UpdatePressure and UpdateIntegrate
+	MotionBounds GetMotionBounds() const;
+
+	// Milliseconds per stage since the last ResetStageTimes, the passes above time themselves
+	template <typename Pass>
+	void TimeStage(DomainStage stage, Pass&& pass);
+	void ResetStageTimes() { stageTimes.fill(0.0); }
+	const std::array<double, DOMAIN_STAGE_COUNT>& GetStageTimes() const { return stageTimes; }
+
+private:
+	void GatherNeighbourCandidates(const Float3& position, std::vector<uint32_t>& outNeighbours) const;
+	Int3 GetCell(const Float3& position) const;
+
+	SPHSettings settings;
+	SmoothingKernels kernels;
+	const SPHKernelTable* kernelTable;
+	JobSystem jobSystem;
+
+	ParticleSoA particles;
+	std::vector<uint32_t> ids; // Owned particles only
+	unsigned int ownedCount = 0;
+	unsigned int lowerHaloCount = 0;
+	unsigned int upperHaloCount = 0;
+
+	// Dense grid over the domain and its halo, cell c owns gridEntries[cellStarts[c], cellStarts[c + 1])
+	std::vector<GridEntry> gridEntries;
+	std::vector<GridEntry> gridScratch;
+	std::vector<uint32_t> cellStarts;
+	Float3 gridOrigin = {};
+	Int3 cellCount = {};
+
+	std::vector<Float3> pressureAccelerations;
+	std::vector<std::vector<uint32_t>> threadNeighbours;
+	std::vector<MotionBounds> threadMotionBounds;
+	std::vector<std::vector<float>> threadVoxels;
+
+	std::array<double, DOMAIN_STAGE_COUNT> stageTimes = {};
+};
+
+template <typename Pass>
+void SPHDomain::TimeStage(DomainStage stage, Pass&& pass)
+{
+	PROFILE_SCOPE(GetDomainStageName(stage));
+	auto start = std::chrono::steady_clock::now();
+	pass();
+	stageTimes[static_cast<unsigned int>(stage)] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,517 @@
+#include "SPHKernelsSIMD.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SPH_SIMD_X86 1
+#include <immintrin.h>
+
+// MSVC lets any function use AVX intrinsics, GCC / Clang need them enabled per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SPH_TARGET_AVX2
+#define SPH_TARGET_AVX512
+#else
+#define SPH_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SPH_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+
+// GCC's AVX-512 headers trip its own uninitialised warnings through _mm512_undefined_ps
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#endif
+#endif
+
+namespace
+{
+	// Scalar
+
+	DensitySample DensityScalar(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+		const Float3& position, const SmoothingKernels& kernels)
+	{
+		DensitySample result = { 0.0f, 0.0f };
+
+		for (unsigned int j = 0; j < count; j++)
+		{
+			Float3 offset = particles.GetPosition(neighbours[j]) - position;
+			float sqrDst = Dot(offset, offset);
+
+			if (sqrDst > kernels.sqrRadius)
+				continue;
+
+			float dst = std::sqrt(sqrDst);
+			result.density += kernels.Density(dst);
+			result.nearDensity += kernels.NearDensity(dst);
+		}
+
+		return result;
+	}
+
+	Float3 PressureScalar(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+		const PressureSample& particle, const SmoothingKernels& kernels, float viscosityCoefficient)
+	{
+		Float3 pressureForce = { 0.0f, 0.0f, 0.0f };
+		Float3 repulsionForce = { 0.0f, 0.0f, 0.0f };
+		Float3 viscousForce = { 0.0f, 0.0f, 0.0f };
+
+		for (unsigned int j = 0; j < count; j++)
+		{
+			uint32_t neighbourIndex = neighbours[j];
+
+			Float3 offset = particles.GetPosition(neighbourIndex) - particle.position;
+			float sqrDst = Dot(offset, offset);
+
+			if (sqrDst > kernels.sqrRadius)
+				continue;
+
+			Float3 relativeVelocity = particles.GetVelocity(neighbourIndex) - particle.velocity;
+
+			float sharedPressure = (particle.pressure + particles.pressure[neighbourIndex]) / 2.0f;
+			float sharedNearPressure = (particle.nearPressure + particles.nearPressure[neighbourIndex]) / 2.0f;
+
+			float dst = std::sqrt(sqrDst);
+
+			// Stops particles getting stuck inside each other and causing velocity to go NaN.
+			Float3 dir = dst > 0 ? offset * (1.0f / dst) : Float3{ 0.0f, 1.0f, 0.0f };
+
+			pressureForce += dir * (kernels.Pressure(dst) * sharedPressure);
+			repulsionForce += dir * (kernels.NearDensityDerivative(dst) * sharedNearPressure);
+			viscousForce += relativeVelocity * (viscosityCoefficient * kernels.Viscosity(dst));
+		}
+
+		return pressureForce + repulsionForce + viscousForce;
+	}
+
+	// Deterministic, MSVC builds the project with /fp:fast which would reassociate the compensation away
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma float_control(precise, on, push)
+#pragma fp_contract(off)
+#endif
+
+	// Neumaier sum, the compensation keeps the low bits plain float adds drop when magnitudes differ
+	struct CompensatedSum
+	{
+		float sum = 0.0f;
+		float compensation = 0.0f;
+
+		void Add(float value)
+		{
+			float total = sum + value;
+			if (std::fabs(sum) >= std::fabs(value))
+				compensation += (sum - total) + value;
+			else
+				compensation += (value - total) + sum;
+			sum = total;
+		}
+
+		float Get() const { return sum + compensation; }
+	};
+
+	DensitySample DensityDeterministic(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+		const Float3& position, const SmoothingKernels& kernels)
+	{
+		CompensatedSum density;
+		CompensatedSum nearDensity;
+
+		for (unsigned int j = 0; j < count; j++)
+		{
+			Float3 offset = particles.GetPosition(neighbours[j]) - position;
+			float sqrDst = Dot(offset, offset);
+
+			if (sqrDst > kernels.sqrRadius)
+				continue;
+
+			float dst = std::sqrt(sqrDst);
+			density.Add(kernels.Density(dst));
+			nearDensity.Add(kernels.NearDensity(dst));
+		}
+
+		return { density.Get(), nearDensity.Get() };
+	}
+
+	Float3 PressureDeterministic(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+		const PressureSample& particle, const SmoothingKernels& kernels, float viscosityCoefficient)
+	{
+		CompensatedSum force[3];
+		CompensatedSum viscous[3];
+
+		for (unsigned int j = 0; j < count; j++)
+		{
+			uint32_t neighbourIndex = neighbours[j];
+
+			Float3 offset = particles.GetPosition(neighbourIndex) - particle.position;
+			float sqrDst = Dot(offset, offset);
+
+			if (sqrDst > kernels.sqrRadius)
+				continue;
+
+			Float3 relativeVelocity = particles.GetVelocity(neighbourIndex) - particle.velocity;
+
+			float sharedPressure = (particle.pressure + particles.pressure[neighbourIndex]) / 2.0f;
+			float sharedNearPressure = (particle.nearPressure + particles.nearPressure[neighbourIndex]) / 2.0f;
+
+			float dst = std::sqrt(sqrDst);
+			Float3 dir = dst > 0 ? offset * (1.0f / dst) : Float3{ 0.0f, 1.0f, 0.0f };
+
+			// Pressure and near pressure share a direction, so they go into one sum per axis
+			float pressureScale = kernels.Pressure(dst) * sharedPressure + kernels.NearDensityDerivative(dst) * sharedNearPressure;
+			float viscousScale = viscosityCoefficient * kernels.Viscosity(dst);
+
+			force[0].Add(dir.x * pressureScale);
+			force[1].Add(dir.y * pressureScale);
+			force[2].Add(dir.z * pressureScale);
+			viscous[0].Add(relativeVelocity.x * viscousScale);
+			viscous[1].Add(relativeVelocity.y * viscousScale);
+			viscous[2].Add(relativeVelocity.z * viscousScale);
+		}
+
+		return {
+			force[0].Get() + viscous[0].Get(),
+			force[1].Get() + viscous[1].Get(),
+			force[2].Get() + viscous[2].Get()
+		};
+	}
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma float_control(pop)
+#endif
+
+#if SPH_SIMD_X86
+
+	// AVX2 (8 lanes)
+
+	SPH_TARGET_AVX2 inline float HorizontalSum(__m256 value)
+	{
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(value), _mm256_extractf128_ps(value, 1));
+		__m128 shuffle = _mm_movehdup_ps(sum);
+		sum = _mm_add_ps(sum, shuffle);
+		shuffle = _mm_movehl_ps(shuffle, sum);
+		sum = _mm_add_ss(sum, shuffle);
+		return _mm_cvtss_f32(sum);
+	}
+
+	SPH_TARGET_AVX2 DensitySample DensityAVX2(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+		const Float3& position, const SmoothingKernels& kernels)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 px = _mm256_set1_ps(position.x);
+		const __m256 py = _mm256_set1_ps(position.y);
+		const __m256 pz = _mm256_set1_ps(position.z);
+		const __m256 radius = _mm256_set1_ps(kernels.radius);
+		const __m256 sqrRadius = _mm256_set1_ps(kernels.sqrRadius);
+		const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i countVector = _mm256_set1_epi32(static_cast<int>(count));
+
+		__m256 densitySum = zero;
+		__m256 nearDensitySum = zero;
+
+		for (unsigned int j = 0; j < count; j += 8)
+		{
+			// Lanes past the end of the list are masked out of the loads and the sums
+			__m256i lanes = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(j)), laneOffsets);
+			__m256i valid = _mm256_cmpgt_epi32(countVector, lanes);
+			__m256 validMask = _mm256_castsi256_ps(valid);
+
+			__m256i index = _mm256_maskload_epi32(reinterpret_cast<const int*>(neighbours + j), valid);
+
+			__m256 dx = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.x.data(), index, validMask, 4), px);
+			__m256 dy = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.y.data(), index, validMask, 4), py);
+			__m256 dz = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.z.data(), index, validMask, 4), pz);
+
+			__m256 sqrDst = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+			__m256 inRange = _mm256_and_ps(validMask, _mm256_cmp_ps(sqrDst, sqrRadius, _CMP_LE_OQ));
+
+			__m256 dst = _mm256_sqrt_ps(sqrDst);
+			__m256 diff = _mm256_and_ps(inRange, _mm256_max_ps(_mm256_sub_ps(radius, dst), zero));
+			__m256 diffSqr = _mm256_mul_ps(diff, diff);
+
+			densitySum = _mm256_add_ps(densitySum, diffSqr);
+			nearDensitySum = _mm256_fmadd_ps(diffSqr, diff, nearDensitySum);
+		}
+
+		return { HorizontalSum(densitySum) * kernels.densityScale, HorizontalSum(nearDensitySum) * kernels.nearDensityScale };
+	}
+
+	SPH_TARGET_AVX2 Float3 PressureAVX2(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+		const PressureSample& particle, const SmoothingKernels& kernels, float viscosityCoefficient)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 px = _mm256_set1_ps(particle.position.x);
+		const __m256 py = _mm256_set1_ps(particle.position.y);
+		const __m256 pz = _mm256_set1_ps(particle.position.z);
+		const __m256 vx = _mm256_set1_ps(particle.velocity.x);
+		const __m256 vy = _mm256_set1_ps(particle.velocity.y);
+		const __m256 vz = _mm256_set1_ps(particle.velocity.z);
+		const __m256 pressure = _mm256_set1_ps(particle.pressure);
+		const __m256 nearPressure = _mm256_set1_ps(particle.nearPressure);
+		const __m256 radius = _mm256_set1_ps(kernels.radius);
+		const __m256 sqrRadius = _mm256_set1_ps(kernels.sqrRadius);
+		const __m256 negPressureScale = _mm256_set1_ps(-kernels.pressureScale);
+		const __m256 negNearScale = _mm256_set1_ps(-kernels.nearDensityDerivativeScale);
+		const __m256 viscosityScale = _mm256_set1_ps(kernels.viscosityScale * viscosityCoefficient);
+		const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i countVector = _mm256_set1_epi32(static_cast<int>(count));
+
+		__m256 forceX = zero, forceY = zero, forceZ = zero;
+		__m256 viscousX = zero, viscousY = zero, viscousZ = zero;
+
+		for (unsigned int j = 0; j < count; j += 8)
+		{
+			__m256i lanes = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(j)), laneOffsets);
+			__m256i valid = _mm256_cmpgt_epi32(countVector, lanes);
+			__m256 validMask = _mm256_castsi256_ps(valid);
+
+			__m256i index = _mm256_maskload_epi32(reinterpret_cast<const int*>(neighbours + j), valid);
+
+			__m256 ox = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.x.data(), index, validMask, 4), px);
+			__m256 oy = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.y.data(), index, validMask, 4), py);
+			__m256 oz = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.z.data(), index, validMask, 4), pz);
+
+			__m256 sqrDst = _mm256_fmadd_ps(oz, oz, _mm256_fmadd_ps(oy, oy, _mm256_mul_ps(ox, ox)));
+			__m256 inRange = _mm256_and_ps(validMask, _mm256_cmp_ps(sqrDst, sqrRadius, _CMP_LE_OQ));
+
+			__m256 rvx = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.vx.data(), index, validMask, 4), vx);
+			__m256 rvy = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.vy.data(), index, validMask, 4), vy);
+			__m256 rvz = _mm256_sub_ps(_mm256_mask_i32gather_ps(zero, particles.vz.data(), index, validMask, 4), vz);
+
+			__m256 neighbourPressure = _mm256_mask_i32gather_ps(zero, particles.pressure.data(), index, validMask, 4);
+			__m256 neighbourNearPressure = _mm256_mask_i32gather_ps(zero, particles.nearPressure.data(), index, validMask, 4);
+
+			__m256 sharedPressure = _mm256_mul_ps(_mm256_add_ps(pressure, neighbourPressure), half);
+			__m256 sharedNearPressure = _mm256_mul_ps(_mm256_add_ps(nearPressure, neighbourNearPressure), half);
+
+			__m256 dst = _mm256_sqrt_ps(sqrDst);
+
+			// Coincident particles get pushed straight up, same as the shader
+			__m256 positive = _mm256_cmp_ps(dst, zero, _CMP_GT_OQ);
+			__m256 invDst = _mm256_div_ps(one, _mm256_blendv_ps(one, dst, positive));
+			__m256 dirX = _mm256_and_ps(positive, _mm256_mul_ps(ox, invDst));
+			__m256 dirY = _mm256_blendv_ps(one, _mm256_mul_ps(oy, invDst), positive);
+			__m256 dirZ = _mm256_and_ps(positive, _mm256_mul_ps(oz, invDst));
+
+			__m256 diff = _mm256_max_ps(_mm256_sub_ps(radius, dst), zero);
+			__m256 kernelDerivative = _mm256_mul_ps(diff, negPressureScale);
+			__m256 nearKernelDerivative = _mm256_mul_ps(_mm256_mul_ps(diff, diff), negNearScale);
+
+			__m256 viscosityDiff = _mm256_max_ps(_mm256_sub_ps(sqrRadius, sqrDst), zero);
+			__m256 viscosity = _mm256_mul_ps(_mm256_mul_ps(viscosityDiff, _mm256_mul_ps(viscosityDiff, viscosityDiff)), viscosityScale);
+
+			__m256 forceScale = _mm256_fmadd_ps(kernelDerivative, sharedPressure, _mm256_mul_ps(nearKernelDerivative, sharedNearPressure));
+			forceScale = _mm256_and_ps(inRange, forceScale);
+			viscosity = _mm256_and_ps(inRange, viscosity);
+
+			forceX = _mm256_fmadd_ps(dirX, forceScale, forceX);
+			forceY = _mm256_fmadd_ps(dirY, forceScale, forceY);
+			forceZ = _mm256_fmadd_ps(dirZ, forceScale, forceZ);
+
+			viscousX = _mm256_fmadd_ps(rvx, viscosity, viscousX);
+			viscousY = _mm256_fmadd_ps(rvy, viscosity, viscousY);
+			viscousZ = _mm256_fmadd_ps(rvz, viscosity, viscousZ);
+		}
+
+		return {
+			HorizontalSum(_mm256_add_ps(forceX, viscousX)),
+			HorizontalSum(_mm256_add_ps(forceY, viscousY)),
+			HorizontalSum(_mm256_add_ps(forceZ, viscousZ))
+		};
+	}
+
+	// AVX-512 (16 lanes)
+
+	SPH_TARGET_AVX512 inline __mmask16 TailMask(unsigned int remaining)
+	{
+		return remaining >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << remaining) - 1);
+	}
+
+	SPH_TARGET_AVX512 DensitySample DensityAVX512(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+		const Float3& position, const SmoothingKernels& kernels)
+	{
+		const __m512 zero = _mm512_setzero_ps();
+		const __m512 px = _mm512_set1_ps(position.x);
+		const __m512 py = _mm512_set1_ps(position.y);
+		const __m512 pz = _mm512_set1_ps(position.z);
+		const __m512 radius = _mm512_set1_ps(kernels.radius);
+		const __m512 sqrRadius = _mm512_set1_ps(kernels.sqrRadius);
+
+		__m512 densitySum = zero;
+		__m512 nearDensitySum = zero;
+
+		for (unsigned int j = 0; j < count; j += 16)
+		{
+			__mmask16 valid = TailMask(count - j);
+			__m512i index = _mm512_maskz_loadu_epi32(valid, neighbours + j);
+
+			__m512 dx = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, valid, index, particles.x.data(), 4), px);
+			__m512 dy = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, valid, index, particles.y.data(), 4), py);
+			__m512 dz = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, valid, index, particles.z.data(), 4), pz);
+
+			__m512 sqrDst = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+			__mmask16 inRange = _mm512_mask_cmp_ps_mask(valid, sqrDst, sqrRadius, _CMP_LE_OQ);
+
+			__m512 dst = _mm512_sqrt_ps(sqrDst);
+			__m512 diff = _mm512_max_ps(_mm512_sub_ps(radius, dst), zero);
+			__m512 diffSqr = _mm512_mul_ps(diff, diff);
+
+			densitySum = _mm512_mask_add_ps(densitySum, inRange, densitySum, diffSqr);
+			nearDensitySum = _mm512_mask3_fmadd_ps(diffSqr, diff, nearDensitySum, inRange);
+		}
+
+		return { _mm512_reduce_add_ps(densitySum) * kernels.densityScale, _mm512_reduce_add_ps(nearDensitySum) * kernels.nearDensityScale };
+	}
+
+	SPH_TARGET_AVX512 Float3 PressureAVX512(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+		const PressureSample& particle, const SmoothingKernels& kernels, float viscosityCoefficient)
+	{
+		const __m512 zero = _mm512_setzero_ps();
+		const __m512 one = _mm512_set1_ps(1.0f);
+		const __m512 half = _mm512_set1_ps(0.5f);
+		const __m512 px = _mm512_set1_ps(particle.position.x);
+		const __m512 py = _mm512_set1_ps(particle.position.y);
+		const __m512 pz = _mm512_set1_ps(particle.position.z);
+		const __m512 vx = _mm512_set1_ps(particle.velocity.x);
+		const __m512 vy = _mm512_set1_ps(particle.velocity.y);
+		const __m512 vz = _mm512_set1_ps(particle.velocity.z);
+		const __m512 pressure = _mm512_set1_ps(particle.pressure);
+		const __m512 nearPressure = _mm512_set1_ps(particle.nearPressure);
+		const __m512 radius = _mm512_set1_ps(kernels.radius);
+		const __m512 sqrRadius = _mm512_set1_ps(kernels.sqrRadius);
+		const __m512 negPressureScale = _mm512_set1_ps(-kernels.pressureScale);
+		const __m512 negNearScale = _mm512_set1_ps(-kernels.nearDensityDerivativeScale);
+		const __m512 viscosityScale = _mm512_set1_ps(kernels.viscosityScale * viscosityCoefficient);
+
+		__m512 forceX = zero, forceY = zero, forceZ = zero;
+		__m512 viscousX = zero, viscousY = zero, viscousZ = zero;
+
+		for (unsigned int j = 0; j < count; j += 16)
+		{
+			__mmask16 valid = TailMask(count - j);
+			__m512i index = _mm512_maskz_loadu_epi32(valid, neighbours + j);
+
+			__m512 ox = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, valid, index, particles.x.data(), 4), px);
+			__m512 oy = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, valid, index, particles.y.data(), 4), py);
+			__m512 oz = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, valid, index, particles.z.data(), 4), pz);
+
+			__m512 sqrDst = _mm512_fmadd_ps(oz, oz, _mm512_fmadd_ps(oy, oy, _mm512_mul_ps(ox, ox)));
+			__mmask16 inRange = _mm512_mask_cmp_ps_mask(valid, sqrDst, sqrRadius, _CMP_LE_OQ);
+
+			__m512 rvx = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, inRange, index, particles.vx.data(), 4), vx);
+			__m512 rvy = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, inRange, index, particles.vy.data(), 4), vy);
+			__m512 rvz = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, inRange, index, particles.vz.data(), 4), vz);
+
+			__m512 neighbourPressure = _mm512_mask_i32gather_ps(zero, inRange, index, particles.pressure.data(), 4);
+			__m512 neighbourNearPressure = _mm512_mask_i32gather_ps(zero, inRange, index, particles.nearPressure.data(), 4);
+
+			__m512 sharedPressure = _mm512_mul_ps(_mm512_add_ps(pressure, neighbourPressure), half);
+			__m512 sharedNearPressure = _mm512_mul_ps(_mm512_add_ps(nearPressure, neighbourNearPressure), half);
+
+			__m512 dst = _mm512_sqrt_ps(sqrDst);
+
+			// Coincident particles get pushed straight up, same as the shader
+			__mmask16 positive = _mm512_cmp_ps_mask(dst, zero, _CMP_GT_OQ);
+			__m512 dirX = _mm512_maskz_div_ps(positive, ox, dst);
+			__m512 dirY = _mm512_mask_div_ps(one, positive, oy, dst);
+			__m512 dirZ = _mm512_maskz_div_ps(positive, oz, dst);
+
+			__m512 diff = _mm512_max_ps(_mm512_sub_ps(radius, dst), zero);
+			__m512 kernelDerivative = _mm512_mul_ps(diff, negPressureScale);
+			__m512 nearKernelDerivative = _mm512_mul_ps(_mm512_mul_ps(diff, diff), negNearScale);
+
+			__m512 viscosityDiff = _mm512_max_ps(_mm512_sub_ps(sqrRadius, sqrDst), zero);
+			__m512 viscosity = _mm512_mul_ps(_mm512_mul_ps(viscosityDiff, _mm512_mul_ps(viscosityDiff, viscosityDiff)), viscosityScale);
+
+			__m512 forceScale = _mm512_fmadd_ps(kernelDerivative, sharedPressure, _mm512_mul_ps(nearKernelDerivative, sharedNearPressure));
+
+			forceX = _mm512_mask3_fmadd_ps(dirX, forceScale, forceX, inRange);
+			forceY = _mm512_mask3_fmadd_ps(dirY, forceScale, forceY, inRange);
+			forceZ = _mm512_mask3_fmadd_ps(dirZ, forceScale, forceZ, inRange);
+
+			viscousX = _mm512_mask3_fmadd_ps(rvx, viscosity, viscousX, inRange);
+			viscousY = _mm512_mask3_fmadd_ps(rvy, viscosity, viscousY, inRange);
+			viscousZ = _mm512_mask3_fmadd_ps(rvz, viscosity, viscousZ, inRange);
+		}
+
+		return {
+			_mm512_reduce_add_ps(_mm512_add_ps(forceX, viscousX)),
+			_mm512_reduce_add_ps(_mm512_add_ps(forceY, viscousY)),
+			_mm512_reduce_add_ps(_mm512_add_ps(forceZ, viscousZ))
+		};
+	}
+
+#endif
+
+	SIMDLevel QuerySIMDLevel()
+	{
+#if SPH_SIMD_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4] = {};
+		__cpuidex(info, 0, 0);
+		if (info[0] < 7)
+			return SIMDLevel::Scalar;
+
+		__cpuidex(info, 1, 0);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool fma = (info[2] & (1 << 12)) != 0;
+		if (!osxsave || !fma)
+			return SIMDLevel::Scalar;
+
+		// The OS has to save the YMM (and ZMM / opmask) registers on context switches
+		unsigned long long xcr0 = _xgetbv(0);
+
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+		bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+#else
+		__builtin_cpu_init();
+		bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		bool avx512 = __builtin_cpu_supports("avx512f");
+#endif
+		if (avx2 && avx512)
+			return SIMDLevel::AVX512;
+		if (avx2)
+			return SIMDLevel::AVX2;
+#endif
+		return SIMDLevel::Scalar;
+	}
+
+	const SPHKernelTable kernelTables[] =
+	{
+		{ SIMDLevel::Scalar, DensityScalar, PressureScalar },
+#if SPH_SIMD_X86
+		{ SIMDLevel::AVX2, DensityAVX2, PressureAVX2 },
+		{ SIMDLevel::AVX512, DensityAVX512, PressureAVX512 },
+#endif
+	};
+}
+
+SIMDLevel DetectSIMDLevel()
+{
+	static const SIMDLevel level = QuerySIMDLevel();
+	return level;
+}
+
+const char* GetSIMDLevelName(SIMDLevel level)
+{
+	switch (level)
+	{
+	case SIMDLevel::AVX2: return "AVX2";
+	case SIMDLevel::AVX512: return "AVX-512";
+	default: return "Scalar";
+	}
+}
+
+const SPHKernelTable& GetSPHKernelTable(SIMDLevel level)
+{
+	level = std::min(level, DetectSIMDLevel());
+	return kernelTables[static_cast<int>(level)];
+}
+
+const SPHKernelTable& GetDeterministicKernelTable()
+{
+	static const SPHKernelTable table = { SIMDLevel::Scalar, DensityDeterministic, PressureDeterministic };
+	return table;
+}
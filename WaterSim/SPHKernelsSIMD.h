@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ParticleSoA.h"
+
+// Vectorised versions of the CalculateDensity / CalculatePressure neighbour loops.
+// Each kernel takes a list of candidate neighbour indices (already filtered to the 27 surrounding cells),
+// gathers their attributes from the ParticleSoA and applies the FluidMaths.hlsl kernels lane by lane.
+// The instruction set is picked at runtime, so one binary runs on any x86-64 machine.
+
+enum class SIMDLevel
+{
+	Scalar,
+	AVX2,
+	AVX512
+};
+
+struct DensitySample
+{
+	float density;
+	float nearDensity;
+};
+
+struct PressureSample
+{
+	Float3 position;
+	Float3 velocity;
+	float pressure;
+	float nearPressure;
+};
+
+using DensityKernelFunction = DensitySample(*)(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+	const Float3& position, const SmoothingKernels& kernels);
+
+// Returns the summed pressure + near pressure + viscous force (not yet divided by density)
+using PressureKernelFunction = Float3(*)(const ParticleSoA& particles, const uint32_t* neighbours, unsigned int count,
+	const PressureSample& particle, const SmoothingKernels& kernels, float viscosityCoefficient);
+
+struct SPHKernelTable
+{
+	SIMDLevel level;
+	DensityKernelFunction density;
+	PressureKernelFunction pressure;
+};
+
+// Highest level supported by both the CPU and the OS
+SIMDLevel DetectSIMDLevel();
+
+const char* GetSIMDLevelName(SIMDLevel level);
+
+// Falls back to the best supported level if the requested one isn't available
+const SPHKernelTable& GetSPHKernelTable(SIMDLevel level);
+
+// Scalar kernels with compensated (Neumaier) sums, compiled with strict floating point semantics.
+// Given the neighbours in a fixed order they give the same bits on every run and every machine with IEEE floats.
+const SPHKernelTable& GetDeterministicKernelTable();
@@ -0,0 +1,345 @@
+#include "SPHSlabs.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+
+SPHSlabs::SPHSlabs(const std::vector<ParticleState>& particles, unsigned int slabCount, unsigned int threadCount,
+	const SPHSettings& settings, bool pinThreads)
+	:
+	settings(settings)
+{
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	if (threadCount == 0)
+		threadCount = hardwareThreads;
+
+	slabCount = std::max(1u, slabCount);
+	threadsPerSlab = std::max(1u, threadCount / slabCount);
+	pinned = pinThreads && slabCount * threadsPerSlab <= hardwareThreads;
+
+	slabs.resize(slabCount);
+	boundaries.resize(slabCount - 1);
+
+	for (unsigned int s = 0; s < slabCount; s++)
+	{
+		Slab& slab = slabs[s];
+		slab.firstProcessor = pinned ? static_cast<int>(s * threadsPerSlab) : -1;
+		slab.domain = std::make_unique<SPHDomain>(threadsPerSlab, slab.firstProcessor, settings);
+		slab.outbox.resize(slabCount);
+	}
+
+	// Everything starts in the first slab, the first Update rebalances and migrates the particles to their slabs
+	unsigned int count = static_cast<unsigned int>(particles.size());
+	std::vector<uint32_t> ids(count);
+	particlePositions.resize(count);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const Float3& position = particles[i].position;
+		ids[i] = i;
+		particlePositions[i] = { position.x, position.y, position.z, 1.0f };
+	}
+	previousParticlePositions = particlePositions;
+	slabs[0].domain->AddParticles(particles.data(), ids.data(), count);
+
+	voxels.resize(VOXEL_GRID_COUNT);
+
+	for (unsigned int s = 0; s < slabCount; s++)
+		slabThreads.emplace_back(&SPHSlabs::SlabLoop, this, s);
+}
+
+SPHSlabs::~SPHSlabs()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shuttingDown = true;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& thread : slabThreads)
+		thread.join();
+}
+
+void SPHSlabs::Update(float deltaTime, float minX, float minZ)
+{
+	PROFILE_SCOPE_ARG("SPHSlabs Update", "particles", GetParticleCount());
+
+	// Substeps of one Advance add up
+	if (currentSubstep == 0)
+	{
+		stageTimes.fill(0.0);
+		for (Slab& slab : slabs)
+		{
+			slab.domain->ResetStageTimes();
+			slab.busyMs = 0.0;
+		}
+	}
+
+	wallMinX = minX;
+	wallMinZ = minZ;
+	stepDeltaTime = deltaTime;
+
+	if (stepsSinceRebalance == 0)
+		Rebalance(minX);
+	stepsSinceRebalance = (stepsSinceRebalance + 1) % REBALANCE_INTERVAL;
+
+	// Each pass needs the previous one finished in the neighbouring slabs, see the comments on the passes
+	RunSlabs(&SPHSlabs::EmigrateParticles);
+	RunSlabs(&SPHSlabs::ImmigrateParticles);
+	RunSlabs(&SPHSlabs::UpdateDensities);
+	RunSlabs(&SPHSlabs::UpdateForcesAndIntegrate);
+	RunSlabs(&SPHSlabs::SumVoxels);
+
+	motionBounds = MotionBounds();
+	for (Slab& slab : slabs)
+	{
+		MotionBounds bounds = slab.domain->GetMotionBounds();
+		motionBounds.maxSpeed = std::max(motionBounds.maxSpeed, bounds.maxSpeed);
+		motionBounds.maxAcceleration = std::max(motionBounds.maxAcceleration, bounds.maxAcceleration);
+
+		const std::array<double, DOMAIN_STAGE_COUNT>& slabTimes = slab.domain->GetStageTimes();
+		for (unsigned int stage = 0; stage < DOMAIN_STAGE_COUNT; stage++)
+			stageTimes[stage] = std::max(stageTimes[stage], slabTimes[stage]);
+	}
+
+	stepIndex++;
+	simulatedTime += deltaTime;
+}
+
+void SPHSlabs::ReadParticles(std::vector<ParticleState>& outParticles)
+{
+	outParticles.resize(GetParticleCount());
+
+	for (const Slab& slab : slabs)
+	{
+		const SPHDomain& domain = *slab.domain;
+		for (unsigned int i = 0; i < domain.GetOwnedCount(); i++)
+			outParticles[domain.GetParticleId(i)] = domain.GetParticle(i);
+	}
+}
+
+std::vector<SlabStats> SPHSlabs::GetSlabStats() const
+{
+	std::vector<SlabStats> stats;
+	for (unsigned int s = 0; s < slabs.size(); s++)
+	{
+		const Slab& slab = slabs[s];
+		float minX = s == 0 ? wallMinX : boundaries[s - 1];
+		float maxX = s + 1 == slabs.size() ? -wallMinX : boundaries[s];
+		stats.push_back({ minX, maxX, slab.domain->GetOwnedCount(), slab.domain->GetHaloCount(), slab.busyMs });
+	}
+	return stats;
+}
+
+void SPHSlabs::RunSlabs(SlabPass pass)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentPass = pass;
+		pendingSlabs = static_cast<unsigned int>(slabs.size());
+		generation++;
+	}
+	wakeCondition.notify_all();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return pendingSlabs == 0; });
+}
+
+void SPHSlabs::SlabLoop(unsigned int slabIndex)
+{
+	Slab& slab = slabs[slabIndex];
+	if (slab.firstProcessor >= 0)
+		PinCurrentThread(static_cast<unsigned int>(slab.firstProcessor));
+
+	std::string threadName = "Slab " + std::to_string(slabIndex);
+	Profiler::SetThreadName(threadName.c_str());
+
+	uint64_t seenGeneration = 0;
+	while (true)
+	{
+		SlabPass pass;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] { return shuttingDown || generation != seenGeneration; });
+
+			if (shuttingDown)
+				return;
+
+			seenGeneration = generation;
+			pass = currentPass;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		(this->*pass)(slab, slabIndex);
+		slab.busyMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pendingSlabs == 0)
+			doneCondition.notify_one();
+	}
+}
+
+void SPHSlabs::Rebalance(float minX)
+{
+	if (boundaries.empty())
+		return;
+
+	PROFILE_SCOPE("Rebalance Slabs");
+
+	// Histogram of x between the walls, a quarter radius per bin is fine enough for the counts to come out even
+	float binWidth = settings.smoothingRadius * 0.25f;
+	float width = std::max(-2.0f * minX, binWidth);
+	int binCount = static_cast<int>(std::ceil(width / binWidth));
+	std::vector<uint32_t> histogram(binCount, 0);
+
+	uint64_t total = 0;
+	for (const Slab& slab : slabs)
+	{
+		const SPHDomain& domain = *slab.domain;
+		for (unsigned int i = 0; i < domain.GetOwnedCount(); i++)
+		{
+			int bin = static_cast<int>(std::floor((domain.GetParticle(i).position.x - minX) / binWidth));
+			histogram[std::clamp(bin, 0, binCount - 1)]++;
+		}
+		total += domain.GetOwnedCount();
+	}
+
+	unsigned int slabCount = static_cast<unsigned int>(slabs.size());
+	uint64_t below = 0;
+	int bin = 0;
+	for (unsigned int b = 0; b < boundaries.size(); b++)
+	{
+		uint64_t target = total * (b + 1) / slabCount;
+		while (bin < binCount && below + histogram[bin] <= target)
+			below += histogram[bin++];
+
+		boundaries[b] = minX + bin * binWidth;
+
+		// A halo only ever comes from the adjacent slabs
+		if (b > 0)
+			boundaries[b] = std::max(boundaries[b], boundaries[b - 1] + settings.smoothingRadius);
+	}
+}
+
+unsigned int SPHSlabs::FindSlab(float x) const
+{
+	return static_cast<unsigned int>(std::upper_bound(boundaries.begin(), boundaries.end(), x) - boundaries.begin());
+}
+
+float SPHSlabs::GetSlabMin(unsigned int slabIndex) const
+{
+	return slabIndex == 0 ? std::numeric_limits<float>::lowest() : boundaries[slabIndex - 1];
+}
+
+float SPHSlabs::GetSlabMax(unsigned int slabIndex) const
+{
+	return slabIndex + 1 == slabs.size() ? std::numeric_limits<float>::max() : boundaries[slabIndex];
+}
+
+void SPHSlabs::EmigrateParticles(Slab& slab, unsigned int slabIndex)
+{
+	// Only writes this slab's particles and outbox
+	slab.emigrants.particles.clear();
+	slab.emigrants.ids.clear();
+	slab.domain->TakeEmigrants(GetSlabMin(slabIndex), GetSlabMax(slabIndex), slab.emigrants.particles, slab.emigrants.ids);
+
+	slab.domain->TimeStage(DomainStage::Migrate, [&]
+	{
+		for (Migrants& migrants : slab.outbox)
+		{
+			migrants.particles.clear();
+			migrants.ids.clear();
+		}
+
+		for (size_t i = 0; i < slab.emigrants.ids.size(); i++)
+		{
+			Migrants& migrants = slab.outbox[FindSlab(slab.emigrants.particles[i].position.x)];
+			migrants.particles.push_back(slab.emigrants.particles[i]);
+			migrants.ids.push_back(slab.emigrants.ids[i]);
+		}
+	});
+}
+
+void SPHSlabs::ImmigrateParticles(Slab& slab, unsigned int slabIndex)
+{
+	// Reads the other slabs' outboxes, which stay put until their next EmigrateParticles
+	for (unsigned int s = 0; s < slabs.size(); s++)
+	{
+		const Migrants& migrants = slabs[s].outbox[slabIndex];
+		if (s != slabIndex && !migrants.ids.empty())
+			slab.domain->AddParticles(migrants.particles.data(), migrants.ids.data(), static_cast<unsigned int>(migrants.ids.size()));
+	}
+
+	// Ownership is final now, so the boundary particles can be packed for the neighbours
+	float lowerLimit = slabIndex > 0 ? GetSlabMin(slabIndex) + settings.smoothingRadius : std::numeric_limits<float>::lowest();
+	float upperLimit = slabIndex + 1 < slabs.size() ? GetSlabMax(slabIndex) - settings.smoothingRadius : std::numeric_limits<float>::max();
+	slab.domain->PackHalo(lowerLimit, upperLimit, slab.haloPacks[0], slab.haloPacks[1]);
+}
+
+void SPHSlabs::UpdateDensities(Slab& slab, unsigned int slabIndex)
+{
+	// Reads the neighbours' halo packs, which stay put until their next ImmigrateParticles
+	static const std::vector<ParticleState> noHalo;
+	const std::vector<ParticleState>& lower = slabIndex > 0 ? slabs[slabIndex - 1].haloPacks[1].particles : noHalo;
+	const std::vector<ParticleState>& upper = slabIndex + 1 < slabs.size() ? slabs[slabIndex + 1].haloPacks[0].particles : noHalo;
+
+	SPHDomain& domain = *slab.domain;
+	domain.SetHalo(lower, upper);
+	domain.BuildGrid(GetSlabMin(slabIndex), GetSlabMax(slabIndex), wallMinX, wallMinZ);
+	domain.UpdateDensities();
+}
+
+void SPHSlabs::UpdateForcesAndIntegrate(Slab& slab, unsigned int slabIndex)
+{
+	// Reads the neighbours' owned densities, which nothing writes until their next UpdateDensities
+	SPHDomain& domain = *slab.domain;
+	domain.TimeStage(DomainStage::HaloExchange, [&]
+	{
+		slab.haloDensities[0].clear();
+		slab.haloDensities[1].clear();
+
+		if (slabIndex > 0)
+			slabs[slabIndex - 1].domain->GatherDensities(slabs[slabIndex - 1].haloPacks[1].slots, slab.haloDensities[0]);
+		if (slabIndex + 1 < slabs.size())
+			slabs[slabIndex + 1].domain->GatherDensities(slabs[slabIndex + 1].haloPacks[0].slots, slab.haloDensities[1]);
+	});
+	domain.SetHaloDensities(slab.haloDensities[0], slab.haloDensities[1]);
+
+	// Ids are owned by exactly one slab, so the slabs never write the same position
+	domain.UpdatePressure(stepDeltaTime);
+	domain.UpdateIntegrate(stepDeltaTime, wallMinX, wallMinZ, particlePositions.data());
+	domain.SplatVoxels();
+}
+
+void SPHSlabs::SumVoxels(Slab& slab, unsigned int slabIndex)
+{
+	// Every slab sums its own share of the voxels over all the partial grids, and clears it for the next step
+	slab.domain->TimeStage(DomainStage::MarchingCubes, [&]
+	{
+		unsigned int slabCount = static_cast<unsigned int>(slabs.size());
+		unsigned int first = static_cast<unsigned int>(uint64_t(VOXEL_GRID_COUNT) * slabIndex / slabCount);
+		unsigned int last = static_cast<unsigned int>(uint64_t(VOXEL_GRID_COUNT) * (slabIndex + 1) / slabCount);
+
+		slab.domain->GetJobSystem().ParallelFor(last - first, 16384, [&](unsigned int begin, unsigned int end, unsigned int)
+		{
+			for (unsigned int v = first + begin; v < first + end; v++)
+			{
+				float sum = 0.0f;
+				for (Slab& other : slabs)
+				{
+					for (std::vector<float>& grid : other.domain->GetThreadVoxels())
+					{
+						if (grid.empty())
+							continue;
+
+						sum += grid[v];
+						grid[v] = 0.0f;
+					}
+				}
+				voxels[v] = sum;
+			}
+		});
+	});
+}
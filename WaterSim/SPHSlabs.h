@@ -0,0 +1,145 @@
+#pragma once
+
+#include "SPHDomain.h"
+
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Where one slab stood after the last Update
+struct SlabStats
+{
+	float minX; // Owned range along x, the outer slabs reach past the walls
+	float maxX;
+	unsigned int particles;
+	unsigned int haloParticles;
+	double busyMs; // Time its thread spent in the passes, the rest went on waiting for the other slabs
+};
+
+// SPHCPU's passes split across slabs of the tank along x, so no pass ever touches the whole particle set.
+// Each slab is an SPHDomain that owns the particles inside it with their own dense grid, and runs the passes on its
+// own JobSystem. Its threads are pinned to a run of consecutive logical processors, keeping it on one socket.
+// Every step the particles within the smoothing radius of a boundary are copied into the neighbour slab as halo
+// particles; after the density pass their densities follow, so the pressure pass sees exactly what SPHCPU would.
+// Boundaries are moved every REBALANCE_INTERVAL steps to give the slabs equal particle counts.
+// Emitters, sinks, neighbour lists, reordering, deterministic mode and checkpoints stay SPHCPU features.
+class SPHSlabs : public SPHBackend
+{
+public:
+	static constexpr unsigned int REBALANCE_INTERVAL = 16;
+
+	// particles are indexed by id. threadCount of 0 uses std::thread::hardware_concurrency(), split evenly between
+	// the slabs. Threads are only pinned when every one of them gets a processor of its own.
+	SPHSlabs(const std::vector<ParticleState>& particles, unsigned int slabCount, unsigned int threadCount = 0,
+		const SPHSettings& settings = SPHSettings(), bool pinThreads = true);
+	~SPHSlabs() override;
+
+	SPHSlabs(const SPHSlabs&) = delete;
+	SPHSlabs& operator=(const SPHSlabs&) = delete;
+
+	void Update(float deltaTime, float minX, float minZ) override;
+
+	unsigned int GetParticleCount() const override { return static_cast<unsigned int>(particlePositions.size()); }
+	void ReadParticles(std::vector<ParticleState>& outParticles) override;
+	const char* GetName() const override { return "CPU Slabs"; }
+
+	MotionBounds GetMotionBounds() const override { return motionBounds; }
+	float GetSmoothingRadius() const override { return settings.smoothingRadius; }
+	void SavePreviousPositions() override { previousParticlePositions = particlePositions; }
+
+	// Indexed by id like SPHCPU::GetParticlePositions, every w is 1
+	const std::vector<Float4>& GetParticlePositions() const { return particlePositions; }
+	const std::vector<Float4>& GetPreviousParticlePositions() const { return previousParticlePositions; }
+	const std::vector<float>& GetVoxels() const { return voxels; }
+
+	unsigned int GetSlabCount() const { return static_cast<unsigned int>(slabs.size()); }
+	unsigned int GetThreadCount() const { return static_cast<unsigned int>(slabs.size()) * threadsPerSlab; }
+	unsigned int GetThreadsPerSlab() const { return threadsPerSlab; }
+	bool ArePinned() const { return pinned; }
+
+	std::vector<SlabStats> GetSlabStats() const;
+
+	// Slowest slab's time in each stage of the last Update, in milliseconds and summed over Advance substeps
+	const std::array<double, DOMAIN_STAGE_COUNT>& GetStageTimes() const { return stageTimes; }
+
+	uint64_t GetStepIndex() const { return stepIndex; }
+	double GetSimulatedTime() const { return simulatedTime; }
+
+private:
+	// Particles leaving for one other slab
+	struct Migrants
+	{
+		std::vector<ParticleState> particles;
+		std::vector<uint32_t> ids;
+	};
+
+	struct Slab
+	{
+		std::unique_ptr<SPHDomain> domain;
+		int firstProcessor = -1;
+
+		std::vector<Migrants> outbox; // Indexed by destination slab
+		Migrants emigrants;
+
+		// Side 0 goes to the slab below and side 1 to the one above, the densities come back the other way
+		HaloPack haloPacks[2];
+		std::vector<DensitySample> haloDensities[2];
+
+		double busyMs = 0.0;
+	};
+
+	using SlabPass = void (SPHSlabs::*)(Slab& slab, unsigned int slabIndex);
+
+	// Runs pass for every slab on the slab threads and waits for all of them
+	void RunSlabs(SlabPass pass);
+	void SlabLoop(unsigned int slabIndex);
+
+	// Moves the boundaries to the x quantiles of the particles, keeping every slab at least a smoothing radius wide
+	void Rebalance(float minX);
+
+	unsigned int FindSlab(float x) const;
+	float GetSlabMin(unsigned int slabIndex) const;
+	float GetSlabMax(unsigned int slabIndex) const;
+
+	// The passes, in the order Update runs them
+	void EmigrateParticles(Slab& slab, unsigned int slabIndex);
+	void ImmigrateParticles(Slab& slab, unsigned int slabIndex);
+	void UpdateDensities(Slab& slab, unsigned int slabIndex);
+	void UpdateForcesAndIntegrate(Slab& slab, unsigned int slabIndex);
+	void SumVoxels(Slab& slab, unsigned int slabIndex);
+
+	SPHSettings settings;
+
+	std::vector<Slab> slabs;
+	std::vector<float> boundaries; // Slab s owns [boundaries[s - 1], boundaries[s]), the outer slabs are open ended
+	unsigned int threadsPerSlab = 1;
+	bool pinned = false;
+	unsigned int stepsSinceRebalance = 0;
+
+	// Walls and step of the Update in flight, read by the passes
+	float wallMinX = -50.0f;
+	float wallMinZ = -50.0f;
+	float stepDeltaTime = 0.0f;
+
+	std::vector<Float4> particlePositions;
+	std::vector<Float4> previousParticlePositions;
+	std::vector<float> voxels;
+
+	MotionBounds motionBounds;
+	std::array<double, DOMAIN_STAGE_COUNT> stageTimes = {};
+	uint64_t stepIndex = 0;
+	double simulatedTime = 0.0;
+
+	// Slab threads, released once per pass like JobSystem workers
+	std::vector<std::thread> slabThreads;
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	SlabPass currentPass = nullptr;
+	unsigned int pendingSlabs = 0;
+	uint64_t generation = 0;
+	bool shuttingDown = false;
+};
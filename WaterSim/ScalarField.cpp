@@ -0,0 +1,193 @@
+#include "ScalarField.h"
+#include "GridSort.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Voxels [first, last] along one axis that can lie within radius of coordinate, one voxel of slack either side
+	// so rounding never drops one the exact test would keep. first > last when none can.
+	void VoxelRange(float coordinate, float origin, float cellSize, float radius, int size, int& first, int& last)
+	{
+		first = std::max(static_cast<int>(std::ceil((coordinate - radius - origin) / cellSize)) - 1, 0);
+		last = std::min(static_cast<int>(std::floor((coordinate + radius - origin) / cellSize)) + 1, size - 1);
+	}
+
+	// Same expressions in the same order as the reference loop, so the sums round identically
+	inline void AddParticle(const Float3& voxelPos, const Float3& position, float density, float radius2, float& sum)
+	{
+		Float3 r = { voxelPos.x - position.x, voxelPos.y - position.y, voxelPos.z - position.z };
+
+		float r2 = r.x * r.x + r.y * r.y + r.z * r.z;
+		if (r2 < radius2)
+		{
+			float term = radius2 - r2;
+			float weight = term * term * term; // Poly6 without normalization constant
+			sum += density * weight;
+		}
+	}
+}
+
+void BuildScalarFieldReference(const std::vector<Float3>& positions, const std::vector<float>& densities,
+	const ScalarFieldGrid& grid, std::vector<float>& outField)
+{
+	const float radius2 = grid.smoothingRadius * grid.smoothingRadius;
+	outField.assign(size_t(grid.sizeX) * grid.sizeY * grid.sizeZ, 0.0f);
+
+	for (int z = 0; z < grid.sizeZ; ++z)
+		for (int y = 0; y < grid.sizeY; ++y)
+			for (int x = 0; x < grid.sizeX; ++x)
+			{
+				Float3 voxelPos = { grid.origin.x + x * grid.cellSize, grid.origin.y + y * grid.cellSize, grid.origin.z + z * grid.cellSize };
+
+				float density = 0.0f;
+				for (size_t i = 0; i < positions.size(); ++i)
+					AddParticle(voxelPos, positions[i], densities[i], radius2, density);
+
+				outField[x + y * size_t(grid.sizeX) + z * size_t(grid.sizeX) * grid.sizeY] = density;
+			}
+}
+
+void ScalarFieldBuilder::Splat(const std::vector<Float3>& positions, const std::vector<float>& densities,
+	const ScalarFieldGrid& grid, std::vector<float>& outField)
+{
+	const float radius = grid.smoothingRadius;
+	const float radius2 = radius * radius;
+	const size_t planeSize = size_t(grid.sizeX) * grid.sizeY;
+	outField.assign(planeSize * grid.sizeZ, 0.0f);
+
+	if (positions.empty() || outField.empty())
+		return;
+
+	// Bin the particles by plane with a count, prefix and fill over the particles in index order, which keeps every
+	// plane's list in index order. A particle lands in the few planes of its diameter, cheap next to the splat.
+	planeStarts.assign(grid.sizeZ + 1, 0);
+	for (const Float3& position : positions)
+	{
+		int first, last;
+		VoxelRange(position.z, grid.origin.z, grid.cellSize, radius, grid.sizeZ, first, last);
+		for (int z = first; z <= last; ++z)
+			planeStarts[z + 1]++;
+	}
+
+	for (int z = 0; z < grid.sizeZ; ++z)
+		planeStarts[z + 1] += planeStarts[z];
+
+	planeParticles.resize(planeStarts[grid.sizeZ]);
+	std::vector<uint32_t> planeFill(planeStarts.begin(), planeStarts.end() - 1);
+	for (uint32_t i = 0; i < positions.size(); ++i)
+	{
+		int first, last;
+		VoxelRange(positions[i].z, grid.origin.z, grid.cellSize, radius, grid.sizeZ, first, last);
+		for (int z = first; z <= last; ++z)
+			planeParticles[planeFill[z]++] = i;
+	}
+
+	// A plane is only written by the task that owns it, so the voxels need no atomics
+	jobSystem.ParallelFor(grid.sizeZ, 1, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int z = begin; z < end; ++z)
+		{
+			float* plane = outField.data() + z * planeSize;
+			float voxelZ = grid.origin.z + static_cast<int>(z) * grid.cellSize;
+
+			for (uint32_t entry = planeStarts[z]; entry < planeStarts[z + 1]; ++entry)
+			{
+				uint32_t i = planeParticles[entry];
+				const Float3& position = positions[i];
+
+				int firstX, lastX, firstY, lastY;
+				VoxelRange(position.x, grid.origin.x, grid.cellSize, radius, grid.sizeX, firstX, lastX);
+				VoxelRange(position.y, grid.origin.y, grid.cellSize, radius, grid.sizeY, firstY, lastY);
+
+				for (int y = firstY; y <= lastY; ++y)
+					for (int x = firstX; x <= lastX; ++x)
+					{
+						Float3 voxelPos = { grid.origin.x + x * grid.cellSize, grid.origin.y + y * grid.cellSize, voxelZ };
+						AddParticle(voxelPos, position, densities[i], radius2, plane[x + y * size_t(grid.sizeX)]);
+					}
+			}
+		}
+	});
+}
+
+void ScalarFieldBuilder::Gather(const std::vector<Float3>& positions, const std::vector<float>& densities,
+	const ScalarFieldGrid& grid, std::vector<float>& outField)
+{
+	const float radius = grid.smoothingRadius;
+	const float radius2 = radius * radius;
+	outField.assign(size_t(grid.sizeX) * grid.sizeY * grid.sizeZ, 0.0f);
+
+	unsigned int count = static_cast<unsigned int>(positions.size());
+	if (count == 0 || outField.empty())
+		return;
+
+	// Same hashed grid as SPHCPU::UpdateSortGrid, keys are hash % particle count
+	if (gridEntries.size() < count)
+		gridEntries.resize(count);
+
+	jobSystem.ParallelFor(count, 1024, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int i = begin; i < end; ++i)
+		{
+			uint32_t hash = HashCell3D(GetCell3D(positions[i], radius));
+			gridEntries[i] = { i, hash, KeyFromHash(hash, count) };
+		}
+	});
+
+	CountingSortGridEntries(jobSystem, gridEntries, gridScratch, count, count, keyStarts);
+
+	threadCandidates.resize(jobSystem.GetThreadCount());
+
+	// A voxel within radius of a particle is at most one cell away from it
+	jobSystem.ParallelFor(grid.sizeY * grid.sizeZ, 4, [&](unsigned int begin, unsigned int end, unsigned int threadIndex)
+	{
+		std::vector<uint32_t>& candidates = threadCandidates[threadIndex];
+
+		for (unsigned int row = begin; row < end; ++row)
+		{
+			int y = static_cast<int>(row) % grid.sizeY;
+			int z = static_cast<int>(row) / grid.sizeY;
+			float* voxels = outField.data() + size_t(row) * grid.sizeX;
+
+			// Neighbouring voxels mostly share a cell, its candidates are only collected again once the cell changes
+			bool haveCell = false;
+			Int3 candidateCell = {};
+
+			for (int x = 0; x < grid.sizeX; ++x)
+			{
+				Float3 voxelPos = { grid.origin.x + x * grid.cellSize, grid.origin.y + y * grid.cellSize, grid.origin.z + z * grid.cellSize };
+				Int3 cell = GetCell3D(voxelPos, radius);
+
+				if (!haveCell || cell.x != candidateCell.x || cell.y != candidateCell.y || cell.z != candidateCell.z)
+				{
+					candidates.clear();
+					for (const Int3& offset : offsets3D)
+					{
+						uint32_t hash = HashCell3D({ cell.x + offset.x, cell.y + offset.y, cell.z + offset.z });
+						uint32_t key = KeyFromHash(hash, count);
+						for (uint32_t entry = keyStarts[key]; entry < keyStarts[key + 1]; ++entry)
+						{
+							if (gridEntries[entry].hash == hash)
+								candidates.push_back(gridEntries[entry].particleIndex);
+						}
+					}
+
+					// Index order for the reference's rounding, and two of the 27 cells can share a hash
+					std::sort(candidates.begin(), candidates.end());
+					candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+					candidateCell = cell;
+					haveCell = true;
+				}
+
+				float density = 0.0f;
+				for (uint32_t i : candidates)
+					AddParticle(voxelPos, positions[i], densities[i], radius2, density);
+
+				voxels[x] = density;
+			}
+		}
+	});
+}
@@ -0,0 +1,160 @@
+#include "SimulationThread.h"
+#include "Profiler.h"
+
+SimulationThread::SimulationThread(unsigned int numParticles, unsigned int workerCount, float stepRate)
+	:
+	sim(std::make_unique<SPHCPU>(numParticles, workerCount)),
+	timestep(stepRate)
+{
+	// The thread has nothing else to do, a step may take up to its own length
+	timestep.SetFrameBudget(1.0f / stepRate);
+
+	// The starting state is visible before the first step
+	PublishFrame();
+	thread = std::thread(&SimulationThread::Run, this);
+}
+
+SimulationThread::~SimulationThread()
+{
+	stopping.store(true, std::memory_order_relaxed);
+	thread.join();
+}
+
+void SimulationThread::Enqueue(Command command)
+{
+	std::lock_guard<std::mutex> lock(commandMutex);
+	commands.push_back(std::move(command));
+}
+
+void SimulationThread::SetPaused(bool newPaused)
+{
+	Enqueue([this, newPaused](SPHCPU&)
+	{
+		// The time spent paused is owed to nobody
+		if (paused && !newPaused)
+			timestep.Reset();
+		paused = newPaused;
+	});
+}
+
+void SimulationThread::SetWalls(float newMinX, float newMinZ)
+{
+	Enqueue([this, newMinX, newMinZ](SPHCPU&) { minX = newMinX; minZ = newMinZ; });
+}
+
+void SimulationThread::SetStepRate(float stepRate)
+{
+	Enqueue([this, stepRate](SPHCPU&)
+	{
+		timestep.SetTargetFPS(stepRate);
+		timestep.SetFrameBudget(1.0f / stepRate);
+	});
+}
+
+void SimulationThread::SaveCheckpoint(const std::string& path)
+{
+	Enqueue([this, path](SPHCPU& sim)
+	{
+		bool saved = sim.SaveCheckpoint(path, minX, minZ);
+		checkpointStatus.store(saved ? "Saved" : "Save failed", std::memory_order_relaxed);
+	});
+}
+
+void SimulationThread::LoadCheckpoint(const std::string& path)
+{
+	Enqueue([this, path](SPHCPU& sim)
+	{
+		if (!sim.LoadCheckpoint(path))
+		{
+			checkpointStatus.store("Load failed", std::memory_order_relaxed);
+			return;
+		}
+
+		stepIndex = sim.GetStepIndex();
+		simulatedTime = sim.GetSimulatedTime();
+		checkpointStatus.store("Loaded", std::memory_order_relaxed);
+
+		// Visible straight away, even while paused
+		PublishFrame();
+	});
+}
+
+void SimulationThread::StartRecording(const std::string& path)
+{
+	Enqueue([this, path](SPHCPU& sim)
+	{
+		recorder.Stop();
+		recorder.Start(path, sim.GetSmoothingRadius());
+	});
+}
+
+void SimulationThread::StopRecording()
+{
+	Enqueue([this](SPHCPU&) { recorder.Stop(); });
+}
+
+void SimulationThread::Run()
+{
+	Profiler::SetThreadName("Simulation");
+
+	while (!stopping.load(std::memory_order_relaxed))
+	{
+		RunCommands();
+
+		if (paused)
+		{
+			// The scheduler isn't measured while paused, or the whole pause would be counted as dropped steps
+			std::this_thread::sleep_for(std::chrono::duration<float>(timestep.GetFixedTimeStep()));
+			continue;
+		}
+
+		timestep.CalculateTimestep();
+
+		bool stepped = false;
+		while (timestep.IsReadyForPhysicsUpdate())
+		{
+			PROFILE_SCOPE("Simulation Step");
+			sim->Advance(timestep.GetFixedTimeStep(), minX, minZ);
+			timestep.ConsumePhysicsUpdate();
+
+			stepIndex++;
+			simulatedTime += timestep.GetFixedTimeStep();
+			stepped = true;
+
+			if (recorder.IsRecording())
+				recorder.Capture(*sim, stepIndex, simulatedTime);
+		}
+
+		if (stepped)
+			PublishFrame();
+
+		// Nothing is owed until the accumulator fills up again
+		float untilNextStep = (1.0f - timestep.GetInterpolationAlpha()) * timestep.GetFixedTimeStep();
+		std::this_thread::sleep_for(std::chrono::duration<float>(untilNextStep));
+	}
+}
+
+void SimulationThread::RunCommands()
+{
+	{
+		std::lock_guard<std::mutex> lock(commandMutex);
+		runningCommands.swap(commands);
+	}
+
+	for (Command& command : runningCommands)
+		command(*sim);
+	runningCommands.clear();
+}
+
+void SimulationThread::PublishFrame()
+{
+	SimulationFrame& frame = frames.GetWriteSlot();
+	frame.positions = sim->GetParticlePositions();
+	frame.particleCount = sim->GetParticleCount();
+	frame.stepIndex = stepIndex;
+	frame.simulatedTime = simulatedTime;
+	frame.stepTime = timestep.GetFixedTimeStep();
+	frame.publishTime = Timestep::Clock::now();
+	frame.timestepStats = timestep.GetStats();
+	frames.Publish();
+}
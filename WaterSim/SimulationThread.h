@@ -0,0 +1,92 @@
+#pragma once
+
+#include "SPHCPU.h"
+#include "FrameRecorder.h"
+#include "Timestep.h"
+#include "TripleBuffer.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One finished simulation state as seen by the render thread
+struct SimulationFrame
+{
+	std::vector<Float4> positions; // Indexed by particle id, w is 0 for retired ids
+	unsigned int particleCount = 0;
+	uint64_t stepIndex = 0;
+	double simulatedTime = 0.0;
+	float stepTime = 0.0f; // Fixed step the state was advanced with
+	Timestep::Clock::time_point publishTime;
+	TimestepStats timestepStats;
+};
+
+// Runs SPHCPU on its own thread at a fixed rate so slow steps never hold up input or presentation.
+// Finished states go out through a triple buffer, changes come in as commands that run on the simulation thread
+// between steps, so nothing touches the simulation from outside while it is stepping.
+class SimulationThread
+{
+public:
+	using Command = std::function<void(SPHCPU& sim)>;
+
+	SimulationThread(unsigned int numParticles, unsigned int workerCount = 0, float stepRate = 60.0f);
+	~SimulationThread();
+
+	SimulationThread(const SimulationThread&) = delete;
+	SimulationThread& operator=(const SimulationThread&) = delete;
+
+	// Any thread, the command runs before the next step
+	void Enqueue(Command command);
+
+	// Convenience commands for the controls the UI has
+	void SetPaused(bool paused);
+	void SetWalls(float minX, float minZ);
+	void SetStepRate(float stepRate);
+
+	// Run between steps like any command, GetCheckpointStatus says how the last one went.
+	// The walls belong to whoever calls SetWalls, so loading keeps the current ones.
+	void SaveCheckpoint(const std::string& path);
+	void LoadCheckpoint(const std::string& path);
+	const char* GetCheckpointStatus() const { return checkpointStatus.load(std::memory_order_relaxed); }
+
+	// Every step is captured into the recording while it runs, the disk is only touched by the recorder's thread
+	void StartRecording(const std::string& path);
+	void StopRecording();
+	FrameRecorderStats GetRecordingStats() const { return recorder.GetStats(); }
+
+	// Render thread: picks up the newest published state if there is one, never blocks.
+	// Returns true when GetFrame changed.
+	bool AcquireFrame() { return frames.Acquire(); }
+	const SimulationFrame& GetFrame() const { return frames.GetReadSlot(); }
+
+private:
+	void Run();
+	void RunCommands();
+	void PublishFrame();
+
+	std::unique_ptr<SPHCPU> sim;
+	Timestep timestep;
+
+	// Only touched by the simulation thread once it runs
+	float minX = -50.0f;
+	float minZ = -50.0f;
+	bool paused = false;
+	uint64_t stepIndex = 0;
+	double simulatedTime = 0.0;
+
+	TripleBuffer<SimulationFrame> frames;
+	FrameRecorder recorder; // Started, stopped and fed on the simulation thread
+
+	std::mutex commandMutex;
+	std::vector<Command> commands;
+	std::vector<Command> runningCommands;
+
+	std::atomic<const char*> checkpointStatus{ "" };
+
+	std::atomic<bool> stopping{ false };
+	std::thread thread;
+};
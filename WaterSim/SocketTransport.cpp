@@ -0,0 +1,364 @@
+#include "SocketTransport.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(_WIN32)
+	using Socket = SOCKET;
+	using PollDescriptor = WSAPOLLFD;
+	const Socket invalidSocket = INVALID_SOCKET;
+
+	void CloseSocket(Socket socket) { closesocket(socket); }
+	bool WouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+	int Poll(PollDescriptor* descriptors, size_t count, int timeoutMs) { return WSAPoll(descriptors, static_cast<ULONG>(count), timeoutMs); }
+
+	bool SetNonBlocking(Socket socket)
+	{
+		u_long enabled = 1;
+		return ioctlsocket(socket, FIONBIO, &enabled) == 0;
+	}
+
+	// Winsock lengths are ints
+	int Send(Socket socket, const uint8_t* data, size_t size) { return send(socket, reinterpret_cast<const char*>(data), static_cast<int>(size), 0); }
+	int Receive(Socket socket, uint8_t* data, size_t size) { return recv(socket, reinterpret_cast<char*>(data), static_cast<int>(size), 0); }
+#else
+	using Socket = int;
+	using PollDescriptor = pollfd;
+	const Socket invalidSocket = -1;
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+	void CloseSocket(Socket socket) { close(socket); }
+	bool WouldBlock() { return errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR; }
+	int Poll(PollDescriptor* descriptors, size_t count, int timeoutMs) { return poll(descriptors, static_cast<nfds_t>(count), timeoutMs); }
+
+	bool SetNonBlocking(Socket socket)
+	{
+		int flags = fcntl(socket, F_GETFL, 0);
+		return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+	}
+
+	// A peer going away must show up as an error rather than SIGPIPE
+	ssize_t Send(Socket socket, const uint8_t* data, size_t size) { return send(socket, data, size, MSG_NOSIGNAL); }
+	ssize_t Receive(Socket socket, uint8_t* data, size_t size) { return recv(socket, data, size, 0); }
+#endif
+
+	sockaddr_in GetLocalAddress(uint16_t port)
+	{
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		return address;
+	}
+
+	// Blocking, for the rank handshake only
+	bool SendAll(Socket socket, const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		while (size > 0)
+		{
+			auto sent = Send(socket, bytes, size);
+			if (sent <= 0)
+				return false;
+			bytes += sent;
+			size -= static_cast<size_t>(sent);
+		}
+		return true;
+	}
+
+	bool ReceiveAll(Socket socket, void* data, size_t size)
+	{
+		uint8_t* bytes = static_cast<uint8_t*>(data);
+		while (size > 0)
+		{
+			auto received = Receive(socket, bytes, size);
+			if (received <= 0)
+				return false;
+			bytes += received;
+			size -= static_cast<size_t>(received);
+		}
+		return true;
+	}
+
+	void DisableNagle(Socket socket)
+	{
+		// The messages are small and every step waits on them
+		int enabled = 1;
+		setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+	}
+
+	// One direction of a message in flight, the 8 byte length comes first
+	struct Transfer
+	{
+		uint8_t header[8];
+		size_t offset = 0; // Over the header and then the payload
+		size_t size = 0; // Payload
+		bool done = false;
+	};
+}
+
+SocketTransport::~SocketTransport()
+{
+	Close();
+}
+
+bool SocketTransport::Connect(unsigned int newRank, unsigned int newRankCount, uint16_t basePort, double timeoutSeconds)
+{
+	Close();
+
+#if defined(_WIN32)
+	WSADATA data;
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		return false;
+	started = true;
+#endif
+
+	rank = newRank;
+	rankCount = newRankCount;
+	sockets.assign(rankCount, static_cast<intptr_t>(invalidSocket));
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeoutSeconds);
+
+	// Listening before connecting lets the ranks above finish their connects while this one is still busy
+	Socket listener = invalidSocket;
+	if (rank + 1 < rankCount)
+	{
+		listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (listener == invalidSocket)
+			return false;
+
+		int enabled = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+
+		sockaddr_in address = GetLocalAddress(static_cast<uint16_t>(basePort + rank));
+		if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, static_cast<int>(rankCount)) != 0)
+		{
+			CloseSocket(listener);
+			return false;
+		}
+	}
+
+	// The lower ranks may not be listening yet, keep trying until the deadline
+	for (unsigned int peer = 0; peer < rank; peer++)
+	{
+		sockaddr_in address = GetLocalAddress(static_cast<uint16_t>(basePort + peer));
+		while (true)
+		{
+			Socket connection = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			if (connection == invalidSocket)
+				break;
+
+			if (connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0)
+			{
+				uint32_t handshake = rank;
+				if (SendAll(connection, &handshake, sizeof(handshake)))
+					sockets[peer] = static_cast<intptr_t>(connection);
+				else
+					CloseSocket(connection);
+				break;
+			}
+
+			CloseSocket(connection);
+			if (std::chrono::steady_clock::now() > deadline)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+
+		if (sockets[peer] == static_cast<intptr_t>(invalidSocket))
+		{
+			if (listener != invalidSocket)
+				CloseSocket(listener);
+			return false;
+		}
+	}
+
+	// The ranks above connect in any order and say who they are
+	for (unsigned int accepted = rank + 1; accepted < rankCount; )
+	{
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		PollDescriptor descriptor = {};
+		descriptor.fd = listener;
+		descriptor.events = POLLIN;
+		if (remaining <= 0 || Poll(&descriptor, 1, static_cast<int>(remaining)) <= 0)
+			break;
+
+		Socket connection = accept(listener, nullptr, nullptr);
+		if (connection == invalidSocket)
+			continue;
+
+		uint32_t peer = 0;
+		if (!ReceiveAll(connection, &peer, sizeof(peer)) || peer <= rank || peer >= rankCount || sockets[peer] != static_cast<intptr_t>(invalidSocket))
+		{
+			CloseSocket(connection);
+			continue;
+		}
+
+		sockets[peer] = static_cast<intptr_t>(connection);
+		accepted++;
+	}
+
+	if (listener != invalidSocket)
+		CloseSocket(listener);
+
+	for (unsigned int peer = 0; peer < rankCount; peer++)
+	{
+		if (peer == rank)
+			continue;
+
+		Socket connection = static_cast<Socket>(sockets[peer]);
+		if (connection == invalidSocket || !SetNonBlocking(connection))
+			return false;
+		DisableNagle(connection);
+	}
+	return true;
+}
+
+void SocketTransport::Close()
+{
+	for (intptr_t connection : sockets)
+	{
+		if (connection != static_cast<intptr_t>(invalidSocket))
+			CloseSocket(static_cast<Socket>(connection));
+	}
+	sockets.clear();
+
+#if defined(_WIN32)
+	if (started)
+		WSACleanup();
+#endif
+	started = false;
+}
+
+bool SocketTransport::Exchange(const std::vector<unsigned int>& peers, const std::vector<std::vector<uint8_t>>& send,
+	std::vector<std::vector<uint8_t>>& receive)
+{
+	size_t peerCount = peers.size();
+	receive.resize(peerCount);
+
+	std::vector<Transfer> outgoing(peerCount);
+	std::vector<Transfer> incoming(peerCount);
+	for (size_t i = 0; i < peerCount; i++)
+	{
+		if (peers[i] >= sockets.size() || sockets[peers[i]] == static_cast<intptr_t>(invalidSocket))
+			return false;
+
+		uint64_t size = send[i].size();
+		std::memcpy(outgoing[i].header, &size, sizeof(size));
+		outgoing[i].size = send[i].size();
+	}
+
+	// Sends and receives interleave, so two peers sending each other more than the socket buffers hold can't deadlock
+	std::vector<PollDescriptor> descriptors;
+	std::vector<size_t> descriptorPeers;
+	while (true)
+	{
+		descriptors.clear();
+		descriptorPeers.clear();
+		for (size_t i = 0; i < peerCount; i++)
+		{
+			short events = static_cast<short>((outgoing[i].done ? 0 : POLLOUT) | (incoming[i].done ? 0 : POLLIN));
+			if (events == 0)
+				continue;
+
+			PollDescriptor descriptor = {};
+			descriptor.fd = static_cast<Socket>(sockets[peers[i]]);
+			descriptor.events = events;
+			descriptors.push_back(descriptor);
+			descriptorPeers.push_back(i);
+		}
+
+		if (descriptors.empty())
+			return true;
+
+		if (Poll(descriptors.data(), descriptors.size(), -1) < 0)
+		{
+			if (WouldBlock())
+				continue;
+			return false;
+		}
+
+		for (size_t d = 0; d < descriptors.size(); d++)
+		{
+			size_t i = descriptorPeers[d];
+			Socket connection = static_cast<Socket>(descriptors[d].fd);
+			short events = descriptors[d].revents;
+
+			if (events & (POLLERR | POLLNVAL))
+				return false;
+
+			if (events & (POLLIN | POLLHUP))
+			{
+				Transfer& transfer = incoming[i];
+				bool inHeader = transfer.offset < sizeof(transfer.header);
+				uint8_t* target = inHeader ? transfer.header + transfer.offset : receive[i].data() + (transfer.offset - sizeof(transfer.header));
+				size_t wanted = inHeader ? sizeof(transfer.header) - transfer.offset : transfer.size - (transfer.offset - sizeof(transfer.header));
+
+				auto received = Receive(connection, target, wanted);
+				if (received == 0)
+					return false;
+				if (received < 0 && !WouldBlock())
+					return false;
+
+				if (received > 0)
+				{
+					transfer.offset += static_cast<size_t>(received);
+					if (inHeader && transfer.offset == sizeof(transfer.header))
+					{
+						uint64_t size = 0;
+						std::memcpy(&size, transfer.header, sizeof(size));
+						transfer.size = static_cast<size_t>(size);
+						receive[i].resize(transfer.size);
+					}
+					if (transfer.offset == sizeof(transfer.header) + transfer.size)
+					{
+						transfer.done = true;
+						bytesReceived += transfer.size;
+					}
+				}
+			}
+
+			if (events & POLLOUT)
+			{
+				Transfer& transfer = outgoing[i];
+				bool inHeader = transfer.offset < sizeof(transfer.header);
+				const uint8_t* source = inHeader ? transfer.header + transfer.offset : send[i].data() + (transfer.offset - sizeof(transfer.header));
+				size_t remaining = inHeader ? sizeof(transfer.header) - transfer.offset : transfer.size - (transfer.offset - sizeof(transfer.header));
+
+				auto sent = Send(connection, source, remaining);
+				if (sent < 0 && !WouldBlock())
+					return false;
+
+				if (sent > 0)
+					transfer.offset += static_cast<size_t>(sent);
+				if (transfer.offset == sizeof(transfer.header) + transfer.size)
+				{
+					transfer.done = true;
+					bytesSent += transfer.size;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Transport.h"
+
+#include <cstdint>
+#include <vector>
+
+// Transport over TCP on localhost, a connection between every pair of ranks.
+// Rank r listens on basePort + r and connects to every rank below it, so the ranks can be started in any order.
+// Messages are framed with their length in host byte order, which is fine since every rank is on the same machine.
+class SocketTransport : public Transport
+{
+public:
+	SocketTransport() = default;
+	~SocketTransport() override;
+
+	SocketTransport(const SocketTransport&) = delete;
+	SocketTransport& operator=(const SocketTransport&) = delete;
+
+	// False if the connections to the other ranks aren't all up within timeoutSeconds
+	bool Connect(unsigned int rank, unsigned int rankCount, uint16_t basePort, double timeoutSeconds = 30.0);
+	void Close();
+
+	unsigned int GetRank() const override { return rank; }
+	unsigned int GetRankCount() const override { return rankCount; }
+
+	bool Exchange(const std::vector<unsigned int>& peers, const std::vector<std::vector<uint8_t>>& send,
+		std::vector<std::vector<uint8_t>>& receive) override;
+
+	// Payload bytes, without the framing
+	uint64_t GetBytesSent() const { return bytesSent; }
+	uint64_t GetBytesReceived() const { return bytesReceived; }
+
+private:
+	std::vector<intptr_t> sockets; // Indexed by rank, -1 for this rank and until connected
+	unsigned int rank = 0;
+	unsigned int rankCount = 1;
+	bool started = false; // Winsock is initialised
+
+	uint64_t bytesSent = 0;
+	uint64_t bytesReceived = 0;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+
+// Space filling curve indices of 3D cell coordinates, used to lay particles out so that
+// particles close in space are also close in memory. Each coordinate must fit in bits (at most 10).
+
+enum class ParticleOrder
+{
+	None,
+	Morton,
+	Hilbert
+};
+
+// Spreads the low 10 bits of value so there are two zero bits between each of them
+inline uint32_t SpreadBits3D(uint32_t value)
+{
+	value &= 0x000003FF;
+	value = (value | (value << 16)) & 0xFF0000FF;
+	value = (value | (value << 8)) & 0x0300F00F;
+	value = (value | (value << 4)) & 0x030C30C3;
+	value = (value | (value << 2)) & 0x09249249;
+	return value;
+}
+
+inline uint32_t MortonCode3D(uint32_t x, uint32_t y, uint32_t z)
+{
+	return SpreadBits3D(x) | (SpreadBits3D(y) << 1) | (SpreadBits3D(z) << 2);
+}
+
+// Skilling's transpose form ("Programming the Hilbert curve", 2004). Unlike Morton order consecutive
+// indices are always face neighbours, so there are no long jumps between octants.
+inline uint32_t HilbertCode3D(uint32_t x, uint32_t y, uint32_t z, unsigned int bits)
+{
+	uint32_t axes[3] = { x, y, z };
+	uint32_t highBit = 1u << (bits - 1);
+
+	// Inverse undo
+	for (uint32_t q = highBit; q > 1; q >>= 1)
+	{
+		uint32_t p = q - 1;
+		for (int i = 0; i < 3; i++)
+		{
+			if (axes[i] & q)
+			{
+				axes[0] ^= p;
+			}
+			else
+			{
+				uint32_t t = (axes[0] ^ axes[i]) & p;
+				axes[0] ^= t;
+				axes[i] ^= t;
+			}
+		}
+	}
+
+	// Gray encode
+	axes[1] ^= axes[0];
+	axes[2] ^= axes[1];
+
+	uint32_t t = 0;
+	for (uint32_t q = highBit; q > 1; q >>= 1)
+	{
+		if (axes[2] & q)
+			t ^= q - 1;
+	}
+
+	for (uint32_t& axis : axes)
+		axis ^= t;
+
+	// Interleave the transposed bits, axes[0] holds the most significant bit of each triple
+	uint32_t code = 0;
+	for (int bit = static_cast<int>(bits) - 1; bit >= 0; bit--)
+	{
+		for (uint32_t axis : axes)
+			code = (code << 1) | ((axis >> bit) & 1);
+	}
+	return code;
+}
@@ -1 +1,99 @@
 #include "Timestep.h"
+
+#include <cmath>
+
+Timestep::Timestep(float targetFPS)
+    : m_fixedTimeStep(1.0f / targetFPS)
+{
+}
+
+void Timestep::CalculateTimestep()
+{
+    Clock::time_point currentTime = Clock::now();
+
+    // Initialize previousTime on the first call
+    if (!started)
+    {
+        previousTime = currentTime;
+        started = true;
+    }
+
+    // Calculate frame time in seconds
+    double frameTime = std::chrono::duration<double>(currentTime - previousTime).count();
+    previousTime = currentTime;
+
+    // Anything the last frame owed but didn't run is given up rather than carried over
+    unsigned int dropped = m_stats.owedSteps - m_stats.executedSteps;
+
+    // Cap frame time to prevent instability during long frames
+    if (frameTime > m_maxFrameTime)
+    {
+        dropped += static_cast<unsigned int>((frameTime - m_maxFrameTime) / m_fixedTimeStep);
+        frameTime = m_maxFrameTime;
+    }
+
+    // Accumulate time and pay it out in whole steps
+    accumulatedTime += frameTime;
+    unsigned int owed = static_cast<unsigned int>(accumulatedTime / m_fixedTimeStep);
+    accumulatedTime -= owed * static_cast<double>(m_fixedTimeStep);
+
+    m_stats.owedSteps = owed;
+    m_stats.executedSteps = 0;
+    m_stats.droppedSteps = dropped;
+    m_stats.physicsMs = 0.0;
+    m_stats.totalOwedSteps += owed;
+    m_stats.totalDroppedSteps += dropped;
+
+    // Store the frame time as delta time for rendering
+    m_deltaTime = static_cast<float>(frameTime);
+    stepStartTime = Clock::now();
+}
+
+bool Timestep::IsReadyForPhysicsUpdate() const
+{
+    if (m_stats.executedSteps >= m_stats.owedSteps || m_stats.executedSteps >= m_maxStepsPerFrame)
+        return false;
+
+    // The first step always runs so the simulation never stops, later ones only if they are predicted to fit
+    if (m_stats.executedSteps == 0)
+        return true;
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - stepStartTime).count();
+    return elapsed + lastStepSeconds <= m_frameBudget;
+}
+
+void Timestep::ConsumePhysicsUpdate()
+{
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - stepStartTime).count();
+
+    lastStepSeconds = elapsed - m_stats.physicsMs * 1e-3;
+    m_stats.physicsMs = elapsed * 1e3;
+
+    m_stats.executedSteps++;
+    m_stats.totalExecutedSteps++;
+}
+
+void Timestep::ConsumeOwedTime()
+{
+    unsigned int steps = m_stats.owedSteps - m_stats.executedSteps;
+
+    m_stats.executedSteps += steps;
+    m_stats.totalExecutedSteps += steps;
+    m_stats.physicsMs = std::chrono::duration<double>(Clock::now() - stepStartTime).count() * 1e3;
+}
+
+void Timestep::Reset()
+{
+    started = false;
+    accumulatedTime = 0.0;
+    m_stats.owedSteps = 0;
+    m_stats.executedSteps = 0;
+    m_stats.droppedSteps = 0;
+}
+
+void Timestep::SetTargetFPS(float targetFPS)
+{
+    if (targetFPS > 0.0f)
+        m_fixedTimeStep = 1.0f / targetFPS;
+}
@@ -1,84 +1,89 @@
 #pragma once
-#include <d3d11_1.h>
+#include <chrono>
+#include <cstdint>
 
+// Per frame bookkeeping of the fixed step scheduler
+struct TimestepStats
+{
+    unsigned int owedSteps = 0;      // Whole steps the elapsed time paid for this frame
+    unsigned int executedSteps = 0;  // Steps run this frame
+    unsigned int droppedSteps = 0;   // Steps given up at the start of this frame (budget, step cap or frame time cap)
+    double physicsMs = 0.0;          // Wall time spent in physics steps this frame
+
+    uint64_t totalOwedSteps = 0;
+    uint64_t totalExecutedSteps = 0;
+    uint64_t totalDroppedSteps = 0;
+};
+
+// Fixed timestep scheduler on the monotonic high resolution clock.
+// Every frame owes one physics step per whole fixed step of elapsed time. They run back to back until the frame's
+// compute budget or step cap is hit, whatever is still owed then is dropped so a slow frame can't cause the next
+// one to owe even more (spiral of death). Simulated time only falls behind wall time by the dropped steps.
 class Timestep
 {
 public:
-    // Constructor to set custom fixed timestep
-    Timestep(float targetFPS = 60.0f)
-        : accumulatedTime(0.0f), m_deltaTime(0.0f), m_fixedTimeStep(1.0f / targetFPS),
-        m_readyForPhysicsUpdate(false), previousTime(0)
-    {
-    }
+    using Clock = std::chrono::steady_clock;
 
-    // Calculates time steps for both fixed updates and variable rendering
-    void CalculateTimestep()
-    {
-        // Get the current time
-        ULONGLONG currentTime = GetTickCount64();
+    // Constructor to set custom fixed timestep
+    Timestep(float targetFPS = 60.0f);
 
-        // Initialize previousTime on the first call
-        if (previousTime == 0)
-            previousTime = currentTime;
+    // Measures the frame time and works out how many steps this frame owes
+    void CalculateTimestep();
 
-        // Calculate frame time in seconds
-        float frameTime = (currentTime - previousTime) / 1000.0f;
-        previousTime = currentTime;
+    // True while an owed step is left and running it should still fit in the frame budget
+    bool IsReadyForPhysicsUpdate() const;
 
-        // Cap frame time to prevent instability during long frames
-        if (frameTime > 0.25f) // Cap at 0.25 seconds (4 FPS)
-            frameTime = 0.25f;
+    // Marks one owed step as run, call after each UpdatePhysics
+    void ConsumePhysicsUpdate();
 
-        // Accumulate time
-        accumulatedTime += frameTime;
+    // Time covered by the steps still owed, for callers that substep on their own
+    float GetOwedTime() const { return (m_stats.owedSteps - m_stats.executedSteps) * m_fixedTimeStep; }
 
-        // Fixed timestep update
-        while (accumulatedTime >= m_fixedTimeStep)
-        {
-            accumulatedTime -= m_fixedTimeStep;
-            m_readyForPhysicsUpdate = true;
-        }
+    // Marks every step still owed as run, call after simulating GetOwedTime()
+    void ConsumeOwedTime();
 
-        // Store the remainder as delta time for rendering
-        m_deltaTime = frameTime;
-    }
-
-    // Returns true if physics should be updated this frame
-    bool IsReadyForPhysicsUpdate() const
-    {
-        return m_readyForPhysicsUpdate;
-    }
-
-    // Consumes the physics update flag
-    void ConsumePhysicsUpdate()
-    {
-        m_readyForPhysicsUpdate = false;
-    }
+    // Forgets the elapsed time and the steps owed so far, call when resuming after a pause so the paused time is
+    // neither stepped nor counted as dropped. The totals are kept.
+    void Reset();
 
     // Returns the fixed time step duration
-    float GetFixedTimeStep() const
-    {
-        return m_fixedTimeStep;
-    }
+    float GetFixedTimeStep() const { return m_fixedTimeStep; }
 
     // Returns the variable time step duration for rendering
-    float GetDeltaTime() const
+    float GetDeltaTime() const { return m_deltaTime; }
+
+    // How far wall time is between the last two fixed steps, 0 to 1, for blending the rendered state
+    float GetInterpolationAlpha() const
     {
-        return m_deltaTime;
+        // Past 1 only for the rest of a frame in which the step was shortened
+        float alpha = static_cast<float>(accumulatedTime / m_fixedTimeStep);
+        return alpha < 1.0f ? alpha : 1.0f;
     }
 
     // Sets a new target FPS (adjusts the fixed timestep)
-    void SetTargetFPS(float targetFPS)
-    {
-        if (targetFPS > 0.0f)
-            m_fixedTimeStep = 1.0f / targetFPS;
-    }
+    void SetTargetFPS(float targetFPS);
+
+    // Wall time physics may take per frame in seconds, at least one owed step always runs
+    void SetFrameBudget(float seconds) { m_frameBudget = seconds; }
+    float GetFrameBudget() const { return m_frameBudget; }
+
+    void SetMaxStepsPerFrame(unsigned int steps) { m_maxStepsPerFrame = steps > 0 ? steps : 1; }
+    unsigned int GetMaxStepsPerFrame() const { return m_maxStepsPerFrame; }
+
+    const TimestepStats& GetStats() const { return m_stats; }
 
 private:
-    float accumulatedTime;          // Accumulated time for fixed updates
-    float m_deltaTime;              // Variable time step for rendering
-    float m_fixedTimeStep;          // Fixed timestep duration
-    bool m_readyForPhysicsUpdate;   // Flag for physics update readiness
-    ULONGLONG previousTime;         // Tracks the last frame time
-};
+    double accumulatedTime = 0.0;       // Elapsed time not yet paid out as steps
+    float m_deltaTime = 0.0f;           // Variable time step for rendering
+    float m_fixedTimeStep;              // Fixed timestep duration
+    float m_frameBudget = 0.010f;       // Physics wall time allowed per frame
+    unsigned int m_maxStepsPerFrame = 8;
+    float m_maxFrameTime = 0.25f;       // Longer frames (breakpoints, window drags) are clamped
+
+    Clock::time_point previousTime;     // Tracks the last frame time
+    Clock::time_point stepStartTime;    // When the current run of physics steps started
+    double lastStepSeconds = 0.0;       // Cost of the last step, used to predict whether another one fits
+    bool started = false;
 
+    TimestepStats m_stats;
+};
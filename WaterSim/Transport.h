@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Moves messages between the processes of a distributed run, one instance per process.
+// Ranks are numbered 0 to GetRankCount() - 1. SocketTransport is the reference implementation.
+class Transport
+{
+public:
+	virtual ~Transport() = default;
+
+	virtual unsigned int GetRank() const = 0;
+	virtual unsigned int GetRankCount() const = 0;
+
+	// Sends send[i] to peers[i] and waits for one message back from each of them into receive[i].
+	// Every peer has to make the matching call with this rank in its peers. False once a peer is lost.
+	virtual bool Exchange(const std::vector<unsigned int>& peers, const std::vector<std::vector<uint8_t>>& send,
+		std::vector<std::vector<uint8_t>>& receive) = 0;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of whole states from one writer thread to one reader thread.
+// The writer always has a slot to fill and the reader always has a slot to read, publishing swaps the writer's slot
+// with the shared middle one and the reader swaps that with its own when something new was published. Neither side
+// ever waits, the reader simply sees the newest published state and skips any it was too slow for.
+template <typename T>
+class TripleBuffer
+{
+public:
+	// Writer side, fill this then Publish
+	T& GetWriteSlot() { return slots[writeIndex]; }
+
+	void Publish()
+	{
+		uint8_t previous = middle.exchange(static_cast<uint8_t>(writeIndex | newFlag), std::memory_order_acq_rel);
+		writeIndex = previous & indexMask;
+	}
+
+	// Reader side, returns true when a state newer than the current read slot was taken
+	bool Acquire()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & newFlag))
+			return false;
+
+		uint8_t previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex = previous & indexMask;
+		return true;
+	}
+
+	// The state taken by the last successful Acquire
+	const T& GetReadSlot() const { return slots[readIndex]; }
+
+private:
+	static constexpr uint8_t indexMask = 0x3;
+	static constexpr uint8_t newFlag = 0x4;
+
+	T slots[3];
+	uint8_t writeIndex = 0;
+	uint8_t readIndex = 1;
+	std::atomic<uint8_t> middle{ 2 };
+};
@@ -7,6 +7,7 @@ Texture2D txDiffuse : register(t0);
 SamplerState samLinear : register(s0);
 
 StructuredBuffer<float4> instancePositions : register(t1);
+StructuredBuffer<float4> previousInstancePositions : register(t2);
 
 //--------------------------------------------------------------------------------------
 // Constant Buffer Variables
@@ -40,6 +41,9 @@ cbuffer ConstantBuffer : register(b0)
 
     float3 EyePosW;
     float HasTexture;
+
+    float InterpolationAlpha; // 1 draws the latest physics step, less blends towards the one before
+    float3 Padding;
 }
 
 struct VS_INPUT
@@ -67,7 +71,15 @@ VS_OUTPUT VS(VS_INPUT input)
 {
     VS_OUTPUT output = (VS_OUTPUT) 0;
 
-    float3 instancePos = instancePositions[input.InstanceID].xyz; // read .xyz
+    float4 currentPos = instancePositions[input.InstanceID];
+    float4 previousPos = previousInstancePositions[input.InstanceID];
+
+    // Ids the CPU simulation has retired have w of 0, collapse them so nothing is rasterised
+    if (currentPos.w == 0.0f)
+        return output;
+
+    // w is 0 before the first step has been saved
+    float3 instancePos = previousPos.w > 0.0f ? lerp(previousPos.xyz, currentPos.xyz, InterpolationAlpha) : currentPos.xyz;
     float3 worldPos = input.PosL.xyz + instancePos;
 
     output.PosW = worldPos;